@@ -111,4 +111,21 @@ struct PrependSPSPPSToIDRFramesParams {
     OMX_BOOL bEnable;
 };
 
+// A pointer to this struct is passed to OMX_SetParameter when the extension
+// index for the 'OMX.google.android.index.prepareForAdaptivePlayback'
+// extension is given.
+//
+// If successful, the output buffers of the port are allocated for frames of
+// up to nMaxFrameWidth x nMaxFrameHeight, and resolution changes within that
+// size are signalled with an OMX_IndexConfigCommonOutputCrop settings change
+// event instead of requiring a port reconfiguration.
+struct PrepareForAdaptivePlaybackParams {
+    OMX_U32 nSize;
+    OMX_VERSIONTYPE nVersion;
+    OMX_U32 nPortIndex;
+    OMX_BOOL bEnable;
+    OMX_U32 nMaxFrameWidth;
+    OMX_U32 nMaxFrameHeight;
+};
+
 #endif  // HARDWARE_API_H_
@@ -122,16 +122,10 @@ gst_base_video_codec_init (GstBaseVideoCodec * base_video_codec,
 static void
 gst_base_video_codec_reset (GstBaseVideoCodec * base_video_codec)
 {
-  GList *g;
-
   GST_DEBUG_OBJECT (base_video_codec, "reset");
 
   GST_BASE_VIDEO_CODEC_STREAM_LOCK (base_video_codec);
-  for (g = base_video_codec->frames; g; g = g_list_next (g)) {
-    gst_video_frame_unref ((GstVideoFrame *) g->data);
-  }
-  g_list_free (base_video_codec->frames);
-  base_video_codec->frames = NULL;
+  gst_base_video_codec_clear_frames (base_video_codec);
 
   base_video_codec->bytes = 0;
   base_video_codec->time = 0;
@@ -207,6 +201,108 @@ gst_base_video_codec_new_frame (GstBaseVideoCodec * base_video_codec)
   return frame;
 }
 
+/**
+ * gst_base_video_codec_append_frame:
+ * @base_video_codec: a #GstBaseVideoCodec
+ * @frame: a #GstVideoFrame
+ *
+ * Appends @frame to the pending frames, taking ownership of @frame.
+ *
+ * Must be called with the stream lock held.
+ */
+void
+gst_base_video_codec_append_frame (GstBaseVideoCodec * base_video_codec,
+    GstVideoFrame * frame)
+{
+  g_return_if_fail (frame->link == NULL);
+
+  g_queue_push_tail (&base_video_codec->frames, frame);
+  frame->link = base_video_codec->frames.tail;
+
+  if (frame->events)
+    base_video_codec->n_frames_with_events++;
+}
+
+/**
+ * gst_base_video_codec_remove_frame:
+ * @base_video_codec: a #GstBaseVideoCodec
+ * @frame: a #GstVideoFrame
+ *
+ * Removes @frame from the pending frames in constant time. The
+ * reference of the pending frames is passed to the caller.
+ *
+ * Must be called with the stream lock held.
+ */
+void
+gst_base_video_codec_remove_frame (GstBaseVideoCodec * base_video_codec,
+    GstVideoFrame * frame)
+{
+  if (!frame->link)
+    return;
+
+  g_queue_delete_link (&base_video_codec->frames, frame->link);
+  frame->link = NULL;
+
+  if (frame->events)
+    base_video_codec->n_frames_with_events--;
+}
+
+/**
+ * gst_base_video_codec_clear_frames:
+ * @base_video_codec: a #GstBaseVideoCodec
+ *
+ * Drops all pending frames.
+ *
+ * Must be called with the stream lock held.
+ */
+void
+gst_base_video_codec_clear_frames (GstBaseVideoCodec * base_video_codec)
+{
+  GstVideoFrame *frame;
+
+  while ((frame = g_queue_pop_head (&base_video_codec->frames))) {
+    frame->link = NULL;
+    gst_video_frame_unref (frame);
+  }
+  base_video_codec->n_frames_with_events = 0;
+}
+
+/**
+ * gst_base_video_codec_take_events:
+ * @base_video_codec: a #GstBaseVideoCodec
+ * @frame: a pending #GstVideoFrame
+ *
+ * Takes the events of all pending frames up to and including @frame.
+ * Only walks the pending frames if some of them still carry events.
+ *
+ * Must be called with the stream lock held.
+ *
+ * Returns: the events in the order they should be pushed downstream
+ */
+GList *
+gst_base_video_codec_take_events (GstBaseVideoCodec * base_video_codec,
+    GstVideoFrame * frame)
+{
+  GList *l, *events = NULL;
+
+  for (l = base_video_codec->frames.head;
+      l && base_video_codec->n_frames_with_events > 0; l = l->next) {
+    GstVideoFrame *tmp = l->data;
+
+    if (tmp->events) {
+      /* The events of a frame are stored newest first */
+      events = g_list_concat (events, g_list_reverse (tmp->events));
+      tmp->events = NULL;
+      base_video_codec->n_frames_with_events--;
+    }
+
+    if (tmp == frame)
+      break;
+  }
+
+  return events;
+}
+
 static void
 _gst_video_frame_free (GstVideoFrame * frame)
 {
@@ -139,9 +139,17 @@ struct _GstVideoFrame
   gboolean force_keyframe;
   gboolean force_keyframe_headers;
 
+  /* TRUE if parts of the frame were pushed with
+   * gst_base_video_encoder_finish_subframe() */
+  gboolean partial;
+
   /* Events that should be pushed downstream *before*
    * the next src_buffer */
   GList *events;
+
+  /*< private >*/
+  /* Link of the frame in GstBaseVideoCodec::frames */
+  GList *link;
 };
 
 struct _GstBaseVideoCodec
@@ -159,7 +167,9 @@ struct _GstBaseVideoCodec
 
   guint64 system_frame_number;
 
-  GList *frames;  /* Protected with OBJECT_LOCK */
+  GQueue frames;  /* Protected with STREAM_LOCK */
+  /* Number of frames in @frames that still carry events */
+  guint n_frames_with_events;
   GstVideoState state;
   GstSegment segment;
 
@@ -187,6 +197,14 @@ GType gst_base_video_codec_get_type (void);
 
 GstVideoFrame * gst_base_video_codec_new_frame (GstBaseVideoCodec *base_video_codec);
 
+void            gst_base_video_codec_append_frame (GstBaseVideoCodec *base_video_codec,
+                                                   GstVideoFrame *frame);
+void            gst_base_video_codec_remove_frame (GstBaseVideoCodec *base_video_codec,
+                                                   GstVideoFrame *frame);
+void            gst_base_video_codec_clear_frames (GstBaseVideoCodec *base_video_codec);
+GList *         gst_base_video_codec_take_events (GstBaseVideoCodec *base_video_codec,
+                                                  GstVideoFrame *frame);
+
 GstVideoFrame * gst_video_frame_ref (GstVideoFrame * frame);
 void            gst_video_frame_unref (GstVideoFrame * frame);
 
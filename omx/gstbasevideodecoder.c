@@ -151,6 +151,8 @@ static GstFlowReturn gst_base_video_decoder_chain (GstPad * pad,
     GstBuffer * buf);
 static gboolean gst_base_video_decoder_sink_query (GstPad * pad,
     GstQuery * query);
+static GstFlowReturn gst_base_video_decoder_sink_bufferalloc (GstPad * pad,
+    guint64 offset, guint size, GstCaps * caps, GstBuffer ** buf);
 static GstStateChangeReturn gst_base_video_decoder_change_state (GstElement *
     element, GstStateChange transition);
 static const GstQueryType *gst_base_video_decoder_get_query_types (GstPad *
@@ -220,6 +222,8 @@ gst_base_video_decoder_init (GstBaseVideoDecoder * base_video_decoder,
       GST_DEBUG_FUNCPTR (gst_base_video_decoder_sink_setcaps));
   gst_pad_set_query_function (pad,
       GST_DEBUG_FUNCPTR (gst_base_video_decoder_sink_query));
+  gst_pad_set_bufferalloc_function (pad,
+      GST_DEBUG_FUNCPTR (gst_base_video_decoder_sink_bufferalloc));
 
   pad = GST_BASE_VIDEO_CODEC_SRC_PAD (base_video_decoder);
 
@@ -234,6 +238,12 @@ gst_base_video_decoder_init (GstBaseVideoDecoder * base_video_decoder,
   base_video_decoder->input_adapter = gst_adapter_new ();
   base_video_decoder->output_adapter = gst_adapter_new ();
 
+  base_video_decoder->max_reverse_bytes =
+      GST_BASE_VIDEO_DECODER_MAX_REVERSE_BYTES;
+
+  base_video_decoder->min_latency = 0;
+  base_video_decoder->max_latency = 0;
+
   gst_base_video_decoder_reset (base_video_decoder, TRUE);
 
   base_video_decoder->sink_clipping = TRUE;
@@ -498,6 +508,15 @@ gst_base_video_decoder_sink_event (GstPad * pad, GstEvent * event)
       GST_BASE_VIDEO_CODEC_STREAM_UNLOCK (base_video_decoder);
       break;
     }
+    case GST_EVENT_FLUSH_START:
+    {
+      /* The stream lock might be held by a streaming thread that
+       * waits for the subclass */
+      if (base_video_decoder_class->flush_start)
+        base_video_decoder_class->flush_start (base_video_decoder);
+      ret = gst_base_video_decoder_push_src_event (base_video_decoder, event);
+      break;
+    }
     case GST_EVENT_FLUSH_STOP:
     {
       GST_BASE_VIDEO_CODEC_STREAM_LOCK (base_video_decoder);
@@ -714,6 +733,7 @@ gst_base_video_decoder_get_query_types (GstPad * pad)
     GST_QUERY_POSITION,
     GST_QUERY_DURATION,
     GST_QUERY_CONVERT,
+    GST_QUERY_LATENCY,
     0
   };
 
@@ -808,6 +828,30 @@ gst_base_video_decoder_src_query (GstPad * pad, GstQuery * query)
       gst_query_set_convert (query, src_fmt, src_val, dest_fmt, dest_val);
       break;
     }
+    case GST_QUERY_LATENCY:
+    {
+      gboolean live;
+      GstClockTime min_latency, max_latency;
+
+      res = gst_pad_peer_query (GST_BASE_VIDEO_CODEC_SINK_PAD (dec), query);
+      if (res) {
+        gst_query_parse_latency (query, &live, &min_latency, &max_latency);
+        GST_DEBUG_OBJECT (dec, "Peer latency: live %d, min %"
+            GST_TIME_FORMAT " max %" GST_TIME_FORMAT, live,
+            GST_TIME_ARGS (min_latency), GST_TIME_ARGS (max_latency));
+
+        GST_OBJECT_LOCK (dec);
+        min_latency += dec->min_latency;
+        if (dec->max_latency == GST_CLOCK_TIME_NONE)
+          max_latency = GST_CLOCK_TIME_NONE;
+        else if (max_latency != GST_CLOCK_TIME_NONE)
+          max_latency += dec->max_latency;
+        GST_OBJECT_UNLOCK (dec);
+
+        gst_query_set_latency (query, live, min_latency, max_latency);
+      }
+      break;
+    }
     default:
       res = gst_pad_query_default (pad, query);
   }
@@ -859,6 +903,31 @@ error:
   goto done;
 }
 
+static GstFlowReturn
+gst_base_video_decoder_sink_bufferalloc (GstPad * pad, guint64 offset,
+    guint size, GstCaps * caps, GstBuffer ** buf)
+{
+  GstBaseVideoDecoder *base_video_decoder;
+  GstBaseVideoDecoderClass *klass;
+  GstFlowReturn ret = GST_FLOW_OK;
+
+  base_video_decoder = GST_BASE_VIDEO_DECODER (gst_pad_get_parent (pad));
+  if (G_UNLIKELY (base_video_decoder == NULL))
+    return GST_FLOW_WRONG_STATE;
+
+  klass = GST_BASE_VIDEO_DECODER_GET_CLASS (base_video_decoder);
+
+  /* NULL makes the core allocate a normal buffer. Only packetized
+   * input is passed to the subclass in the buffers it was pushed in */
+  *buf = NULL;
+  if (klass->alloc_sink_buffer && base_video_decoder->packetized)
+    ret = klass->alloc_sink_buffer (base_video_decoder, offset, size, caps, buf);
+
+  gst_object_unref (base_video_decoder);
+
+  return ret;
+}
+
 typedef struct _Timestamp Timestamp;
 struct _Timestamp
 {
@@ -873,7 +942,7 @@ gst_base_video_decoder_add_timestamp (GstBaseVideoDecoder * base_video_decoder,
 {
   Timestamp *ts;
 
-  ts = g_malloc (sizeof (Timestamp));
+  ts = g_slice_new (Timestamp);
 
   GST_LOG_OBJECT (base_video_decoder,
       "adding timestamp %" GST_TIME_FORMAT " %" GST_TIME_FORMAT,
@@ -884,8 +953,7 @@ gst_base_video_decoder_add_timestamp (GstBaseVideoDecoder * base_video_decoder,
   ts->timestamp = GST_BUFFER_TIMESTAMP (buffer);
   ts->duration = GST_BUFFER_DURATION (buffer);
 
-  base_video_decoder->timestamps =
-      g_list_append (base_video_decoder->timestamps, ts);
+  g_queue_push_tail (&base_video_decoder->timestamps, ts);
 }
 
 static void
@@ -894,24 +962,18 @@ gst_base_video_decoder_get_timestamp_at_offset (GstBaseVideoDecoder *
     GstClockTime * duration)
 {
   Timestamp *ts;
-  GList *g;
 
   *timestamp = GST_CLOCK_TIME_NONE;
   *duration = GST_CLOCK_TIME_NONE;
 
-  g = base_video_decoder->timestamps;
-  while (g) {
-    ts = g->data;
-    if (ts->offset <= offset) {
-      *timestamp = ts->timestamp;
-      *duration = ts->duration;
-      g_free (ts);
-      g = g_list_next (g);
-      base_video_decoder->timestamps =
-          g_list_remove (base_video_decoder->timestamps, ts);
-    } else {
-      break;
-    }
+  /* Timestamps are queued in offset order, so only the
+   * ones at the head can be at or before the offset */
+  while ((ts = g_queue_peek_head (&base_video_decoder->timestamps))
+      && ts->offset <= offset) {
+    *timestamp = ts->timestamp;
+    *duration = ts->duration;
+    g_queue_pop_head (&base_video_decoder->timestamps);
+    g_slice_free (Timestamp, ts);
   }
 
   GST_LOG_OBJECT (base_video_decoder,
@@ -928,6 +990,8 @@ gst_base_video_decoder_clear_queues (GstBaseVideoDecoder * dec)
   g_list_foreach (dec->gather, (GFunc) gst_mini_object_unref, NULL);
   g_list_free (dec->gather);
   dec->gather = NULL;
+  dec->reverse_bytes = 0;
+  dec->reverse_skipping = FALSE;
   g_list_foreach (dec->decode, (GFunc) gst_video_frame_unref, NULL);
   g_list_free (dec->decode);
   dec->decode = NULL;
@@ -937,16 +1001,15 @@ gst_base_video_decoder_clear_queues (GstBaseVideoDecoder * dec)
   g_list_foreach (dec->parse_gather, (GFunc) gst_video_frame_unref, NULL);
   g_list_free (dec->parse_gather);
   dec->parse_gather = NULL;
-  g_list_foreach (GST_BASE_VIDEO_CODEC (dec)->frames,
-      (GFunc) gst_video_frame_unref, NULL);
-  g_list_free (GST_BASE_VIDEO_CODEC (dec)->frames);
-  GST_BASE_VIDEO_CODEC (dec)->frames = NULL;
+  gst_base_video_codec_clear_frames (GST_BASE_VIDEO_CODEC (dec));
 }
 
 static void
 gst_base_video_decoder_reset (GstBaseVideoDecoder * base_video_decoder,
     gboolean full)
 {
+  Timestamp *ts;
+
   GST_DEBUG_OBJECT (base_video_decoder, "reset full %d", full);
 
   GST_BASE_VIDEO_CODEC_STREAM_LOCK (base_video_decoder);
@@ -969,9 +1032,8 @@ gst_base_video_decoder_reset (GstBaseVideoDecoder * base_video_decoder,
   base_video_decoder->frame_offset = 0;
   gst_adapter_clear (base_video_decoder->input_adapter);
   gst_adapter_clear (base_video_decoder->output_adapter);
-  g_list_foreach (base_video_decoder->timestamps, (GFunc) g_free, NULL);
-  g_list_free (base_video_decoder->timestamps);
-  base_video_decoder->timestamps = NULL;
+  while ((ts = g_queue_pop_head (&base_video_decoder->timestamps)))
+    g_slice_free (Timestamp, ts);
 
   if (base_video_decoder->current_frame) {
     gst_video_frame_unref (base_video_decoder->current_frame);
@@ -1017,7 +1079,7 @@ gst_base_video_decoder_chain_forward (GstBaseVideoDecoder * base_video_decoder,
   if (base_video_decoder->packetized) {
     base_video_decoder->current_frame->sink_buffer = buf;
 
-    if (GST_BUFFER_FLAG_IS_SET (buf, GST_BUFFER_FLAG_DELTA_UNIT))
+    if (!GST_BUFFER_FLAG_IS_SET (buf, GST_BUFFER_FLAG_DELTA_UNIT))
       base_video_decoder->current_frame->is_sync_point = TRUE;
 
     ret = gst_base_video_decoder_have_frame_2 (base_video_decoder);
@@ -1178,6 +1240,7 @@ gst_base_video_decoder_flush_parse (GstBaseVideoDecoder * dec)
   while (dec->queued) {
     GstBuffer *buf = GST_BUFFER_CAST (dec->queued->data);
 
+    dec->reverse_bytes -= GST_BUFFER_SIZE (buf);
     if (G_LIKELY (res == GST_FLOW_OK)) {
       GST_DEBUG_OBJECT (dec, "pushing buffer %p of size %u, "
           "time %" GST_TIME_FORMAT ", dur %" GST_TIME_FORMAT, buf,
@@ -1214,14 +1277,32 @@ gst_base_video_decoder_chain_reverse (GstBaseVideoDecoder * dec,
       gbuf = GST_BUFFER_CAST (dec->gather->data);
       /* remove from the gather list */
       dec->gather = g_list_delete_link (dec->gather, dec->gather);
+      dec->reverse_bytes -= GST_BUFFER_SIZE (gbuf);
       /* copy to parse queue */
       dec->parse = g_list_prepend (dec->parse, gbuf);
     }
     /* parse and decode stuff in the parse queue */
     gst_base_video_decoder_flush_parse (dec);
+    dec->reverse_skipping = FALSE;
   }
 
   if (G_LIKELY (buf)) {
+    /* The gathered data starts at a keyframe, so if it gets too large
+     * the remainder until the next discont is skipped. Everything
+     * before it can still be decoded, later smaller buffers can't
+     * because they might refer to the skipped ones */
+    if (dec->reverse_skipping || (dec->max_reverse_bytes > 0 &&
+            dec->reverse_bytes + GST_BUFFER_SIZE (buf) >
+            dec->max_reverse_bytes)) {
+      dec->reverse_skipping = TRUE;
+      GST_DEBUG_OBJECT (dec, "skipping buffer %p of size %u, "
+          "time %" GST_TIME_FORMAT ", already have %" G_GUINT64_FORMAT
+          " bytes", buf, GST_BUFFER_SIZE (buf),
+          GST_TIME_ARGS (GST_BUFFER_TIMESTAMP (buf)), dec->reverse_bytes);
+      gst_buffer_unref (buf);
+      return result;
+    }
+
     GST_DEBUG_OBJECT (dec, "gathering buffer %p of size %u, "
         "time %" GST_TIME_FORMAT ", dur %" GST_TIME_FORMAT, buf,
         GST_BUFFER_SIZE (buf), GST_TIME_ARGS (GST_BUFFER_TIMESTAMP (buf)),
@@ -1229,6 +1310,7 @@ gst_base_video_decoder_chain_reverse (GstBaseVideoDecoder * dec,
 
     /* add buffer to gather queue */
     dec->gather = g_list_prepend (dec->gather, buf);
+    dec->reverse_bytes += GST_BUFFER_SIZE (buf);
   }
 
   return result;
@@ -1383,11 +1465,11 @@ static void
 gst_base_video_decoder_prepare_finish_frame (GstBaseVideoDecoder *
     base_video_decoder, GstVideoFrame * frame)
 {
-  GList *l, *events = NULL;
+  GList *l, *events;
 
 #ifndef GST_DISABLE_GST_DEBUG
   GST_LOG_OBJECT (base_video_decoder, "n %d in %d out %d",
-      g_list_length (GST_BASE_VIDEO_CODEC (base_video_decoder)->frames),
+      GST_BASE_VIDEO_CODEC (base_video_decoder)->frames.length,
       gst_adapter_available (base_video_decoder->input_adapter),
       gst_adapter_available (base_video_decoder->output_adapter));
 #endif
@@ -1397,19 +1479,9 @@ gst_base_video_decoder_prepare_finish_frame (GstBaseVideoDecoder *
       GST_TIME_ARGS (frame->presentation_timestamp));
 
   /* Push all pending events that arrived before this frame */
-  for (l = base_video_decoder->base_video_codec.frames; l; l = l->next) {
-    GstVideoFrame *tmp = l->data;
-
-    if (tmp->events) {
-      events = tmp->events;
-      tmp->events = NULL;
-    }
-
-    if (tmp == frame)
-      break;
-  }
-
-  for (l = g_list_last (events); l; l = l->prev) {
+  events = gst_base_video_codec_take_events (GST_BASE_VIDEO_CODEC
+      (base_video_decoder), frame);
+  for (l = events; l; l = l->next) {
     GST_LOG_OBJECT (base_video_decoder, "pushing %s event",
         GST_EVENT_TYPE_NAME (l->data));
     gst_pad_push_event (GST_BASE_VIDEO_CODEC_SRC_PAD (base_video_decoder),
@@ -1479,8 +1551,7 @@ static void
 gst_base_video_decoder_do_finish_frame (GstBaseVideoDecoder * dec,
     GstVideoFrame * frame)
 {
-  GST_BASE_VIDEO_CODEC (dec)->frames =
-      g_list_remove (GST_BASE_VIDEO_CODEC (dec)->frames, frame);
+  gst_base_video_codec_remove_frame (GST_BASE_VIDEO_CODEC (dec), frame);
 
   gst_video_frame_unref (frame);
 }
@@ -1669,9 +1740,22 @@ gst_base_video_decoder_finish_frame (GstBaseVideoDecoder * base_video_decoder,
     base_video_decoder->error_count--;
 
   if (GST_BASE_VIDEO_CODEC (base_video_decoder)->segment.rate < 0.0) {
+    /* The frames are pushed latest first, so the ones closest
+     * to the keyframe are kept if the output gets too large */
+    if (base_video_decoder->max_reverse_bytes > 0 &&
+        base_video_decoder->reverse_bytes + GST_BUFFER_SIZE (src_buffer) >
+        base_video_decoder->max_reverse_bytes) {
+      GST_DEBUG_OBJECT (base_video_decoder, "too much queued, dropping "
+          "buffer %" GST_TIME_FORMAT,
+          GST_TIME_ARGS (GST_BUFFER_TIMESTAMP (src_buffer)));
+      gst_buffer_unref (src_buffer);
+      goto done;
+    }
+
     GST_LOG_OBJECT (base_video_decoder, "queued buffer");
     base_video_decoder->queued =
         g_list_prepend (base_video_decoder->queued, src_buffer);
+    base_video_decoder->reverse_bytes += GST_BUFFER_SIZE (src_buffer);
   } else {
     ret = gst_pad_push (GST_BASE_VIDEO_CODEC_SRC_PAD (base_video_decoder),
         src_buffer);
@@ -1853,8 +1937,8 @@ gst_base_video_decoder_have_frame_2 (GstBaseVideoDecoder * base_video_decoder)
       GST_TIME_ARGS (frame->decode_timestamp));
   GST_LOG_OBJECT (base_video_decoder, "dist %d", frame->distance_from_sync);
 
-  GST_BASE_VIDEO_CODEC (base_video_decoder)->frames =
-      g_list_append (GST_BASE_VIDEO_CODEC (base_video_decoder)->frames, frame);
+  gst_base_video_codec_append_frame (GST_BASE_VIDEO_CODEC (base_video_decoder),
+      frame);
 
   frame->deadline =
       gst_segment_to_running_time (&GST_BASE_VIDEO_CODEC
@@ -1942,15 +2026,14 @@ GstVideoFrame *
 gst_base_video_decoder_get_oldest_frame (GstBaseVideoDecoder *
     base_video_decoder)
 {
-  GList *g;
+  GstVideoFrame *frame;
 
   GST_BASE_VIDEO_CODEC_STREAM_LOCK (base_video_decoder);
-  g = g_list_first (GST_BASE_VIDEO_CODEC (base_video_decoder)->frames);
+  frame =
+      g_queue_peek_head (&GST_BASE_VIDEO_CODEC (base_video_decoder)->frames);
   GST_BASE_VIDEO_CODEC_STREAM_UNLOCK (base_video_decoder);
 
-  if (g == NULL)
-    return NULL;
-  return (GstVideoFrame *) (g->data);
+  return frame;
 }
 
 /**
@@ -1968,11 +2051,11 @@ gst_base_video_decoder_get_frame (GstBaseVideoDecoder * base_video_decoder,
   GstVideoFrame *frame = NULL;
 
   GST_BASE_VIDEO_CODEC_STREAM_LOCK (base_video_decoder);
-  for (g = g_list_first (GST_BASE_VIDEO_CODEC (base_video_decoder)->frames);
-      g; g = g_list_next (g)) {
+  for (g = GST_BASE_VIDEO_CODEC (base_video_decoder)->frames.head; g;
+      g = g_list_next (g)) {
     GstVideoFrame *tmp = g->data;
 
-    if (frame->system_frame_number == frame_number) {
+    if (tmp->system_frame_number == frame_number) {
       frame = tmp;
       break;
     }
@@ -2154,6 +2237,61 @@ gst_base_video_decoder_get_max_decode_time (GstBaseVideoDecoder *
   return deadline;
 }
 
+/**
+ * gst_base_video_decoder_set_latency:
+ * @base_video_decoder: a #GstBaseVideoDecoder
+ * @min_latency: minimum latency
+ * @max_latency: maximum latency, or GST_CLOCK_TIME_NONE if unlimited
+ *
+ * Informs the base class about the latency the subclass adds, it is
+ * reported in the LATENCY query. A latency message is posted if the
+ * latency changed, so that the pipeline reconfigures it.
+ */
+void
+gst_base_video_decoder_set_latency (GstBaseVideoDecoder * base_video_decoder,
+    GstClockTime min_latency, GstClockTime max_latency)
+{
+  gboolean changed;
+
+  g_return_if_fail (GST_CLOCK_TIME_IS_VALID (min_latency));
+  g_return_if_fail (max_latency >= min_latency);
+
+  GST_OBJECT_LOCK (base_video_decoder);
+  changed = base_video_decoder->min_latency != min_latency
+      || base_video_decoder->max_latency != max_latency;
+  base_video_decoder->min_latency = min_latency;
+  base_video_decoder->max_latency = max_latency;
+  GST_OBJECT_UNLOCK (base_video_decoder);
+
+  if (changed) {
+    GST_DEBUG_OBJECT (base_video_decoder, "Latency min %" GST_TIME_FORMAT
+        " max %" GST_TIME_FORMAT, GST_TIME_ARGS (min_latency),
+        GST_TIME_ARGS (max_latency));
+    gst_element_post_message (GST_ELEMENT_CAST (base_video_decoder),
+        gst_message_new_latency (GST_OBJECT_CAST (base_video_decoder)));
+  }
+}
+
+/**
+ * gst_base_video_decoder_get_latency:
+ * @base_video_decoder: a #GstBaseVideoDecoder
+ * @min_latency: (out) (allow-none): the minimum latency
+ * @max_latency: (out) (allow-none): the maximum latency
+ *
+ * Returns the latency set with gst_base_video_decoder_set_latency().
+ */
+void
+gst_base_video_decoder_get_latency (GstBaseVideoDecoder * base_video_decoder,
+    GstClockTime * min_latency, GstClockTime * max_latency)
+{
+  GST_OBJECT_LOCK (base_video_decoder);
+  if (min_latency)
+    *min_latency = base_video_decoder->min_latency;
+  if (max_latency)
+    *max_latency = base_video_decoder->max_latency;
+  GST_OBJECT_UNLOCK (base_video_decoder);
+}
+
 /**
  * gst_base_video_decoder_get_oldest_frame:
  * @base_video_decoder_class: a #GstBaseVideoDecoderClass
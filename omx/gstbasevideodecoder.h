@@ -72,6 +72,14 @@ G_BEGIN_DECLS
  */
 #define GST_BASE_VIDEO_DECODER_FLOW_DROPPED GST_FLOW_CUSTOM_SUCCESS_1
 
+/**
+ * GST_BASE_VIDEO_DECODER_MAX_REVERSE_BYTES:
+ *
+ * Default limit of the data that is gathered and queued during
+ * reverse playback.
+ */
+#define GST_BASE_VIDEO_DECODER_MAX_REVERSE_BYTES (128 * 1024 * 1024)
+
 typedef struct _GstBaseVideoDecoder GstBaseVideoDecoder;
 typedef struct _GstBaseVideoDecoderClass GstBaseVideoDecoderClass;
 
@@ -150,7 +158,7 @@ struct _GstBaseVideoDecoder
   /* relative offset of frame */
   guint64           frame_offset;
   /* tracking ts and offsets */
-  GList            *timestamps;
+  GQueue            timestamps;
   /* whether parsing is in sync */
   gboolean          have_sync;
 
@@ -176,6 +184,11 @@ struct _GstBaseVideoDecoder
   /* collected output */
   GList            *queued;
   gboolean          process;
+  /* size of gather and queued, and its limit (0 for unlimited) */
+  guint64           reverse_bytes;
+  guint64           max_reverse_bytes;
+  /* TRUE if input is skipped until the next discont */
+  gboolean          reverse_skipping;
 
   /* no comment ... */
   guint64           base_picture_number;
@@ -186,6 +199,10 @@ struct _GstBaseVideoDecoder
   guint             dropped;
   guint             processed;
 
+  /* latency added by the decoder, protected by the object lock */
+  GstClockTime      min_latency;
+  GstClockTime      max_latency;
+
   /* FIXME before moving to base */
   void             *padding[GST_PADDING_LARGE];
 };
@@ -212,6 +229,14 @@ struct _GstBaseVideoDecoder
  * @finish:         Optional.
  *                  Called to request subclass to dispatch any pending remaining
  *                  data (e.g. at EOS).
+ * @alloc_sink_buffer: Optional.
+ *                  Allows subclass to provide buffers for upstream to write
+ *                  input data into. Setting the buffer to %NULL lets
+ *                  upstream allocate a normal buffer.
+ * @flush_start:    Optional.
+ *                  Called when flushing starts, before @reset is called
+ *                  when it stops. Not serialized with the data flow, allows
+ *                  unblocking the streaming thread if it waits for the codec.
  *
  * Subclasses can override any of the available virtual methods or not, as
  * needed. At minimum @handle_frame needs to be overridden, and @set_format
@@ -239,6 +264,10 @@ struct _GstBaseVideoDecoderClass
 
   GstFlowReturn (*handle_frame)   (GstBaseVideoDecoder *coder, GstVideoFrame *frame);
 
+  GstFlowReturn (*alloc_sink_buffer) (GstBaseVideoDecoder *coder, guint64 offset,
+                                   guint size, GstCaps *caps, GstBuffer **buf);
+
+  void          (*flush_start)    (GstBaseVideoDecoder *coder);
 
   /*< private >*/
   guint32       capture_mask;
@@ -269,6 +298,12 @@ GstVideoState   *gst_base_video_decoder_get_state (GstBaseVideoDecoder *base_vid
 GstClockTimeDiff gst_base_video_decoder_get_max_decode_time (
                                     GstBaseVideoDecoder *base_video_decoder,
                                     GstVideoFrame *frame);
+void             gst_base_video_decoder_set_latency (GstBaseVideoDecoder *base_video_decoder,
+                                    GstClockTime min_latency,
+                                    GstClockTime max_latency);
+void             gst_base_video_decoder_get_latency (GstBaseVideoDecoder *base_video_decoder,
+                                    GstClockTime *min_latency,
+                                    GstClockTime *max_latency);
 GstFlowReturn    gst_base_video_decoder_finish_frame (GstBaseVideoDecoder *base_video_decoder,
                                     GstVideoFrame *frame);
 GstFlowReturn    gst_base_video_decoder_drop_frame (GstBaseVideoDecoder *dec,
@@ -299,11 +299,9 @@ gst_base_video_encoder_drain (GstBaseVideoEncoder * enc)
     ret = enc_class->reset (enc);
   }
   /* everything should be away now */
-  if (codec->frames) {
+  if (codec->frames.length) {
     /* not fatal/impossible though if subclass/codec eats stuff */
-    g_list_foreach (codec->frames, (GFunc) gst_video_frame_unref, NULL);
-    g_list_free (codec->frames);
-    codec->frames = NULL;
+    gst_base_video_codec_clear_frames (codec);
   }
 
   return ret;
@@ -317,7 +315,7 @@ gst_base_video_encoder_sink_setcaps (GstPad * pad, GstCaps * caps)
   GstStructure *structure;
   GstVideoState *state, tmp_state;
   gboolean ret;
-  gboolean changed = FALSE;
+  gboolean changed = FALSE, framerate_changed;
 
   base_video_encoder = GST_BASE_VIDEO_ENCODER (gst_pad_get_parent (pad));
   base_video_encoder_class =
@@ -350,7 +348,7 @@ gst_base_video_encoder_sink_setcaps (GstPad * pad, GstCaps * caps)
     tmp_state.fps_n = 0;
     tmp_state.fps_d = 1;
   }
-  changed = changed || (tmp_state.fps_n != state->fps_n
+  framerate_changed = (tmp_state.fps_n != state->fps_n
       || tmp_state.fps_d != state->fps_d);
 
   if (!gst_video_parse_caps_pixel_aspect_ratio (caps, &tmp_state.par_n,
@@ -380,9 +378,11 @@ gst_base_video_encoder_sink_setcaps (GstPad * pad, GstCaps * caps)
   tmp_state.clean_offset_left = 0;
   tmp_state.clean_offset_top = 0;
 
-  if (changed) {
-    /* arrange draining pending frames */
-    gst_base_video_encoder_drain (base_video_encoder);
+  if (changed || framerate_changed) {
+    /* arrange draining pending frames. Subclasses that can't change
+     * the framerate while encoding drain themselves */
+    if (changed)
+      gst_base_video_encoder_drain (base_video_encoder);
 
     /* and subclass should be ready to configure format at any time around */
     if (base_video_encoder_class->set_format)
@@ -878,8 +878,8 @@ gst_base_video_encoder_chain (GstPad * pad, GstBuffer * buf)
   }
   GST_OBJECT_UNLOCK (base_video_encoder);
 
-  GST_BASE_VIDEO_CODEC (base_video_encoder)->frames =
-      g_list_append (GST_BASE_VIDEO_CODEC (base_video_encoder)->frames, frame);
+  gst_base_video_codec_append_frame (GST_BASE_VIDEO_CODEC (base_video_encoder),
+      frame);
 
   /* new data, more finish needed */
   base_video_encoder->drained = FALSE;
@@ -949,62 +949,42 @@ stop_error:
   return GST_STATE_CHANGE_FAILURE;
 }
 
-/**
- * gst_base_video_encoder_finish_frame:
- * @base_video_encoder: a #GstBaseVideoEncoder
- * @frame: an encoded #GstVideoFrame 
+/* Pushes the events before frame and its src_buffer, which is the
+ * last part of the frame if last is TRUE. The state of the stream
+ * is only updated for the first part.
  *
- * @frame must have a valid encoded data buffer, whose metadata fields
- * are then appropriately set according to frame data or no buffer at
- * all if the frame should be dropped.
- * It is subsequently pushed downstream or provided to @shape_output.
- * In any case, the frame is considered finished and released.
- *
- * Returns: a #GstFlowReturn resulting from sending data downstream
- */
-GstFlowReturn
-gst_base_video_encoder_finish_frame (GstBaseVideoEncoder * base_video_encoder,
-    GstVideoFrame * frame)
+ * NOTE: Call with the stream lock */
+static GstFlowReturn
+gst_base_video_encoder_push_frame (GstBaseVideoEncoder * base_video_encoder,
+    GstVideoFrame * frame, gboolean last)
 {
   GstFlowReturn ret = GST_FLOW_OK;
   GstBaseVideoEncoderClass *base_video_encoder_class;
-  GList *l;
+  GList *l, *events;
   GstBuffer *headers = NULL;
 
   base_video_encoder_class =
       GST_BASE_VIDEO_ENCODER_GET_CLASS (base_video_encoder);
 
-  GST_LOG_OBJECT (base_video_encoder,
-      "finish frame fpn %d", frame->presentation_frame_number);
-
-  GST_BASE_VIDEO_CODEC_STREAM_LOCK (base_video_encoder);
-
   /* Push all pending events that arrived before this frame */
-  for (l = base_video_encoder->base_video_codec.frames; l; l = l->next) {
-    GstVideoFrame *tmp = l->data;
-
-    if (tmp->events) {
-      GList *k;
-
-      for (k = g_list_last (tmp->events); k; k = k->prev)
-        gst_pad_push_event (GST_BASE_VIDEO_CODEC_SRC_PAD (base_video_encoder),
-            k->data);
-      g_list_free (tmp->events);
-      tmp->events = NULL;
-    }
-
-    if (tmp == frame)
-      break;
-  }
-
-  /* no buffer data means this frame is skipped/dropped */
+  events = gst_base_video_codec_take_events (GST_BASE_VIDEO_CODEC
+      (base_video_encoder), frame);
+  for (l = events; l; l = l->next)
+    gst_pad_push_event (GST_BASE_VIDEO_CODEC_SRC_PAD (base_video_encoder),
+        l->data);
+  g_list_free (events);
+
+  /* no buffer data means this frame is skipped/dropped,
+   * or that all of it was pushed in parts already */
   if (!frame->src_buffer) {
-    GST_DEBUG_OBJECT (base_video_encoder, "skipping frame %" GST_TIME_FORMAT,
-        GST_TIME_ARGS (frame->presentation_timestamp));
-    goto done;
+    if (!frame->partial)
+      GST_DEBUG_OBJECT (base_video_encoder, "skipping frame %" GST_TIME_FORMAT,
+          GST_TIME_ARGS (frame->presentation_timestamp));
+    return ret;
   }
 
-  if (frame->is_sync_point && base_video_encoder->force_key_unit) {
+  if (frame->is_sync_point && !frame->partial
+      && base_video_encoder->force_key_unit) {
     GstClockTime stream_time, running_time;
     GstEvent *ev;
     ForcedKeyUnitEvent *fevt = NULL;
@@ -1069,27 +1049,44 @@ gst_base_video_encoder_finish_frame (GstBaseVideoEncoder * base_video_encoder,
     }
   }
 
-  if (frame->is_sync_point) {
-    base_video_encoder->distance_from_sync = 0;
-    GST_BUFFER_FLAG_UNSET (frame->src_buffer, GST_BUFFER_FLAG_DELTA_UNIT);
-  } else {
-    GST_BUFFER_FLAG_SET (frame->src_buffer, GST_BUFFER_FLAG_DELTA_UNIT);
-  }
+  if (!frame->partial) {
+    if (frame->is_sync_point)
+      base_video_encoder->distance_from_sync = 0;
+    frame->distance_from_sync = base_video_encoder->distance_from_sync;
+    base_video_encoder->distance_from_sync++;
 
-  frame->distance_from_sync = base_video_encoder->distance_from_sync;
-  base_video_encoder->distance_from_sync++;
+    frame->decode_frame_number = frame->system_frame_number - 1;
+    if (frame->decode_frame_number < 0) {
+      frame->decode_timestamp = 0;
+    } else {
+      frame->decode_timestamp =
+          gst_util_uint64_scale (frame->decode_frame_number,
+          GST_SECOND * GST_BASE_VIDEO_CODEC (base_video_encoder)->state.fps_d,
+          GST_BASE_VIDEO_CODEC (base_video_encoder)->state.fps_n);
+    }
 
-  frame->decode_frame_number = frame->system_frame_number - 1;
-  if (frame->decode_frame_number < 0) {
-    frame->decode_timestamp = 0;
-  } else {
-    frame->decode_timestamp = gst_util_uint64_scale (frame->decode_frame_number,
-        GST_SECOND * GST_BASE_VIDEO_CODEC (base_video_encoder)->state.fps_d,
-        GST_BASE_VIDEO_CODEC (base_video_encoder)->state.fps_n);
+    /* update rate estimate */
+    if (GST_CLOCK_TIME_IS_VALID (frame->presentation_duration)) {
+      GST_BASE_VIDEO_CODEC (base_video_encoder)->time +=
+          frame->presentation_duration;
+    } else {
+      /* better none than nothing valid */
+      GST_BASE_VIDEO_CODEC (base_video_encoder)->time = GST_CLOCK_TIME_NONE;
+    }
   }
+  GST_BASE_VIDEO_CODEC (base_video_encoder)->bytes +=
+      GST_BUFFER_SIZE (frame->src_buffer);
+
+  if (frame->is_sync_point)
+    GST_BUFFER_FLAG_UNSET (frame->src_buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+  else
+    GST_BUFFER_FLAG_SET (frame->src_buffer, GST_BUFFER_FLAG_DELTA_UNIT);
 
+  /* All parts have the timestamp of the frame, the last
+   * one its duration */
   GST_BUFFER_TIMESTAMP (frame->src_buffer) = frame->presentation_timestamp;
-  GST_BUFFER_DURATION (frame->src_buffer) = frame->presentation_duration;
+  GST_BUFFER_DURATION (frame->src_buffer) =
+      last ? frame->presentation_duration : GST_CLOCK_TIME_NONE;
   GST_BUFFER_OFFSET (frame->src_buffer) = frame->decode_timestamp;
 
   if (G_UNLIKELY (headers)) {
@@ -1098,17 +1095,6 @@ gst_base_video_encoder_finish_frame (GstBaseVideoEncoder * base_video_encoder,
     GST_BUFFER_OFFSET (headers) = frame->decode_timestamp;
   }
 
-  /* update rate estimate */
-  GST_BASE_VIDEO_CODEC (base_video_encoder)->bytes +=
-      GST_BUFFER_SIZE (frame->src_buffer);
-  if (GST_CLOCK_TIME_IS_VALID (frame->presentation_duration)) {
-    GST_BASE_VIDEO_CODEC (base_video_encoder)->time +=
-        frame->presentation_duration;
-  } else {
-    /* better none than nothing valid */
-    GST_BASE_VIDEO_CODEC (base_video_encoder)->time = GST_CLOCK_TIME_NONE;
-  }
-
   if (G_UNLIKELY (GST_BASE_VIDEO_CODEC (base_video_encoder)->discont)) {
     GST_LOG_OBJECT (base_video_encoder, "marking discont");
     GST_BUFFER_FLAG_SET (frame->src_buffer, GST_BUFFER_FLAG_DISCONT);
@@ -1124,7 +1110,7 @@ gst_base_video_encoder_finish_frame (GstBaseVideoEncoder * base_video_encoder,
     gst_pad_push (GST_BASE_VIDEO_CODEC_SRC_PAD (base_video_encoder), headers);
   }
 
-  if (base_video_encoder_class->shape_output) {
+  if (last && base_video_encoder_class->shape_output) {
     ret = base_video_encoder_class->shape_output (base_video_encoder, frame);
   } else {
     ret =
@@ -1133,10 +1119,41 @@ gst_base_video_encoder_finish_frame (GstBaseVideoEncoder * base_video_encoder,
   }
   frame->src_buffer = NULL;
 
-done:
+  if (!last)
+    frame->partial = TRUE;
+
+  return ret;
+}
+
+/**
+ * gst_base_video_encoder_finish_frame:
+ * @base_video_encoder: a #GstBaseVideoEncoder
+ * @frame: an encoded #GstVideoFrame 
+ *
+ * @frame must have a valid encoded data buffer, whose metadata fields
+ * are then appropriately set according to frame data or no buffer at
+ * all if the frame should be dropped.
+ * It is subsequently pushed downstream or provided to @shape_output.
+ * In any case, the frame is considered finished and released.
+ *
+ * Returns: a #GstFlowReturn resulting from sending data downstream
+ */
+GstFlowReturn
+gst_base_video_encoder_finish_frame (GstBaseVideoEncoder * base_video_encoder,
+    GstVideoFrame * frame)
+{
+  GstFlowReturn ret;
+
+  GST_LOG_OBJECT (base_video_encoder,
+      "finish frame fpn %d", frame->presentation_frame_number);
+
+  GST_BASE_VIDEO_CODEC_STREAM_LOCK (base_video_encoder);
+
+  ret = gst_base_video_encoder_push_frame (base_video_encoder, frame, TRUE);
+
   /* handed out */
-  GST_BASE_VIDEO_CODEC (base_video_encoder)->frames =
-      g_list_remove (GST_BASE_VIDEO_CODEC (base_video_encoder)->frames, frame);
+  gst_base_video_codec_remove_frame (GST_BASE_VIDEO_CODEC (base_video_encoder),
+      frame);
 
   gst_video_frame_unref (frame);
 
@@ -1145,6 +1162,37 @@ done:
   return ret;
 }
 
+/**
+ * gst_base_video_encoder_finish_subframe:
+ * @base_video_encoder: a #GstBaseVideoEncoder
+ * @frame: a #GstVideoFrame that is being encoded
+ *
+ * Pushes the encoded data buffer of @frame, which is only a part of
+ * the frame, e.g. a slice, downstream with the timestamp and flags of
+ * the frame. @frame stays pending until it is finished with
+ * gst_base_video_encoder_finish_frame(), with the last part or no
+ * buffer at all.
+ *
+ * Returns: a #GstFlowReturn resulting from sending data downstream
+ */
+GstFlowReturn
+gst_base_video_encoder_finish_subframe (GstBaseVideoEncoder *
+    base_video_encoder, GstVideoFrame * frame)
+{
+  GstFlowReturn ret;
+
+  g_return_val_if_fail (frame->src_buffer != NULL, GST_FLOW_ERROR);
+
+  GST_LOG_OBJECT (base_video_encoder,
+      "finish subframe fpn %d", frame->presentation_frame_number);
+
+  GST_BASE_VIDEO_CODEC_STREAM_LOCK (base_video_encoder);
+  ret = gst_base_video_encoder_push_frame (base_video_encoder, frame, FALSE);
+  GST_BASE_VIDEO_CODEC_STREAM_UNLOCK (base_video_encoder);
+
+  return ret;
+}
+
 /**
  * gst_base_video_encoder_get_state:
  * @base_video_encoder: a #GstBaseVideoEncoder
@@ -1217,15 +1265,14 @@ GstVideoFrame *
 gst_base_video_encoder_get_oldest_frame (GstBaseVideoEncoder *
     base_video_encoder)
 {
-  GList *g;
+  GstVideoFrame *frame;
 
   GST_BASE_VIDEO_CODEC_STREAM_LOCK (base_video_encoder);
-  g = g_list_first (GST_BASE_VIDEO_CODEC (base_video_encoder)->frames);
+  frame =
+      g_queue_peek_head (&GST_BASE_VIDEO_CODEC (base_video_encoder)->frames);
   GST_BASE_VIDEO_CODEC_STREAM_UNLOCK (base_video_encoder);
 
-  if (g == NULL)
-    return NULL;
-  return (GstVideoFrame *) (g->data);
+  return frame;
 }
 
 /* FIXME there could probably be more of these;
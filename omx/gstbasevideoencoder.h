@@ -169,6 +169,8 @@ const GstVideoState*   gst_base_video_encoder_get_state (GstBaseVideoEncoder *co
 GstVideoFrame*         gst_base_video_encoder_get_oldest_frame (GstBaseVideoEncoder *coder);
 GstFlowReturn          gst_base_video_encoder_finish_frame (GstBaseVideoEncoder *base_video_encoder,
                                                             GstVideoFrame *frame);
+GstFlowReturn          gst_base_video_encoder_finish_subframe (GstBaseVideoEncoder *base_video_encoder,
+                                                               GstVideoFrame *frame);
 
 void                   gst_base_video_encoder_set_latency (GstBaseVideoEncoder *base_video_encoder,
                                                            GstClockTime min_latency, GstClockTime max_latency);
@@ -32,6 +32,9 @@
 #include <string.h>
 
 #include "gstomx.h"
+#include "gstomxplanecopy.h"
+#include "gstomxcapscache.h"
+#include "gstomxresources.h"
 #include "gstomxmpeg4videodec.h"
 #include "gstomxh264dec.h"
 #include "gstomxh263dec.h"
@@ -57,6 +60,22 @@ GST_DEBUG_CATEGORY (gstomx_debug);
 G_LOCK_DEFINE_STATIC (core_handles);
 static GHashTable *core_handles;
 
+/* Protects the lent, detached and recycled fields of all buffers */
+G_LOCK_DEFINE_STATIC (lent_buffers);
+
+/* Components in the Loaded state that were released by their elements,
+ * by core, component name, role and hacks. Getting a component handle
+ * and setting its role can take a long time with some implementations */
+G_LOCK_DEFINE_STATIC (component_pool);
+static GHashTable *component_pool;      /* Contains GQueue* */
+#define GST_OMX_COMPONENT_POOL_DEFAULT_SIZE 1
+static guint component_pool_size = GST_OMX_COMPONENT_POOL_DEFAULT_SIZE;
+
+/* Milliseconds until flushing fails if the component doesn't return
+ * all buffers of the flushed ports */
+#define GST_OMX_FLUSH_DEFAULT_TIMEOUT 5000
+static guint flush_timeout = GST_OMX_FLUSH_DEFAULT_TIMEOUT;
+
 GstOMXCore *
 gst_omx_core_acquire (const gchar * filename)
 {
@@ -89,6 +108,11 @@ gst_omx_core_acquire (const gchar * filename)
     if (!g_module_symbol (core->module, "OMX_FreeHandle",
             (gpointer *) & core->free_handle))
       goto symbol_error;
+    /* Optional */
+    g_module_symbol (core->module, "OMX_ComponentNameEnum",
+        (gpointer *) & core->component_name_enum);
+    g_module_symbol (core->module, "OMX_GetRolesOfComponent",
+        (gpointer *) & core->get_roles_of_component);
 
     GST_DEBUG ("Successfully loaded core '%s'", filename);
   }
@@ -171,6 +195,11 @@ gst_omx_core_acquire_hybris (const gchar * filename)
     core->free_handle = android_dlsym (core->hybris_module, "OMX_FreeHandle");
     if (!core->free_handle)
       goto symbol_error;
+    /* Optional */
+    core->component_name_enum =
+        android_dlsym (core->hybris_module, "OMX_ComponentNameEnum");
+    core->get_roles_of_component =
+        android_dlsym (core->hybris_module, "OMX_GetRolesOfComponent");
 
     GST_DEBUG ("Successfully loaded core '%s'", filename);
   }
@@ -242,40 +271,34 @@ gst_omx_core_release (GstOMXCore * core)
   G_UNLOCK (core_handles);
 }
 
-/* NOTE: comp->messages_lock will be used */
 static void
 gst_omx_component_flush_messages (GstOMXComponent * comp)
 {
-  GstOMXMessage *msg;
+  GstOMXMessage msg;
 
-  g_mutex_lock (comp->messages_lock);
-  while ((msg = g_queue_pop_head (&comp->messages))) {
-    g_slice_free (GstOMXMessage, msg);
-  }
-  g_mutex_unlock (comp->messages_lock);
+  while (gst_omx_ring_pop (comp->messages, &msg));
 }
 
-/* NOTE: Call with comp->lock, comp->messages_lock will be used */
+/* NOTE: Call with comp->lock */
 static void
-gst_omx_component_handle_messages (GstOMXComponent * comp)
+gst_omx_component_handle_ring_messages (GstOMXComponent * comp,
+    GstOMXRing * messages)
 {
-  GstOMXMessage *msg;
-
-  g_mutex_lock (comp->messages_lock);
+  GstOMXMessage msg;
 
-  while ((msg = g_queue_pop_head (&comp->messages))) {
-    switch (msg->type) {
+  while (gst_omx_ring_pop (messages, &msg)) {
+    switch (msg.type) {
       case GST_OMX_MESSAGE_STATE_SET:{
         GST_DEBUG_OBJECT (comp->parent, "State change to %d finished",
-            msg->content.state_set.state);
-        comp->state = msg->content.state_set.state;
+            msg.content.state_set.state);
+        comp->state = msg.content.state_set.state;
         if (comp->state == comp->pending_state)
           comp->pending_state = OMX_StateInvalid;
         break;
       }
       case GST_OMX_MESSAGE_FLUSH:{
         GstOMXPort *port = NULL;
-        OMX_U32 index = msg->content.flush.port;
+        OMX_U32 index = msg.content.flush.port;
 
         port = gst_omx_component_get_port (comp, index);
         if (!port)
@@ -293,7 +316,7 @@ gst_omx_component_handle_messages (GstOMXComponent * comp)
         break;
       }
       case GST_OMX_MESSAGE_ERROR:{
-        OMX_ERRORTYPE error = msg->content.error.error;
+        OMX_ERRORTYPE error = msg.content.error.error;
 
         if (error == OMX_ErrorNone)
           break;
@@ -306,14 +329,13 @@ gst_omx_component_handle_messages (GstOMXComponent * comp)
          */
         if (comp->last_error == OMX_ErrorNone)
           comp->last_error = error;
-        g_cond_broadcast (comp->messages_cond);
 
         break;
       }
       case GST_OMX_MESSAGE_PORT_ENABLE:{
         GstOMXPort *port = NULL;
-        OMX_U32 index = msg->content.port_enable.port;
-        OMX_BOOL enable = msg->content.port_enable.enable;
+        OMX_U32 index = msg.content.port_enable.port;
+        OMX_BOOL enable = msg.content.port_enable.enable;
 
         port = gst_omx_component_get_port (comp, index);
         if (!port)
@@ -327,11 +349,27 @@ gst_omx_component_handle_messages (GstOMXComponent * comp)
       }
       case GST_OMX_MESSAGE_PORT_SETTINGS_CHANGED:{
         gint i, n;
-        OMX_U32 index = msg->content.port_settings_changed.port;
+        OMX_U32 index = msg.content.port_settings_changed.port;
         GList *outports = NULL, *l, *k;
 
         GST_DEBUG_OBJECT (comp->parent, "Settings changed (port %u)", index);
 
+        /* With adaptive playback only the crop rectangle changes if the
+         * new frames fit into the buffers. They stay valid and only new
+         * caps are needed, see gst_omx_port_set_adaptive_playback() */
+        if (msg.content.port_settings_changed.index ==
+            OMX_IndexConfigCommonOutputCrop) {
+          n = (comp->ports ? comp->ports->len : 0);
+          for (i = 0; i < n; i++) {
+            GstOMXPort *port = g_ptr_array_index (comp->ports, i);
+
+            if ((index == OMX_ALL || index == port->index)
+                && port->port_def.eDir == OMX_DirOutput)
+              port->crop_changed = TRUE;
+          }
+          break;
+        }
+
         /* FIXME: This probably can be done better */
 
         /* Now update the ports' states */
@@ -368,59 +406,337 @@ gst_omx_component_handle_messages (GstOMXComponent * comp)
 
         break;
       }
-      case GST_OMX_MESSAGE_BUFFER_DONE:{
-        GstOMXBuffer *buf = msg->content.buffer_done.buffer->pAppPrivate;
-        GstOMXPort *port;
-        GstOMXComponent *comp;
-
-        port = buf->port;
-        comp = port->comp;
-
-        if (msg->content.buffer_done.empty) {
-          /* Input buffer is empty again and can be used to contain new input */
-          GST_DEBUG_OBJECT (comp->parent, "Port %u emptied buffer %p (%p)",
-              port->index, buf, buf->omx_buf->pBuffer);
-
-          /* XXX: Some OMX implementations don't reset nOffset
-           * when the complete buffer is emptied but instead
-           * only reset nFilledLen. We reset nOffset to 0
-           * if nFilledLen == 0, which is safe to do because
-           * the offset *must* be 0 if the buffer is not
-           * filled at all.
-           *
-           * Seen in QCOM's OMX implementation.
-           */
-          if (buf->omx_buf->nFilledLen == 0)
-            buf->omx_buf->nOffset = 0;
-
-          /* Reset all flags, some implementations don't
-           * reset them themselves and the flags are not
-           * valid anymore after the buffer was consumed
-           */
-          buf->omx_buf->nFlags = 0;
-        } else {
-          /* Output buffer contains output now or
-           * the port was flushed */
-          GST_DEBUG_OBJECT (comp->parent, "Port %u filled buffer %p (%p)",
-              port->index, buf, buf->omx_buf->pBuffer);
-        }
-
-        buf->used = FALSE;
-
-        g_queue_push_tail (&port->pending_buffers, buf);
-
-        break;
-      }
       default:{
         g_assert_not_reached ();
         break;
       }
     }
+  }
+
+  /* If the ring was full we lost a message and can't know
+   * anymore what state the component is in */
+  if (G_UNLIKELY (g_atomic_int_get (&comp->messages_overflow))) {
+    g_atomic_int_set (&comp->messages_overflow, 0);
+    GST_ERROR_OBJECT (comp->parent, "Lost messages of the component");
+    if (comp->last_error == OMX_ErrorNone)
+      comp->last_error = OMX_ErrorOverflow;
+  }
+}
+
+/* NOTE: Call with comp->lock */
+static void
+gst_omx_component_handle_messages (GstOMXComponent * comp)
+{
+  gst_omx_component_handle_ring_messages (comp, comp->messages);
+}
+
+/* Passes the buffer to the component to be emptied or filled
+ *
+ * NOTE: Call with port->lock */
+static OMX_ERRORTYPE
+gst_omx_port_pass_buffer (GstOMXPort * port, GstOMXBuffer * buf)
+{
+  GstOMXComponent *comp = port->comp;
+  gint64 start = GST_OMX_TRACE_START (comp->trace);
+  OMX_ERRORTYPE err;
+
+  if (port->port_def.eDir == OMX_DirInput) {
+    err = OMX_EmptyThisBuffer (comp->handle, buf->omx_buf);
+    GST_OMX_TRACE_CALL (comp->trace, GST_OMX_TRACE_EMPTY_THIS_BUFFER,
+        port->index, buf, buf->omx_buf->nFilledLen, start);
+  } else {
+    err = OMX_FillThisBuffer (comp->handle, buf->omx_buf);
+    GST_OMX_TRACE_CALL (comp->trace, GST_OMX_TRACE_FILL_THIS_BUFFER,
+        port->index, buf, 0, start);
+  }
+
+  return err;
+}
+
+/* Adaptive output buffer counts: if the component holds no output
+ * buffers anymore in at least GST_OMX_ADAPTIVE_STARVED of
+ * GST_OMX_ADAPTIVE_WINDOW buffers that are passed to it, the port is
+ * reconfigured with GST_OMX_ADAPTIVE_STEP more buffers, up to
+ * GST_OMX_ADAPTIVE_MAX_EXTRA_BUFFERS */
+#define GST_OMX_ADAPTIVE_WINDOW 32
+#define GST_OMX_ADAPTIVE_STARVED 4
+#define GST_OMX_ADAPTIVE_STEP 2
+#define GST_OMX_ADAPTIVE_MAX_EXTRA_BUFFERS 8
+
+/* Called before an output buffer is passed to the component again.
+ * The component runs out of buffers if downstream keeps too many of
+ * them or if buffers are returned slower than it fills them.
+ *
+ * NOTE: Call with port->lock */
+static void
+gst_omx_port_check_starved (GstOMXPort * port)
+{
+  guint i, n;
+
+  if (!port->adaptive_buffers || port->adaptive_grow
+      || port->adaptive_extra_buffers >= GST_OMX_ADAPTIVE_MAX_EXTRA_BUFFERS)
+    return;
+
+  n = port->buffers ? port->buffers->len : 0;
+  for (i = 0; i < n; i++) {
+    GstOMXBuffer *buf = g_ptr_array_index (port->buffers, i);
+
+    if (buf->used)
+      break;
+  }
+  if (i == n)
+    port->adaptive_starved++;
+
+  if (++port->adaptive_passed < GST_OMX_ADAPTIVE_WINDOW)
+    return;
+
+  if (port->adaptive_starved >= GST_OMX_ADAPTIVE_STARVED) {
+    GST_INFO_OBJECT (port->comp->parent,
+        "Port %u starved %u times in %u buffers, adding %u buffers",
+        port->index, port->adaptive_starved, port->adaptive_passed,
+        GST_OMX_ADAPTIVE_STEP);
+    port->adaptive_extra_buffers += GST_OMX_ADAPTIVE_STEP;
+    /* The settings cookie is only changed with comp->lock,
+     * see gst_omx_port_acquire_buffer() */
+    port->adaptive_grow = TRUE;
+  }
+  port->adaptive_passed = 0;
+  port->adaptive_starved = 0;
+}
+
+static void
+gst_omx_port_flush_messages (GstOMXPort * port)
+{
+  GstOMXBuffer *buf;
+
+  while (gst_omx_ring_pop (port->messages, &buf));
+}
+
+/* NOTE: Call with port->lock */
+static void
+gst_omx_port_handle_messages (GstOMXPort * port)
+{
+  GstOMXComponent *comp = port->comp;
+  GstOMXBuffer *buf;
+
+  while (gst_omx_ring_pop (port->messages, &buf)) {
+    if (G_UNLIKELY (buf->recycled)) {
+      OMX_ERRORTYPE err;
+
+      /* Returned from downstream, see gst_omx_port_wrap_buffer() */
+      buf->recycled = FALSE;
+
+      if (port->port_def.eDir == OMX_DirInput) {
+        /* Was never filled, can be used again */
+        buf->omx_buf->nOffset = 0;
+        buf->omx_buf->nFilledLen = 0;
+        buf->omx_buf->nFlags = 0;
+        buf->omx_buf->hMarkTargetComponent = NULL;
+        buf->omx_buf->pMarkData = NULL;
+      } else if (!port->flushing) {
+        GST_DEBUG_OBJECT (comp->parent, "Port %u recycled buffer %p (%p)",
+            port->index, buf, buf->omx_buf->pBuffer);
+
+        buf->omx_buf->nFlags = 0;
+        buf->omx_buf->hMarkTargetComponent = NULL;
+        buf->omx_buf->pMarkData = NULL;
+        gst_omx_port_check_starved (port);
+        buf->used = TRUE;
+        err = gst_omx_port_pass_buffer (port, buf);
+        if (err == OMX_ErrorNone)
+          continue;
+
+        GST_ERROR_OBJECT (comp->parent,
+            "Failed to pass buffer %p (%p) to port %u: %s (0x%08x)", buf,
+            buf->omx_buf->pBuffer, port->index, gst_omx_error_to_string (err),
+            err);
+        buf->used = FALSE;
+      }
+
+      g_queue_push_tail (&port->pending_buffers, buf);
+      continue;
+    }
+
+    if (port->port_def.eDir == OMX_DirInput) {
+      /* Input buffer is empty again and can be used to contain new input */
+      GST_DEBUG_OBJECT (comp->parent, "Port %u emptied buffer %p (%p)",
+          port->index, buf, buf->omx_buf->pBuffer);
+
+      /* XXX: Some OMX implementations don't reset nOffset
+       * when the complete buffer is emptied but instead
+       * only reset nFilledLen. We reset nOffset to 0
+       * if nFilledLen == 0, which is safe to do because
+       * the offset *must* be 0 if the buffer is not
+       * filled at all.
+       *
+       * Seen in QCOM's OMX implementation.
+       */
+      if (buf->omx_buf->nFilledLen == 0)
+        buf->omx_buf->nOffset = 0;
+
+      /* Reset all flags, some implementations don't
+       * reset them themselves and the flags are not
+       * valid anymore after the buffer was consumed
+       */
+      buf->omx_buf->nFlags = 0;
+
+      /* Marks only apply to the frame they were set for */
+      buf->omx_buf->hMarkTargetComponent = NULL;
+      buf->omx_buf->pMarkData = NULL;
+    } else {
+      /* Output buffer contains output now or
+       * the port was flushed */
+      GST_DEBUG_OBJECT (comp->parent, "Port %u filled buffer %p (%p)",
+          port->index, buf, buf->omx_buf->pBuffer);
+    }
+
+    buf->used = FALSE;
+
+    g_queue_push_tail (&port->pending_buffers, buf);
+  }
+}
+
+/* Waiters increase messages_waiters while holding messages_lock and
+ * before checking for messages, so that it's enough to only take
+ * messages_lock after a message was queued if there are waiters.
+ *
+ * NOTE: port->messages_lock will be used */
+static void
+gst_omx_port_wake (GstOMXPort * port)
+{
+  if (!g_atomic_int_get (&port->messages_waiters))
+    return;
+
+  g_mutex_lock (port->messages_lock);
+  g_cond_broadcast (port->messages_cond);
+  g_mutex_unlock (port->messages_lock);
+}
+
+/* NOTE: The ports' messages_lock will be used */
+static void
+gst_omx_component_wake_ports (GstOMXComponent * comp)
+{
+  gint i, n;
+
+  n = (comp->ports ? comp->ports->len : 0);
+  for (i = 0; i < n; i++)
+    gst_omx_port_wake (g_ptr_array_index (comp->ports, i));
+}
+
+/* Waits until a buffer of this port was returned by the component,
+ * a component event happened or the port was woken up otherwise.
+ * deadline is in g_get_monotonic_time() units, -1 waits forever.
+ * Returns FALSE if the deadline was reached.
+ *
+ * NOTE: Call with port->lock and comp->lock, both are released
+ * while waiting and the pending messages are handled afterwards */
+static gboolean
+gst_omx_port_wait_messages (GstOMXPort * port, gint64 deadline)
+{
+  GstOMXComponent *comp = port->comp;
+  gboolean signalled = TRUE;
+
+  g_mutex_lock (port->messages_lock);
+  g_atomic_int_inc (&port->messages_waiters);
+  g_mutex_unlock (comp->lock);
+  g_mutex_unlock (port->lock);
+
+  if (gst_omx_ring_is_empty (port->messages)
+      && gst_omx_ring_is_empty (comp->messages)) {
+    if (deadline == -1)
+      g_cond_wait (port->messages_cond, port->messages_lock);
+    else
+      signalled = g_cond_wait_until (port->messages_cond, port->messages_lock,
+          deadline);
+  }
+
+  g_atomic_int_add (&port->messages_waiters, -1);
+  g_mutex_unlock (port->messages_lock);
+  g_mutex_lock (port->lock);
+  g_mutex_lock (comp->lock);
+
+  gst_omx_component_handle_messages (comp);
+  gst_omx_port_handle_messages (port);
+
+  return signalled;
+}
+
+/* Queues a component event and wakes up everybody who is waiting
+ * for the component or one of its ports. Never allocates and only
+ * takes the messages_locks if somebody is waiting.
+ *
+ * NOTE: comp->messages_lock and the ports' messages_lock will be used */
+static void
+gst_omx_component_send_message (GstOMXComponent * comp, GstOMXMessage * msg)
+{
+  GstOMXRing *messages;
+
+  /* The ring can be replaced by a bigger one, which waits until
+   * nobody pushes to the old ring anymore */
+  g_atomic_int_inc (&comp->messages_pushers);
+  messages = g_atomic_pointer_get (&comp->messages);
+  if (G_UNLIKELY (!gst_omx_ring_push (messages, msg))) {
+    GST_ERROR_OBJECT (comp->parent, "Message queue full, dropping message %d",
+        msg->type);
+    g_atomic_int_set (&comp->messages_overflow, 1);
+  }
+  g_atomic_int_add (&comp->messages_pushers, -1);
 
-    g_slice_free (GstOMXMessage, msg);
+  if (g_atomic_int_get (&comp->messages_waiters)) {
+    g_mutex_lock (comp->messages_lock);
+    g_cond_broadcast (comp->messages_cond);
+    g_mutex_unlock (comp->messages_lock);
   }
 
+  gst_omx_component_wake_ports (comp);
+}
+
+/* Makes sure that the component's ring can hold @capacity messages.
+ * Messages that the callbacks still push to the old ring are handled
+ * before anything in the new ring, so that their order is kept.
+ *
+ * NOTE: Call with comp->lock, uses comp->messages_lock and the
+ * ports' messages_lock */
+static void
+gst_omx_component_ensure_messages_capacity (GstOMXComponent * comp,
+    guint capacity)
+{
+  GstOMXRing *messages, *old_messages;
+  guint i;
+
+  if (capacity <= comp->messages->capacity)
+    return;
+
+  GST_DEBUG_OBJECT (comp->parent, "Growing message queue to %u messages",
+      capacity);
+
+  /* Waiters only look at the ring while holding the component's or
+   * their port's messages_lock, afterwards they all use the new ring */
+  messages = gst_omx_ring_new (capacity, sizeof (GstOMXMessage));
+  g_mutex_lock (comp->messages_lock);
+  old_messages = comp->messages;
+  g_atomic_pointer_set (&comp->messages, messages);
   g_mutex_unlock (comp->messages_lock);
+  for (i = 0; i < comp->ports->len; i++) {
+    GstOMXPort *port = g_ptr_array_index (comp->ports, i);
+
+    g_mutex_lock (port->messages_lock);
+    g_mutex_unlock (port->messages_lock);
+  }
+
+  while (g_atomic_int_get (&comp->messages_pushers))
+    g_thread_yield ();
+
+  if (!gst_omx_ring_is_empty (old_messages)) {
+    gst_omx_component_handle_ring_messages (comp, old_messages);
+
+    /* Waiters might have missed these messages in the new ring */
+    g_mutex_lock (comp->messages_lock);
+    g_cond_broadcast (comp->messages_cond);
+    g_mutex_unlock (comp->messages_lock);
+    gst_omx_component_wake_ports (comp);
+  }
+  gst_omx_ring_free (old_messages);
 }
 
 static OMX_ERRORTYPE
@@ -438,49 +754,47 @@ EventHandler (OMX_HANDLETYPE hComponent, OMX_PTR pAppData, OMX_EVENTTYPE eEvent,
 
       switch (cmd) {
         case OMX_CommandStateSet:{
-          GstOMXMessage *msg = g_slice_new (GstOMXMessage);
+          GstOMXMessage msg;
 
-          msg->type = GST_OMX_MESSAGE_STATE_SET;
-          msg->content.state_set.state = nData2;
+          msg.type = GST_OMX_MESSAGE_STATE_SET;
+          msg.content.state_set.state = nData2;
 
           GST_DEBUG_OBJECT (comp->parent, "State change to %d finished",
-              msg->content.state_set.state);
+              msg.content.state_set.state);
+          GST_OMX_TRACE_INSTANT (comp->trace, GST_OMX_TRACE_STATE_SET,
+              OMX_ALL, NULL, msg.content.state_set.state);
 
-          g_mutex_lock (comp->messages_lock);
-          g_queue_push_tail (&comp->messages, msg);
-          g_cond_broadcast (comp->messages_cond);
-          g_mutex_unlock (comp->messages_lock);
+          gst_omx_component_send_message (comp, &msg);
           break;
         }
         case OMX_CommandFlush:{
-          GstOMXMessage *msg = g_slice_new (GstOMXMessage);
+          GstOMXMessage msg;
 
-          msg->type = GST_OMX_MESSAGE_FLUSH;
-          msg->content.flush.port = nData2;
+          msg.type = GST_OMX_MESSAGE_FLUSH;
+          msg.content.flush.port = nData2;
           GST_DEBUG_OBJECT (comp->parent, "Port %u flushed",
-              msg->content.flush.port);
+              msg.content.flush.port);
+          GST_OMX_TRACE_INSTANT (comp->trace, GST_OMX_TRACE_FLUSH_DONE,
+              msg.content.flush.port, NULL, 0);
 
-          g_mutex_lock (comp->messages_lock);
-          g_queue_push_tail (&comp->messages, msg);
-          g_cond_broadcast (comp->messages_cond);
-          g_mutex_unlock (comp->messages_lock);
+          gst_omx_component_send_message (comp, &msg);
           break;
         }
         case OMX_CommandPortEnable:
         case OMX_CommandPortDisable:{
-          GstOMXMessage *msg = g_slice_new (GstOMXMessage);
+          GstOMXMessage msg;
 
-          msg->type = GST_OMX_MESSAGE_PORT_ENABLE;
-          msg->content.port_enable.port = nData2;
-          msg->content.port_enable.enable = (cmd == OMX_CommandPortEnable);
+          msg.type = GST_OMX_MESSAGE_PORT_ENABLE;
+          msg.content.port_enable.port = nData2;
+          msg.content.port_enable.enable = (cmd == OMX_CommandPortEnable);
           GST_DEBUG_OBJECT (comp->parent, "Port %u %s",
-              msg->content.port_enable.port,
-              (msg->content.port_enable.enable ? "enabled" : "disabled"));
+              msg.content.port_enable.port,
+              (msg.content.port_enable.enable ? "enabled" : "disabled"));
+          GST_OMX_TRACE_INSTANT (comp->trace, GST_OMX_TRACE_PORT_ENABLE_DONE,
+              msg.content.port_enable.port, NULL,
+              msg.content.port_enable.enable);
 
-          g_mutex_lock (comp->messages_lock);
-          g_queue_push_tail (&comp->messages, msg);
-          g_cond_broadcast (comp->messages_cond);
-          g_mutex_unlock (comp->messages_lock);
+          gst_omx_component_send_message (comp, &msg);
           break;
         }
         default:
@@ -490,36 +804,35 @@ EventHandler (OMX_HANDLETYPE hComponent, OMX_PTR pAppData, OMX_EVENTTYPE eEvent,
     }
     case OMX_EventError:
     {
-      GstOMXMessage *msg;
+      GstOMXMessage msg;
 
       /* Yes, this really happens... */
       if (nData1 == OMX_ErrorNone)
         break;
 
-      msg = g_slice_new (GstOMXMessage);
-
-      msg->type = GST_OMX_MESSAGE_ERROR;
-      msg->content.error.error = nData1;
+      msg.type = GST_OMX_MESSAGE_ERROR;
+      msg.content.error.error = nData1;
       GST_ERROR_OBJECT (comp->parent, "Got error: %s (0x%08x)",
-          gst_omx_error_to_string (msg->content.error.error),
-          msg->content.error.error);
+          gst_omx_error_to_string (msg.content.error.error),
+          msg.content.error.error);
 
-      g_mutex_lock (comp->messages_lock);
-      g_queue_push_tail (&comp->messages, msg);
-      g_cond_broadcast (comp->messages_cond);
-      g_mutex_unlock (comp->messages_lock);
+      gst_omx_component_send_message (comp, &msg);
       break;
     }
     case OMX_EventPortSettingsChanged:
     {
-      GstOMXMessage *msg = g_slice_new (GstOMXMessage);
-      OMX_U32 index;
+      GstOMXMessage msg;
+      OMX_U32 index, param_index;
 
+      /* nData2 is the index of the changed parameter or
+       * config if the component sets it */
       if (!(comp->hacks &
               GST_OMX_HACK_EVENT_PORT_SETTINGS_CHANGED_NDATA_PARAMETER_SWAP)) {
         index = nData1;
+        param_index = nData2;
       } else {
         index = nData2;
+        param_index = nData1;
       }
 
 
@@ -529,15 +842,14 @@ EventHandler (OMX_HANDLETYPE hComponent, OMX_PTR pAppData, OMX_EVENTTYPE eEvent,
         index = 1;
 
 
-      msg->type = GST_OMX_MESSAGE_PORT_SETTINGS_CHANGED;
-      msg->content.port_settings_changed.port = index;
-      GST_DEBUG_OBJECT (comp->parent, "Settings changed (port index: %d)",
-          msg->content.port_settings_changed.port);
+      msg.type = GST_OMX_MESSAGE_PORT_SETTINGS_CHANGED;
+      msg.content.port_settings_changed.port = index;
+      msg.content.port_settings_changed.index = (OMX_INDEXTYPE) param_index;
+      GST_DEBUG_OBJECT (comp->parent,
+          "Settings changed (port index: %d, parameter: 0x%08x)",
+          msg.content.port_settings_changed.port, param_index);
 
-      g_mutex_lock (comp->messages_lock);
-      g_queue_push_tail (&comp->messages, msg);
-      g_cond_broadcast (comp->messages_cond);
-      g_mutex_unlock (comp->messages_lock);
+      gst_omx_component_send_message (comp, &msg);
 
       break;
     }
@@ -550,13 +862,27 @@ EventHandler (OMX_HANDLETYPE hComponent, OMX_PTR pAppData, OMX_EVENTTYPE eEvent,
   return OMX_ErrorNone;
 }
 
+/* Buffers don't go through the component's message queue but
+ * directly to their port, so that only the thread waiting on
+ * this port is woken up */
+static void
+gst_omx_port_buffer_done (GstOMXBuffer * buf)
+{
+  GstOMXPort *port = buf->port;
+
+  /* Can't fail, the ring has space for all buffers of the port */
+  if (G_UNLIKELY (!gst_omx_ring_push (port->messages, &buf)))
+    g_assert_not_reached ();
+
+  gst_omx_port_wake (port);
+}
+
 static OMX_ERRORTYPE
 EmptyBufferDone (OMX_HANDLETYPE hComponent, OMX_PTR pAppData,
     OMX_BUFFERHEADERTYPE * pBuffer)
 {
   GstOMXBuffer *buf;
   GstOMXComponent *comp;
-  GstOMXMessage *msg;
 
   buf = pBuffer->pAppPrivate;
   if (!buf) {
@@ -568,20 +894,12 @@ EmptyBufferDone (OMX_HANDLETYPE hComponent, OMX_PTR pAppData,
 
   comp = buf->port->comp;
 
-  msg = g_slice_new (GstOMXMessage);
-  msg->type = GST_OMX_MESSAGE_BUFFER_DONE;
-  msg->content.buffer_done.component = hComponent;
-  msg->content.buffer_done.app_data = pAppData;
-  msg->content.buffer_done.buffer = pBuffer;
-  msg->content.buffer_done.empty = OMX_TRUE;
-
   GST_DEBUG_OBJECT (comp->parent, "Port %u emptied buffer %p (%p)",
       buf->port->index, buf, buf->omx_buf->pBuffer);
+  GST_OMX_TRACE_INSTANT (comp->trace, GST_OMX_TRACE_EMPTY_BUFFER_DONE,
+      buf->port->index, buf, 0);
 
-  g_mutex_lock (comp->messages_lock);
-  g_queue_push_tail (&comp->messages, msg);
-  g_cond_broadcast (comp->messages_cond);
-  g_mutex_unlock (comp->messages_lock);
+  gst_omx_port_buffer_done (buf);
 
   return OMX_ErrorNone;
 }
@@ -592,7 +910,6 @@ FillBufferDone (OMX_HANDLETYPE hComponent, OMX_PTR pAppData,
 {
   GstOMXBuffer *buf;
   GstOMXComponent *comp;
-  GstOMXMessage *msg;
 
   buf = pBuffer->pAppPrivate;
   if (!buf) {
@@ -604,20 +921,12 @@ FillBufferDone (OMX_HANDLETYPE hComponent, OMX_PTR pAppData,
 
   comp = buf->port->comp;
 
-  msg = g_slice_new (GstOMXMessage);
-  msg->type = GST_OMX_MESSAGE_BUFFER_DONE;
-  msg->content.buffer_done.component = hComponent;
-  msg->content.buffer_done.app_data = pAppData;
-  msg->content.buffer_done.buffer = pBuffer;
-  msg->content.buffer_done.empty = OMX_FALSE;
-
   GST_DEBUG_OBJECT (comp->parent, "Port %u filled buffer %p (%p)",
       buf->port->index, buf, buf->omx_buf->pBuffer);
+  GST_OMX_TRACE_INSTANT (comp->trace, GST_OMX_TRACE_FILL_BUFFER_DONE,
+      buf->port->index, buf, buf->omx_buf->nFilledLen);
 
-  g_mutex_lock (comp->messages_lock);
-  g_queue_push_tail (&comp->messages, msg);
-  g_cond_broadcast (comp->messages_cond);
-  g_mutex_unlock (comp->messages_lock);
+  gst_omx_port_buffer_done (buf);
 
   return OMX_ErrorNone;
 }
@@ -625,6 +934,54 @@ FillBufferDone (OMX_HANDLETYPE hComponent, OMX_PTR pAppData,
 static OMX_CALLBACKTYPE callbacks =
     { EventHandler, EmptyBufferDone, FillBufferDone };
 
+/* Number of component events that can be queued in addition to one
+ * for every buffer of the component. Events are handled whenever a
+ * buffer is acquired or released, so usually only a handful are
+ * queued, but some components post an event for every buffer */
+#define GST_OMX_MESSAGE_QUEUE_HEADROOM 32
+
+static GstOMXComponent *
+gst_omx_component_pool_take (const gchar * key)
+{
+  GstOMXComponent *comp = NULL;
+  GQueue *pool;
+
+  G_LOCK (component_pool);
+  if (component_pool && (pool = g_hash_table_lookup (component_pool, key)))
+    comp = g_queue_pop_head (pool);
+  G_UNLOCK (component_pool);
+
+  return comp;
+}
+
+/* Returns TRUE if any component was freed */
+static gboolean
+gst_omx_component_pool_clear (void)
+{
+  GstOMXComponent *comp;
+  GHashTableIter iter;
+  GQueue *pool, comps = G_QUEUE_INIT;
+
+  G_LOCK (component_pool);
+  if (component_pool) {
+    g_hash_table_iter_init (&iter, component_pool);
+    while (g_hash_table_iter_next (&iter, NULL, (gpointer *) & pool)) {
+      while ((comp = g_queue_pop_head (pool)))
+        g_queue_push_tail (&comps, comp);
+    }
+  }
+  G_UNLOCK (component_pool);
+
+  if (comps.length == 0)
+    return FALSE;
+
+  GST_DEBUG ("Freeing %u pooled components", comps.length);
+  while ((comp = g_queue_pop_head (&comps)))
+    gst_omx_component_free (comp);
+
+  return TRUE;
+}
+
 /* NOTE: Uses comp->lock and comp->messages_lock */
 GstOMXComponent *
 gst_omx_component_new (GstObject * parent, const gchar * core_name,
@@ -633,11 +990,28 @@ gst_omx_component_new (GstObject * parent, const gchar * core_name,
   OMX_ERRORTYPE err;
   GstOMXCore *core;
   GstOMXComponent *comp;
+  gchar *pool_key;
+
+  pool_key =
+      g_strdup_printf ("%s:%s:%s:%" G_GINT64_MODIFIER "x", core_name,
+      component_name, GST_STR_NULL (component_role), hacks);
+
+  comp = gst_omx_component_pool_take (pool_key);
+  if (comp) {
+    GST_DEBUG_OBJECT (parent, "Reusing pooled component handle %p (%s)",
+        comp->handle, component_name);
+    comp->parent = gst_object_ref (parent);
+    if (comp->trace)
+      gst_omx_trace_set_owner (comp->trace, parent);
+    g_free (pool_key);
+    return comp;
+  }
 
   if (hacks & GST_OMX_HACK_HYBRIS) {
 #ifndef HAVE_HYBRIS
     GST_ERROR_OBJECT (parent,
         "hybris hack enabled but hybris support has not been compiled in");
+    g_free (pool_key);
     return NULL;
 #else
     core = gst_omx_core_acquire_hybris (core_name);
@@ -645,8 +1019,10 @@ gst_omx_component_new (GstObject * parent, const gchar * core_name,
   } else
     core = gst_omx_core_acquire (core_name);
 
-  if (!core)
+  if (!core) {
+    g_free (pool_key);
     return NULL;
+  }
 
   comp = g_slice_new0 (GstOMXComponent);
   comp->core = core;
@@ -654,12 +1030,18 @@ gst_omx_component_new (GstObject * parent, const gchar * core_name,
   err =
       core->get_handle (&comp->handle, (OMX_STRING) component_name, comp,
       &callbacks);
+  /* Pooled components might hold the resources we need */
+  if (err == OMX_ErrorInsufficientResources && gst_omx_component_pool_clear ())
+    err =
+        core->get_handle (&comp->handle, (OMX_STRING) component_name, comp,
+        &callbacks);
   if (err != OMX_ErrorNone) {
     GST_ERROR_OBJECT (parent,
         "Failed to get component handle '%s' from core '%s': 0x%08x",
         component_name, core_name, err);
     gst_omx_core_release (core);
     g_slice_free (GstOMXComponent, comp);
+    g_free (pool_key);
     return NULL;
   }
   GST_DEBUG_OBJECT (parent,
@@ -667,6 +1049,12 @@ gst_omx_component_new (GstObject * parent, const gchar * core_name,
       component_name, core_name);
   comp->parent = gst_object_ref (parent);
   comp->hacks = hacks;
+  comp->pool_key = pool_key;
+  comp->reusable = TRUE;
+
+  comp->trace = gst_omx_trace_new (component_name);
+  if (comp->trace)
+    gst_omx_trace_set_owner (comp->trace, parent);
 
   comp->ports = g_ptr_array_new ();
   comp->n_in_ports = 0;
@@ -678,7 +1066,9 @@ gst_omx_component_new (GstObject * parent, const gchar * core_name,
 
   g_mutex_init (&comp->resurrection_lock);
 
-  g_queue_init (&comp->messages);
+  comp->messages =
+      gst_omx_ring_new (GST_OMX_MESSAGE_QUEUE_HEADROOM,
+      sizeof (GstOMXMessage));
   comp->pending_state = OMX_StateInvalid;
   comp->last_error = OMX_ErrorNone;
 
@@ -721,27 +1111,43 @@ gst_omx_component_new (GstObject * parent, const gchar * core_name,
   return comp;
 }
 
-/* NOTE: Uses comp->messages_lock */
-void
-gst_omx_component_free (GstOMXComponent * comp)
+/* NOTE: Uses comp->messages_lock and the ports' locks */
+static void
+gst_omx_component_free_ports (GstOMXComponent * comp)
 {
   gint i, n;
 
+  n = comp->ports->len;
+  for (i = 0; i < n; i++) {
+    GstOMXPort *port = g_ptr_array_index (comp->ports, i);
+
+    gst_omx_port_deallocate_buffers (port);
+    g_assert (port->buffers == NULL);
+    g_assert (g_queue_get_length (&port->pending_buffers) == 0);
+
+    gst_omx_port_flush_messages (port);
+    gst_omx_ring_free (port->messages);
+    g_cond_free (port->messages_cond);
+    g_mutex_free (port->messages_lock);
+    g_mutex_free (port->lock);
+
+    g_slice_free (GstOMXPort, port);
+  }
+  g_ptr_array_set_size (comp->ports, 0);
+  comp->n_in_ports = 0;
+  comp->n_out_ports = 0;
+}
+
+/* NOTE: Uses comp->messages_lock and the ports' locks */
+void
+gst_omx_component_free (GstOMXComponent * comp)
+{
   g_return_if_fail (comp != NULL);
 
   GST_DEBUG_OBJECT (comp->parent, "Unloading component %p", comp);
 
   if (comp->ports) {
-    n = comp->ports->len;
-    for (i = 0; i < n; i++) {
-      GstOMXPort *port = g_ptr_array_index (comp->ports, i);
-
-      gst_omx_port_deallocate_buffers (port);
-      g_assert (port->buffers == NULL);
-      g_assert (g_queue_get_length (&port->pending_buffers) == 0);
-
-      g_slice_free (GstOMXPort, port);
-    }
+    gst_omx_component_free_ports (comp);
 #if GLIB_CHECK_VERSION(2,22,0)
     g_ptr_array_unref (comp->ports);
 #else
@@ -754,6 +1160,7 @@ gst_omx_component_free (GstOMXComponent * comp)
   gst_omx_core_release (comp->core);
 
   gst_omx_component_flush_messages (comp);
+  gst_omx_ring_free (comp->messages);
 
   g_mutex_clear (&comp->resurrection_lock);
 
@@ -761,24 +1168,107 @@ gst_omx_component_free (GstOMXComponent * comp)
   g_mutex_free (comp->messages_lock);
   g_mutex_free (comp->lock);
 
-  gst_object_unref (comp->parent);
+  if (comp->parent)
+    gst_object_unref (comp->parent);
 
   if (comp->gralloc) {
     gst_gralloc_unref (comp->gralloc);
   }
 
+  if (comp->trace)
+    gst_omx_trace_free (comp->trace);
+
+  g_free (comp->pool_key);
   g_slice_free (GstOMXComponent, comp);
 }
 
+/* Like gst_omx_component_free(), but keeps the component for the next
+ * gst_omx_component_new() with the same core, component name, role and
+ * hacks if it is back in the Loaded state without errors.
+ *
+ * NOTE: Uses comp->lock, comp->messages_lock and the ports' locks */
+void
+gst_omx_component_release (GstOMXComponent * comp)
+{
+  GQueue *pool;
+  gboolean reuse;
+  guint i;
+
+  g_return_if_fail (comp != NULL);
+
+  g_mutex_lock (comp->lock);
+  gst_omx_component_handle_messages (comp);
+  reuse = comp->reusable && comp->state == OMX_StateLoaded
+      && comp->pending_state == OMX_StateInvalid
+      && comp->last_error == OMX_ErrorNone;
+  g_mutex_unlock (comp->lock);
+
+  /* Native buffers keep references to the parent */
+  if (!reuse || component_pool_size == 0 || (comp->hacks &
+          (GST_OMX_HACK_NO_COMPONENT_POOL |
+              GST_OMX_HACK_NO_COMPONENT_RECONFIGURE |
+              GST_OMX_HACK_ANDROID_BUFFERS)))
+    goto free;
+
+  /* The next user expects all ports to be enabled */
+  for (i = 0; i < comp->ports->len; i++) {
+    if (!gst_omx_port_is_enabled (g_ptr_array_index (comp->ports, i)))
+      goto free;
+  }
+
+  gst_omx_component_free_ports (comp);
+
+  GST_DEBUG_OBJECT (comp->parent, "Releasing component %p to the pool", comp);
+  gst_omx_component_dump_trace (comp);
+  gst_object_unref (comp->parent);
+  comp->parent = NULL;
+
+  G_LOCK (component_pool);
+  if (!component_pool)
+    component_pool =
+        g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+  pool = g_hash_table_lookup (component_pool, comp->pool_key);
+  if (!pool) {
+    pool = g_queue_new ();
+    g_hash_table_insert (component_pool, g_strdup (comp->pool_key), pool);
+  }
+
+  if (pool->length < component_pool_size) {
+    g_queue_push_tail (pool, comp);
+    comp = NULL;
+  }
+  G_UNLOCK (component_pool);
+
+  if (!comp)
+    return;
+
+free:
+  gst_omx_component_free (comp);
+}
+
+/* Writes the events traced since the last dump to the trace file,
+ * does nothing if tracing is disabled. See gstomxtrace.c */
+void
+gst_omx_component_dump_trace (GstOMXComponent * comp)
+{
+  g_return_if_fail (comp != NULL);
+
+  if (comp->trace)
+    gst_omx_trace_dump (comp->trace);
+}
+
 /* NOTE: Uses comp->lock and comp->messages_lock */
 OMX_ERRORTYPE
 gst_omx_component_set_state (GstOMXComponent * comp, OMX_STATETYPE state)
 {
   OMX_STATETYPE old_state;
   OMX_ERRORTYPE err = OMX_ErrorNone;
+  gint64 start;
 
   g_return_val_if_fail (comp != NULL, OMX_ErrorUndefined);
 
+  start = GST_OMX_TRACE_START (comp->trace);
   g_mutex_lock (comp->lock);
 
   gst_omx_component_handle_messages (comp);
@@ -806,9 +1296,7 @@ gst_omx_component_set_state (GstOMXComponent * comp, OMX_STATETYPE state)
     g_list_free (comp->pending_reconfigure_outports);
     comp->pending_reconfigure_outports = NULL;
     /* Notify all inports that are still waiting */
-    g_mutex_lock (comp->messages_lock);
-    g_cond_broadcast (comp->messages_cond);
-    g_mutex_unlock (comp->messages_lock);
+    gst_omx_component_wake_ports (comp);
   }
 
   err = OMX_SendCommand (comp->handle, OMX_CommandStateSet, state, NULL);
@@ -818,6 +1306,9 @@ done:
   gst_omx_component_handle_messages (comp);
   g_mutex_unlock (comp->lock);
 
+  GST_OMX_TRACE_CALL (comp->trace, GST_OMX_TRACE_SET_STATE, OMX_ALL, NULL,
+      state, start);
+
   if (err != OMX_ErrorNone) {
     GST_ERROR_OBJECT (comp->parent,
         "Error setting state from %d to %d: %s (0x%08x)", old_state, state,
@@ -832,7 +1323,7 @@ OMX_STATETYPE
 gst_omx_component_get_state (GstOMXComponent * comp, GstClockTime timeout)
 {
   OMX_STATETYPE ret;
-  GTimeVal *timeval, abstimeout;
+  gint64 deadline;
   gboolean signalled = TRUE;
 
   g_return_val_if_fail (comp != NULL, OMX_StateInvalid);
@@ -855,17 +1346,17 @@ gst_omx_component_get_state (GstOMXComponent * comp, GstClockTime timeout)
   }
 
   if (timeout != GST_CLOCK_TIME_NONE) {
-    glong add = timeout / (GST_SECOND / G_USEC_PER_SEC);
+    gint64 add = timeout / (GST_SECOND / G_TIME_SPAN_SECOND);
 
     if (add == 0)
       goto done;
 
-    g_get_current_time (&abstimeout);
-    g_time_val_add (&abstimeout, add);
-    timeval = &abstimeout;
-    GST_DEBUG_OBJECT (comp->parent, "Waiting for %ld us", add);
+    /* Monotonic, so that wall clock changes don't affect the timeout */
+    deadline = g_get_monotonic_time () + add;
+    GST_DEBUG_OBJECT (comp->parent, "Waiting for %" G_GINT64_FORMAT " us",
+        add);
   } else {
-    timeval = NULL;
+    deadline = -1;
     GST_DEBUG_OBJECT (comp->parent, "Waiting for signal");
   }
 
@@ -873,17 +1364,19 @@ gst_omx_component_get_state (GstOMXComponent * comp, GstClockTime timeout)
   while (signalled && comp->last_error == OMX_ErrorNone
       && comp->pending_state != OMX_StateInvalid) {
     g_mutex_lock (comp->messages_lock);
+    g_atomic_int_inc (&comp->messages_waiters);
     g_mutex_unlock (comp->lock);
-    if (!g_queue_is_empty (&comp->messages)) {
+    if (!gst_omx_ring_is_empty (comp->messages)) {
       signalled = TRUE;
-    }
-    if (timeval == NULL) {
+    } else if (deadline == -1) {
       g_cond_wait (comp->messages_cond, comp->messages_lock);
       signalled = TRUE;
     } else {
       signalled =
-          g_cond_timed_wait (comp->messages_cond, comp->messages_lock, timeval);
+          g_cond_wait_until (comp->messages_cond, comp->messages_lock,
+          deadline);
     }
+    g_atomic_int_add (&comp->messages_waiters, -1);
     g_mutex_unlock (comp->messages_lock);
     g_mutex_lock (comp->lock);
     if (signalled)
@@ -1048,12 +1541,20 @@ gst_omx_component_add_port (GstOMXComponent * comp, guint32 index)
 
   port->port_def = port_def;
 
+  port->lock = g_mutex_new ();
+  port->messages_lock = g_mutex_new ();
+  port->messages_cond = g_cond_new ();
+  port->messages =
+      gst_omx_ring_new (MAX (port_def.nBufferCountActual, 1),
+      sizeof (GstOMXBuffer *));
+
   g_queue_init (&port->pending_buffers);
   port->resurrection_cookie = 1;
   port->flushing = TRUE;
   port->flushed = FALSE;
   port->settings_changed = FALSE;
   port->enabled_changed = FALSE;
+  port->crop_changed = FALSE;
 
   if (port->port_def.eDir == OMX_DirInput)
     comp->n_in_ports++;
@@ -1101,7 +1602,7 @@ gst_omx_component_trigger_settings_changed (GstOMXComponent * comp,
   }
 }
 
-/* NOTE: Uses comp->lock and comp->messages_lock */
+/* NOTE: Uses comp->lock, comp->messages_lock and the ports' messages_lock */
 void
 gst_omx_component_set_last_error (GstOMXComponent * comp, OMX_ERRORTYPE err)
 {
@@ -1123,6 +1624,8 @@ gst_omx_component_set_last_error (GstOMXComponent * comp, OMX_ERRORTYPE err)
   g_mutex_lock (comp->messages_lock);
   g_cond_broadcast (comp->messages_cond);
   g_mutex_unlock (comp->messages_lock);
+
+  gst_omx_component_wake_ports (comp);
 }
 
 /* NOTE: Uses comp->lock and comp->messages_lock */
@@ -1267,14 +1770,81 @@ gst_omx_port_update_port_definition (GstOMXPort * port,
   return (err == OMX_ErrorNone);
 }
 
-/* NOTE: Uses comp->lock and comp->messages_lock */
-GstOMXAcquireBufferReturn
-gst_omx_port_acquire_buffer (GstOMXPort * port, GstOMXBuffer ** buf)
+/* Gets the crop rectangle of an output port, the whole
+ * frame if the component doesn't know it */
+static void
+gst_omx_port_get_crop (GstOMXPort * port, OMX_CONFIG_RECTTYPE * rect)
+{
+  OMX_ERRORTYPE err;
+
+  GST_OMX_INIT_STRUCT (rect);
+  rect->nPortIndex = port->index;
+
+  err = gst_omx_component_get_config (port->comp,
+      OMX_IndexConfigCommonOutputCrop, rect);
+  if (err != OMX_ErrorNone) {
+    rect->nLeft = 0;
+    rect->nTop = 0;
+    rect->nWidth = port->port_def.format.video.nFrameWidth;
+    rect->nHeight = port->port_def.format.video.nFrameHeight;
+  }
+
+  GST_INFO_OBJECT (port->comp->parent, "crop rectangle: %dx%d, %dx%d",
+      rect->nLeft, rect->nTop, rect->nWidth, rect->nHeight);
+}
+
+static GstStructure *
+gst_omx_crop_structure_new (const OMX_CONFIG_RECTTYPE * rect)
+{
+  return gst_structure_new (GST_OMX_CROP_QDATA,
+      "left", G_TYPE_INT, rect->nLeft,
+      "top", G_TYPE_INT, rect->nTop,
+      "right", G_TYPE_INT, rect->nLeft + rect->nWidth,
+      "bottom", G_TYPE_INT, rect->nTop + rect->nHeight, NULL);
+}
+
+/* Android native buffers carry the crop rectangle of the port when they
+ * were allocated. With adaptive playback the crop rectangle changes
+ * while the buffers are reused, so update it before passing them on.
+ *
+ * NOTE: Call with port->lock, the buffer must not be used downstream */
+static void
+gst_omx_port_update_buffer_crop (GstOMXPort * port, GstOMXBuffer * buf)
+{
+  GstBuffer *buffer = GST_BUFFER (buf->native_buffer);
+  GQuark quark = g_quark_from_string (GST_OMX_CROP_QDATA);
+  const GstStructure *crop;
+  gint left, top, right, bottom;
+
+  crop = gst_buffer_get_qdata (buffer, quark);
+  if (crop && gst_structure_get_int (crop, "left", &left)
+      && gst_structure_get_int (crop, "top", &top)
+      && gst_structure_get_int (crop, "right", &right)
+      && gst_structure_get_int (crop, "bottom", &bottom)
+      && left == port->crop.nLeft && top == port->crop.nTop
+      && right == port->crop.nLeft + port->crop.nWidth
+      && bottom == port->crop.nTop + port->crop.nHeight)
+    return;
+
+  if (!gst_buffer_is_metadata_writable (buffer)) {
+    GST_WARNING_OBJECT (port->comp->parent,
+        "Can't update crop rectangle of buffer %p", buf);
+    return;
+  }
+
+  gst_buffer_set_qdata (buffer, quark,
+      gst_omx_crop_structure_new (&port->crop));
+}
+
+/* NOTE: Uses port->lock, comp->lock and port->messages_lock */
+GstOMXAcquireBufferReturn
+gst_omx_port_acquire_buffer (GstOMXPort * port, GstOMXBuffer ** buf)
 {
   GstOMXAcquireBufferReturn ret = GST_OMX_ACQUIRE_BUFFER_ERROR;
   GstOMXComponent *comp;
   OMX_ERRORTYPE err;
   GstOMXBuffer *_buf = NULL;
+  gint64 start;
 
   g_return_val_if_fail (port != NULL, GST_OMX_ACQUIRE_BUFFER_ERROR);
   g_return_val_if_fail (buf != NULL, GST_OMX_ACQUIRE_BUFFER_ERROR);
@@ -1282,12 +1852,15 @@ gst_omx_port_acquire_buffer (GstOMXPort * port, GstOMXBuffer ** buf)
   *buf = NULL;
 
   comp = port->comp;
+  start = g_get_monotonic_time ();
 
+  g_mutex_lock (port->lock);
   g_mutex_lock (comp->lock);
   GST_DEBUG_OBJECT (comp->parent, "Acquiring buffer from port %u", port->index);
 
 retry:
   gst_omx_component_handle_messages (comp);
+  gst_omx_port_handle_messages (port);
 
   /* Check if the component is in an error state */
   if ((err = comp->last_error) != OMX_ErrorNone) {
@@ -1310,18 +1883,11 @@ retry:
    */
   if (port->port_def.eDir == OMX_DirInput) {
     if (g_atomic_int_get (&comp->have_pending_reconfigure_outports)) {
-      gst_omx_component_handle_messages (comp);
       while (g_atomic_int_get (&comp->have_pending_reconfigure_outports) &&
           (err = comp->last_error) == OMX_ErrorNone && !port->flushing) {
         GST_DEBUG_OBJECT (comp->parent,
             "Waiting for output ports to reconfigure");
-        g_mutex_lock (comp->messages_lock);
-        g_mutex_unlock (comp->lock);
-        if (g_queue_is_empty (&comp->messages))
-          g_cond_wait (comp->messages_cond, comp->messages_lock);
-        g_mutex_unlock (comp->messages_lock);
-        g_mutex_lock (comp->lock);
-        gst_omx_component_handle_messages (comp);
+        gst_omx_port_wait_messages (port, -1);
       }
       goto retry;
     }
@@ -1335,6 +1901,12 @@ retry:
     }
   }
 
+  /* Reconfigure with more buffers, see gst_omx_port_check_starved() */
+  if (G_UNLIKELY (port->adaptive_grow)) {
+    port->adaptive_grow = FALSE;
+    port->settings_cookie++;
+  }
+
   /* If we have an output port that needs to be reconfigured
    * and it still has buffers pending for the old configuration
    * we first return them.
@@ -1364,6 +1936,20 @@ retry:
     goto done;
   }
 
+  /* Only the crop rectangle changed, the new caps
+   * can be used with the current buffers */
+  if (port->crop_changed) {
+    GST_DEBUG_OBJECT (comp->parent, "Port %u has a new crop rectangle",
+        port->index);
+    port->crop_changed = FALSE;
+    gst_omx_component_get_parameter (comp, OMX_IndexParamPortDefinition,
+        &port->port_def);
+    if (comp->hacks & GST_OMX_HACK_ANDROID_BUFFERS)
+      gst_omx_port_get_crop (port, &port->crop);
+    port->stats.reconfigures++;
+    port->settings_changed = TRUE;
+  }
+
   if (port->settings_changed) {
     GST_DEBUG_OBJECT (comp->parent,
         "Port %u has settings changed, need new caps", port->index);
@@ -1382,16 +1968,9 @@ retry:
    * arrives, an error happens, the port is flushing
    * or the port needs to be reconfigured.
    */
-  gst_omx_component_handle_messages (comp);
   if (g_queue_is_empty (&port->pending_buffers)) {
     GST_DEBUG_OBJECT (comp->parent, "Queue of port %u is empty", port->index);
-    g_mutex_lock (comp->messages_lock);
-    g_mutex_unlock (comp->lock);
-    if (g_queue_is_empty (&comp->messages))
-      g_cond_wait (comp->messages_cond, comp->messages_lock);
-    g_mutex_unlock (comp->messages_lock);
-    g_mutex_lock (comp->lock);
-    gst_omx_component_handle_messages (comp);
+    gst_omx_port_wait_messages (port, -1);
 
     /* And now check everything again and maybe get a buffer */
     goto retry;
@@ -1407,11 +1986,16 @@ retry:
 
 done:
   if (_buf && _buf->native_buffer) {
+    if (port->max_width)
+      gst_omx_port_update_buffer_crop (port, _buf);
     gst_buffer_ref (GST_BUFFER (_buf->native_buffer));
     gst_object_ref (comp->parent);
   }
 
+  port->stats.acquire_time += g_get_monotonic_time () - start;
+
   g_mutex_unlock (comp->lock);
+  g_mutex_unlock (port->lock);
 
   if (_buf) {
     g_assert (_buf == _buf->omx_buf->pAppPrivate);
@@ -1420,24 +2004,31 @@ done:
 
   GST_DEBUG_OBJECT (comp->parent, "Acquired buffer %p (%p) from port %u: %d",
       _buf, (_buf ? _buf->omx_buf->pBuffer : NULL), port->index, ret);
+  GST_OMX_TRACE_CALL (comp->trace, GST_OMX_TRACE_ACQUIRE_BUFFER, port->index,
+      _buf, ret, start);
 
   return ret;
 }
 
-/* NOTE: Uses comp->lock and comp->messages_lock */
+/* NOTE: Uses port->lock, comp->lock and port->messages_lock.
+ * The buffer is passed to the component without holding comp->lock,
+ * so releasing buffers on one port doesn't block the other ports */
 OMX_ERRORTYPE
 gst_omx_port_release_buffer (GstOMXPort * port, GstOMXBuffer * buf)
 {
   GstOMXComponent *comp;
   GstNativeBuffer *native_buffer;
   OMX_ERRORTYPE err = OMX_ErrorNone;
+  gint64 start;
 
   g_return_val_if_fail (port != NULL, OMX_ErrorUndefined);
   g_return_val_if_fail (buf != NULL, OMX_ErrorUndefined);
   g_return_val_if_fail (buf->port == port, OMX_ErrorUndefined);
 
   comp = port->comp;
+  start = GST_OMX_TRACE_START (comp->trace);
 
+  g_mutex_lock (port->lock);
   g_mutex_lock (comp->lock);
 
   GST_DEBUG_OBJECT (comp->parent, "Releasing buffer %p (%p) to port %u",
@@ -1446,6 +2037,10 @@ gst_omx_port_release_buffer (GstOMXPort * port, GstOMXBuffer * buf)
   native_buffer = buf->native_buffer;
 
   gst_omx_component_handle_messages (comp);
+  err = comp->last_error;
+  g_mutex_unlock (comp->lock);
+
+  gst_omx_port_handle_messages (port);
 
 #if 0
   if (port->port_def.eDir == OMX_DirInput) {
@@ -1457,13 +2052,11 @@ gst_omx_port_release_buffer (GstOMXPort * port, GstOMXBuffer * buf)
   }
 #endif
 
-  if ((err = comp->last_error) != OMX_ErrorNone) {
+  if (err != OMX_ErrorNone) {
     GST_ERROR_OBJECT (comp->parent, "Component is in error state: %s (0x%08x)",
         gst_omx_error_to_string (err), err);
     g_queue_push_tail (&port->pending_buffers, buf);
-    g_mutex_lock (comp->messages_lock);
-    g_cond_broadcast (comp->messages_cond);
-    g_mutex_unlock (comp->messages_lock);
+    gst_omx_port_wake (port);
     goto done;
   }
 
@@ -1471,9 +2064,7 @@ gst_omx_port_release_buffer (GstOMXPort * port, GstOMXBuffer * buf)
     GST_DEBUG_OBJECT (comp->parent, "Port %u is flushing, not releasing buffer",
         port->index);
     g_queue_push_tail (&port->pending_buffers, buf);
-    g_mutex_lock (comp->messages_lock);
-    g_cond_broadcast (comp->messages_cond);
-    g_mutex_unlock (comp->messages_lock);
+    gst_omx_port_wake (port);
     goto done;
   }
 
@@ -1481,48 +2072,274 @@ gst_omx_port_release_buffer (GstOMXPort * port, GstOMXBuffer * buf)
 
   /* FIXME: What if the settings cookies don't match? */
 
-  buf->used = TRUE;
-
-  if (port->port_def.eDir == OMX_DirInput) {
-    err = OMX_EmptyThisBuffer (comp->handle, buf->omx_buf);
-  } else {
-    err = OMX_FillThisBuffer (comp->handle, buf->omx_buf);
+  if (port->port_def.eDir == OMX_DirOutput) {
+    /* Components propagate marks from the input buffers,
+     * don't keep the ones of the previous output around */
+    buf->omx_buf->hMarkTargetComponent = NULL;
+    buf->omx_buf->pMarkData = NULL;
+    gst_omx_port_check_starved (port);
   }
+
+  buf->used = TRUE;
+  err = gst_omx_port_pass_buffer (port, buf);
   GST_DEBUG_OBJECT (comp->parent, "Released buffer %p to port %u: %s (0x%08x)",
       buf, port->index, gst_omx_error_to_string (err), err);
 
 done:
-  gst_omx_component_handle_messages (comp);
-  g_mutex_unlock (comp->lock);
+  gst_omx_port_handle_messages (port);
+  g_mutex_unlock (port->lock);
 
   if (native_buffer) {
     gst_buffer_unref (GST_BUFFER (native_buffer));
     gst_object_unref (comp->parent);
   }
 
+  GST_OMX_TRACE_CALL (comp->trace, GST_OMX_TRACE_RELEASE_BUFFER, port->index,
+      buf, err, start);
+
   if (err != OMX_ErrorNone)
     gst_omx_component_set_last_error (comp, err);
 
   return err;
 }
 
-/* NOTE: Uses comp->lock and comp->messages_lock */
+/* Called when the last reference to a wrapped buffer is dropped.
+ * The port might be gone already, in which case the buffer was
+ * detached by gst_omx_port_deallocate_buffers_unlocked() and is
+ * freed here */
+static void
+gst_omx_buffer_unwrap (gpointer data)
+{
+  GstOMXBuffer *buf = data;
+  gboolean free_buf = FALSE;
+
+  G_LOCK (lent_buffers);
+  buf->lent = FALSE;
+  if (!buf->detached) {
+    GST_OMX_TRACE_INSTANT (buf->port->comp->trace,
+        GST_OMX_TRACE_UNWRAP_BUFFER, buf->port->index, buf, 0);
+    buf->port->lent_count--;
+    /* Return the buffer to the port like the callbacks do, it is
+     * passed to the component again by the next user of the port.
+     * Can't fail, the ring has space for all buffers */
+    buf->recycled = TRUE;
+    if (G_UNLIKELY (!gst_omx_ring_push (buf->port->messages, &buf)))
+      g_assert_not_reached ();
+    gst_omx_port_wake (buf->port);
+  } else if (!buf->omx_buf) {
+    free_buf = TRUE;
+  }
+  G_UNLOCK (lent_buffers);
+
+  if (free_buf) {
+    g_free (buf->memory);
+    g_slice_free (GstOMXBuffer, buf);
+  }
+}
+
+/* Wraps the memory of an acquired buffer in a GstBuffer without
+ * copying. The OMX buffer is owned by the GstBuffer afterwards and must
+ * not be released, it is returned to the port when the GstBuffer is
+ * freed or with gst_omx_port_reclaim_buffer(). Returns NULL if the port
+ * does not support this or is flushing, the buffer has to be copied
+ * and released as usual then.
+ *
+ * NOTE: Uses port->lock
+ */
+GstBuffer *
+gst_omx_port_wrap_buffer (GstOMXPort * port, GstOMXBuffer * buf)
+{
+  GstBuffer *outbuf;
+
+  g_return_val_if_fail (port != NULL, NULL);
+  g_return_val_if_fail (buf != NULL, NULL);
+  g_return_val_if_fail (buf->port == port, NULL);
+
+  if (!port->zero_copy || !buf->memory)
+    return NULL;
+
+  /* Buffers of a flushing port might be detached any moment */
+  g_mutex_lock (port->lock);
+  if (port->flushing) {
+    g_mutex_unlock (port->lock);
+    return NULL;
+  }
+
+  outbuf = gst_buffer_new ();
+  GST_BUFFER_DATA (outbuf) = buf->omx_buf->pBuffer + buf->omx_buf->nOffset;
+  GST_BUFFER_SIZE (outbuf) = buf->omx_buf->nFilledLen;
+  GST_BUFFER_MALLOCDATA (outbuf) = (guint8 *) buf;
+  GST_BUFFER_FREE_FUNC (outbuf) = gst_omx_buffer_unwrap;
+
+  G_LOCK (lent_buffers);
+  buf->lent = TRUE;
+  port->lent_count++;
+  G_UNLOCK (lent_buffers);
+  g_mutex_unlock (port->lock);
+
+  GST_OMX_TRACE_INSTANT (port->comp->trace, GST_OMX_TRACE_WRAP_BUFFER,
+      port->index, buf, 0);
+
+  GST_DEBUG_OBJECT (port->comp->parent, "Wrapped buffer %p (%p) of port %u",
+      buf, buf->omx_buf->pBuffer, port->index);
+
+  return outbuf;
+}
+
+/* Takes the OMX buffer back from a GstBuffer that was created by
+ * gst_omx_port_wrap_buffer() for this port, e.g. after upstream wrote
+ * into an input buffer. nOffset and nFilledLen are set to the data of
+ * the GstBuffer, which must not be used anymore afterwards. Returns NULL
+ * if the GstBuffer does not wrap a buffer of the port or is shared.
+ *
+ * NOTE: Uses port->lock
+ */
+GstOMXBuffer *
+gst_omx_port_reclaim_buffer (GstOMXPort * port, GstBuffer * buffer)
+{
+  GstOMXBuffer *buf;
+  OMX_BUFFERHEADERTYPE *omx_buf;
+
+  g_return_val_if_fail (port != NULL, NULL);
+  g_return_val_if_fail (buffer != NULL, NULL);
+
+  if (GST_BUFFER_FREE_FUNC (buffer) != gst_omx_buffer_unwrap
+      || GST_MINI_OBJECT_REFCOUNT_VALUE (buffer) != 1)
+    return NULL;
+
+  buf = (GstOMXBuffer *) GST_BUFFER_MALLOCDATA (buffer);
+  if (buf->port != port)
+    return NULL;
+
+  g_mutex_lock (port->lock);
+  G_LOCK (lent_buffers);
+  if (buf->detached || !buf->omx_buf) {
+    G_UNLOCK (lent_buffers);
+    g_mutex_unlock (port->lock);
+    return NULL;
+  }
+
+  /* Upstream might have changed the data and size but must stay
+   * inside of the buffer */
+  omx_buf = buf->omx_buf;
+  if (GST_BUFFER_DATA (buffer) < omx_buf->pBuffer
+      || GST_BUFFER_DATA (buffer) + GST_BUFFER_SIZE (buffer) >
+      omx_buf->pBuffer + omx_buf->nAllocLen) {
+    G_UNLOCK (lent_buffers);
+    g_mutex_unlock (port->lock);
+    return NULL;
+  }
+
+  buf->lent = FALSE;
+  port->lent_count--;
+  G_UNLOCK (lent_buffers);
+
+  omx_buf->nOffset = GST_BUFFER_DATA (buffer) - omx_buf->pBuffer;
+  omx_buf->nFilledLen = GST_BUFFER_SIZE (buffer);
+  GST_BUFFER_MALLOCDATA (buffer) = NULL;
+  GST_BUFFER_FREE_FUNC (buffer) = NULL;
+  g_mutex_unlock (port->lock);
+
+  GST_DEBUG_OBJECT (port->comp->parent, "Reclaimed buffer %p (%p) of port %u",
+      buf, omx_buf->pBuffer, port->index);
+  GST_OMX_TRACE_INSTANT (port->comp->trace, GST_OMX_TRACE_UNWRAP_BUFFER,
+      port->index, buf, 0);
+
+  return buf;
+}
+
+/* Returns the number of buffers of the port that are wrapped
+ * by gst_omx_port_wrap_buffer() and not returned yet */
+gint
+gst_omx_port_get_lent_count (GstOMXPort * port)
+{
+  gint lent_count;
+
+  g_return_val_if_fail (port != NULL, 0);
+
+  G_LOCK (lent_buffers);
+  lent_count = port->lent_count;
+  G_UNLOCK (lent_buffers);
+
+  return lent_count;
+}
+
+/* Passes all pending output buffers to the component in one batch,
+ * after the port stopped flushing
+ *
+ * NOTE: Call with port->lock and comp->lock */
+static OMX_ERRORTYPE
+gst_omx_port_fill_pending_unlocked (GstOMXPort * port)
+{
+  GstOMXComponent *comp = port->comp;
+  OMX_ERRORTYPE err = OMX_ErrorNone;
+  GstOMXBuffer *buf;
+  GQueue *pending;
+
+  if (port->port_def.eDir != OMX_DirOutput || !port->buffers)
+    return OMX_ErrorNone;
+
+  pending = g_queue_copy (&port->pending_buffers);
+  g_queue_clear (&port->pending_buffers);
+
+  /* Enqueue all buffers for the component to fill */
+  while ((buf = g_queue_pop_head (pending))) {
+    g_assert (!buf->used);
+
+    /* Reset all flags, some implementations don't
+     * reset them themselves and the flags are not
+     * valid anymore after the buffer was consumed
+     */
+    buf->omx_buf->nFlags = 0;
+    buf->omx_buf->hMarkTargetComponent = NULL;
+    buf->omx_buf->pMarkData = NULL;
+
+    buf->used = TRUE;
+    err = gst_omx_port_pass_buffer (port, buf);
+
+    if (err != OMX_ErrorNone) {
+      buf->used = FALSE;
+      g_queue_push_tail (&port->pending_buffers, buf);
+      /* Keep the remaining ones for the next try */
+      while ((buf = g_queue_pop_head (pending)))
+        g_queue_push_tail (&port->pending_buffers, buf);
+
+      GST_ERROR_OBJECT (comp->parent,
+          "Failed to pass buffer to port %u: %s (0x%08x)", port->index,
+          gst_omx_error_to_string (err), err);
+      break;
+    }
+    GST_DEBUG_OBJECT (comp->parent, "Passed buffer %p (%p) to component",
+        buf, buf->omx_buf->pBuffer);
+  }
+
+  g_queue_free (pending);
+
+  return err;
+}
+
+/* NOTE: Uses port->lock, comp->lock and port->messages_lock */
 OMX_ERRORTYPE
 gst_omx_port_set_flushing (GstOMXPort * port, gboolean flush)
 {
   GstOMXComponent *comp;
   OMX_ERRORTYPE err = OMX_ErrorNone;
+  gboolean changed = FALSE;
+  gint64 start;
 
   g_return_val_if_fail (port != NULL, OMX_ErrorUndefined);
 
   comp = port->comp;
+  start = g_get_monotonic_time ();
 
+  g_mutex_lock (port->lock);
   g_mutex_lock (comp->lock);
 
   GST_DEBUG_OBJECT (comp->parent, "Setting port %d to %sflushing",
       port->index, (flush ? "" : "not "));
 
   gst_omx_component_handle_messages (comp);
+  gst_omx_port_handle_messages (port);
 
   if (! !flush == ! !port->flushing) {
     GST_DEBUG_OBJECT (comp->parent, "Port %u was %sflushing already",
@@ -1546,14 +2363,13 @@ gst_omx_port_set_flushing (GstOMXPort * port, gboolean flush)
   }
 
   port->flushing = flush;
+  changed = TRUE;
   if (flush) {
-    GTimeVal abstimeout, *timeval;
+    gint64 deadline;
     gboolean signalled;
     OMX_ERRORTYPE last_error;
 
-    g_mutex_lock (comp->messages_lock);
-    g_cond_broadcast (comp->messages_cond);
-    g_mutex_unlock (comp->messages_lock);
+    gst_omx_port_wake (port);
 
     /* Now flush the port */
     port->flushed = FALSE;
@@ -1579,10 +2395,9 @@ gst_omx_port_set_flushing (GstOMXPort * port, gboolean flush)
       goto done;
     }
 
-    g_get_current_time (&abstimeout);
-    g_time_val_add (&abstimeout, 5 * G_USEC_PER_SEC);
-    timeval = &abstimeout;
-    GST_DEBUG_OBJECT (comp->parent, "Waiting for 5s");
+    deadline = g_get_monotonic_time () +
+        (gint64) flush_timeout * G_TIME_SPAN_MILLISECOND;
+    GST_DEBUG_OBJECT (comp->parent, "Waiting for %ums", flush_timeout);
 
     /* Retry until timeout or until an error happend or
      * until all buffers were released by the component and
@@ -1590,21 +2405,10 @@ gst_omx_port_set_flushing (GstOMXPort * port, gboolean flush)
     signalled = TRUE;
     last_error = OMX_ErrorNone;
     gst_omx_component_handle_messages (comp);
+    gst_omx_port_handle_messages (port);
     while (signalled && last_error == OMX_ErrorNone && !port->flushed
         && port->buffers->len > g_queue_get_length (&port->pending_buffers)) {
-      g_mutex_lock (comp->messages_lock);
-      g_mutex_unlock (comp->lock);
-      if (!g_queue_is_empty (&comp->messages))
-        signalled = TRUE;
-      else
-        signalled =
-            g_cond_timed_wait (comp->messages_cond, comp->messages_lock,
-            timeval);
-      g_mutex_unlock (comp->messages_lock);
-      g_mutex_lock (comp->lock);
-
-      if (signalled)
-        gst_omx_component_handle_messages (comp);
+      signalled = gst_omx_port_wait_messages (port, deadline);
 
       last_error = comp->last_error;
     }
@@ -1624,50 +2428,24 @@ gst_omx_port_set_flushing (GstOMXPort * port, gboolean flush)
       goto done;
     }
   } else {
-    if (port->port_def.eDir == OMX_DirOutput && port->buffers) {
-      GstOMXBuffer *buf;
-
-      GQueue *pending = g_queue_copy (&port->pending_buffers);
-      g_queue_clear (&port->pending_buffers);
-
-      /* Enqueue all buffers for the component to fill */
-      while ((buf = g_queue_pop_head (pending))) {
-        if (!buf)
-          continue;
-
-        g_assert (!buf->used);
-
-        /* Reset all flags, some implementations don't
-         * reset them themselves and the flags are not
-         * valid anymore after the buffer was consumed
-         */
-        buf->omx_buf->nFlags = 0;
-
-        err = OMX_FillThisBuffer (comp->handle, buf->omx_buf);
-
-        if (err != OMX_ErrorNone) {
-          buf->used = FALSE;
-          g_queue_push_tail (&port->pending_buffers, buf);
-
-          GST_ERROR_OBJECT (comp->parent,
-              "Failed to pass buffer %p (%p) to port %u: %s (0x%08x)", buf,
-              buf->omx_buf->pBuffer, port->index,
-              gst_omx_error_to_string (err), err);
-          goto error;
-        }
-        GST_DEBUG_OBJECT (comp->parent, "Passed buffer %p (%p) to component",
-            buf, buf->omx_buf->pBuffer);
-      }
-
-      g_queue_free (pending);
-    }
+    err = gst_omx_port_fill_pending_unlocked (port);
+    if (err != OMX_ErrorNone)
+      goto error;
   }
 
 done:
   GST_DEBUG_OBJECT (comp->parent, "Set port %u to %sflushing: %s (0x%08x)",
       port->index, (flush ? "" : "not "), gst_omx_error_to_string (err), err);
   gst_omx_component_handle_messages (comp);
+  if (flush && changed) {
+    port->stats.flushes++;
+    port->stats.flush_time += g_get_monotonic_time () - start;
+  }
   g_mutex_unlock (comp->lock);
+  g_mutex_unlock (port->lock);
+
+  GST_OMX_TRACE_CALL (comp->trace, GST_OMX_TRACE_SET_FLUSHING, port->index,
+      NULL, flush, start);
 
   return err;
 
@@ -1680,7 +2458,7 @@ error:
   }
 }
 
-/* NOTE: Uses comp->lock and comp->messages_lock */
+/* NOTE: Uses port->lock */
 gboolean
 gst_omx_port_is_flushing (GstOMXPort * port)
 {
@@ -1691,10 +2469,9 @@ gst_omx_port_is_flushing (GstOMXPort * port)
 
   comp = port->comp;
 
-  g_mutex_lock (comp->lock);
-  gst_omx_component_handle_messages (port->comp);
+  g_mutex_lock (port->lock);
   flushing = port->flushing;
-  g_mutex_unlock (comp->lock);
+  g_mutex_unlock (port->lock);
 
   GST_DEBUG_OBJECT (comp->parent, "Port %u is flushing: %d", port->index,
       flushing);
@@ -1702,6 +2479,178 @@ gst_omx_port_is_flushing (GstOMXPort * port)
   return flushing;
 }
 
+/* Like gst_omx_port_wait_messages() but only releases comp->lock
+ * while waiting, and handles the messages of all ports afterwards.
+ *
+ * NOTE: Call with comp->lock and the port->lock of all ports */
+static gboolean
+gst_omx_component_wait_port_messages (GstOMXComponent * comp,
+    GstOMXPort * port, gint64 deadline)
+{
+  gboolean signalled = TRUE;
+  guint i;
+
+  g_mutex_lock (port->messages_lock);
+  g_atomic_int_inc (&port->messages_waiters);
+  g_mutex_unlock (comp->lock);
+
+  if (gst_omx_ring_is_empty (port->messages)
+      && gst_omx_ring_is_empty (comp->messages))
+    signalled = g_cond_wait_until (port->messages_cond, port->messages_lock,
+        deadline);
+
+  g_atomic_int_add (&port->messages_waiters, -1);
+  g_mutex_unlock (port->messages_lock);
+  g_mutex_lock (comp->lock);
+
+  gst_omx_component_handle_messages (comp);
+  for (i = 0; i < comp->ports->len; i++)
+    gst_omx_port_handle_messages (g_ptr_array_index (comp->ports, i));
+
+  return signalled;
+}
+
+/* Sets all ports of the component to flushing or not flushing. Unlike
+ * calling gst_omx_port_set_flushing() for every port, the flush
+ * commands are sent to all ports before waiting for any of them.
+ *
+ * NOTE: Uses the port->lock of all ports, comp->lock and the
+ * ports' messages_lock */
+OMX_ERRORTYPE
+gst_omx_component_set_flushing (GstOMXComponent * comp, gboolean flush)
+{
+  OMX_ERRORTYPE err = OMX_ErrorNone;
+  GstOMXPort *port;
+  GPtrArray *changed;
+  gboolean signalled = TRUE, set_error = FALSE;
+  gint64 start, deadline;
+  guint i, n;
+
+  g_return_val_if_fail (comp != NULL, OMX_ErrorUndefined);
+
+  start = g_get_monotonic_time ();
+  n = comp->ports ? comp->ports->len : 0;
+  changed = g_ptr_array_sized_new (n);
+
+  /* Always in the order of the ports array */
+  for (i = 0; i < n; i++) {
+    port = g_ptr_array_index (comp->ports, i);
+    g_mutex_lock (port->lock);
+  }
+  g_mutex_lock (comp->lock);
+
+  GST_DEBUG_OBJECT (comp->parent, "Setting all ports to %sflushing",
+      (flush ? "" : "not "));
+
+  gst_omx_component_handle_messages (comp);
+  for (i = 0; i < n; i++)
+    gst_omx_port_handle_messages (g_ptr_array_index (comp->ports, i));
+
+  if ((err = comp->last_error) != OMX_ErrorNone) {
+    GST_ERROR_OBJECT (comp->parent, "Component is in error state: %s (0x%08x)",
+        gst_omx_error_to_string (err), err);
+    goto done;
+  }
+
+  if (comp->state != OMX_StateIdle && comp->state != OMX_StateExecuting) {
+    GST_DEBUG_OBJECT (comp->parent, "Component is in wrong state: %d",
+        comp->state);
+    err = OMX_ErrorUndefined;
+    goto done;
+  }
+
+  for (i = 0; i < n; i++) {
+    port = g_ptr_array_index (comp->ports, i);
+
+    if (! !flush == ! !port->flushing)
+      continue;
+
+    port->flushing = flush;
+    g_ptr_array_add (changed, port);
+
+    if (!flush) {
+      err = gst_omx_port_fill_pending_unlocked (port);
+      if (err != OMX_ErrorNone) {
+        set_error = TRUE;
+        goto done;
+      }
+      continue;
+    }
+
+    gst_omx_port_wake (port);
+    port->flushed = FALSE;
+
+    err = OMX_SendCommand (comp->handle, OMX_CommandFlush, port->index, NULL);
+    if (err != OMX_ErrorNone) {
+      GST_ERROR_OBJECT (comp->parent,
+          "Error sending flush command to port %u: %s (0x%08x)", port->index,
+          gst_omx_error_to_string (err), err);
+      goto done;
+    }
+  }
+
+  if (!flush || changed->len == 0)
+    goto done;
+
+  deadline = g_get_monotonic_time () +
+      (gint64) flush_timeout * G_TIME_SPAN_MILLISECOND;
+  GST_DEBUG_OBJECT (comp->parent, "Waiting for %ums", flush_timeout);
+
+  /* Wait for the ports one after another, they are all flushed
+   * by the component in the meantime. A port is done once all
+   * buffers were released or the flush command completed */
+  while (signalled && (err = comp->last_error) == OMX_ErrorNone) {
+    port = NULL;
+    for (i = 0; i < changed->len; i++) {
+      GstOMXPort *p = g_ptr_array_index (changed, i);
+
+      if (!p->flushed && p->buffers
+          && p->buffers->len > g_queue_get_length (&p->pending_buffers)) {
+        port = p;
+        break;
+      }
+    }
+    if (!port)
+      break;
+
+    signalled = gst_omx_component_wait_port_messages (comp, port, deadline);
+  }
+
+  for (i = 0; i < changed->len; i++) {
+    port = g_ptr_array_index (changed, i);
+    port->flushed = FALSE;
+    port->stats.flushes++;
+    port->stats.flush_time += g_get_monotonic_time () - start;
+  }
+
+  if (err != OMX_ErrorNone) {
+    GST_ERROR_OBJECT (comp->parent, "Got error while flushing: %s (0x%08x)",
+        gst_omx_error_to_string (err), err);
+  } else if (!signalled) {
+    GST_ERROR_OBJECT (comp->parent, "Timeout while flushing");
+    err = OMX_ErrorTimeout;
+  }
+
+done:
+  GST_DEBUG_OBJECT (comp->parent, "Set all ports to %sflushing: %s (0x%08x)",
+      (flush ? "" : "not "), gst_omx_error_to_string (err), err);
+  gst_omx_component_handle_messages (comp);
+  g_mutex_unlock (comp->lock);
+  for (i = n; i > 0; i--) {
+    port = g_ptr_array_index (comp->ports, i - 1);
+    g_mutex_unlock (port->lock);
+  }
+  g_ptr_array_free (changed, TRUE);
+
+  GST_OMX_TRACE_CALL (comp->trace, GST_OMX_TRACE_SET_FLUSHING, OMX_ALL, NULL,
+      flush, start);
+
+  if (set_error)
+    gst_omx_component_set_last_error (comp, err);
+
+  return err;
+}
+
 static gboolean
 gst_omx_resurrect_buffer (void *data, GstNativeBuffer * buffer)
 {
@@ -1743,14 +2692,19 @@ gst_omx_resurrect_buffer (void *data, GstNativeBuffer * buffer)
   return resurrect;
 }
 
-/* NOTE: Must be called while holding comp->lock, uses comp->messages_lock */
+/* Number of output buffers that are allocated in addition to the
+ * minimum if they're passed downstream without copying */
+#define GST_OMX_ZERO_COPY_EXTRA_BUFFERS 2
+
+/* NOTE: Must be called while holding port->lock and comp->lock,
+ * uses comp->messages_lock and port->messages_lock */
 static OMX_ERRORTYPE
 gst_omx_port_allocate_buffers_unlocked (GstOMXPort * port)
 {
   GstOMXComponent *comp;
   OMX_ERRORTYPE err = OMX_ErrorNone;
+  guint total;
   gint i, n;
-  OMX_CONFIG_RECTTYPE rect;
 
   g_assert (!port->buffers || port->buffers->len == 0);
 
@@ -1789,34 +2743,86 @@ gst_omx_port_allocate_buffers_unlocked (GstOMXPort * port)
     goto error;
   }
 
+  /* Additional buffers requested by the element or added by the
+   * adaptive mode. Buffers that are passed downstream without copying
+   * are not available to the component until downstream is done with
+   * them, so allocate some more to not starve the component
+   */
+  n = port->port_def.nBufferCountMin + port->extra_buffers;
+  if (port->adaptive_buffers)
+    n += port->adaptive_extra_buffers;
+  if (port->zero_copy && port->port_def.eDir == OMX_DirOutput)
+    n += GST_OMX_ZERO_COPY_EXTRA_BUFFERS;
+
+  if (port->port_def.nBufferCountActual < (guint) n) {
+    OMX_ERRORTYPE tmp;
+
+    port->port_def.nBufferCountActual = n;
+    tmp = gst_omx_component_set_parameter (comp, OMX_IndexParamPortDefinition,
+        &port->port_def);
+    if (tmp != OMX_ErrorNone)
+      GST_WARNING_OBJECT (comp->parent,
+          "Failed to allocate additional buffers for port %u: %s (0x%08x)",
+          port->index, gst_omx_error_to_string (tmp), tmp);
+    gst_omx_component_get_parameter (comp, OMX_IndexParamPortDefinition,
+        &port->port_def);
+  }
+
+  /* Components can reject sizes below their minimum and
+   * will keep their own size then */
+  if (port->buffer_size && port->buffer_size != port->port_def.nBufferSize) {
+    OMX_ERRORTYPE tmp;
+
+    port->port_def.nBufferSize = port->buffer_size;
+    tmp = gst_omx_component_set_parameter (comp, OMX_IndexParamPortDefinition,
+        &port->port_def);
+    if (tmp != OMX_ErrorNone)
+      GST_WARNING_OBJECT (comp->parent,
+          "Failed to set buffer size %u for port %u: %s (0x%08x)",
+          port->buffer_size, port->index, gst_omx_error_to_string (tmp), tmp);
+    gst_omx_component_get_parameter (comp, OMX_IndexParamPortDefinition,
+        &port->port_def);
+  }
+
   n = port->port_def.nBufferCountActual;
   GST_DEBUG_OBJECT (comp->parent,
       "Allocating %d buffers of size %u for port %u", n,
       port->port_def.nBufferSize, port->index);
 
-  if (!port->buffers)
-    port->buffers = g_ptr_array_sized_new (n);
+  /* The callbacks must always be able to queue all buffers.
+   * No buffers are allocated at this point, so nobody else can
+   * use the old ring anymore except for waiters checking if
+   * it is empty */
+  if ((guint) n > port->messages->capacity) {
+    GstOMXRing *messages, *old_messages;
+
+    messages = gst_omx_ring_new (n, sizeof (GstOMXBuffer *));
+    g_mutex_lock (port->messages_lock);
+    old_messages = port->messages;
+    port->messages = messages;
+    g_mutex_unlock (port->messages_lock);
+    gst_omx_ring_free (old_messages);
+  }
 
-  if (port->port_def.eDir == OMX_DirOutput
-      && comp->hacks & GST_OMX_HACK_ANDROID_BUFFERS) {
+  /* Same for the component's events, which can come in bursts of
+   * one per buffer on all ports */
+  total = GST_OMX_MESSAGE_QUEUE_HEADROOM;
+  for (i = 0; i < (gint) comp->ports->len; i++) {
+    GstOMXPort *tmp = g_ptr_array_index (comp->ports, i);
 
-    /* Let's get the crop rect */
-    GST_OMX_INIT_STRUCT (&rect);
-    rect.nPortIndex = port->index;
+    total += tmp->port_def.nBufferCountActual;
+  }
+  gst_omx_component_ensure_messages_capacity (comp, total);
 
-    err =
-        gst_omx_component_get_config (comp, OMX_IndexConfigCommonOutputCrop,
-        &rect);
-    if (err != OMX_ErrorNone) {
-      rect.nLeft = 0;
-      rect.nTop = 0;
-      rect.nWidth = port->port_def.format.video.nFrameWidth;
-      rect.nHeight = port->port_def.format.video.nFrameHeight;
-    }
+  if (!port->buffers)
+    port->buffers = g_ptr_array_sized_new (n);
+  G_LOCK (lent_buffers);
+  port->lent_count = 0;
+  G_UNLOCK (lent_buffers);
 
-    GST_INFO_OBJECT (comp->parent, "crop rectangle: %dx%d, %dx%d", rect.nLeft,
-        rect.nTop, rect.nWidth, rect.nHeight);
-  }
+  if (port->port_def.eDir == OMX_DirOutput
+      && comp->hacks & GST_OMX_HACK_ANDROID_BUFFERS)
+    gst_omx_port_get_crop (port, &port->crop);
 
   for (i = 0; i < n; i++) {
     GstOMXBuffer *buf;
@@ -1834,11 +2840,7 @@ gst_omx_port_allocate_buffers_unlocked (GstOMXPort * port)
       int width = port->port_def.format.video.nFrameWidth;
       int height = port->port_def.format.video.nFrameHeight;
       int stride = 0;
-      GstStructure *crop = gst_structure_new (GST_OMX_CROP_QDATA,
-          "left", G_TYPE_INT, rect.nLeft,
-          "top", G_TYPE_INT, rect.nTop,
-          "right", G_TYPE_INT, rect.nLeft + rect.nWidth,
-          "bottom", G_TYPE_INT, rect.nTop + rect.nHeight, NULL);
+      GstStructure *crop = gst_omx_crop_structure_new (&port->crop);
 
       buf->android_handle =
           gst_gralloc_allocate (comp->gralloc, width, height, format,
@@ -1893,6 +2895,33 @@ gst_omx_port_allocate_buffers_unlocked (GstOMXPort * port)
           gst_structure_free (crop);
         }
       }
+    } else if (port->zero_copy) {
+      gsize align = MAX (port->port_def.nBufferAlignment, 1);
+      guint8 *data;
+
+      buf->memory = g_malloc (port->port_def.nBufferSize + align - 1);
+      data = buf->memory + (align - ((guintptr) buf->memory) % align) % align;
+
+      err =
+          OMX_UseBuffer (comp->handle, &buf->omx_buf, port->index, buf,
+          port->port_def.nBufferSize, data);
+
+      /* Fall back to copying if the component wants to
+       * allocate the buffers itself */
+      if (err != OMX_ErrorNone) {
+        g_free (buf->memory);
+        buf->memory = NULL;
+
+        if (i == 0) {
+          GST_INFO_OBJECT (comp->parent,
+              "Port %u does not support OMX_UseBuffer: %s (0x%08x)",
+              port->index, gst_omx_error_to_string (err), err);
+          port->zero_copy = FALSE;
+          err =
+              OMX_AllocateBuffer (comp->handle, &buf->omx_buf, port->index,
+              buf, port->port_def.nBufferSize);
+        }
+      }
     } else {
       err =
           OMX_AllocateBuffer (comp->handle, &buf->omx_buf, port->index, buf,
@@ -1933,7 +2962,7 @@ error:
   }
 }
 
-/* NOTE: Uses comp->lock and comp->messages_lock */
+/* NOTE: Uses port->lock, comp->lock and the messages_locks */
 OMX_ERRORTYPE
 gst_omx_port_allocate_buffers (GstOMXPort * port)
 {
@@ -1941,19 +2970,23 @@ gst_omx_port_allocate_buffers (GstOMXPort * port)
 
   g_return_val_if_fail (port != NULL, OMX_ErrorUndefined);
 
+  g_mutex_lock (port->lock);
   g_mutex_lock (port->comp->lock);
   err = gst_omx_port_allocate_buffers_unlocked (port);
   g_mutex_unlock (port->comp->lock);
+  g_mutex_unlock (port->lock);
 
   return err;
 }
 
-/* NOTE: Must be called while holding comp->lock, uses comp->messages_lock */
+/* NOTE: Must be called while holding port->lock and comp->lock,
+ * uses comp->messages_lock and port->messages_lock */
 static OMX_ERRORTYPE
 gst_omx_port_deallocate_buffers_unlocked (GstOMXPort * port)
 {
   GstOMXComponent *comp;
   OMX_ERRORTYPE err = OMX_ErrorNone;
+  gboolean lent;
   gint i, n;
 
   comp = port->comp;
@@ -1962,6 +2995,7 @@ gst_omx_port_deallocate_buffers_unlocked (GstOMXPort * port)
       port->index);
 
   gst_omx_component_handle_messages (port->comp);
+  gst_omx_port_handle_messages (port);
 
   if (!port->buffers) {
     GST_DEBUG_OBJECT (comp->parent, "No buffers allocated for port %u",
@@ -2001,7 +3035,6 @@ gst_omx_port_deallocate_buffers_unlocked (GstOMXPort * port)
           buf->omx_buf->pBuffer);
 
       tmp = OMX_FreeBuffer (comp->handle, port->index, buf->omx_buf);
-      buf->omx_buf = NULL;
 
       if (tmp != OMX_ErrorNone) {
         GST_ERROR_OBJECT (comp->parent,
@@ -2012,15 +3045,26 @@ gst_omx_port_deallocate_buffers_unlocked (GstOMXPort * port)
       }
     }
 
+    /* Buffers that are still used downstream are freed when
+     * downstream releases them */
+    G_LOCK (lent_buffers);
+    buf->omx_buf = NULL;
+    buf->detached = TRUE;
+    lent = buf->lent;
+    G_UNLOCK (lent_buffers);
+
     /* Free regular buffers now.  Native buffers are unreffed and will
      * free the GstOMXBuffer when their ref count reaches zero. */
     if (buf->native_buffer) {
       gst_buffer_unref (GST_BUFFER (buf->native_buffer));
-    } else {
+    } else if (!lent) {
+      g_free (buf->memory);
       g_slice_free (GstOMXBuffer, buf);
     }
   }
   g_queue_clear (&port->pending_buffers);
+  /* Recycled buffers might still be queued */
+  gst_omx_port_flush_messages (port);
 #if GLIB_CHECK_VERSION(2,22,0)
   g_ptr_array_unref (port->buffers);
 #else
@@ -2037,7 +3081,7 @@ done:
   return err;
 }
 
-/* NOTE: Uses comp->lock and comp->messages_lock */
+/* NOTE: Uses port->lock, comp->lock and the messages_locks */
 OMX_ERRORTYPE
 gst_omx_port_deallocate_buffers (GstOMXPort * port)
 {
@@ -2045,26 +3089,31 @@ gst_omx_port_deallocate_buffers (GstOMXPort * port)
 
   g_return_val_if_fail (port != NULL, OMX_ErrorUndefined);
 
+  g_mutex_lock (port->lock);
   g_mutex_lock (port->comp->lock);
   err = gst_omx_port_deallocate_buffers_unlocked (port);
   g_mutex_unlock (port->comp->lock);
+  g_mutex_unlock (port->lock);
 
   return err;
 }
 
-/* NOTE: Must be called while holding comp->lock, uses comp->messages_lock */
+/* NOTE: Must be called while holding port->lock and comp->lock,
+ * uses comp->messages_lock and port->messages_lock */
 static OMX_ERRORTYPE
 gst_omx_port_set_enabled_unlocked (GstOMXPort * port, gboolean enabled)
 {
   GstOMXComponent *comp;
   OMX_ERRORTYPE err = OMX_ErrorNone;
-  GTimeVal abstimeout, *timeval;
+  gint64 deadline, start;
   gboolean signalled;
   OMX_ERRORTYPE last_error;
 
   comp = port->comp;
+  start = GST_OMX_TRACE_START (comp->trace);
 
   gst_omx_component_handle_messages (comp);
+  gst_omx_port_handle_messages (port);
 
   if ((err = comp->last_error) != OMX_ErrorNone) {
     GST_ERROR_OBJECT (comp->parent, "Component in error state: %s (0x%08x)",
@@ -2088,6 +3137,7 @@ gst_omx_port_set_enabled_unlocked (GstOMXPort * port, gboolean enabled)
      * by the component and no new buffers should be passed to
      * the component anymore */
     port->flushing = TRUE;
+    gst_omx_port_wake (port);
   }
 
   if (enabled)
@@ -2129,6 +3179,15 @@ gst_omx_port_set_enabled_unlocked (GstOMXPort * port, gboolean enabled)
         gst_buffer_ref (GST_BUFFER (buf->native_buffer));
         g_queue_push_tail (&port->pending_buffers, buf);
       }
+
+      /* Same for buffers that are still used downstream, they are
+       * freed once downstream releases them */
+      G_LOCK (lent_buffers);
+      if (buf->lent && !buf->native_buffer) {
+        buf->detached = TRUE;
+        g_queue_push_tail (&port->pending_buffers, buf);
+      }
+      G_UNLOCK (lent_buffers);
     }
     // Increment the resurrection cookie, any buffers with the old
     // cookie will be deleted when their reference count reaches zero
@@ -2137,29 +3196,18 @@ gst_omx_port_set_enabled_unlocked (GstOMXPort * port, gboolean enabled)
     g_mutex_unlock (&comp->resurrection_lock);
   }
 
-  g_get_current_time (&abstimeout);
-  g_time_val_add (&abstimeout, 5 * G_USEC_PER_SEC);
-  timeval = &abstimeout;
+  deadline = g_get_monotonic_time () + 5 * G_TIME_SPAN_SECOND;
   GST_DEBUG_OBJECT (comp->parent, "Waiting for 5s");
 
   /* First wait until all buffers are released by the port */
   signalled = TRUE;
   last_error = OMX_ErrorNone;
   gst_omx_component_handle_messages (comp);
+  gst_omx_port_handle_messages (port);
   while (signalled && last_error == OMX_ErrorNone && (port->buffers
           && port->buffers->len >
           g_queue_get_length (&port->pending_buffers))) {
-    g_mutex_lock (comp->messages_lock);
-    g_mutex_unlock (comp->lock);
-    if (!g_queue_is_empty (&comp->messages))
-      signalled = TRUE;
-    else
-      signalled =
-          g_cond_timed_wait (comp->messages_cond, comp->messages_lock, timeval);
-    g_mutex_unlock (comp->messages_lock);
-    g_mutex_lock (comp->lock);
-    if (signalled)
-      gst_omx_component_handle_messages (comp);
+    signalled = gst_omx_port_wait_messages (port, deadline);
     last_error = comp->last_error;
   }
 
@@ -2199,17 +3247,7 @@ gst_omx_port_set_enabled_unlocked (GstOMXPort * port, gboolean enabled)
   gst_omx_component_handle_messages (comp);
   while (signalled && last_error == OMX_ErrorNone
       && (! !port->port_def.bEnabled != ! !enabled || !port->enabled_changed)) {
-    g_mutex_lock (comp->messages_lock);
-    g_mutex_unlock (comp->lock);
-    if (!g_queue_is_empty (&comp->messages))
-      signalled = TRUE;
-    else
-      signalled =
-          g_cond_timed_wait (comp->messages_cond, comp->messages_lock, timeval);
-    g_mutex_unlock (comp->messages_lock);
-    g_mutex_lock (comp->lock);
-    if (signalled)
-      gst_omx_component_handle_messages (comp);
+    signalled = gst_omx_port_wait_messages (port, deadline);
     last_error = comp->last_error;
     gst_omx_component_get_parameter (comp, OMX_IndexParamPortDefinition,
         &port->port_def);
@@ -2250,8 +3288,10 @@ gst_omx_port_set_enabled_unlocked (GstOMXPort * port, gboolean enabled)
          * valid anymore after the buffer was consumed
          */
         buf->omx_buf->nFlags = 0;
+        buf->omx_buf->hMarkTargetComponent = NULL;
+        buf->omx_buf->pMarkData = NULL;
 
-        err = OMX_FillThisBuffer (comp->handle, buf->omx_buf);
+        err = gst_omx_port_pass_buffer (port, buf);
 
         if (err != OMX_ErrorNone) {
           GST_ERROR_OBJECT (comp->parent,
@@ -2272,6 +3312,8 @@ done:
   GST_DEBUG_OBJECT (comp->parent, "Port %u is %s%s: %s (0x%08x)", port->index,
       (err == OMX_ErrorNone ? "" : "not "),
       (enabled ? "enabled" : "disabled"), gst_omx_error_to_string (err), err);
+  GST_OMX_TRACE_CALL (comp->trace, GST_OMX_TRACE_SET_ENABLED, port->index,
+      NULL, enabled, start);
 
   return err;
 
@@ -2284,7 +3326,7 @@ error:
   }
 }
 
-/* NOTE: Uses comp->lock and comp->messages_lock */
+/* NOTE: Uses port->lock, comp->lock and the messages_locks */
 OMX_ERRORTYPE
 gst_omx_port_set_enabled (GstOMXPort * port, gboolean enabled)
 {
@@ -2292,9 +3334,11 @@ gst_omx_port_set_enabled (GstOMXPort * port, gboolean enabled)
 
   g_return_val_if_fail (port != NULL, OMX_ErrorUndefined);
 
+  g_mutex_lock (port->lock);
   g_mutex_lock (port->comp->lock);
   err = gst_omx_port_set_enabled_unlocked (port, enabled);
   g_mutex_unlock (port->comp->lock);
+  g_mutex_unlock (port->lock);
 
   return err;
 }
@@ -2319,17 +3363,20 @@ gst_omx_port_is_enabled (GstOMXPort * port)
   return enabled;
 }
 
-/* NOTE: Uses comp->lock and comp->messages_lock */
+/* NOTE: Uses port->lock, comp->lock and the messages_locks */
 OMX_ERRORTYPE
 gst_omx_port_reconfigure (GstOMXPort * port)
 {
   GstOMXComponent *comp;
   OMX_ERRORTYPE err = OMX_ErrorNone;
+  gint64 start;
 
   g_return_val_if_fail (port != NULL, OMX_ErrorUndefined);
 
   comp = port->comp;
+  start = g_get_monotonic_time ();
 
+  g_mutex_lock (port->lock);
   g_mutex_lock (comp->lock);
   GST_DEBUG_OBJECT (comp->parent, "Reconfiguring port %u", port->index);
 
@@ -2353,6 +3400,8 @@ gst_omx_port_reconfigure (GstOMXPort * port)
     goto done;
 
   port->configured_settings_cookie = port->settings_cookie;
+  port->stats.reconfigures++;
+  port->stats.reconfigure_time += g_get_monotonic_time () - start;
 
   /* If this is an output port, notify all input ports
    * that might wait for us to reconfigure in
@@ -2370,9 +3419,7 @@ gst_omx_port_reconfigure (GstOMXPort * port)
     }
     if (!comp->pending_reconfigure_outports) {
       g_atomic_int_set (&comp->have_pending_reconfigure_outports, 0);
-      g_mutex_lock (comp->messages_lock);
-      g_cond_broadcast (comp->messages_cond);
-      g_mutex_unlock (comp->messages_lock);
+      gst_omx_component_wake_ports (comp);
     }
   }
 
@@ -2381,11 +3428,12 @@ done:
       port->index, gst_omx_error_to_string (err), err);
 
   g_mutex_unlock (comp->lock);
+  g_mutex_unlock (port->lock);
 
   return err;
 }
 
-/* NOTE: Uses comp->lock and comp->messages_lock */
+/* NOTE: Uses port->lock, comp->lock and the messages_locks */
 OMX_ERRORTYPE
 gst_omx_port_manual_reconfigure (GstOMXPort * port, gboolean start)
 {
@@ -2396,6 +3444,7 @@ gst_omx_port_manual_reconfigure (GstOMXPort * port, gboolean start)
 
   comp = port->comp;
 
+  g_mutex_lock (port->lock);
   g_mutex_lock (comp->lock);
 
   GST_DEBUG_OBJECT (comp->parent, "Manual reconfigure of port %u %s",
@@ -2406,10 +3455,18 @@ gst_omx_port_manual_reconfigure (GstOMXPort * port, gboolean start)
   if ((err = comp->last_error) != OMX_ErrorNone)
     goto done;
 
-  if (start)
+  if (start) {
     port->settings_cookie++;
-  else
+    port->reconfigure_start = g_get_monotonic_time ();
+  } else {
     port->configured_settings_cookie = port->settings_cookie;
+    if (port->reconfigure_start) {
+      port->stats.reconfigures++;
+      port->stats.reconfigure_time +=
+          g_get_monotonic_time () - port->reconfigure_start;
+      port->reconfigure_start = 0;
+    }
+  }
 
   if (port->port_def.eDir == OMX_DirOutput) {
     GList *l;
@@ -2435,9 +3492,7 @@ gst_omx_port_manual_reconfigure (GstOMXPort * port, gboolean start)
       }
       if (!comp->pending_reconfigure_outports) {
         g_atomic_int_set (&comp->have_pending_reconfigure_outports, 0);
-        g_mutex_lock (comp->messages_lock);
-        g_cond_broadcast (comp->messages_cond);
-        g_mutex_unlock (comp->messages_lock);
+        gst_omx_component_wake_ports (comp);
       }
     }
   }
@@ -2448,10 +3503,181 @@ done:
       port->index, gst_omx_error_to_string (err), err);
 
   g_mutex_unlock (comp->lock);
+  g_mutex_unlock (port->lock);
 
   return err;
 }
 
+/* Allocates the buffers of an output port for frames of up to max_width
+ * x max_height, so that the component can change the resolution within
+ * that size without the port being disabled and its buffers being
+ * reallocated. Only the crop rectangle changes then and the port
+ * returns GST_OMX_ACQUIRE_BUFFER_RECONFIGURED for the new caps.
+ *
+ * Uses the Android adaptive playback extension, returns
+ * OMX_ErrorUnsupportedIndex if the component doesn't support it.
+ * Must be called after the port is configured and before the buffers
+ * are allocated, a max_width or max_height of 0 disables it. The
+ * component is not reused by other elements after this succeeded.
+ *
+ * NOTE: Uses port->lock, comp->lock must be unlocked */
+OMX_ERRORTYPE
+gst_omx_port_set_adaptive_playback (GstOMXPort * port, guint32 max_width,
+    guint32 max_height)
+{
+  GstOMXComponent *comp;
+  OMX_ERRORTYPE err = OMX_ErrorNone;
+  OMX_INDEXTYPE extension;
+  OMX_PARAM_PORTDEFINITIONTYPE port_def;
+  struct PrepareForAdaptivePlaybackParams param;
+  gboolean enable, enabled;
+
+  g_return_val_if_fail (port != NULL, OMX_ErrorUndefined);
+  g_return_val_if_fail (port->port_def.eDir == OMX_DirOutput,
+      OMX_ErrorUndefined);
+
+  comp = port->comp;
+  enable = (max_width > 0 && max_height > 0);
+
+  g_mutex_lock (port->lock);
+  enabled = (port->max_width > 0);
+  g_mutex_unlock (port->lock);
+
+  if (!enable && !enabled)
+    goto done;
+
+  /* No locks are held while calling into the component, its
+   * callbacks might need them */
+  err = OMX_GetExtensionIndex (comp->handle,
+      (OMX_STRING) "OMX.google.android.index.prepareForAdaptivePlayback",
+      &extension);
+  if (err != OMX_ErrorNone) {
+    GST_INFO_OBJECT (comp->parent,
+        "Port %u does not support adaptive playback: %s (0x%08x)",
+        port->index, gst_omx_error_to_string (err), err);
+    err = OMX_ErrorUnsupportedIndex;
+    goto done;
+  }
+
+  GST_OMX_INIT_STRUCT (&param);
+  param.nPortIndex = port->index;
+  param.bEnable = enable ? OMX_TRUE : OMX_FALSE;
+  param.nMaxFrameWidth = max_width;
+  param.nMaxFrameHeight = max_height;
+
+  err = gst_omx_component_set_parameter (comp, extension, &param);
+  if (err != OMX_ErrorNone) {
+    GST_WARNING_OBJECT (comp->parent,
+        "Failed to set adaptive playback of port %u: %s (0x%08x)",
+        port->index, gst_omx_error_to_string (err), err);
+    goto done;
+  }
+
+  /* The buffer size depends on the maximum frame size now */
+  gst_omx_port_get_port_definition (port, &port_def);
+
+  g_mutex_lock (port->lock);
+  port->max_width = enable ? max_width : 0;
+  port->max_height = enable ? max_height : 0;
+  port->port_def = port_def;
+  g_mutex_unlock (port->lock);
+
+  /* Other users of the component don't expect it to be
+   * prepared for adaptive playback */
+  comp->reusable = FALSE;
+
+done:
+  GST_DEBUG_OBJECT (comp->parent,
+      "Adaptive playback of port %u up to %ux%u: %s (0x%08x)", port->index,
+      max_width, max_height, gst_omx_error_to_string (err), err);
+
+  return err;
+}
+
+/* Layout of the OpenMAX IL 1.2 OMX_CONFIG_PORTBOOLEANTYPE, which most
+ * vendor extensions that switch a feature of a port use */
+typedef struct
+{
+  OMX_U32 nSize;
+  OMX_VERSIONTYPE nVersion;
+  OMX_U32 nPortIndex;
+  OMX_BOOL bEnabled;
+} GstOMXPortBooleanParam;
+
+/* Enables or disables a vendor feature of the port with the extension
+ * extension_name, which has to take a GstOMXPortBooleanParam. Returns
+ * OMX_ErrorUnsupportedIndex if the component doesn't support it. The
+ * component is not reused by other elements after this succeeded.
+ *
+ * NOTE: comp->lock must be unlocked while calling this */
+OMX_ERRORTYPE
+gst_omx_port_set_extension_enabled (GstOMXPort * port,
+    const gchar * extension_name, gboolean enabled)
+{
+  GstOMXComponent *comp;
+  OMX_ERRORTYPE err;
+  OMX_INDEXTYPE extension;
+  GstOMXPortBooleanParam param;
+
+  g_return_val_if_fail (port != NULL, OMX_ErrorUndefined);
+  g_return_val_if_fail (extension_name != NULL, OMX_ErrorUndefined);
+
+  comp = port->comp;
+
+  err = OMX_GetExtensionIndex (comp->handle, (OMX_STRING) extension_name,
+      &extension);
+  if (err != OMX_ErrorNone) {
+    GST_INFO_OBJECT (comp->parent, "Extension '%s' not supported: %s "
+        "(0x%08x)", extension_name, gst_omx_error_to_string (err), err);
+    err = OMX_ErrorUnsupportedIndex;
+    goto done;
+  }
+
+  GST_OMX_INIT_STRUCT (&param);
+  param.nPortIndex = port->index;
+  param.bEnabled = enabled ? OMX_TRUE : OMX_FALSE;
+
+  err = gst_omx_component_set_parameter (comp, extension, &param);
+
+  /* Other users of the component don't expect the vendor feature */
+  if (err == OMX_ErrorNone)
+    comp->reusable = FALSE;
+
+done:
+  GST_DEBUG_OBJECT (comp->parent, "Setting '%s' of port %u to %d: %s "
+      "(0x%08x)", extension_name, port->index, enabled,
+      gst_omx_error_to_string (err), err);
+
+  return err;
+}
+
+/* NOTE: Uses port->lock */
+void
+gst_omx_port_get_stats (GstOMXPort * port, GstOMXPortStats * stats)
+{
+  guint i, n_used = 0;
+
+  g_return_if_fail (port != NULL);
+  g_return_if_fail (stats != NULL);
+
+  g_mutex_lock (port->lock);
+  *stats = port->stats;
+
+  for (i = 0; port->buffers && i < port->buffers->len; i++) {
+    GstOMXBuffer *buf = g_ptr_array_index (port->buffers, i);
+
+    if (buf->used)
+      n_used++;
+  }
+  stats->n_component = n_used;
+  stats->n_pending = g_queue_get_length (&port->pending_buffers);
+
+  G_LOCK (lent_buffers);
+  stats->n_downstream = port->lent_count;
+  G_UNLOCK (lent_buffers);
+  g_mutex_unlock (port->lock);
+}
+
 GQuark gst_omx_element_name_quark = 0;
 
 static GType (*types[]) (void) = {
@@ -2594,6 +3820,10 @@ gst_omx_parse_hacks (gchar ** hacks)
       hacks_flags |= GST_OMX_HACK_ANDROID_BUFFERS;
     else if (g_str_equal (*hacks, "implicit-format-change"))
       hacks_flags |= GST_OMX_HACK_IMPLICIT_FORMAT_CHANGE;
+    else if (g_str_equal (*hacks, "no-zero-copy"))
+      hacks_flags |= GST_OMX_HACK_NO_ZERO_COPY;
+    else if (g_str_equal (*hacks, "no-component-pool"))
+      hacks_flags |= GST_OMX_HACK_NO_COMPONENT_POOL;
     else
       GST_WARNING ("Unknown hack: %s", *hacks);
     hacks++;
@@ -2602,6 +3832,174 @@ gst_omx_parse_hacks (gchar ** hacks)
   return hacks_flags;
 }
 
+void
+gst_omx_buffer_config_load (GstOMXBufferConfig * buffer_config,
+    GKeyFile * config, const gchar * element_name)
+{
+  GError *err = NULL;
+  gint value;
+
+  buffer_config->extra_input_buffers = 0;
+  buffer_config->extra_output_buffers = 0;
+  buffer_config->input_buffer_size = -1;
+  buffer_config->adaptive_output_buffers = FALSE;
+  buffer_config->adaptive_max_width = 0;
+  buffer_config->adaptive_max_height = 0;
+  buffer_config->low_latency = FALSE;
+
+  value =
+      g_key_file_get_integer (config, element_name, "extra-input-buffers",
+      &err);
+  if (!err && value >= 0)
+    buffer_config->extra_input_buffers = value;
+  g_clear_error (&err);
+
+  value =
+      g_key_file_get_integer (config, element_name, "extra-output-buffers",
+      &err);
+  if (!err && value >= 0)
+    buffer_config->extra_output_buffers = value;
+  g_clear_error (&err);
+
+  value =
+      g_key_file_get_integer (config, element_name, "input-buffer-size", &err);
+  if (!err && value >= -1)
+    buffer_config->input_buffer_size = value;
+  g_clear_error (&err);
+
+  buffer_config->adaptive_output_buffers =
+      g_key_file_get_boolean (config, element_name, "adaptive-output-buffers",
+      NULL);
+
+  value =
+      g_key_file_get_integer (config, element_name, "adaptive-max-width",
+      &err);
+  if (!err && value >= 0)
+    buffer_config->adaptive_max_width = value;
+  g_clear_error (&err);
+
+  value =
+      g_key_file_get_integer (config, element_name, "adaptive-max-height",
+      &err);
+  if (!err && value >= 0)
+    buffer_config->adaptive_max_height = value;
+  g_clear_error (&err);
+
+  buffer_config->low_latency =
+      g_key_file_get_boolean (config, element_name, "low-latency", NULL);
+}
+
+/* Must be called before the buffers are allocated. The input buffer
+ * size is set by the decoders, it depends on the caps */
+void
+gst_omx_buffer_config_apply (const GstOMXBufferConfig * buffer_config,
+    GstOMXPort * in_port, GstOMXPort * out_port)
+{
+  in_port->extra_buffers = buffer_config->extra_input_buffers;
+  in_port->buffer_size = MAX (buffer_config->input_buffer_size, 0);
+
+  out_port->extra_buffers = buffer_config->extra_output_buffers;
+  out_port->buffer_size = 0;
+  out_port->adaptive_buffers = buffer_config->adaptive_output_buffers;
+
+  /* Every queued buffer is a frame of delay */
+  if (buffer_config->low_latency) {
+    in_port->extra_buffers = 0;
+    out_port->extra_buffers = 0;
+    out_port->adaptive_buffers = FALSE;
+  }
+}
+
+/* Group of gstomx.conf with settings for all elements */
+#define GST_OMX_PLUGIN_GROUP "gst-omx"
+
+static void
+gst_omx_configure_plugin (GKeyFile * config)
+{
+  GError *err = NULL;
+  gint threads = 0, threshold = GST_OMX_PLANE_COPY_DEFAULT_THREAD_THRESHOLD;
+  gint pool_size, value;
+
+  if (g_key_file_has_group (config, GST_OMX_PLUGIN_GROUP)) {
+    if (g_key_file_has_key (config, GST_OMX_PLUGIN_GROUP, "copy-threads",
+            NULL)) {
+      threads = g_key_file_get_integer (config, GST_OMX_PLUGIN_GROUP,
+          "copy-threads", &err);
+      if (err || threads < 0) {
+        GST_ERROR ("Invalid copy-threads configuration");
+        g_clear_error (&err);
+        threads = 0;
+      }
+    }
+    if (g_key_file_has_key (config, GST_OMX_PLUGIN_GROUP, "copy-threshold",
+            NULL)) {
+      threshold = g_key_file_get_integer (config, GST_OMX_PLUGIN_GROUP,
+          "copy-threshold", &err);
+      if (err || threshold < 0) {
+        GST_ERROR ("Invalid copy-threshold configuration");
+        g_clear_error (&err);
+        threshold = GST_OMX_PLANE_COPY_DEFAULT_THREAD_THRESHOLD;
+      }
+    }
+    if (g_key_file_has_key (config, GST_OMX_PLUGIN_GROUP, "flush-timeout",
+            NULL)) {
+      value = g_key_file_get_integer (config, GST_OMX_PLUGIN_GROUP,
+          "flush-timeout", &err);
+      if (err || value <= 0) {
+        GST_ERROR ("Invalid flush-timeout configuration");
+        g_clear_error (&err);
+      } else {
+        flush_timeout = value;
+      }
+    }
+    if (g_key_file_has_key (config, GST_OMX_PLUGIN_GROUP,
+            "component-pool-size", NULL)) {
+      pool_size = g_key_file_get_integer (config, GST_OMX_PLUGIN_GROUP,
+          "component-pool-size", &err);
+      if (err || pool_size < 0) {
+        GST_ERROR ("Invalid component-pool-size configuration");
+        g_clear_error (&err);
+      } else {
+        component_pool_size = pool_size;
+      }
+    }
+  }
+
+  gst_omx_plane_copy_set_threads (threads, threshold);
+  gst_omx_trace_configure (config, GST_OMX_PLUGIN_GROUP);
+  gst_omx_resources_configure (config, GST_OMX_PLUGIN_GROUP);
+}
+
+/* Adds elements for the components of the cores listed in the
+ * autoregister-cores key, see gstomxcapscache.c */
+static void
+gst_omx_autoregister_cores (GstPlugin * plugin, GKeyFile * config)
+{
+  GError *err = NULL;
+  gchar **cores, **hacks;
+  gint rank, i;
+
+  cores = g_key_file_get_string_list (config, GST_OMX_PLUGIN_GROUP,
+      "autoregister-cores", NULL, NULL);
+  if (!cores)
+    return;
+
+  rank = g_key_file_get_integer (config, GST_OMX_PLUGIN_GROUP,
+      "autoregister-rank", &err);
+  if (err) {
+    rank = GST_RANK_SECONDARY;
+    g_clear_error (&err);
+  }
+  hacks = g_key_file_get_string_list (config, GST_OMX_PLUGIN_GROUP,
+      "autoregister-hacks", NULL, NULL);
+
+  for (i = 0; cores[i]; i++)
+    gst_omx_caps_cache_register_core (plugin, config, cores[i], rank, hacks);
+
+  g_strfreev (hacks);
+  g_strfreev (cores);
+}
+
 static gboolean
 plugin_init (GstPlugin * plugin)
 {
@@ -2619,6 +4017,8 @@ plugin_init (GstPlugin * plugin)
 
   GST_DEBUG_CATEGORY_INIT (gstomx_debug, "omx", 0, "gst-omx");
 
+  GST_INFO ("Using %s plane copy", gst_omx_plane_copy_get_impl ()->name);
+
   gst_omx_element_name_quark =
       g_quark_from_static_string ("gst-omx-element-name");
 
@@ -2651,10 +4051,14 @@ plugin_init (GstPlugin * plugin)
     goto done;
   }
 
+  gst_omx_configure_plugin (config);
+
   /* Initialize all types */
   for (i = 0; i < G_N_ELEMENTS (types); i++)
     types[i] ();
 
+  gst_omx_autoregister_cores (plugin, config);
+
   elements = g_key_file_get_groups (config, &n_elements);
   for (i = 0; i < n_elements; i++) {
     GTypeQuery type_query;
@@ -2663,6 +4067,9 @@ plugin_init (GstPlugin * plugin)
     gchar *type_name, *core_name, *component_name;
     gint rank;
 
+    if (g_str_equal (elements[i], GST_OMX_PLUGIN_GROUP))
+      continue;
+
     GST_DEBUG ("Registering element '%s'", elements[i]);
 
     err = NULL;
@@ -31,6 +31,9 @@
 #include <gst/gstgralloc.h>
 #include <gst/gstnativebuffer.h>
 
+#include "gstomxring.h"
+#include "gstomxtrace.h"
+
 G_BEGIN_DECLS
 
 #define GST_OMX_INIT_STRUCT(st) G_STMT_START { \
@@ -95,12 +98,26 @@ G_BEGIN_DECLS
  */
 #define GST_OMX_HACK_IMPLICIT_FORMAT_CHANGE                           G_GUINT64_CONSTANT (0x0000000000000400)
 
+/* The component does not work with buffers that are allocated by us
+ * and passed with OMX_UseBuffer, e.g. because it requires physically
+ * contiguous memory, but still accepts them. Data is always copied.
+ */
+#define GST_OMX_HACK_NO_ZERO_COPY                                     G_GUINT64_CONSTANT (0x0000000000000800)
+
+/* The component does not behave like a new one after it went back to
+ * the Loaded state, e.g. because it keeps the previous stream's state.
+ * Released components are freed instead of being kept for reuse.
+ */
+#define GST_OMX_HACK_NO_COMPONENT_POOL                                G_GUINT64_CONSTANT (0x0000000000001000)
+
 typedef struct _GstOMXCore GstOMXCore;
 typedef struct _GstOMXPort GstOMXPort;
 typedef enum _GstOMXPortDirection GstOMXPortDirection;
 typedef struct _GstOMXComponent GstOMXComponent;
 typedef struct _GstOMXBuffer GstOMXBuffer;
 typedef struct _GstOMXMessage GstOMXMessage;
+typedef struct _GstOMXPortStats GstOMXPortStats;
+typedef struct _GstOMXBufferConfig GstOMXBufferConfig;
 
 typedef enum {
   /* Everything good and the buffer is valid */
@@ -135,6 +152,12 @@ struct _GstOMXCore {
   OMX_ERRORTYPE (*get_handle) (OMX_HANDLETYPE * handle,
       OMX_STRING name, OMX_PTR data, OMX_CALLBACKTYPE * callbacks);
   OMX_ERRORTYPE (*free_handle) (OMX_HANDLETYPE handle);
+
+  /* Optional, only used for probing the components of the core */
+  OMX_ERRORTYPE (*component_name_enum) (OMX_STRING name, OMX_U32 length,
+      OMX_U32 index);
+  OMX_ERRORTYPE (*get_roles_of_component) (OMX_STRING name,
+      OMX_U32 * n_roles, OMX_U8 ** roles);
 };
 
 typedef enum {
@@ -143,7 +166,6 @@ typedef enum {
   GST_OMX_MESSAGE_ERROR,
   GST_OMX_MESSAGE_PORT_ENABLE,
   GST_OMX_MESSAGE_PORT_SETTINGS_CHANGED,
-  GST_OMX_MESSAGE_BUFFER_DONE,
 } GstOMXMessageType;
 
 struct _GstOMXMessage {
@@ -165,20 +187,69 @@ struct _GstOMXMessage {
     } port_enable;
     struct {
       OMX_U32 port;
+      /* The changed parameter or config, 0 if unknown */
+      OMX_INDEXTYPE index;
     } port_settings_changed;
-    struct {
-      OMX_HANDLETYPE component;
-      OMX_PTR app_data;
-      OMX_BUFFERHEADERTYPE *buffer;
-      OMX_BOOL empty;
-    } buffer_done;
   } content;
 };
 
+/* Buffer configuration of an element, the defaults are read from the
+ * keys with the same names of its configuration group */
+struct _GstOMXBufferConfig {
+  guint extra_input_buffers;
+  guint extra_output_buffers;
+  /* -1 for the component's default, 0 to derive it from
+   * the caps, only used by the decoders */
+  gint input_buffer_size;
+  gboolean adaptive_output_buffers;
+  /* Maximum frame size for adaptive playback, 0 to disable
+   * it, only used by the decoders */
+  guint adaptive_max_width, adaptive_max_height;
+  /* Only the buffers the component needs, overrides the
+   * extra and adaptive buffers */
+  gboolean low_latency;
+};
+
+/* Times are in microseconds */
+struct _GstOMXPortStats {
+  guint64 acquire_time; /* Spent in gst_omx_port_acquire_buffer() */
+  guint flushes;
+  guint64 flush_time;
+  guint reconfigures;
+  guint64 reconfigure_time;
+
+  /* Current buffer occupancy, only set by gst_omx_port_get_stats() */
+  guint n_component; /* Passed to the component */
+  guint n_pending; /* Returned by the component, not acquired yet */
+  guint n_downstream; /* Wrapped by gst_omx_port_wrap_buffer() */
+};
+
 struct _GstOMXPort {
   GstOMXComponent *comp;
   guint32 index;
 
+  /* Locking order: lock -> comp->lock -> messages_lock
+   *
+   * lock protects the buffers, pending_buffers, flushing and
+   * the configured settings of this port. The fields that are
+   * changed by component events (flushed, enabled_changed,
+   * settings_cookie) are protected by comp->lock.
+   *
+   * Never hold lock or comp->lock while waiting for messages_cond.
+   * messages_cond is signalled whenever a buffer of this port is
+   * returned by the component, and broadcast for every component
+   * event */
+  GMutex *lock;
+
+  /* GstOMXBuffer* returned by the component. Can hold all buffers
+   * of the port, so the callbacks never have to wait for space */
+  GstOMXRing *messages;
+  /* Only used for waiting, the callbacks only take messages_lock
+   * if somebody is waiting */
+  GMutex *messages_lock;
+  GCond *messages_cond;
+  gint messages_waiters; /* atomic */
+
   OMX_PARAM_PORTDEFINITIONTYPE port_def;
   GPtrArray *buffers; /* Contains GstOMXBuffer* */
   GQueue pending_buffers; /* Contains GstOMXBuffer* */
@@ -187,6 +258,7 @@ struct _GstOMXPort {
   gboolean flushing;
   gboolean flushed; /* TRUE after OMX_CommandFlush was done */
   gboolean enabled_changed; /* TRUE after OMX_Command{En,Dis}able was done */
+  gboolean crop_changed; /* TRUE after only the output crop changed */
 
   /* Increased whenever the settings of these port change.
    * If settings_cookie != configured_settings_cookie
@@ -195,6 +267,41 @@ struct _GstOMXPort {
   gint settings_cookie;
   gint configured_settings_cookie;
   gint resurrection_cookie;
+
+  /* If TRUE the buffers are allocated by us and passed to the
+   * component with OMX_UseBuffer, so they can be passed to other
+   * elements without copying with gst_omx_port_wrap_buffer(). Set before
+   * the buffers are allocated, reset if the component does not support it */
+  gboolean zero_copy;
+  /* Number of wrapped buffers, protected by the same lock as
+   * GstOMXBuffer::lent */
+  gint lent_count;
+
+  /* Buffers allocated in addition to the minimum and the size of the
+   * buffers, 0 for the component's default. Set before the buffers
+   * are allocated */
+  guint extra_buffers;
+  guint32 buffer_size;
+  /* If TRUE output ports are reconfigured with more buffers if the
+   * component repeatedly runs out of buffers, see
+   * gst_omx_port_check_starved(). Set before the buffers are allocated,
+   * the other fields are protected by lock */
+  gboolean adaptive_buffers;
+  guint adaptive_extra_buffers;
+  guint adaptive_passed, adaptive_starved;
+  gboolean adaptive_grow;
+
+  /* Maximum frame size of the output buffers for adaptive playback,
+   * 0 if disabled. Resolution changes within this size only change
+   * the crop rectangle, see gst_omx_port_set_adaptive_playback().
+   * Set before the buffers are allocated */
+  guint32 max_width, max_height;
+  /* Crop rectangle of the Android native buffers, protected by lock */
+  OMX_CONFIG_RECTTYPE crop;
+
+  /* Protected by lock, see gst_omx_port_get_stats() */
+  GstOMXPortStats stats;
+  gint64 reconfigure_start; /* 0 if no manual reconfiguration */
 };
 
 struct _GstOMXComponent {
@@ -204,19 +311,29 @@ struct _GstOMXComponent {
 
   guint64 hacks; /* Flags, GST_OMX_HACK_* */
 
-  /* Added once, never changed. No locks necessary */
+  /* Added once, never changed while the component is used.
+   * No locks necessary */
   GPtrArray *ports; /* Contains GstOMXPort* */
   gint n_in_ports, n_out_ports;
 
-  /* Locking order: lock -> messages_lock
+  /* Locking order: port->lock -> lock -> messages_lock
    *
    * Never hold lock while waiting for messages_cond
-   * Always check that messages is empty before waiting */
+   * Always check that messages is empty before waiting.
+   * Buffers returned by the component don't go through
+   * this queue but through the messages of their port,
+   * messages_cond is only used for state changes */
   GMutex *lock;
 
-  GQueue messages; /* Queue of GstOMXMessages */
+  /* Contains GstOMXMessages. Big enough for one message per buffer of
+   * all ports, replaced by a bigger one while holding lock and the
+   * messages_locks when buffers are allocated */
+  GstOMXRing *messages;
   GMutex *messages_lock;
   GCond *messages_cond;
+  gint messages_waiters; /* atomic */
+  gint messages_pushers; /* atomic, callbacks pushing to messages */
+  gint messages_overflow; /* atomic, TRUE if messages were lost */
 
   GMutex resurrection_lock;
 
@@ -233,6 +350,15 @@ struct _GstOMXComponent {
   int android_buffer_usage;
   gboolean use_old_android_extension;
   OMX_INDEXTYPE android_extension;
+
+  /* Key of the component pool, see gst_omx_component_release() */
+  gchar *pool_key;
+  /* FALSE if settings were changed that the next user
+   * of the component would not set again */
+  gboolean reusable;
+
+  /* NULL if tracing is disabled, see gstomxtrace.c */
+  GstOMXTrace *trace;
 };
 
 struct _GstOMXBuffer {
@@ -250,6 +376,17 @@ struct _GstOMXBuffer {
 
   buffer_handle_t android_handle;
   GstNativeBuffer *native_buffer;
+
+  /* Memory passed to OMX_UseBuffer for zero-copy ports */
+  guint8 *memory;
+  /* TRUE while the buffer is wrapped in a GstBuffer downstream,
+   * detached is TRUE if the port doesn't wait for it anymore.
+   * recycled is TRUE if it was returned from downstream and has
+   * to be passed to the component again. Protected by a global lock
+   * because wrapped buffers can outlive the component */
+  gboolean lent;
+  gboolean detached;
+  gboolean recycled;
 };
 
 extern GQuark     gst_omx_element_name_quark;
@@ -258,6 +395,8 @@ GKeyFile *        gst_omx_get_configuration (void);
 
 const gchar *     gst_omx_error_to_string (OMX_ERRORTYPE err);
 guint64           gst_omx_parse_hacks (gchar ** hacks);
+void              gst_omx_buffer_config_load (GstOMXBufferConfig * buffer_config, GKeyFile * config, const gchar * element_name);
+void              gst_omx_buffer_config_apply (const GstOMXBufferConfig * buffer_config, GstOMXPort * in_port, GstOMXPort * out_port);
 
 GstOMXCore *      gst_omx_core_acquire (const gchar * filename);
 #ifdef HAVE_HYBRIS
@@ -269,6 +408,8 @@ void              gst_omx_core_release (GstOMXCore * core);
 
 GstOMXComponent * gst_omx_component_new  (GstObject *parent, const gchar * core_name, const gchar * component_name, const gchar *component_role, guint64 hacks);
 void              gst_omx_component_free (GstOMXComponent * comp);
+void              gst_omx_component_release (GstOMXComponent * comp);
+void              gst_omx_component_dump_trace (GstOMXComponent * comp);
 
 OMX_ERRORTYPE     gst_omx_component_set_state (GstOMXComponent * comp, OMX_STATETYPE state);
 OMX_STATETYPE     gst_omx_component_get_state (GstOMXComponent * comp, GstClockTime timeout);
@@ -276,6 +417,7 @@ OMX_STATETYPE     gst_omx_component_get_state (GstOMXComponent * comp, GstClockT
 void              gst_omx_component_set_last_error (GstOMXComponent * comp, OMX_ERRORTYPE err);
 OMX_ERRORTYPE     gst_omx_component_get_last_error (GstOMXComponent * comp);
 const gchar *     gst_omx_component_get_last_error_string (GstOMXComponent * comp);
+OMX_ERRORTYPE     gst_omx_component_set_flushing (GstOMXComponent * comp, gboolean flush);
 
 GstOMXPort *      gst_omx_component_add_port (GstOMXComponent * comp, guint32 index);
 GstOMXPort *      gst_omx_component_get_port (GstOMXComponent * comp, guint32 index);
@@ -294,6 +436,9 @@ gboolean          gst_omx_port_update_port_definition (GstOMXPort *port, OMX_PAR
 
 GstOMXAcquireBufferReturn gst_omx_port_acquire_buffer (GstOMXPort *port, GstOMXBuffer **buf);
 OMX_ERRORTYPE     gst_omx_port_release_buffer (GstOMXPort *port, GstOMXBuffer *buf);
+GstBuffer *       gst_omx_port_wrap_buffer (GstOMXPort *port, GstOMXBuffer *buf);
+GstOMXBuffer *    gst_omx_port_reclaim_buffer (GstOMXPort *port, GstBuffer *buffer);
+gint              gst_omx_port_get_lent_count (GstOMXPort *port);
 
 OMX_ERRORTYPE     gst_omx_port_set_flushing (GstOMXPort *port, gboolean flush);
 gboolean          gst_omx_port_is_flushing (GstOMXPort *port);
@@ -307,6 +452,10 @@ OMX_ERRORTYPE     gst_omx_port_set_enabled (GstOMXPort * port, gboolean enabled)
 gboolean          gst_omx_port_is_enabled (GstOMXPort * port);
 
 OMX_ERRORTYPE     gst_omx_port_manual_reconfigure (GstOMXPort * port, gboolean start);
+OMX_ERRORTYPE     gst_omx_port_set_adaptive_playback (GstOMXPort * port, guint32 max_width, guint32 max_height);
+OMX_ERRORTYPE     gst_omx_port_set_extension_enabled (GstOMXPort * port, const gchar * extension_name, gboolean enabled);
+
+void              gst_omx_port_get_stats (GstOMXPort * port, GstOMXPortStats * stats);
 
 G_END_DECLS
 
@@ -34,8 +34,31 @@
 GST_DEBUG_CATEGORY_STATIC (gst_omx_audio_enc_debug_category);
 #define GST_CAT_DEFAULT gst_omx_audio_enc_debug_category
 
+/* Input chunks passed to the component, for the latency statistics.
+ * Audio encoders have no frames, so the output is matched to the
+ * input by its timestamp */
+typedef struct
+{
+  guint64 timestamp;            /* OMX ticks */
+  gint64 arrival;
+  gint64 queued;
+} InputIdentification;
+
+/* Limit for components that don't keep the timestamps */
+#define MAX_PENDING_INPUTS 256
+
+static void
+input_identification_free (InputIdentification * id)
+{
+  g_slice_free (InputIdentification, id);
+}
+
 /* prototypes */
 static void gst_omx_audio_enc_finalize (GObject * object);
+static void gst_omx_audio_enc_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec);
+static void gst_omx_audio_enc_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec);
 
 static GstStateChangeReturn
 gst_omx_audio_enc_change_state (GstElement * element,
@@ -55,7 +78,12 @@ static GstFlowReturn gst_omx_audio_enc_drain (GstOMXAudioEnc * self);
 
 enum
 {
-  PROP_0
+  PROP_0,
+  PROP_STATS,
+  PROP_STATS_INTERVAL,
+  PROP_EXTRA_INPUT_BUFFERS,
+  PROP_EXTRA_OUTPUT_BUFFERS,
+  PROP_ADAPTIVE_OUTPUT_BUFFERS
 };
 
 /* class initialization */
@@ -200,6 +228,18 @@ gst_omx_audio_enc_base_init (gpointer g_class)
 
     audioenc_class->hacks = gst_omx_parse_hacks (hacks);
   }
+
+  gst_omx_buffer_config_load (&audioenc_class->buffer_config, config,
+      element_name);
+}
+
+static void
+gst_omx_audio_enc_dump_trace (GstOMXAudioEnc * self)
+{
+  g_mutex_lock (self->component_lock);
+  if (self->component)
+    gst_omx_component_dump_trace (self->component);
+  g_mutex_unlock (self->component_lock);
 }
 
 static void
@@ -210,6 +250,44 @@ gst_omx_audio_enc_class_init (GstOMXAudioEncClass * klass)
   GstAudioEncoderClass *audio_encoder_class = GST_AUDIO_ENCODER_CLASS (klass);
 
   gobject_class->finalize = gst_omx_audio_enc_finalize;
+  gobject_class->set_property = gst_omx_audio_enc_set_property;
+  gobject_class->get_property = gst_omx_audio_enc_get_property;
+
+  g_object_class_install_property (gobject_class, PROP_STATS,
+      g_param_spec_boxed ("stats", "Statistics",
+          "Statistics of the encoder, see gstomxstats.c",
+          GST_TYPE_STRUCTURE, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_STATS_INTERVAL,
+      g_param_spec_uint ("stats-interval", "Statistics interval",
+          "Interval of the statistics element messages in ms (0=disabled)",
+          0, G_MAXUINT, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_EXTRA_INPUT_BUFFERS,
+      g_param_spec_uint ("extra-input-buffers", "Extra input buffers",
+          "Input buffers allocated in addition to the minimum",
+          0, G_MAXUINT, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property (gobject_class, PROP_EXTRA_OUTPUT_BUFFERS,
+      g_param_spec_uint ("extra-output-buffers", "Extra output buffers",
+          "Output buffers allocated in addition to the minimum",
+          0, G_MAXUINT, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property (gobject_class,
+      PROP_ADAPTIVE_OUTPUT_BUFFERS, g_param_spec_boolean
+      ("adaptive-output-buffers", "Adaptive output buffers",
+          "Allocate more output buffers if the component runs out of them",
+          FALSE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+
+  /* Writes the events traced since the last dump to the trace file,
+   * see gstomxtrace.c */
+  g_signal_new_class_handler ("dump-trace", G_TYPE_FROM_CLASS (klass),
+      G_SIGNAL_RUN_LAST | G_SIGNAL_ACTION,
+      G_CALLBACK (gst_omx_audio_enc_dump_trace), NULL, NULL,
+      g_cclosure_marshal_VOID__VOID, G_TYPE_NONE, 0);
 
   element_class->change_state =
       GST_DEBUG_FUNCPTR (gst_omx_audio_enc_change_state);
@@ -258,33 +336,59 @@ gst_omx_audio_enc_init (GstOMXAudioEnc * self, GstOMXAudioEncClass * klass)
 {
   self->drain_lock = g_mutex_new ();
   self->drain_cond = g_cond_new ();
+  self->component_lock = g_mutex_new ();
+
+  self->stats = gst_omx_stats_new ();
+  self->pending_inputs = g_queue_new ();
+  self->buffer_config = klass->buffer_config;
+}
+
+static void
+gst_omx_audio_enc_clear_pending_inputs (GstOMXAudioEnc * self)
+{
+  InputIdentification *id;
+
+  while ((id = g_queue_pop_head (self->pending_inputs)))
+    input_identification_free (id);
 }
 
 static gboolean
 gst_omx_audio_enc_open (GstOMXAudioEnc * self)
 {
   GstOMXAudioEncClass *klass = GST_OMX_AUDIO_ENC_GET_CLASS (self);
+  GstOMXComponent *component;
+
+  gst_omx_stats_reset (self->stats);
 
-  self->component =
+  component =
       gst_omx_component_new (GST_OBJECT_CAST (self), klass->core_name,
       klass->component_name, klass->component_role, klass->hacks);
   self->started = FALSE;
 
-  if (!self->component)
+  if (!component)
     return FALSE;
 
+  g_mutex_lock (self->component_lock);
+  self->component = component;
+  g_mutex_unlock (self->component_lock);
+
   if (gst_omx_component_get_state (self->component,
           GST_CLOCK_TIME_NONE) != OMX_StateLoaded)
     return FALSE;
 
+  g_mutex_lock (self->component_lock);
   self->in_port =
       gst_omx_component_add_port (self->component, klass->in_port_index);
   self->out_port =
       gst_omx_component_add_port (self->component, klass->out_port_index);
+  g_mutex_unlock (self->component_lock);
 
   if (!self->in_port || !self->out_port)
     return FALSE;
 
+  gst_omx_buffer_config_apply (&self->buffer_config, self->in_port,
+      self->out_port);
+
   return TRUE;
 }
 
@@ -317,14 +421,18 @@ gst_omx_audio_enc_close (GstOMXAudioEnc * self)
 {
   GST_DEBUG_OBJECT (self, "Closing encoder");
 
-  if (!gst_omx_audio_enc_shutdown (self))
+  g_mutex_lock (self->component_lock);
+  if (!gst_omx_audio_enc_shutdown (self)) {
+    g_mutex_unlock (self->component_lock);
     return FALSE;
+  }
 
   self->in_port = NULL;
   self->out_port = NULL;
   if (self->component)
     gst_omx_component_free (self->component);
   self->component = NULL;
+  g_mutex_unlock (self->component_lock);
 
   return TRUE;
 }
@@ -336,10 +444,73 @@ gst_omx_audio_enc_finalize (GObject * object)
 
   g_mutex_free (self->drain_lock);
   g_cond_free (self->drain_cond);
+  g_mutex_free (self->component_lock);
+
+  gst_omx_audio_enc_clear_pending_inputs (self);
+  g_queue_free (self->pending_inputs);
+  gst_omx_stats_free (self->stats);
 
   G_OBJECT_CLASS (parent_class)->finalize (object);
 }
 
+static void
+gst_omx_audio_enc_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstOMXAudioEnc *self = GST_OMX_AUDIO_ENC (object);
+
+  switch (prop_id) {
+    case PROP_STATS_INTERVAL:
+      gst_omx_stats_set_interval (self->stats, g_value_get_uint (value));
+      break;
+    case PROP_EXTRA_INPUT_BUFFERS:
+      self->buffer_config.extra_input_buffers = g_value_get_uint (value);
+      break;
+    case PROP_EXTRA_OUTPUT_BUFFERS:
+      self->buffer_config.extra_output_buffers = g_value_get_uint (value);
+      break;
+    case PROP_ADAPTIVE_OUTPUT_BUFFERS:
+      self->buffer_config.adaptive_output_buffers =
+          g_value_get_boolean (value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_omx_audio_enc_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec)
+{
+  GstOMXAudioEnc *self = GST_OMX_AUDIO_ENC (object);
+
+  switch (prop_id) {
+    case PROP_STATS:
+      g_mutex_lock (self->component_lock);
+      g_value_take_boxed (value, gst_omx_stats_get_structure (self->stats,
+              self->in_port, self->out_port));
+      g_mutex_unlock (self->component_lock);
+      break;
+    case PROP_STATS_INTERVAL:
+      g_value_set_uint (value, gst_omx_stats_get_interval (self->stats));
+      break;
+    case PROP_EXTRA_INPUT_BUFFERS:
+      g_value_set_uint (value, self->buffer_config.extra_input_buffers);
+      break;
+    case PROP_EXTRA_OUTPUT_BUFFERS:
+      g_value_set_uint (value, self->buffer_config.extra_output_buffers);
+      break;
+    case PROP_ADAPTIVE_OUTPUT_BUFFERS:
+      g_value_set_boolean (value,
+          self->buffer_config.adaptive_output_buffers);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
 static GstStateChangeReturn
 gst_omx_audio_enc_change_state (GstElement * element, GstStateChange transition)
 {
@@ -420,6 +591,7 @@ gst_omx_audio_enc_loop (GstOMXAudioEnc * self)
   GstFlowReturn flow_ret = GST_FLOW_OK;
   GstOMXAcquireBufferReturn acq_return;
   gboolean is_eos;
+  gint64 start, arrival = 0;
 
   klass = GST_OMX_AUDIO_ENC_GET_CLASS (self);
 
@@ -487,6 +659,7 @@ gst_omx_audio_enc_loop (GstOMXAudioEnc * self)
 
     GST_AUDIO_ENCODER_STREAM_LOCK (self);
     is_eos = ! !(buf->omx_buf->nFlags & OMX_BUFFERFLAG_EOS);
+    start = GST_OMX_TRACE_START (self->component->trace);
 
     if ((buf->omx_buf->nFlags & OMX_BUFFERFLAG_CODECCONFIG)
         && buf->omx_buf->nFilledLen > 0) {
@@ -513,6 +686,23 @@ gst_omx_audio_enc_loop (GstOMXAudioEnc * self)
     } else if (buf->omx_buf->nFilledLen > 0) {
       GstBuffer *outbuf;
       guint n_samples;
+      InputIdentification *id, *last = NULL;
+
+      /* Take all inputs that are encoded into this output */
+      while ((id = g_queue_peek_head (self->pending_inputs))
+          && id->timestamp <= buf->omx_buf->nTimeStamp) {
+        g_queue_pop_head (self->pending_inputs);
+        if (last)
+          input_identification_free (last);
+        last = id;
+      }
+      if (last) {
+        gst_omx_stats_add_latency (self->stats,
+            GST_OMX_STATS_COMPONENT_LATENCY,
+            g_get_monotonic_time () - last->queued);
+        arrival = last->arrival;
+        input_identification_free (last);
+      }
 
       n_samples =
           klass->get_num_samples (self, self->out_port,
@@ -524,6 +714,8 @@ gst_omx_audio_enc_loop (GstOMXAudioEnc * self)
         memcpy (GST_BUFFER_DATA (outbuf),
             buf->omx_buf->pBuffer + buf->omx_buf->nOffset,
             buf->omx_buf->nFilledLen);
+        gst_omx_stats_add (self->stats, GST_OMX_STATS_BYTES_COPIED_OUT,
+            buf->omx_buf->nFilledLen);
       } else {
         outbuf = gst_buffer_new ();
       }
@@ -539,11 +731,21 @@ gst_omx_audio_enc_loop (GstOMXAudioEnc * self)
             gst_util_uint64_scale (buf->omx_buf->nTickCount, GST_SECOND,
             OMX_TICKS_PER_SECOND);
 
+      gst_omx_stats_add (self->stats, GST_OMX_STATS_FRAMES_OUT, 1);
       flow_ret =
           gst_audio_encoder_finish_frame (GST_AUDIO_ENCODER (self),
           outbuf, n_samples);
     }
 
+    GST_OMX_TRACE_CALL (self->component->trace, GST_OMX_TRACE_PUSH,
+        port->index, buf, flow_ret, start);
+
+    if (arrival)
+      gst_omx_stats_add_latency (self->stats, GST_OMX_STATS_LATENCY,
+          g_get_monotonic_time () - arrival);
+    gst_omx_stats_post (self->stats, GST_ELEMENT_CAST (self), self->in_port,
+        self->out_port);
+
     if (is_eos || flow_ret == GST_FLOW_UNEXPECTED) {
       g_mutex_lock (self->drain_lock);
       if (self->draining) {
@@ -604,6 +806,10 @@ flow_error:
       gst_pad_push_event (GST_AUDIO_ENCODER_SRC_PAD (self),
           gst_event_new_eos ());
       gst_pad_pause_task (GST_AUDIO_ENCODER_SRC_PAD (self));
+
+      GST_OMX_TRACE_INSTANT (self->component->trace, GST_OMX_TRACE_EOS,
+          port->index, NULL, 0);
+      gst_omx_component_dump_trace (self->component);
     } else if (flow_ret == GST_FLOW_NOT_LINKED
         || flow_ret < GST_FLOW_UNEXPECTED) {
       GST_ELEMENT_ERROR (self, STREAM, FAILED, ("Internal data stream error."),
@@ -677,6 +883,10 @@ gst_omx_audio_enc_stop (GstAudioEncoder * encoder)
   self->started = FALSE;
   self->eos = FALSE;
 
+  GST_AUDIO_ENCODER_STREAM_LOCK (self);
+  gst_omx_audio_enc_clear_pending_inputs (self);
+  GST_AUDIO_ENCODER_STREAM_UNLOCK (self);
+
   g_mutex_lock (self->drain_lock);
   self->draining = FALSE;
   g_cond_broadcast (self->drain_cond);
@@ -861,19 +1071,18 @@ gst_omx_audio_enc_flush (GstAudioEncoder * encoder)
 
   gst_omx_audio_enc_drain (self);
 
-  gst_omx_port_set_flushing (self->in_port, TRUE);
-  gst_omx_port_set_flushing (self->out_port, TRUE);
+  gst_omx_component_set_flushing (self->component, TRUE);
 
-  /* Wait until the srcpad loop is finished */
+  /* Wait until the srcpad loop is paused */
   GST_AUDIO_ENCODER_STREAM_UNLOCK (self);
-  GST_PAD_STREAM_LOCK (GST_AUDIO_ENCODER_SRC_PAD (self));
-  GST_PAD_STREAM_UNLOCK (GST_AUDIO_ENCODER_SRC_PAD (self));
+  gst_pad_pause_task (GST_AUDIO_ENCODER_SRC_PAD (self));
   GST_AUDIO_ENCODER_STREAM_LOCK (self);
 
-  gst_omx_port_set_flushing (self->in_port, FALSE);
-  gst_omx_port_set_flushing (self->out_port, FALSE);
+  gst_omx_component_set_flushing (self->component, FALSE);
 
-  /* Start the srcpad loop again */
+  gst_omx_audio_enc_clear_pending_inputs (self);
+
+  /* Resume the srcpad loop */
   self->last_upstream_ts = 0;
   self->downstream_flow_ret = GST_FLOW_OK;
   self->eos = FALSE;
@@ -889,6 +1098,7 @@ gst_omx_audio_enc_handle_frame (GstAudioEncoder * encoder, GstBuffer * inbuf)
   GstOMXBuffer *buf;
   guint offset = 0;
   GstClockTime timestamp, duration, timestamp_offset = 0;
+  gint64 arrival;
 
   self = GST_OMX_AUDIO_ENC (encoder);
 
@@ -906,6 +1116,9 @@ gst_omx_audio_enc_handle_frame (GstAudioEncoder * encoder, GstBuffer * inbuf)
 
   GST_DEBUG_OBJECT (self, "Handling frame");
 
+  arrival = g_get_monotonic_time ();
+  gst_omx_stats_add (self->stats, GST_OMX_STATS_FRAMES_IN, 1);
+
   timestamp = GST_BUFFER_TIMESTAMP (inbuf);
   duration = GST_BUFFER_DURATION (inbuf);
 
@@ -956,6 +1169,8 @@ gst_omx_audio_enc_handle_frame (GstAudioEncoder * encoder, GstBuffer * inbuf)
         buf->omx_buf->nAllocLen - buf->omx_buf->nOffset);
     memcpy (buf->omx_buf->pBuffer + buf->omx_buf->nOffset,
         GST_BUFFER_DATA (inbuf) + offset, buf->omx_buf->nFilledLen);
+    gst_omx_stats_add (self->stats, GST_OMX_STATS_BYTES_COPIED_IN,
+        buf->omx_buf->nFilledLen);
 
     /* Interpolate timestamps if we're passing the buffer
      * in multiple chunks */
@@ -977,6 +1192,19 @@ gst_omx_audio_enc_handle_frame (GstAudioEncoder * encoder, GstBuffer * inbuf)
       self->last_upstream_ts += duration;
     }
 
+    if (timestamp != GST_CLOCK_TIME_NONE) {
+      InputIdentification *id;
+
+      if (g_queue_get_length (self->pending_inputs) >= MAX_PENDING_INPUTS)
+        input_identification_free (g_queue_pop_head (self->pending_inputs));
+
+      id = g_slice_new (InputIdentification);
+      id->timestamp = buf->omx_buf->nTimeStamp;
+      id->arrival = arrival;
+      id->queued = g_get_monotonic_time ();
+      g_queue_push_tail (self->pending_inputs, id);
+    }
+
     offset += buf->omx_buf->nFilledLen;
     self->started = TRUE;
     gst_omx_port_release_buffer (self->in_port, buf);
@@ -1039,12 +1267,12 @@ gst_omx_audio_enc_event (GstAudioEncoder * encoder, GstEvent * event)
       GST_WARNING_OBJECT (self, "Component does not support empty EOS buffers");
 
       /* Insert a NULL into the queue to signal EOS */
-      g_mutex_lock (self->component->lock);
+      g_mutex_lock (self->out_port->lock);
       g_queue_push_tail (&self->out_port->pending_buffers, NULL);
-      g_mutex_unlock (self->component->lock);
-      g_mutex_lock (self->component->messages_lock);
-      g_cond_broadcast (self->component->messages_cond);
-      g_mutex_unlock (self->component->messages_lock);
+      g_mutex_lock (self->out_port->messages_lock);
+      g_cond_broadcast (self->out_port->messages_cond);
+      g_mutex_unlock (self->out_port->messages_lock);
+      g_mutex_unlock (self->out_port->lock);
       return TRUE;
     }
 
@@ -25,6 +25,7 @@
 #include <gst/audio/gstaudioencoder.h>
 
 #include "gstomx.h"
+#include "gstomxstats.h"
 
 G_BEGIN_DECLS
 
@@ -70,6 +71,18 @@ struct _GstOMXAudioEnc
   gboolean draining;
 
   GstFlowReturn downstream_flow_ret;
+
+  GstOMXStats *stats;
+
+  /* Held while the component and its ports are created or freed,
+   * for the stats property and the dump-trace signal */
+  GMutex *component_lock;
+
+  /* properties */
+  GstOMXBufferConfig buffer_config;
+  /* Input chunks passed to the component, see gstomxaudioenc.c.
+   * NOTE: Protected by the stream lock */
+  GQueue *pending_inputs;
 };
 
 struct _GstOMXAudioEncClass
@@ -87,6 +100,9 @@ struct _GstOMXAudioEncClass
 
   guint64 hacks;
 
+  /* Defaults of the properties */
+  GstOMXBufferConfig buffer_config;
+
   gboolean (*set_format)       (GstOMXAudioEnc * self, GstOMXPort * port, GstAudioInfo * info);
   GstCaps *(*get_caps)         (GstOMXAudioEnc * self, GstOMXPort * port, GstAudioInfo * info);
   guint    (*get_num_samples)  (GstOMXAudioEnc * self, GstOMXPort * port, GstAudioInfo * info, GstOMXBuffer * buffer);
@@ -0,0 +1,729 @@
+/*
+ * Copyright (C) 2013, Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+/* Registers elements for all components of a core that have a role we
+ * support, with template caps restricted to the color formats and
+ * H.264 profiles/levels the component reports.
+ *
+ * Probing needs to load the core and to create every component, so the
+ * results are kept in a cache file per core in the user cache directory
+ * and only probed again if the core library changed. The cache contains
+ * one group per component and role:
+ *
+ *   [OMX.vendor.video_decoder.avc video_decoder.avc]
+ *   component-name=OMX.vendor.video_decoder.avc
+ *   component-role=video_decoder.avc
+ *   in-port-index=0
+ *   out-port-index=1
+ *   color-formats=19;21;
+ *   profiles=1;2;8;
+ *   levels=8192;8192;2048;
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <sys/stat.h>
+#include <glib/gstdio.h>
+
+#include "gstomx.h"
+#include "gstomxcapscache.h"
+#include "gstomxvideodec.h"
+#include "gstomxvideoenc.h"
+#include "gstomxmpeg4videodec.h"
+#include "gstomxmpeg2videodec.h"
+#include "gstomxh264dec.h"
+#include "gstomxh263dec.h"
+#include "gstomxwmvdec.h"
+#include "gstomxvc1videodec.h"
+#include "gstomxmpeg4videoenc.h"
+#include "gstomxh264enc.h"
+#include "gstomxh263enc.h"
+
+GST_DEBUG_CATEGORY_EXTERN (gstomx_debug);
+#define GST_CAT_DEFAULT gstomx_debug
+
+/* Upper bound for the enumeration of formats and profiles, some
+ * components never return OMX_ErrorNoMore */
+#define MAX_QUERIES 64
+
+typedef struct
+{
+  const gchar *role;
+  const gchar *suffix;
+  GType (*get_type) (void);
+  gboolean decoder;
+} RoleInfo;
+
+static const RoleInfo roles[] = {
+  {"video_decoder.avc", "h264dec", gst_omx_h264_dec_get_type, TRUE},
+  {"video_decoder.mpeg4", "mpeg4videodec", gst_omx_mpeg4_video_dec_get_type,
+      TRUE},
+  {"video_decoder.h263", "h263dec", gst_omx_h263_dec_get_type, TRUE},
+  {"video_decoder.mpeg2", "mpeg2videodec", gst_omx_mpeg2_video_dec_get_type,
+      TRUE},
+  {"video_decoder.wmv", "wmvdec", gst_omx_wmv_dec_get_type, TRUE},
+  {"video_decoder.vc1", "vc1videodec", gst_omx_vc1_video_dec_get_type, TRUE},
+  {"video_encoder.avc", "h264enc", gst_omx_h264_enc_get_type, FALSE},
+  {"video_encoder.mpeg4", "mpeg4videoenc", gst_omx_mpeg4_video_enc_get_type,
+      FALSE},
+  {"video_encoder.h263", "h263enc", gst_omx_h263_enc_get_type, FALSE}
+};
+
+/* In increasing order, the OMX values are bit flags */
+static const struct
+{
+  OMX_VIDEO_AVCLEVELTYPE level;
+  const gchar *name;
+} h264_levels[] = {
+  {OMX_VIDEO_AVCLevel1, "1"}, {OMX_VIDEO_AVCLevel1b, "1b"},
+  {OMX_VIDEO_AVCLevel11, "1.1"}, {OMX_VIDEO_AVCLevel12, "1.2"},
+  {OMX_VIDEO_AVCLevel13, "1.3"}, {OMX_VIDEO_AVCLevel2, "2"},
+  {OMX_VIDEO_AVCLevel21, "2.1"}, {OMX_VIDEO_AVCLevel22, "2.2"},
+  {OMX_VIDEO_AVCLevel3, "3"}, {OMX_VIDEO_AVCLevel31, "3.1"},
+  {OMX_VIDEO_AVCLevel32, "3.2"}, {OMX_VIDEO_AVCLevel4, "4"},
+  {OMX_VIDEO_AVCLevel41, "4.1"}, {OMX_VIDEO_AVCLevel42, "4.2"},
+  {OMX_VIDEO_AVCLevel5, "5"}, {OMX_VIDEO_AVCLevel51, "5.1"}
+};
+
+static const struct
+{
+  OMX_VIDEO_AVCPROFILETYPE profile;
+  const gchar *name;
+} h264_profiles[] = {
+  /* Constrained baseline and progressive high streams are subsets
+   * of baseline and high, which h264parse names separately */
+  {OMX_VIDEO_AVCProfileBaseline, "baseline"},
+  {OMX_VIDEO_AVCProfileBaseline, "constrained-baseline"},
+  {OMX_VIDEO_AVCProfileMain, "main"},
+  {OMX_VIDEO_AVCProfileExtended, "extended"},
+  {OMX_VIDEO_AVCProfileHigh, "high"},
+  {OMX_VIDEO_AVCProfileHigh, "progressive-high"},
+  {OMX_VIDEO_AVCProfileHigh10, "high-10"},
+  {OMX_VIDEO_AVCProfileHigh422, "high-4:2:2"},
+  {OMX_VIDEO_AVCProfileHigh444, "high-4:4:4"}
+};
+
+static OMX_ERRORTYPE
+probe_event_handler (OMX_HANDLETYPE hComponent, OMX_PTR pAppData,
+    OMX_EVENTTYPE eEvent, OMX_U32 nData1, OMX_U32 nData2, OMX_PTR pEventData)
+{
+  return OMX_ErrorNone;
+}
+
+static OMX_ERRORTYPE
+probe_buffer_done (OMX_HANDLETYPE hComponent, OMX_PTR pAppData,
+    OMX_BUFFERHEADERTYPE * pBuffer)
+{
+  return OMX_ErrorNone;
+}
+
+/* Components are only queried in the Loaded state */
+static OMX_CALLBACKTYPE probe_callbacks =
+    { probe_event_handler, probe_buffer_done, probe_buffer_done };
+
+static const RoleInfo *
+get_role_info (const gchar * role)
+{
+  gint i;
+
+  for (i = 0; i < G_N_ELEMENTS (roles); i++) {
+    if (g_str_equal (roles[i].role, role))
+      return &roles[i];
+  }
+
+  return NULL;
+}
+
+static void
+probe_role (OMX_HANDLETYPE handle, const gchar * component_name,
+    const RoleInfo * info, GKeyFile * cache)
+{
+  OMX_PARAM_COMPONENTROLETYPE role_param;
+  OMX_PORT_PARAM_TYPE port_param;
+  OMX_VIDEO_PARAM_PORTFORMATTYPE format_param;
+  OMX_VIDEO_PARAM_PROFILELEVELTYPE profile_param;
+  OMX_ERRORTYPE err;
+  guint32 in_port_index, out_port_index, raw_port_index, coded_port_index;
+  GArray *formats, *profiles, *levels;
+  gchar *group;
+  gint i;
+
+  GST_OMX_INIT_STRUCT (&role_param);
+  g_strlcpy ((gchar *) role_param.cRole, info->role, sizeof (role_param.cRole));
+  err = OMX_SetParameter (handle, OMX_IndexParamStandardComponentRole,
+      &role_param);
+  if (err != OMX_ErrorNone)
+    GST_DEBUG ("Failed to set role '%s' of component '%s': %s (0x%08x)",
+        info->role, component_name, gst_omx_error_to_string (err), err);
+
+  GST_OMX_INIT_STRUCT (&port_param);
+  err = OMX_GetParameter (handle, OMX_IndexParamVideoInit, &port_param);
+  if (err != OMX_ErrorNone || port_param.nPorts < 2) {
+    GST_WARNING ("Component '%s' has no video ports for role '%s'",
+        component_name, info->role);
+    return;
+  }
+
+  in_port_index = port_param.nStartPortNumber;
+  out_port_index = port_param.nStartPortNumber + 1;
+  raw_port_index = info->decoder ? out_port_index : in_port_index;
+  coded_port_index = info->decoder ? in_port_index : out_port_index;
+
+  formats = g_array_new (FALSE, FALSE, sizeof (gint));
+  for (i = 0; i < MAX_QUERIES; i++) {
+    gint format;
+
+    GST_OMX_INIT_STRUCT (&format_param);
+    format_param.nPortIndex = raw_port_index;
+    format_param.nIndex = i;
+    if (OMX_GetParameter (handle, OMX_IndexParamVideoPortFormat,
+            &format_param) != OMX_ErrorNone)
+      break;
+
+    format = format_param.eColorFormat;
+    g_array_append_val (formats, format);
+  }
+
+  profiles = g_array_new (FALSE, FALSE, sizeof (gint));
+  levels = g_array_new (FALSE, FALSE, sizeof (gint));
+  for (i = 0; i < MAX_QUERIES; i++) {
+    gint profile, level;
+
+    GST_OMX_INIT_STRUCT (&profile_param);
+    profile_param.nPortIndex = coded_port_index;
+    profile_param.nProfileIndex = i;
+    if (OMX_GetParameter (handle,
+            OMX_IndexParamVideoProfileLevelQuerySupported,
+            &profile_param) != OMX_ErrorNone)
+      break;
+
+    profile = profile_param.eProfile;
+    level = profile_param.eLevel;
+    g_array_append_val (profiles, profile);
+    g_array_append_val (levels, level);
+  }
+
+  GST_DEBUG ("Component '%s' role '%s': %u color formats, %u profiles",
+      component_name, info->role, formats->len, profiles->len);
+
+  group = g_strdup_printf ("%s %s", component_name, info->role);
+  g_key_file_set_string (cache, group, "component-name", component_name);
+  g_key_file_set_string (cache, group, "component-role", info->role);
+  g_key_file_set_integer (cache, group, "in-port-index", in_port_index);
+  g_key_file_set_integer (cache, group, "out-port-index", out_port_index);
+  g_key_file_set_integer_list (cache, group, "color-formats",
+      (gint *) formats->data, formats->len);
+  g_key_file_set_integer_list (cache, group, "profiles",
+      (gint *) profiles->data, profiles->len);
+  g_key_file_set_integer_list (cache, group, "levels",
+      (gint *) levels->data, levels->len);
+  g_free (group);
+
+  g_array_free (formats, TRUE);
+  g_array_free (profiles, TRUE);
+  g_array_free (levels, TRUE);
+}
+
+static void
+probe_component (GstOMXCore * core, const gchar * component_name,
+    GKeyFile * cache)
+{
+  OMX_HANDLETYPE handle;
+  OMX_ERRORTYPE err;
+  OMX_U32 n_roles = 0, i;
+  gchar **component_roles;
+
+  err = core->get_roles_of_component ((OMX_STRING) component_name, &n_roles,
+      NULL);
+  if (err != OMX_ErrorNone || n_roles == 0)
+    return;
+
+  component_roles = g_new0 (gchar *, n_roles + 1);
+  for (i = 0; i < n_roles; i++)
+    component_roles[i] = g_malloc0 (OMX_MAX_STRINGNAME_SIZE);
+
+  err = core->get_roles_of_component ((OMX_STRING) component_name, &n_roles,
+      (OMX_U8 **) component_roles);
+  if (err != OMX_ErrorNone)
+    goto done;
+
+  err = core->get_handle (&handle, (OMX_STRING) component_name, NULL,
+      &probe_callbacks);
+  if (err != OMX_ErrorNone) {
+    GST_WARNING ("Failed to get handle of component '%s': %s (0x%08x)",
+        component_name, gst_omx_error_to_string (err), err);
+    goto done;
+  }
+
+  for (i = 0; i < n_roles; i++) {
+    const RoleInfo *info = get_role_info (component_roles[i]);
+
+    if (info)
+      probe_role (handle, component_name, info, cache);
+  }
+
+  core->free_handle (handle);
+
+done:
+  g_strfreev (component_roles);
+}
+
+static GKeyFile *
+probe_core (const gchar * core_name, gchar ** hacks)
+{
+  GstOMXCore *core;
+  GKeyFile *cache;
+  gchar component_name[OMX_MAX_STRINGNAME_SIZE];
+  OMX_U32 i;
+
+  if (gst_omx_parse_hacks (hacks) & GST_OMX_HACK_HYBRIS) {
+#ifndef HAVE_HYBRIS
+    GST_ERROR ("hybris hack enabled but hybris support has not been "
+        "compiled in");
+    return NULL;
+#else
+    core = gst_omx_core_acquire_hybris (core_name);
+#endif /* HAVE_HYBRIS */
+  } else
+    core = gst_omx_core_acquire (core_name);
+
+  if (!core)
+    return NULL;
+
+  if (!core->component_name_enum || !core->get_roles_of_component) {
+    GST_ERROR ("Core '%s' does not support enumerating components",
+        core_name);
+    gst_omx_core_release (core);
+    return NULL;
+  }
+
+  GST_INFO ("Probing components of core '%s'", core_name);
+
+  cache = g_key_file_new ();
+  for (i = 0; core->component_name_enum ((OMX_STRING) component_name,
+          sizeof (component_name), i) == OMX_ErrorNone; i++)
+    probe_component (core, component_name, cache);
+
+  gst_omx_core_release (core);
+
+  return cache;
+}
+
+static gchar *
+get_cache_filename (const gchar * core_name)
+{
+  gchar *checksum, *basename, *filename;
+
+  checksum = g_compute_checksum_for_string (G_CHECKSUM_MD5, core_name, -1);
+  basename = g_strdup_printf ("%s.cache", checksum);
+  filename =
+      g_build_filename (g_get_user_cache_dir (), "gst-omx", basename, NULL);
+  g_free (basename);
+  g_free (checksum);
+
+  return filename;
+}
+
+/* Returns NULL if there is no cache or it is outdated */
+static GKeyFile *
+load_cache (const gchar * filename, const gchar * core_name,
+    const struct stat *st)
+{
+  GKeyFile *cache;
+  gchar *cached_core_name;
+  gboolean valid;
+
+  cache = g_key_file_new ();
+  if (!g_key_file_load_from_file (cache, filename, G_KEY_FILE_NONE, NULL)) {
+    g_key_file_free (cache);
+    return NULL;
+  }
+
+  cached_core_name =
+      g_key_file_get_string (cache, GST_OMX_CAPS_CACHE_GROUP, "core-name",
+      NULL);
+  valid = g_key_file_get_integer (cache, GST_OMX_CAPS_CACHE_GROUP, "version",
+      NULL) == GST_OMX_CAPS_CACHE_VERSION
+      && g_strcmp0 (cached_core_name, core_name) == 0
+      && g_key_file_get_int64 (cache, GST_OMX_CAPS_CACHE_GROUP, "core-mtime",
+      NULL) == (gint64) st->st_mtime
+      && g_key_file_get_int64 (cache, GST_OMX_CAPS_CACHE_GROUP, "core-size",
+      NULL) == (gint64) st->st_size;
+  g_free (cached_core_name);
+
+  if (!valid) {
+    GST_DEBUG ("Cache '%s' of core '%s' is outdated", filename, core_name);
+    g_key_file_free (cache);
+    return NULL;
+  }
+
+  return cache;
+}
+
+static void
+save_cache (GKeyFile * cache, const gchar * filename, const gchar * core_name,
+    const struct stat *st)
+{
+  GError *err = NULL;
+  gchar *dirname, *data;
+  gsize length;
+
+  g_key_file_set_integer (cache, GST_OMX_CAPS_CACHE_GROUP, "version",
+      GST_OMX_CAPS_CACHE_VERSION);
+  g_key_file_set_string (cache, GST_OMX_CAPS_CACHE_GROUP, "core-name",
+      core_name);
+  g_key_file_set_int64 (cache, GST_OMX_CAPS_CACHE_GROUP, "core-mtime",
+      st->st_mtime);
+  g_key_file_set_int64 (cache, GST_OMX_CAPS_CACHE_GROUP, "core-size",
+      st->st_size);
+
+  dirname = g_path_get_dirname (filename);
+  g_mkdir_with_parents (dirname, 0755);
+  g_free (dirname);
+
+  /* Not fatal, the core is probed again next time */
+  data = g_key_file_to_data (cache, &length, NULL);
+  if (!g_file_set_contents (filename, data, length, &err)) {
+    GST_WARNING ("Failed to write cache '%s': %s", filename, err->message);
+    g_error_free (err);
+  }
+  g_free (data);
+}
+
+static GstCaps *
+get_raw_caps (const gchar * template_caps, const gint * formats,
+    gsize n_formats)
+{
+  GstCaps *caps;
+  GValue list = { 0, };
+  GValue fourcc = { 0, };
+  gboolean have_i420 = FALSE, have_nv12 = FALSE;
+  gsize i;
+  guint j;
+
+  caps = gst_caps_from_string (template_caps);
+
+  /* The only formats the elements can handle */
+  for (i = 0; i < n_formats; i++) {
+    if (formats[i] == OMX_COLOR_FormatYUV420Planar)
+      have_i420 = TRUE;
+    else if (formats[i] == OMX_COLOR_FormatYUV420SemiPlanar)
+      have_nv12 = TRUE;
+  }
+
+  if (!have_i420 && !have_nv12)
+    return caps;
+
+  g_value_init (&list, GST_TYPE_LIST);
+  g_value_init (&fourcc, GST_TYPE_FOURCC);
+  if (have_i420) {
+    gst_value_set_fourcc (&fourcc, GST_MAKE_FOURCC ('I', '4', '2', '0'));
+    gst_value_list_append_value (&list, &fourcc);
+  }
+  if (have_nv12) {
+    gst_value_set_fourcc (&fourcc, GST_MAKE_FOURCC ('N', 'V', '1', '2'));
+    gst_value_list_append_value (&list, &fourcc);
+  }
+
+  for (j = 0; j < gst_caps_get_size (caps); j++) {
+    GstStructure *s = gst_caps_get_structure (caps, j);
+
+    if (gst_structure_has_name (s, "video/x-raw-yuv"))
+      gst_structure_set_value (s, "format", &list);
+  }
+
+  g_value_unset (&fourcc);
+  g_value_unset (&list);
+
+  return caps;
+}
+
+/* One structure per supported profile with all levels up to
+ * the highest one the component supports for it */
+static GstCaps *
+get_h264_caps (const gchar * template_caps, const gint * profiles,
+    const gint * levels, gsize n_profiles)
+{
+  GstCaps *templ, *caps;
+  gint i, k;
+  gsize j;
+  guint l;
+
+  templ = gst_caps_from_string (template_caps);
+  caps = gst_caps_new_empty ();
+
+  for (i = 0; i < G_N_ELEMENTS (h264_profiles); i++) {
+    GValue list = { 0, };
+    GValue level = { 0, };
+    gint max_level = 0;
+
+    for (j = 0; j < n_profiles; j++) {
+      if (profiles[j] == (gint) h264_profiles[i].profile)
+        max_level = MAX (max_level, levels[j]);
+    }
+    if (max_level == 0)
+      continue;
+
+    g_value_init (&list, GST_TYPE_LIST);
+    g_value_init (&level, G_TYPE_STRING);
+    for (k = 0; k < G_N_ELEMENTS (h264_levels); k++) {
+      if ((gint) h264_levels[k].level > max_level)
+        break;
+      g_value_set_static_string (&level, h264_levels[k].name);
+      gst_value_list_append_value (&list, &level);
+    }
+
+    for (l = 0; l < gst_caps_get_size (templ); l++) {
+      GstStructure *s = gst_structure_copy (gst_caps_get_structure (templ, l));
+
+      gst_structure_set (s, "profile", G_TYPE_STRING, h264_profiles[i].name,
+          NULL);
+      gst_structure_set_value (s, "level", &list);
+      gst_caps_append_structure (caps, s);
+    }
+
+    g_value_unset (&level);
+    g_value_unset (&list);
+  }
+
+  if (gst_caps_is_empty (caps)) {
+    gst_caps_unref (caps);
+    return templ;
+  }
+
+  gst_caps_unref (templ);
+  return caps;
+}
+
+/* Returns TRUE if the configuration already has an element
+ * for this component and role */
+static gboolean
+is_configured (GKeyFile * config, const gchar * core_name,
+    const gchar * component_name, const gchar * component_role)
+{
+  gchar **groups;
+  gsize n_groups, i;
+  gboolean ret = FALSE;
+
+  groups = g_key_file_get_groups (config, &n_groups);
+  for (i = 0; i < n_groups && !ret; i++) {
+    gchar *core, *component, *role;
+
+    core = g_key_file_get_string (config, groups[i], "core-name", NULL);
+    component =
+        g_key_file_get_string (config, groups[i], "component-name", NULL);
+    role = g_key_file_get_string (config, groups[i], "component-role", NULL);
+
+    ret = g_strcmp0 (core, core_name) == 0
+        && g_strcmp0 (component, component_name) == 0
+        && (!role || g_strcmp0 (role, component_role) == 0);
+
+    g_free (role);
+    g_free (component);
+    g_free (core);
+  }
+  g_strfreev (groups);
+
+  return ret;
+}
+
+static gchar *
+get_element_name (const gchar * component_name, const RoleInfo * info)
+{
+  GString *name;
+  const gchar *p;
+
+  if (g_str_has_prefix (component_name, "OMX."))
+    component_name += 4;
+
+  name = g_string_new ("omx");
+  for (p = component_name; *p; p++) {
+    if (g_ascii_isalnum (*p))
+      g_string_append_c (name, g_ascii_tolower (*p));
+  }
+  g_string_append_c (name, '-');
+  g_string_append (name, info->suffix);
+
+  return g_string_free (name, FALSE);
+}
+
+static void
+add_element (GKeyFile * config, GKeyFile * cache, const gchar * group,
+    const gchar * core_name, gint rank, gchar ** hacks)
+{
+  const RoleInfo *info;
+  GTypeClass *klass;
+  GType type;
+  const gchar *raw_template_caps, *coded_template_caps;
+  gchar *component_name, *component_role, *element_name, *str;
+  gint *formats, *profiles, *levels;
+  gsize n_formats = 0, n_profiles = 0, n_levels = 0;
+  GstCaps *raw_caps, *coded_caps;
+
+  component_name =
+      g_key_file_get_string (cache, group, "component-name", NULL);
+  component_role =
+      g_key_file_get_string (cache, group, "component-role", NULL);
+  if (!component_name || !component_role
+      || !(info = get_role_info (component_role)))
+    goto done;
+
+  if (is_configured (config, core_name, component_name, component_role)) {
+    GST_DEBUG ("Component '%s' with role '%s' is configured already",
+        component_name, component_role);
+    goto done;
+  }
+
+  element_name = get_element_name (component_name, info);
+  if (g_key_file_has_group (config, element_name)) {
+    GST_WARNING ("Element '%s' exists already", element_name);
+    g_free (element_name);
+    goto done;
+  }
+
+  type = info->get_type ();
+  klass = g_type_class_ref (type);
+  if (info->decoder) {
+    coded_template_caps =
+        GST_OMX_VIDEO_DEC_CLASS (klass)->default_sink_template_caps;
+    raw_template_caps =
+        GST_OMX_VIDEO_DEC_CLASS (klass)->default_src_template_caps;
+  } else {
+    raw_template_caps =
+        GST_OMX_VIDEO_ENC_CLASS (klass)->default_sink_template_caps;
+    coded_template_caps =
+        GST_OMX_VIDEO_ENC_CLASS (klass)->default_src_template_caps;
+  }
+  g_type_class_unref (klass);
+
+  formats =
+      g_key_file_get_integer_list (cache, group, "color-formats", &n_formats,
+      NULL);
+  profiles =
+      g_key_file_get_integer_list (cache, group, "profiles", &n_profiles,
+      NULL);
+  levels =
+      g_key_file_get_integer_list (cache, group, "levels", &n_levels, NULL);
+
+  raw_caps = get_raw_caps (raw_template_caps, formats, n_formats);
+  if (g_str_equal (info->suffix, "h264dec")
+      || g_str_equal (info->suffix, "h264enc"))
+    coded_caps = get_h264_caps (coded_template_caps, profiles, levels,
+        MIN (n_profiles, n_levels));
+  else
+    coded_caps = gst_caps_from_string (coded_template_caps);
+
+  GST_INFO ("Adding element '%s' for component '%s' with role '%s'",
+      element_name, component_name, component_role);
+
+  g_key_file_set_string (config, element_name, "type-name",
+      g_type_name (type));
+  g_key_file_set_string (config, element_name, "core-name", core_name);
+  g_key_file_set_string (config, element_name, "component-name",
+      component_name);
+  g_key_file_set_string (config, element_name, "component-role",
+      component_role);
+  g_key_file_set_integer (config, element_name, "rank", rank);
+  g_key_file_set_integer (config, element_name, "in-port-index",
+      g_key_file_get_integer (cache, group, "in-port-index", NULL));
+  g_key_file_set_integer (config, element_name, "out-port-index",
+      g_key_file_get_integer (cache, group, "out-port-index", NULL));
+
+  str = gst_caps_to_string (info->decoder ? coded_caps : raw_caps);
+  g_key_file_set_string (config, element_name, "sink-template-caps", str);
+  g_free (str);
+  str = gst_caps_to_string (info->decoder ? raw_caps : coded_caps);
+  g_key_file_set_string (config, element_name, "src-template-caps", str);
+  g_free (str);
+
+  if (hacks)
+    g_key_file_set_string_list (config, element_name, "hacks",
+        (const gchar * const *) hacks, g_strv_length (hacks));
+
+  gst_caps_unref (coded_caps);
+  gst_caps_unref (raw_caps);
+  g_free (levels);
+  g_free (profiles);
+  g_free (formats);
+  g_free (element_name);
+
+done:
+  g_free (component_role);
+  g_free (component_name);
+}
+
+/**
+ * gst_omx_caps_cache_register_core:
+ * @plugin: the plugin that is loaded
+ * @config: the configuration
+ * @core_name: filename of an OpenMAX IL core
+ * @rank: rank for the new elements
+ * @hacks: hacks for loading the core and for the new elements
+ *
+ * Adds an element configuration to @config for every component of
+ * @core_name with a supported role that is not configured yet.
+ * Probing results are taken from the cache if the core is unchanged.
+ */
+void
+gst_omx_caps_cache_register_core (GstPlugin * plugin, GKeyFile * config,
+    const gchar * core_name, gint rank, gchar ** hacks)
+{
+  GKeyFile *cache;
+  struct stat st;
+  gchar *filename, *dirname, *basename;
+  gchar **groups;
+  gsize n_groups, i;
+
+  if (g_stat (core_name, &st) != 0) {
+    GST_ERROR ("Core '%s' does not exist", core_name);
+    return;
+  }
+
+  /* Rescan the plugin if the core changes */
+  dirname = g_path_get_dirname (core_name);
+  basename = g_path_get_basename (core_name);
+  gst_plugin_add_dependency_simple (plugin, NULL, dirname, basename,
+      GST_PLUGIN_DEPENDENCY_FLAG_NONE);
+  g_free (basename);
+  g_free (dirname);
+
+  filename = get_cache_filename (core_name);
+  cache = load_cache (filename, core_name, &st);
+  if (!cache) {
+    cache = probe_core (core_name, hacks);
+    if (!cache) {
+      g_free (filename);
+      return;
+    }
+    save_cache (cache, filename, core_name, &st);
+  }
+  g_free (filename);
+
+  groups = g_key_file_get_groups (cache, &n_groups);
+  for (i = 0; i < n_groups; i++) {
+    if (!g_str_equal (groups[i], GST_OMX_CAPS_CACHE_GROUP))
+      add_element (config, cache, groups[i], core_name, rank, hacks);
+  }
+  g_strfreev (groups);
+
+  g_key_file_free (cache);
+}
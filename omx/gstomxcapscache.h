@@ -0,0 +1,40 @@
+/*
+ * Copyright (C) 2013, Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+#ifndef __GST_OMX_CAPS_CACHE_H__
+#define __GST_OMX_CAPS_CACHE_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/* Bump whenever the layout of the cache files or the caps
+ * derived from the probed parameters change */
+#define GST_OMX_CAPS_CACHE_VERSION 2
+
+/* Group of the cache files that describes the probed core */
+#define GST_OMX_CAPS_CACHE_GROUP "gst-omx-cache"
+
+void gst_omx_caps_cache_register_core (GstPlugin * plugin, GKeyFile * config,
+                                       const gchar * core_name, gint rank,
+                                       gchar ** hacks);
+
+G_END_DECLS
+
+#endif /* __GST_OMX_CAPS_CACHE_H__ */
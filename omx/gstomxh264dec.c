@@ -39,6 +39,8 @@ static gboolean gst_omx_h264_dec_is_format_change (GstOMXVideoDec * dec,
     GstOMXPort * port, GstVideoState * state);
 static gboolean gst_omx_h264_dec_set_format (GstOMXVideoDec * dec,
     GstOMXPort * port, GstVideoState * state);
+static gboolean gst_omx_h264_dec_is_droppable (GstOMXVideoDec * dec,
+    GstVideoFrame * frame);
 
 enum
 {
@@ -83,6 +85,8 @@ gst_omx_h264_dec_class_init (GstOMXH264DecClass * klass)
   videodec_class->is_format_change =
       GST_DEBUG_FUNCPTR (gst_omx_h264_dec_is_format_change);
   videodec_class->set_format = GST_DEBUG_FUNCPTR (gst_omx_h264_dec_set_format);
+  videodec_class->is_droppable =
+      GST_DEBUG_FUNCPTR (gst_omx_h264_dec_is_droppable);
 
   videodec_class->default_sink_template_caps = "video/x-h264, "
       "parsed=(boolean) true, "
@@ -113,12 +117,77 @@ static gboolean
 gst_omx_h264_dec_set_format (GstOMXVideoDec * dec, GstOMXPort * port,
     GstVideoState * state)
 {
+  GstOMXH264Dec *self = GST_OMX_H264_DEC (dec);
   gboolean ret;
   OMX_PARAM_PORTDEFINITIONTYPE port_def;
 
+  /* avcC codec_data, the stream is in the avc format then */
+  if (state->codec_data && GST_BUFFER_SIZE (state->codec_data) >= 7
+      && GST_BUFFER_DATA (state->codec_data)[0] == 1)
+    self->nal_length_size = (GST_BUFFER_DATA (state->codec_data)[4] & 0x3) + 1;
+  else
+    self->nal_length_size = 0;
+
   gst_omx_port_get_port_definition (port, &port_def);
   port_def.format.video.eCompressionFormat = OMX_VIDEO_CodingAVC;
   ret = gst_omx_port_update_port_definition (port, &port_def);
 
   return ret;
 }
+
+/* Returns the header byte of the first slice NAL unit of the access
+ * unit, or -1 if there is none */
+static gint
+gst_omx_h264_dec_find_slice (GstOMXH264Dec * self, const guint8 * data,
+    guint size)
+{
+  guint i, nal_size;
+  guint8 header;
+
+  if (self->nal_length_size == 0) {
+    /* Emulation prevention makes start codes unique */
+    for (i = 0; i + 3 < size; i++) {
+      if (data[i] != 0 || data[i + 1] != 0 || data[i + 2] != 1)
+        continue;
+
+      i += 3;
+      header = data[i];
+      if ((header & 0x1f) >= 1 && (header & 0x1f) <= 5)
+        return header;
+    }
+  } else {
+    i = 0;
+    while (i + self->nal_length_size < size) {
+      guint j;
+
+      nal_size = 0;
+      for (j = 0; j < self->nal_length_size; j++)
+        nal_size = (nal_size << 8) | data[i + j];
+      i += self->nal_length_size;
+
+      header = data[i];
+      if ((header & 0x1f) >= 1 && (header & 0x1f) <= 5)
+        return header;
+      if (nal_size > size - i)
+        break;
+      i += nal_size;
+    }
+  }
+
+  return -1;
+}
+
+/* Access units are only referenced by others if nal_ref_idc of
+ * their slices is not 0, it's the same for all slices */
+static gboolean
+gst_omx_h264_dec_is_droppable (GstOMXVideoDec * dec, GstVideoFrame * frame)
+{
+  GstOMXH264Dec *self = GST_OMX_H264_DEC (dec);
+  gint header;
+
+  header =
+      gst_omx_h264_dec_find_slice (self, GST_BUFFER_DATA (frame->sink_buffer),
+      GST_BUFFER_SIZE (frame->sink_buffer));
+
+  return header != -1 && (header & 0x60) == 0;
+}
@@ -45,6 +45,10 @@ typedef struct _GstOMXH264DecClass GstOMXH264DecClass;
 struct _GstOMXH264Dec
 {
   GstOMXVideoDec parent;
+
+  /* Size of the NAL unit length fields of the avc stream
+   * format, 0 for the byte-stream format */
+  guint nal_length_size;
 };
 
 struct _GstOMXH264DecClass
@@ -31,6 +31,10 @@ GST_DEBUG_CATEGORY_STATIC (gst_omx_h264_enc_debug_category);
 
 /* prototypes */
 static void gst_omx_h264_enc_finalize (GObject * object);
+static void gst_omx_h264_enc_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec);
+static void gst_omx_h264_enc_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec);
 static gboolean gst_omx_h264_enc_set_format (GstOMXVideoEnc * enc,
     GstOMXPort * port, GstVideoState * state);
 static GstCaps *gst_omx_h264_enc_get_caps (GstOMXVideoEnc * enc,
@@ -40,9 +44,12 @@ static GstFlowReturn gst_omx_h264_enc_handle_output_frame (GstOMXVideoEnc *
 
 enum
 {
-  PROP_0
+  PROP_0,
+  PROP_SLICE_MBS
 };
 
+#define DEFAULT_SLICE_MBS (0)
+
 /* class initialization */
 
 #define DEBUG_INIT(bla) \
@@ -77,6 +84,16 @@ gst_omx_h264_enc_class_init (GstOMXH264EncClass * klass)
   GstOMXVideoEncClass *videoenc_class = GST_OMX_VIDEO_ENC_CLASS (klass);
 
   gobject_class->finalize = gst_omx_h264_enc_finalize;
+  gobject_class->set_property = gst_omx_h264_enc_set_property;
+  gobject_class->get_property = gst_omx_h264_enc_get_property;
+
+  g_object_class_install_property (gobject_class, PROP_SLICE_MBS,
+      g_param_spec_uint ("slice-mbs", "Slice macroblocks",
+          "Macroblocks per slice, in low latency mode every slice is pushed "
+          "as soon as it is encoded (0=component default)",
+          0, G_MAXUINT, DEFAULT_SLICE_MBS,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
 
   videoenc_class->set_format = GST_DEBUG_FUNCPTR (gst_omx_h264_enc_set_format);
   videoenc_class->get_caps = GST_DEBUG_FUNCPTR (gst_omx_h264_enc_get_caps);
@@ -90,6 +107,7 @@ gst_omx_h264_enc_class_init (GstOMXH264EncClass * klass)
 static void
 gst_omx_h264_enc_init (GstOMXH264Enc * self, GstOMXH264EncClass * klass)
 {
+  self->slice_mbs = DEFAULT_SLICE_MBS;
 }
 
 static void
@@ -100,6 +118,103 @@ gst_omx_h264_enc_finalize (GObject * object)
   G_OBJECT_CLASS (parent_class)->finalize (object);
 }
 
+static void
+gst_omx_h264_enc_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstOMXH264Enc *self = GST_OMX_H264_ENC (object);
+
+  switch (prop_id) {
+    case PROP_SLICE_MBS:
+      self->slice_mbs = g_value_get_uint (value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_omx_h264_enc_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec)
+{
+  GstOMXH264Enc *self = GST_OMX_H264_ENC (object);
+
+  switch (prop_id) {
+    case PROP_SLICE_MBS:
+      g_value_set_uint (value, self->slice_mbs);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+/* Splits the frames into slices of slice-mbs macroblocks and, in low
+ * latency mode, disables B-frames, which delay the output, and keyframes
+ * other than the first if intra refresh replaces them */
+static gboolean
+gst_omx_h264_enc_set_avc_params (GstOMXH264Enc * self)
+{
+  GstOMXVideoEnc *enc = GST_OMX_VIDEO_ENC (self);
+  OMX_VIDEO_PARAM_AVCTYPE param;
+  OMX_ERRORTYPE err;
+
+  if (self->slice_mbs == 0 && !enc->buffer_config.low_latency)
+    return TRUE;
+
+  GST_OMX_INIT_STRUCT (&param);
+  param.nPortIndex = enc->out_port->index;
+  enc->component->reusable = FALSE;
+
+  err = gst_omx_component_get_parameter (enc->component,
+      OMX_IndexParamVideoAvc, &param);
+  if (err != OMX_ErrorNone) {
+    GST_WARNING_OBJECT (self, "Getting AVC parameters not supported: %s "
+        "(0x%08x)", gst_omx_error_to_string (err), err);
+    return TRUE;
+  }
+
+  if (self->slice_mbs > 0)
+    param.nSliceHeaderSpacing = self->slice_mbs;
+  if (enc->buffer_config.low_latency) {
+    param.nBFrames = 0;
+    param.nAllowedPictureTypes &= ~OMX_VIDEO_PictureTypeB;
+    if (enc->intra_refresh)
+      param.nPFrames = 0xffffffff;
+  }
+
+  err = gst_omx_component_set_parameter (enc->component,
+      OMX_IndexParamVideoAvc, &param);
+  if (err == OMX_ErrorUnsupportedIndex || err == OMX_ErrorUnsupportedSetting) {
+    GST_WARNING_OBJECT (self, "Setting AVC parameters not supported: %s "
+        "(0x%08x)", gst_omx_error_to_string (err), err);
+  } else if (err != OMX_ErrorNone) {
+    GST_ERROR_OBJECT (self, "Error setting AVC parameters: %s (0x%08x)",
+        gst_omx_error_to_string (err), err);
+    return FALSE;
+  }
+
+  if (self->slice_mbs > 0) {
+    OMX_VIDEO_PARAM_AVCSLICEFMO fmo;
+
+    GST_OMX_INIT_STRUCT (&fmo);
+    fmo.nPortIndex = enc->out_port->index;
+    err = gst_omx_component_get_parameter (enc->component,
+        OMX_IndexParamVideoSliceFMO, &fmo);
+    if (err == OMX_ErrorNone) {
+      fmo.eSliceMode = OMX_VIDEO_SLICEMODE_AVCMBSlice;
+      err = gst_omx_component_set_parameter (enc->component,
+          OMX_IndexParamVideoSliceFMO, &fmo);
+    }
+    if (err != OMX_ErrorNone)
+      GST_INFO_OBJECT (self, "Setting the slice mode not supported: %s "
+          "(0x%08x)", gst_omx_error_to_string (err), err);
+  }
+
+  return TRUE;
+}
+
 static gboolean
 gst_omx_h264_enc_set_format (GstOMXVideoEnc * enc, GstOMXPort * port,
     GstVideoState * state)
@@ -208,6 +323,11 @@ gst_omx_h264_enc_set_format (GstOMXVideoEnc * enc, GstOMXPort * port,
     return FALSE;
   }
 
+  /* Only possible before the buffers are allocated */
+  if (gst_omx_component_get_state (enc->component, 0) == OMX_StateLoaded
+      && !gst_omx_h264_enc_set_avc_params (self))
+    return FALSE;
+
   return TRUE;
 }
 
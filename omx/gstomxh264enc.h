@@ -45,6 +45,9 @@ typedef struct _GstOMXH264EncClass GstOMXH264EncClass;
 struct _GstOMXH264Enc
 {
   GstOMXVideoEnc parent;
+
+  /* properties */
+  guint32 slice_mbs;
 };
 
 struct _GstOMXH264EncClass
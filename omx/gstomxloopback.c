@@ -0,0 +1,1542 @@
+/*
+ * Copyright (C) 2013, Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+/*
+ * Software loopback OpenMAX IL core
+ *
+ * This is a minimal OpenMAX IL core that provides a video decoder and a
+ * video encoder component which do not decode or encode anything. Input
+ * buffers are copied into output buffers of a plausible size after a
+ * configurable delay. It allows to run and profile the plugin on machines
+ * without any OpenMAX hardware, e.g. with a gstomx.conf section like:
+ *
+ *   [omxh264dec]
+ *   type-name=GstOMXH264Dec
+ *   core-name=/usr/lib/gst-omx/libomxloopback.so
+ *   component-name=OMX.loopback.video_decoder
+ *   rank=0
+ *   in-port-index=0
+ *   out-port-index=1
+ *
+ * The behaviour of the components is configured with the
+ * GST_OMX_LOOPBACK environment variable, which contains a ';' separated
+ * list of key=value pairs:
+ *
+ *   latency=<usecs>            Delay between EmptyThisBuffer() and the
+ *                              corresponding output buffer (default: 0)
+ *   buffer-count=<n>           nBufferCountMin of all ports (default: 4)
+ *   stride-align=<n>           Alignment of nStride of raw video ports
+ *                              (default: 16)
+ *   slice-height-align=<n>     Alignment of nSliceHeight of raw video ports
+ *                              (default: 16)
+ *   reorder=<n>                Number of decoded frames that are held back
+ *                              and output in timestamp order (default: 0)
+ *   compression=<n>            Size ratio between encoder input and output
+ *                              (default: 20)
+ *   keyframe-interval=<n>      Distance between encoder sync frames
+ *                              (default: 30)
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <glib.h>
+#include <string.h>
+
+#include <OMX_Core.h>
+#include <OMX_Component.h>
+
+#define LOOPBACK_INIT_STRUCT(st) G_STMT_START { \
+  memset ((st), 0, sizeof (*(st))); \
+  (st)->nSize = sizeof (*(st)); \
+  (st)->nVersion.s.nVersionMajor = OMX_VERSION_MAJOR; \
+  (st)->nVersion.s.nVersionMinor = OMX_VERSION_MINOR; \
+  (st)->nVersion.s.nRevision = OMX_VERSION_REVISION; \
+  (st)->nVersion.s.nStep = OMX_VERSION_STEP; \
+} G_STMT_END
+
+#define LOOPBACK_DECODER_NAME "OMX.loopback.video_decoder"
+#define LOOPBACK_ENCODER_NAME "OMX.loopback.video_encoder"
+
+#define LOOPBACK_IN_PORT 0
+#define LOOPBACK_OUT_PORT 1
+#define LOOPBACK_N_PORTS 2
+
+#define LOOPBACK_DEFAULT_WIDTH 176
+#define LOOPBACK_DEFAULT_HEIGHT 144
+#define LOOPBACK_MIN_BITSTREAM_BUFFER_SIZE (64 * 1024)
+
+/* Fake AVC SPS/PPS with start code, emitted as encoder codec config */
+static const OMX_U8 loopback_codec_config[] = {
+  0x00, 0x00, 0x00, 0x01, 0x67, 0x42, 0x00, 0x0a, 0xf8, 0x41, 0xa2,
+  0x00, 0x00, 0x00, 0x01, 0x68, 0xce, 0x38, 0x80
+};
+
+typedef enum
+{
+  LOOPBACK_TYPE_DECODER,
+  LOOPBACK_TYPE_ENCODER
+} LoopbackType;
+
+typedef struct
+{
+  const gchar *role;
+  OMX_VIDEO_CODINGTYPE coding;
+} LoopbackRole;
+
+static const LoopbackRole decoder_roles[] = {
+  {"video_decoder.avc", OMX_VIDEO_CodingAVC},
+  {"video_decoder.mpeg4", OMX_VIDEO_CodingMPEG4},
+  {"video_decoder.h263", OMX_VIDEO_CodingH263},
+  {"video_decoder.mpeg2", OMX_VIDEO_CodingMPEG2},
+  {"video_decoder.wmv", OMX_VIDEO_CodingWMV},
+  {"video_decoder.vc1", OMX_VIDEO_CodingWMV},
+  {NULL, OMX_VIDEO_CodingUnused}
+};
+
+static const LoopbackRole encoder_roles[] = {
+  {"video_encoder.avc", OMX_VIDEO_CodingAVC},
+  {"video_encoder.mpeg4", OMX_VIDEO_CodingMPEG4},
+  {"video_encoder.h263", OMX_VIDEO_CodingH263},
+  {NULL, OMX_VIDEO_CodingUnused}
+};
+
+static const OMX_COLOR_FORMATTYPE loopback_color_formats[] = {
+  OMX_COLOR_FormatYUV420Planar,
+  OMX_COLOR_FormatYUV420SemiPlanar
+};
+
+typedef struct
+{
+  gint64 latency;
+  guint buffer_count;
+  guint stride_align;
+  guint slice_height_align;
+  guint reorder;
+  guint compression;
+  guint keyframe_interval;
+} LoopbackConfig;
+
+typedef struct
+{
+  /* Must be the first member, headers are cast to LoopbackBuffer */
+  OMX_BUFFERHEADERTYPE header;
+  /* TRUE if pBuffer was allocated by us */
+  gboolean allocated;
+  /* Monotonic time at which an input buffer may be processed */
+  gint64 ready_time;
+} LoopbackBuffer;
+
+typedef struct
+{
+  OMX_PARAM_PORTDEFINITIONTYPE def;
+  /* Number of buffer headers on this port */
+  guint n_buffers;
+  /* LoopbackBuffers currently owned by the component */
+  GQueue queue;
+} LoopbackPort;
+
+typedef struct
+{
+  OMX_COMMANDTYPE cmd;
+  OMX_U32 param;
+  gboolean started;
+} LoopbackCommand;
+
+typedef struct
+{
+  OMX_COMPONENTTYPE *handle;
+  LoopbackType type;
+  const gchar *name;
+  gchar role[OMX_MAX_STRINGNAME_SIZE];
+  LoopbackConfig config;
+
+  OMX_CALLBACKTYPE callbacks;
+  OMX_PTR app_data;
+
+  GMutex lock;
+  GCond cond;
+  GThread *thread;
+  gboolean shutdown;            /* LOCK */
+
+  OMX_STATETYPE state;          /* LOCK */
+  GQueue commands;              /* LOCK */
+  LoopbackPort ports[LOOPBACK_N_PORTS]; /* LOCK */
+
+  /* Decoded output buffers held back for reordering, sorted by
+   * timestamp. LOCK */
+  GQueue reorder;
+
+  guint64 n_frames;             /* LOCK */
+  gboolean codec_config_sent;   /* LOCK */
+  gboolean force_keyframe;      /* LOCK */
+  OMX_VIDEO_PARAM_BITRATETYPE bitrate;  /* LOCK */
+  OMX_VIDEO_PARAM_QUANTIZATIONTYPE quantization;        /* LOCK */
+} LoopbackComponent;
+
+static LoopbackConfig loopback_config;
+static gint loopback_init_count = 0;
+
+static guint
+loopback_parse_uint (const gchar * value, guint def)
+{
+  gchar *end = NULL;
+  guint64 v;
+
+  v = g_ascii_strtoull (value, &end, 10);
+  if (end == value || v > G_MAXUINT)
+    return def;
+  return (guint) v;
+}
+
+static void
+loopback_config_load (LoopbackConfig * config)
+{
+  const gchar *env;
+  gchar **pairs, **p;
+
+  config->latency = 0;
+  config->buffer_count = 4;
+  config->stride_align = 16;
+  config->slice_height_align = 16;
+  config->reorder = 0;
+  config->compression = 20;
+  config->keyframe_interval = 30;
+
+  env = g_getenv ("GST_OMX_LOOPBACK");
+  if (!env)
+    return;
+
+  pairs = g_strsplit (env, ";", -1);
+  for (p = pairs; *p; p++) {
+    gchar **kv = g_strsplit (g_strstrip (*p), "=", 2);
+
+    if (kv[0] && kv[1]) {
+      if (g_str_equal (kv[0], "latency"))
+        config->latency = loopback_parse_uint (kv[1], 0);
+      else if (g_str_equal (kv[0], "buffer-count"))
+        config->buffer_count = loopback_parse_uint (kv[1], 4);
+      else if (g_str_equal (kv[0], "stride-align"))
+        config->stride_align = loopback_parse_uint (kv[1], 16);
+      else if (g_str_equal (kv[0], "slice-height-align"))
+        config->slice_height_align = loopback_parse_uint (kv[1], 16);
+      else if (g_str_equal (kv[0], "reorder"))
+        config->reorder = loopback_parse_uint (kv[1], 0);
+      else if (g_str_equal (kv[0], "compression"))
+        config->compression = loopback_parse_uint (kv[1], 20);
+      else if (g_str_equal (kv[0], "keyframe-interval"))
+        config->keyframe_interval = loopback_parse_uint (kv[1], 30);
+      else
+        g_warning ("Unknown loopback setting '%s'", kv[0]);
+    }
+    g_strfreev (kv);
+  }
+  g_strfreev (pairs);
+
+  /* Sanitize, 0 would mean division by zero or no buffers at all */
+  config->buffer_count = MAX (config->buffer_count, 1);
+  config->stride_align = MAX (config->stride_align, 1);
+  config->slice_height_align = MAX (config->slice_height_align, 1);
+  config->compression = MAX (config->compression, 1);
+  config->keyframe_interval = MAX (config->keyframe_interval, 1);
+}
+
+static inline guint
+loopback_align (guint value, guint align)
+{
+  return ((value + align - 1) / align) * align;
+}
+
+/* NOTE: Call with comp->lock */
+static void
+loopback_port_update_layout (LoopbackComponent * comp, LoopbackPort * port)
+{
+  OMX_VIDEO_PORTDEFINITIONTYPE *video = &port->def.format.video;
+  OMX_U32 size;
+
+  if (video->eCompressionFormat == OMX_VIDEO_CodingUnused) {
+    video->nStride = loopback_align (video->nFrameWidth,
+        comp->config.stride_align);
+    video->nSliceHeight = loopback_align (video->nFrameHeight,
+        comp->config.slice_height_align);
+
+    /* Both I420 and NV12 use the same amount of memory, the chroma
+     * planes start at nStride * nSliceHeight */
+    size = video->nStride * video->nSliceHeight;
+    size += 2 * ((video->nStride + 1) / 2) * ((video->nSliceHeight + 1) / 2);
+  } else {
+    video->nStride = 0;
+    video->nSliceHeight = 0;
+    size = MAX (LOOPBACK_MIN_BITSTREAM_BUFFER_SIZE,
+        (video->nFrameWidth * video->nFrameHeight * 3) / 4);
+  }
+
+  port->def.nBufferSize = size;
+}
+
+static void
+loopback_port_init (LoopbackComponent * comp, LoopbackPort * port,
+    OMX_U32 index, gboolean compressed)
+{
+  OMX_PARAM_PORTDEFINITIONTYPE *def = &port->def;
+
+  LOOPBACK_INIT_STRUCT (def);
+  def->nPortIndex = index;
+  def->eDir = (index == LOOPBACK_IN_PORT) ? OMX_DirInput : OMX_DirOutput;
+  def->nBufferCountMin = comp->config.buffer_count;
+  /* Reordered frames are owned by the component, the client needs
+   * enough buffers on top of that to make progress */
+  if (comp->type == LOOPBACK_TYPE_DECODER && index == LOOPBACK_OUT_PORT)
+    def->nBufferCountMin += comp->config.reorder;
+  def->nBufferCountActual = def->nBufferCountMin;
+  def->bEnabled = OMX_TRUE;
+  def->bPopulated = OMX_FALSE;
+  def->eDomain = OMX_PortDomainVideo;
+  def->bBuffersContiguous = OMX_FALSE;
+  def->nBufferAlignment = 16;
+
+  def->format.video.cMIMEType = (OMX_STRING) "video/x-raw";
+  def->format.video.nFrameWidth = LOOPBACK_DEFAULT_WIDTH;
+  def->format.video.nFrameHeight = LOOPBACK_DEFAULT_HEIGHT;
+  def->format.video.xFramerate = 30 << 16;
+  def->format.video.bFlagErrorConcealment = OMX_FALSE;
+  if (compressed) {
+    def->format.video.eCompressionFormat = OMX_VIDEO_CodingAVC;
+    def->format.video.eColorFormat = OMX_COLOR_FormatUnused;
+  } else {
+    def->format.video.eCompressionFormat = OMX_VIDEO_CodingUnused;
+    def->format.video.eColorFormat = OMX_COLOR_FormatYUV420Planar;
+  }
+
+  g_queue_init (&port->queue);
+  port->n_buffers = 0;
+
+  loopback_port_update_layout (comp, port);
+}
+
+static LoopbackPort *
+loopback_get_port (LoopbackComponent * comp, OMX_U32 index)
+{
+  if (index >= LOOPBACK_N_PORTS)
+    return NULL;
+  return &comp->ports[index];
+}
+
+static gboolean
+loopback_port_is_populated (LoopbackPort * port)
+{
+  return !port->def.bEnabled
+      || port->n_buffers >= port->def.nBufferCountActual;
+}
+
+/* Callback helpers. All of them are called with comp->lock and release
+ * it while calling into the IL client to prevent deadlocks */
+static void
+loopback_send_event (LoopbackComponent * comp, OMX_EVENTTYPE event,
+    OMX_U32 data1, OMX_U32 data2)
+{
+  g_mutex_unlock (&comp->lock);
+  comp->callbacks.EventHandler (comp->handle, comp->app_data, event, data1,
+      data2, NULL);
+  g_mutex_lock (&comp->lock);
+}
+
+static void
+loopback_buffer_done (LoopbackComponent * comp, LoopbackBuffer * buf,
+    gboolean empty)
+{
+  g_mutex_unlock (&comp->lock);
+  if (empty)
+    comp->callbacks.EmptyBufferDone (comp->handle, comp->app_data,
+        &buf->header);
+  else
+    comp->callbacks.FillBufferDone (comp->handle, comp->app_data,
+        &buf->header);
+  g_mutex_lock (&comp->lock);
+}
+
+/* NOTE: Call with comp->lock */
+static void
+loopback_port_return_buffers (LoopbackComponent * comp, OMX_U32 index)
+{
+  LoopbackPort *port = &comp->ports[index];
+  LoopbackBuffer *buf;
+
+  if (index == LOOPBACK_OUT_PORT) {
+    while ((buf = g_queue_pop_head (&comp->reorder))) {
+      buf->header.nFilledLen = 0;
+      buf->header.nFlags = 0;
+      loopback_buffer_done (comp, buf, FALSE);
+    }
+  }
+
+  while ((buf = g_queue_pop_head (&port->queue))) {
+    if (index == LOOPBACK_OUT_PORT) {
+      buf->header.nFilledLen = 0;
+      buf->header.nFlags = 0;
+    }
+    loopback_buffer_done (comp, buf, index == LOOPBACK_IN_PORT);
+  }
+}
+
+/* NOTE: Call with comp->lock. Returns TRUE if the command was completed
+ * and removed from the queue */
+static gboolean
+loopback_process_state_set (LoopbackComponent * comp, LoopbackCommand * cmd)
+{
+  OMX_STATETYPE target = (OMX_STATETYPE) cmd->param;
+  OMX_ERRORTYPE err = OMX_ErrorNone;
+  gint i;
+
+  if (target == comp->state) {
+    err = OMX_ErrorSameState;
+    goto error;
+  }
+
+  switch (target) {
+    case OMX_StateIdle:
+      if (comp->state == OMX_StateLoaded) {
+        for (i = 0; i < LOOPBACK_N_PORTS; i++) {
+          if (!loopback_port_is_populated (&comp->ports[i]))
+            return FALSE;
+        }
+      } else if (comp->state == OMX_StateExecuting
+          || comp->state == OMX_StatePause) {
+        for (i = 0; i < LOOPBACK_N_PORTS; i++)
+          loopback_port_return_buffers (comp, i);
+      } else {
+        err = OMX_ErrorIncorrectStateTransition;
+        goto error;
+      }
+      break;
+    case OMX_StateLoaded:
+      if (comp->state != OMX_StateIdle) {
+        err = OMX_ErrorIncorrectStateTransition;
+        goto error;
+      }
+      for (i = 0; i < LOOPBACK_N_PORTS; i++) {
+        if (comp->ports[i].n_buffers > 0)
+          return FALSE;
+      }
+      comp->codec_config_sent = FALSE;
+      comp->n_frames = 0;
+      break;
+    case OMX_StateExecuting:
+    case OMX_StatePause:
+      if (comp->state != OMX_StateIdle && comp->state != OMX_StatePause
+          && comp->state != OMX_StateExecuting) {
+        err = OMX_ErrorIncorrectStateTransition;
+        goto error;
+      }
+      break;
+    default:
+      err = OMX_ErrorIncorrectStateTransition;
+      goto error;
+  }
+
+  comp->state = target;
+  loopback_send_event (comp, OMX_EventCmdComplete, OMX_CommandStateSet,
+      target);
+
+  return TRUE;
+
+error:
+  {
+    loopback_send_event (comp, OMX_EventError, err, 0);
+    return TRUE;
+  }
+}
+
+/* NOTE: Call with comp->lock */
+static gboolean
+loopback_process_command (LoopbackComponent * comp)
+{
+  LoopbackCommand *cmd;
+  OMX_U32 first, last, i;
+
+  cmd = g_queue_peek_head (&comp->commands);
+  if (!cmd)
+    return FALSE;
+
+  if (cmd->param == OMX_ALL) {
+    first = 0;
+    last = LOOPBACK_N_PORTS - 1;
+  } else {
+    first = last = cmd->param;
+  }
+
+  switch (cmd->cmd) {
+    case OMX_CommandStateSet:
+      if (!loopback_process_state_set (comp, cmd))
+        return FALSE;
+      break;
+    case OMX_CommandFlush:
+      for (i = first; i <= last; i++) {
+        loopback_port_return_buffers (comp, i);
+        loopback_send_event (comp, OMX_EventCmdComplete, OMX_CommandFlush, i);
+      }
+      break;
+    case OMX_CommandPortDisable:
+      if (!cmd->started) {
+        for (i = first; i <= last; i++)
+          comp->ports[i].def.bEnabled = OMX_FALSE;
+        cmd->started = TRUE;
+      }
+      for (i = first; i <= last; i++)
+        loopback_port_return_buffers (comp, i);
+      if (comp->state != OMX_StateLoaded) {
+        for (i = first; i <= last; i++) {
+          if (comp->ports[i].n_buffers > 0)
+            return FALSE;
+        }
+      }
+      for (i = first; i <= last; i++)
+        loopback_send_event (comp, OMX_EventCmdComplete,
+            OMX_CommandPortDisable, i);
+      break;
+    case OMX_CommandPortEnable:
+      if (!cmd->started) {
+        for (i = first; i <= last; i++)
+          comp->ports[i].def.bEnabled = OMX_TRUE;
+        cmd->started = TRUE;
+      }
+      if (comp->state != OMX_StateLoaded) {
+        for (i = first; i <= last; i++) {
+          if (!loopback_port_is_populated (&comp->ports[i]))
+            return FALSE;
+        }
+      }
+      for (i = first; i <= last; i++)
+        loopback_send_event (comp, OMX_EventCmdComplete,
+            OMX_CommandPortEnable, i);
+      break;
+    default:
+      loopback_send_event (comp, OMX_EventError, OMX_ErrorNotImplemented, 0);
+      break;
+  }
+
+  g_queue_remove (&comp->commands, cmd);
+  g_slice_free (LoopbackCommand, cmd);
+
+  return TRUE;
+}
+
+static gint
+loopback_compare_timestamp (gconstpointer a, gconstpointer b, gpointer data)
+{
+  const LoopbackBuffer *ba = a, *bb = b;
+
+  if (ba->header.nTimeStamp < bb->header.nTimeStamp)
+    return -1;
+  else if (ba->header.nTimeStamp > bb->header.nTimeStamp)
+    return 1;
+  return 0;
+}
+
+/* NOTE: Call with comp->lock */
+static void
+loopback_output (LoopbackComponent * comp, LoopbackBuffer * outbuf,
+    gboolean drain)
+{
+  LoopbackBuffer *buf;
+
+  if (comp->type == LOOPBACK_TYPE_ENCODER || comp->config.reorder == 0) {
+    if (outbuf)
+      loopback_buffer_done (comp, outbuf, FALSE);
+    return;
+  }
+
+  /* Emulate presentation order output of a decoder that has to
+   * reorder frames */
+  if (outbuf)
+    g_queue_insert_sorted (&comp->reorder, outbuf,
+        loopback_compare_timestamp, NULL);
+  while (comp->reorder.length > (drain ? 0 : comp->config.reorder)) {
+    buf = g_queue_pop_head (&comp->reorder);
+    loopback_buffer_done (comp, buf, FALSE);
+  }
+}
+
+/* NOTE: Call with comp->lock */
+static void
+loopback_fill_output (LoopbackComponent * comp, LoopbackBuffer * inbuf,
+    LoopbackBuffer * outbuf)
+{
+  OMX_BUFFERHEADERTYPE *in = &inbuf->header, *out = &outbuf->header;
+  OMX_U32 size, copy;
+
+  out->nOffset = 0;
+  out->nTimeStamp = in->nTimeStamp;
+  out->nTickCount = in->nTickCount;
+  out->nFlags = OMX_BUFFERFLAG_ENDOFFRAME;
+  out->hMarkTargetComponent = in->hMarkTargetComponent;
+  out->pMarkData = in->pMarkData;
+
+  if (comp->type == LOOPBACK_TYPE_DECODER) {
+    /* A decoded frame always covers the complete raw frame */
+    size = comp->ports[LOOPBACK_OUT_PORT].def.nBufferSize;
+  } else {
+    gboolean keyframe;
+
+    keyframe = comp->force_keyframe
+        || (comp->n_frames % comp->config.keyframe_interval) == 0;
+    comp->force_keyframe = FALSE;
+
+    size = MAX (in->nFilledLen / comp->config.compression, 1);
+    if (keyframe) {
+      size *= 4;
+      out->nFlags |= OMX_BUFFERFLAG_SYNCFRAME;
+    }
+  }
+
+  size = MIN (size, out->nAllocLen);
+  copy = MIN (size, in->nFilledLen);
+  memcpy (out->pBuffer, in->pBuffer + in->nOffset, copy);
+  out->nFilledLen = size;
+
+  comp->n_frames++;
+}
+
+/* NOTE: Call with comp->lock. Returns TRUE if any progress was made,
+ * otherwise sets @wait_until to the time until which nothing can happen
+ * or -1 if the thread must wait for the IL client */
+static gboolean
+loopback_process_buffers (LoopbackComponent * comp, gint64 * wait_until)
+{
+  LoopbackPort *in_port = &comp->ports[LOOPBACK_IN_PORT];
+  LoopbackPort *out_port = &comp->ports[LOOPBACK_OUT_PORT];
+  LoopbackBuffer *inbuf, *outbuf;
+  gint64 now;
+
+  *wait_until = -1;
+
+  if (comp->state != OMX_StateExecuting)
+    return FALSE;
+  if (!in_port->def.bEnabled || !out_port->def.bEnabled)
+    return FALSE;
+
+  inbuf = g_queue_peek_head (&in_port->queue);
+  if (!inbuf)
+    return FALSE;
+
+  now = g_get_monotonic_time ();
+  if (inbuf->ready_time > now) {
+    *wait_until = inbuf->ready_time;
+    return FALSE;
+  }
+
+  /* Codec config only initializes the decoder */
+  if (comp->type == LOOPBACK_TYPE_DECODER
+      && (inbuf->header.nFlags & OMX_BUFFERFLAG_CODECCONFIG)) {
+    g_queue_pop_head (&in_port->queue);
+    inbuf->header.nFilledLen = 0;
+    loopback_buffer_done (comp, inbuf, TRUE);
+    return TRUE;
+  }
+
+  outbuf = g_queue_peek_head (&out_port->queue);
+  if (!outbuf)
+    return FALSE;
+
+  if (comp->type == LOOPBACK_TYPE_ENCODER && !comp->codec_config_sent
+      && inbuf->header.nFilledLen > 0) {
+    OMX_BUFFERHEADERTYPE *out = &outbuf->header;
+
+    g_queue_pop_head (&out_port->queue);
+    out->nOffset = 0;
+    out->nFilledLen = MIN (sizeof (loopback_codec_config), out->nAllocLen);
+    memcpy (out->pBuffer, loopback_codec_config, out->nFilledLen);
+    out->nTimeStamp = inbuf->header.nTimeStamp;
+    out->nTickCount = 0;
+    out->nFlags = OMX_BUFFERFLAG_CODECCONFIG | OMX_BUFFERFLAG_ENDOFFRAME;
+    comp->codec_config_sent = TRUE;
+    loopback_buffer_done (comp, outbuf, FALSE);
+    return TRUE;
+  }
+
+  if (inbuf->header.nFilledLen > 0) {
+    g_queue_pop_head (&out_port->queue);
+    loopback_fill_output (comp, inbuf, outbuf);
+    loopback_output (comp, outbuf, FALSE);
+
+    if (inbuf->header.nFlags & OMX_BUFFERFLAG_EOS) {
+      /* Handle the EOS in the next iteration with an empty buffer */
+      inbuf->header.nFilledLen = 0;
+      return TRUE;
+    }
+
+    g_queue_pop_head (&in_port->queue);
+    inbuf->header.nFilledLen = 0;
+    loopback_buffer_done (comp, inbuf, TRUE);
+    return TRUE;
+  }
+
+  if (inbuf->header.nFlags & OMX_BUFFERFLAG_EOS) {
+    g_queue_pop_head (&in_port->queue);
+    g_queue_pop_head (&out_port->queue);
+
+    outbuf->header.nOffset = 0;
+    outbuf->header.nFilledLen = 0;
+    outbuf->header.nTimeStamp = inbuf->header.nTimeStamp;
+    outbuf->header.nTickCount = 0;
+    outbuf->header.nFlags = OMX_BUFFERFLAG_EOS;
+
+    /* Everything that was held back for reordering comes before EOS */
+    loopback_output (comp, NULL, TRUE);
+    loopback_buffer_done (comp, inbuf, TRUE);
+    loopback_buffer_done (comp, outbuf, FALSE);
+    loopback_send_event (comp, OMX_EventBufferFlag, LOOPBACK_OUT_PORT,
+        OMX_BUFFERFLAG_EOS);
+    return TRUE;
+  }
+
+  /* Empty buffer without any flags, just return it */
+  g_queue_pop_head (&in_port->queue);
+  loopback_buffer_done (comp, inbuf, TRUE);
+
+  return TRUE;
+}
+
+static gpointer
+loopback_thread (gpointer data)
+{
+  LoopbackComponent *comp = data;
+  gint64 wait_until;
+
+  g_mutex_lock (&comp->lock);
+  while (!comp->shutdown) {
+    if (loopback_process_command (comp))
+      continue;
+    if (loopback_process_buffers (comp, &wait_until))
+      continue;
+
+    if (wait_until == -1)
+      g_cond_wait (&comp->cond, &comp->lock);
+    else
+      g_cond_wait_until (&comp->cond, &comp->lock, wait_until);
+  }
+  g_mutex_unlock (&comp->lock);
+
+  return NULL;
+}
+
+/* OMX_COMPONENTTYPE implementation */
+#define LOOPBACK_COMPONENT(h) \
+  ((LoopbackComponent *) ((OMX_COMPONENTTYPE *) (h))->pComponentPrivate)
+
+static OMX_ERRORTYPE
+loopback_get_component_version (OMX_HANDLETYPE handle,
+    OMX_STRING name, OMX_VERSIONTYPE * component_version,
+    OMX_VERSIONTYPE * spec_version, OMX_UUIDTYPE * uuid)
+{
+  LoopbackComponent *comp = LOOPBACK_COMPONENT (handle);
+
+  g_strlcpy (name, comp->name, OMX_MAX_STRINGNAME_SIZE);
+  component_version->nVersion = OMX_VERSION;
+  spec_version->nVersion = OMX_VERSION;
+  if (uuid)
+    memset (*uuid, 0, sizeof (OMX_UUIDTYPE));
+
+  return OMX_ErrorNone;
+}
+
+static OMX_ERRORTYPE
+loopback_send_command (OMX_HANDLETYPE handle, OMX_COMMANDTYPE cmd,
+    OMX_U32 param, OMX_PTR cmd_data)
+{
+  LoopbackComponent *comp = LOOPBACK_COMPONENT (handle);
+  LoopbackCommand *command;
+
+  switch (cmd) {
+    case OMX_CommandStateSet:
+      break;
+    case OMX_CommandFlush:
+    case OMX_CommandPortDisable:
+    case OMX_CommandPortEnable:
+      if (param != OMX_ALL && param >= LOOPBACK_N_PORTS)
+        return OMX_ErrorBadPortIndex;
+      break;
+    default:
+      return OMX_ErrorNotImplemented;
+  }
+
+  command = g_slice_new0 (LoopbackCommand);
+  command->cmd = cmd;
+  command->param = param;
+
+  g_mutex_lock (&comp->lock);
+  g_queue_push_tail (&comp->commands, command);
+  g_cond_signal (&comp->cond);
+  g_mutex_unlock (&comp->lock);
+
+  return OMX_ErrorNone;
+}
+
+static const LoopbackRole *
+loopback_get_roles (LoopbackComponent * comp)
+{
+  return (comp->type == LOOPBACK_TYPE_DECODER) ? decoder_roles : encoder_roles;
+}
+
+static OMX_ERRORTYPE
+loopback_get_parameter (OMX_HANDLETYPE handle, OMX_INDEXTYPE index,
+    OMX_PTR param)
+{
+  LoopbackComponent *comp = LOOPBACK_COMPONENT (handle);
+  OMX_ERRORTYPE err = OMX_ErrorNone;
+
+  if (!param)
+    return OMX_ErrorBadParameter;
+
+  g_mutex_lock (&comp->lock);
+  switch (index) {
+    case OMX_IndexParamPortDefinition:{
+      OMX_PARAM_PORTDEFINITIONTYPE *def = param;
+      LoopbackPort *port = loopback_get_port (comp, def->nPortIndex);
+
+      if (!port) {
+        err = OMX_ErrorBadPortIndex;
+        break;
+      }
+      port->def.bPopulated = port->n_buffers >= port->def.nBufferCountActual;
+      memcpy (def, &port->def, sizeof (*def));
+      break;
+    }
+    case OMX_IndexParamVideoInit:{
+      OMX_PORT_PARAM_TYPE *init = param;
+
+      init->nPorts = LOOPBACK_N_PORTS;
+      init->nStartPortNumber = 0;
+      break;
+    }
+    case OMX_IndexParamVideoPortFormat:{
+      OMX_VIDEO_PARAM_PORTFORMATTYPE *format = param;
+      LoopbackPort *port = loopback_get_port (comp, format->nPortIndex);
+
+      if (!port) {
+        err = OMX_ErrorBadPortIndex;
+        break;
+      }
+
+      if (port->def.format.video.eCompressionFormat != OMX_VIDEO_CodingUnused) {
+        if (format->nIndex > 0) {
+          err = OMX_ErrorNoMore;
+          break;
+        }
+        format->eCompressionFormat = port->def.format.video.eCompressionFormat;
+        format->eColorFormat = OMX_COLOR_FormatUnused;
+      } else {
+        if (format->nIndex >= G_N_ELEMENTS (loopback_color_formats)) {
+          err = OMX_ErrorNoMore;
+          break;
+        }
+        format->eCompressionFormat = OMX_VIDEO_CodingUnused;
+        format->eColorFormat = loopback_color_formats[format->nIndex];
+      }
+      format->xFramerate = port->def.format.video.xFramerate;
+      break;
+    }
+    case OMX_IndexParamStandardComponentRole:{
+      OMX_PARAM_COMPONENTROLETYPE *role = param;
+
+      g_strlcpy ((gchar *) role->cRole, comp->role, sizeof (role->cRole));
+      break;
+    }
+    case OMX_IndexParamVideoBitrate:{
+      OMX_VIDEO_PARAM_BITRATETYPE *bitrate = param;
+
+      if (comp->type != LOOPBACK_TYPE_ENCODER) {
+        err = OMX_ErrorUnsupportedIndex;
+        break;
+      }
+      memcpy (bitrate, &comp->bitrate, sizeof (*bitrate));
+      break;
+    }
+    case OMX_IndexParamVideoQuantization:{
+      OMX_VIDEO_PARAM_QUANTIZATIONTYPE *quant = param;
+
+      if (comp->type != LOOPBACK_TYPE_ENCODER) {
+        err = OMX_ErrorUnsupportedIndex;
+        break;
+      }
+      memcpy (quant, &comp->quantization, sizeof (*quant));
+      break;
+    }
+    default:
+      err = OMX_ErrorUnsupportedIndex;
+      break;
+  }
+  g_mutex_unlock (&comp->lock);
+
+  return err;
+}
+
+static OMX_ERRORTYPE
+loopback_set_parameter (OMX_HANDLETYPE handle, OMX_INDEXTYPE index,
+    OMX_PTR param)
+{
+  LoopbackComponent *comp = LOOPBACK_COMPONENT (handle);
+  OMX_ERRORTYPE err = OMX_ErrorNone;
+
+  if (!param)
+    return OMX_ErrorBadParameter;
+
+  g_mutex_lock (&comp->lock);
+  switch (index) {
+    case OMX_IndexParamPortDefinition:{
+      OMX_PARAM_PORTDEFINITIONTYPE *def = param;
+      LoopbackPort *port = loopback_get_port (comp, def->nPortIndex);
+      LoopbackPort *other;
+      OMX_U32 requested_size;
+
+      if (!port) {
+        err = OMX_ErrorBadPortIndex;
+        break;
+      }
+      if (comp->state != OMX_StateLoaded && port->def.bEnabled) {
+        err = OMX_ErrorIncorrectStateOperation;
+        break;
+      }
+      if (def->nBufferCountActual < port->def.nBufferCountMin) {
+        err = OMX_ErrorBadParameter;
+        break;
+      }
+
+      port->def.nBufferCountActual = def->nBufferCountActual;
+      port->def.format.video.nFrameWidth = def->format.video.nFrameWidth;
+      port->def.format.video.nFrameHeight = def->format.video.nFrameHeight;
+      port->def.format.video.xFramerate = def->format.video.xFramerate;
+      port->def.format.video.nBitrate = def->format.video.nBitrate;
+      if (port->def.format.video.eCompressionFormat != OMX_VIDEO_CodingUnused) {
+        if (def->format.video.eCompressionFormat != OMX_VIDEO_CodingUnused)
+          port->def.format.video.eCompressionFormat =
+              def->format.video.eCompressionFormat;
+      } else {
+        if (def->format.video.eColorFormat == OMX_COLOR_FormatYUV420Planar
+            || def->format.video.eColorFormat ==
+            OMX_COLOR_FormatYUV420SemiPlanar)
+          port->def.format.video.eColorFormat = def->format.video.eColorFormat;
+      }
+      requested_size = def->nBufferSize;
+      loopback_port_update_layout (comp, port);
+      /* Allow the client to request bigger buffers than necessary */
+      port->def.nBufferSize = MAX (port->def.nBufferSize, requested_size);
+
+      /* The input port dictates the frame size of the output port */
+      if (port->def.nPortIndex == LOOPBACK_IN_PORT) {
+        other = &comp->ports[LOOPBACK_OUT_PORT];
+        other->def.format.video.nFrameWidth = def->format.video.nFrameWidth;
+        other->def.format.video.nFrameHeight = def->format.video.nFrameHeight;
+        other->def.format.video.xFramerate = def->format.video.xFramerate;
+        loopback_port_update_layout (comp, other);
+      }
+      break;
+    }
+    case OMX_IndexParamVideoPortFormat:{
+      OMX_VIDEO_PARAM_PORTFORMATTYPE *format = param;
+      LoopbackPort *port = loopback_get_port (comp, format->nPortIndex);
+
+      if (!port) {
+        err = OMX_ErrorBadPortIndex;
+        break;
+      }
+
+      if (port->def.format.video.eCompressionFormat != OMX_VIDEO_CodingUnused) {
+        if (format->eCompressionFormat == OMX_VIDEO_CodingUnused) {
+          err = OMX_ErrorUnsupportedSetting;
+          break;
+        }
+        port->def.format.video.eCompressionFormat = format->eCompressionFormat;
+      } else {
+        if (format->eColorFormat != OMX_COLOR_FormatYUV420Planar
+            && format->eColorFormat != OMX_COLOR_FormatYUV420SemiPlanar) {
+          err = OMX_ErrorUnsupportedSetting;
+          break;
+        }
+        port->def.format.video.eColorFormat = format->eColorFormat;
+      }
+      loopback_port_update_layout (comp, port);
+      break;
+    }
+    case OMX_IndexParamStandardComponentRole:{
+      OMX_PARAM_COMPONENTROLETYPE *role = param;
+      const LoopbackRole *roles = loopback_get_roles (comp);
+      LoopbackPort *port;
+      gint i;
+
+      for (i = 0; roles[i].role; i++) {
+        if (g_str_equal ((const gchar *) role->cRole, roles[i].role))
+          break;
+      }
+      if (!roles[i].role) {
+        err = OMX_ErrorUnsupportedSetting;
+        break;
+      }
+
+      g_strlcpy (comp->role, roles[i].role, sizeof (comp->role));
+      port = (comp->type == LOOPBACK_TYPE_DECODER) ?
+          &comp->ports[LOOPBACK_IN_PORT] : &comp->ports[LOOPBACK_OUT_PORT];
+      port->def.format.video.eCompressionFormat = roles[i].coding;
+      break;
+    }
+    case OMX_IndexParamVideoBitrate:{
+      OMX_VIDEO_PARAM_BITRATETYPE *bitrate = param;
+
+      if (comp->type != LOOPBACK_TYPE_ENCODER) {
+        err = OMX_ErrorUnsupportedIndex;
+        break;
+      }
+      comp->bitrate.eControlRate = bitrate->eControlRate;
+      comp->bitrate.nTargetBitrate = bitrate->nTargetBitrate;
+      break;
+    }
+    case OMX_IndexParamVideoQuantization:{
+      OMX_VIDEO_PARAM_QUANTIZATIONTYPE *quant = param;
+
+      if (comp->type != LOOPBACK_TYPE_ENCODER) {
+        err = OMX_ErrorUnsupportedIndex;
+        break;
+      }
+      comp->quantization.nQpI = quant->nQpI;
+      comp->quantization.nQpP = quant->nQpP;
+      comp->quantization.nQpB = quant->nQpB;
+      break;
+    }
+    default:
+      err = OMX_ErrorUnsupportedIndex;
+      break;
+  }
+  g_mutex_unlock (&comp->lock);
+
+  return err;
+}
+
+static OMX_ERRORTYPE
+loopback_get_config (OMX_HANDLETYPE handle, OMX_INDEXTYPE index,
+    OMX_PTR config)
+{
+  LoopbackComponent *comp = LOOPBACK_COMPONENT (handle);
+  OMX_ERRORTYPE err = OMX_ErrorNone;
+
+  if (!config)
+    return OMX_ErrorBadParameter;
+
+  g_mutex_lock (&comp->lock);
+  switch (index) {
+    case OMX_IndexConfigCommonOutputCrop:{
+      OMX_CONFIG_RECTTYPE *rect = config;
+      LoopbackPort *port = loopback_get_port (comp, rect->nPortIndex);
+
+      if (!port) {
+        err = OMX_ErrorBadPortIndex;
+        break;
+      }
+      rect->nLeft = 0;
+      rect->nTop = 0;
+      rect->nWidth = port->def.format.video.nFrameWidth;
+      rect->nHeight = port->def.format.video.nFrameHeight;
+      break;
+    }
+    case OMX_IndexConfigVideoBitrate:{
+      OMX_VIDEO_CONFIG_BITRATETYPE *bitrate = config;
+
+      if (comp->type != LOOPBACK_TYPE_ENCODER) {
+        err = OMX_ErrorUnsupportedIndex;
+        break;
+      }
+      bitrate->nEncodeBitrate = comp->bitrate.nTargetBitrate;
+      break;
+    }
+    case OMX_IndexConfigVideoFramerate:{
+      OMX_CONFIG_FRAMERATETYPE *framerate = config;
+      LoopbackPort *port = loopback_get_port (comp, framerate->nPortIndex);
+
+      if (!port) {
+        err = OMX_ErrorBadPortIndex;
+        break;
+      }
+      framerate->xEncodeFramerate = port->def.format.video.xFramerate;
+      break;
+    }
+    default:
+      err = OMX_ErrorUnsupportedIndex;
+      break;
+  }
+  g_mutex_unlock (&comp->lock);
+
+  return err;
+}
+
+static OMX_ERRORTYPE
+loopback_set_config (OMX_HANDLETYPE handle, OMX_INDEXTYPE index,
+    OMX_PTR config)
+{
+  LoopbackComponent *comp = LOOPBACK_COMPONENT (handle);
+  OMX_ERRORTYPE err = OMX_ErrorNone;
+
+  if (!config)
+    return OMX_ErrorBadParameter;
+
+  g_mutex_lock (&comp->lock);
+  switch (index) {
+    case OMX_IndexConfigVideoBitrate:{
+      OMX_VIDEO_CONFIG_BITRATETYPE *bitrate = config;
+
+      if (comp->type != LOOPBACK_TYPE_ENCODER) {
+        err = OMX_ErrorUnsupportedIndex;
+        break;
+      }
+      comp->bitrate.nTargetBitrate = bitrate->nEncodeBitrate;
+      break;
+    }
+    case OMX_IndexConfigVideoFramerate:{
+      OMX_CONFIG_FRAMERATETYPE *framerate = config;
+      LoopbackPort *port = loopback_get_port (comp, framerate->nPortIndex);
+
+      if (!port) {
+        err = OMX_ErrorBadPortIndex;
+        break;
+      }
+      port->def.format.video.xFramerate = framerate->xEncodeFramerate;
+      break;
+    }
+    case OMX_IndexConfigVideoIntraVOPRefresh:{
+      OMX_CONFIG_INTRAREFRESHVOPTYPE *refresh = config;
+
+      if (comp->type != LOOPBACK_TYPE_ENCODER) {
+        err = OMX_ErrorUnsupportedIndex;
+        break;
+      }
+      if (refresh->IntraRefreshVOP)
+        comp->force_keyframe = TRUE;
+      break;
+    }
+    default:
+      err = OMX_ErrorUnsupportedIndex;
+      break;
+  }
+  g_mutex_unlock (&comp->lock);
+
+  return err;
+}
+
+static OMX_ERRORTYPE
+loopback_get_extension_index (OMX_HANDLETYPE handle, OMX_STRING name,
+    OMX_INDEXTYPE * index)
+{
+  return OMX_ErrorUnsupportedIndex;
+}
+
+static OMX_ERRORTYPE
+loopback_get_state (OMX_HANDLETYPE handle, OMX_STATETYPE * state)
+{
+  LoopbackComponent *comp = LOOPBACK_COMPONENT (handle);
+
+  g_mutex_lock (&comp->lock);
+  *state = comp->state;
+  g_mutex_unlock (&comp->lock);
+
+  return OMX_ErrorNone;
+}
+
+static OMX_ERRORTYPE
+loopback_component_tunnel_request (OMX_HANDLETYPE handle, OMX_U32 port,
+    OMX_HANDLETYPE tunneled_comp, OMX_U32 tunneled_port,
+    OMX_TUNNELSETUPTYPE * setup)
+{
+  return OMX_ErrorNotImplemented;
+}
+
+static OMX_ERRORTYPE
+loopback_add_buffer (LoopbackComponent * comp, OMX_BUFFERHEADERTYPE ** header,
+    OMX_U32 index, OMX_PTR app_private, OMX_U32 size, OMX_U8 * data)
+{
+  LoopbackPort *port;
+  LoopbackBuffer *buf;
+
+  g_mutex_lock (&comp->lock);
+  port = loopback_get_port (comp, index);
+  if (!port) {
+    g_mutex_unlock (&comp->lock);
+    return OMX_ErrorBadPortIndex;
+  }
+  if (size < port->def.nBufferSize) {
+    g_mutex_unlock (&comp->lock);
+    return OMX_ErrorBadParameter;
+  }
+
+  buf = g_slice_new0 (LoopbackBuffer);
+  LOOPBACK_INIT_STRUCT (&buf->header);
+  if (data) {
+    buf->header.pBuffer = data;
+  } else {
+    buf->header.pBuffer = g_malloc0 (size);
+    buf->allocated = TRUE;
+  }
+  buf->header.nAllocLen = size;
+  buf->header.pAppPrivate = app_private;
+  if (index == LOOPBACK_IN_PORT) {
+    buf->header.nInputPortIndex = index;
+    buf->header.nOutputPortIndex = OMX_ALL;
+  } else {
+    buf->header.nInputPortIndex = OMX_ALL;
+    buf->header.nOutputPortIndex = index;
+  }
+
+  port->n_buffers++;
+  g_cond_signal (&comp->cond);
+  g_mutex_unlock (&comp->lock);
+
+  *header = &buf->header;
+
+  return OMX_ErrorNone;
+}
+
+static OMX_ERRORTYPE
+loopback_use_buffer (OMX_HANDLETYPE handle, OMX_BUFFERHEADERTYPE ** header,
+    OMX_U32 index, OMX_PTR app_private, OMX_U32 size, OMX_U8 * data)
+{
+  if (!header || !data)
+    return OMX_ErrorBadParameter;
+
+  return loopback_add_buffer (LOOPBACK_COMPONENT (handle), header, index,
+      app_private, size, data);
+}
+
+static OMX_ERRORTYPE
+loopback_allocate_buffer (OMX_HANDLETYPE handle,
+    OMX_BUFFERHEADERTYPE ** header, OMX_U32 index, OMX_PTR app_private,
+    OMX_U32 size)
+{
+  if (!header)
+    return OMX_ErrorBadParameter;
+
+  return loopback_add_buffer (LOOPBACK_COMPONENT (handle), header, index,
+      app_private, size, NULL);
+}
+
+static OMX_ERRORTYPE
+loopback_free_buffer (OMX_HANDLETYPE handle, OMX_U32 index,
+    OMX_BUFFERHEADERTYPE * header)
+{
+  LoopbackComponent *comp = LOOPBACK_COMPONENT (handle);
+  LoopbackBuffer *buf = (LoopbackBuffer *) header;
+  LoopbackPort *port;
+
+  g_mutex_lock (&comp->lock);
+  port = loopback_get_port (comp, index);
+  if (!port || !header) {
+    g_mutex_unlock (&comp->lock);
+    return OMX_ErrorBadParameter;
+  }
+
+  /* Freeing a buffer that we still own is a client bug, but don't
+   * crash on it later */
+  g_queue_remove (&port->queue, buf);
+  g_queue_remove (&comp->reorder, buf);
+
+  g_assert (port->n_buffers > 0);
+  port->n_buffers--;
+  g_cond_signal (&comp->cond);
+  g_mutex_unlock (&comp->lock);
+
+  if (buf->allocated)
+    g_free (buf->header.pBuffer);
+  g_slice_free (LoopbackBuffer, buf);
+
+  return OMX_ErrorNone;
+}
+
+static OMX_ERRORTYPE
+loopback_queue_buffer (LoopbackComponent * comp, OMX_U32 index,
+    OMX_BUFFERHEADERTYPE * header)
+{
+  LoopbackBuffer *buf = (LoopbackBuffer *) header;
+  LoopbackPort *port = &comp->ports[index];
+
+  if (!header)
+    return OMX_ErrorBadParameter;
+
+  g_mutex_lock (&comp->lock);
+  if (comp->state != OMX_StateExecuting && comp->state != OMX_StatePause
+      && comp->state != OMX_StateIdle) {
+    g_mutex_unlock (&comp->lock);
+    return OMX_ErrorIncorrectStateOperation;
+  }
+
+  if (index == LOOPBACK_IN_PORT)
+    buf->ready_time = g_get_monotonic_time () + comp->config.latency;
+  g_queue_push_tail (&port->queue, buf);
+  g_cond_signal (&comp->cond);
+  g_mutex_unlock (&comp->lock);
+
+  return OMX_ErrorNone;
+}
+
+static OMX_ERRORTYPE
+loopback_empty_this_buffer (OMX_HANDLETYPE handle,
+    OMX_BUFFERHEADERTYPE * header)
+{
+  return loopback_queue_buffer (LOOPBACK_COMPONENT (handle), LOOPBACK_IN_PORT,
+      header);
+}
+
+static OMX_ERRORTYPE
+loopback_fill_this_buffer (OMX_HANDLETYPE handle,
+    OMX_BUFFERHEADERTYPE * header)
+{
+  return loopback_queue_buffer (LOOPBACK_COMPONENT (handle),
+      LOOPBACK_OUT_PORT, header);
+}
+
+static OMX_ERRORTYPE
+loopback_set_callbacks (OMX_HANDLETYPE handle, OMX_CALLBACKTYPE * callbacks,
+    OMX_PTR app_data)
+{
+  LoopbackComponent *comp = LOOPBACK_COMPONENT (handle);
+
+  if (!callbacks)
+    return OMX_ErrorBadParameter;
+
+  g_mutex_lock (&comp->lock);
+  comp->callbacks = *callbacks;
+  comp->app_data = app_data;
+  g_mutex_unlock (&comp->lock);
+
+  return OMX_ErrorNone;
+}
+
+static OMX_ERRORTYPE
+loopback_component_deinit (OMX_HANDLETYPE handle)
+{
+  LoopbackComponent *comp = LOOPBACK_COMPONENT (handle);
+  LoopbackCommand *cmd;
+  LoopbackBuffer *buf;
+  gint i;
+
+  g_mutex_lock (&comp->lock);
+  comp->shutdown = TRUE;
+  g_cond_signal (&comp->cond);
+  g_mutex_unlock (&comp->lock);
+
+  g_thread_join (comp->thread);
+
+  while ((cmd = g_queue_pop_head (&comp->commands)))
+    g_slice_free (LoopbackCommand, cmd);
+
+  /* Buffers should've been freed by the client already, this only
+   * handles broken clients */
+  g_queue_clear (&comp->reorder);
+  for (i = 0; i < LOOPBACK_N_PORTS; i++) {
+    while ((buf = g_queue_pop_head (&comp->ports[i].queue))) {
+      if (buf->allocated)
+        g_free (buf->header.pBuffer);
+      g_slice_free (LoopbackBuffer, buf);
+    }
+  }
+
+  g_cond_clear (&comp->cond);
+  g_mutex_clear (&comp->lock);
+  g_slice_free (LoopbackComponent, comp);
+
+  return OMX_ErrorNone;
+}
+
+static OMX_ERRORTYPE
+loopback_use_egl_image (OMX_HANDLETYPE handle,
+    OMX_BUFFERHEADERTYPE ** header, OMX_U32 index, OMX_PTR app_private,
+    void *egl_image)
+{
+  return OMX_ErrorNotImplemented;
+}
+
+static OMX_ERRORTYPE
+loopback_component_role_enum (OMX_HANDLETYPE handle, OMX_U8 * role,
+    OMX_U32 index)
+{
+  LoopbackComponent *comp = LOOPBACK_COMPONENT (handle);
+  const LoopbackRole *roles = loopback_get_roles (comp);
+  OMX_U32 n;
+
+  for (n = 0; roles[n].role; n++);
+  if (index >= n)
+    return OMX_ErrorNoMore;
+
+  g_strlcpy ((gchar *) role, roles[index].role, OMX_MAX_STRINGNAME_SIZE);
+
+  return OMX_ErrorNone;
+}
+
+/* Core functions */
+OMX_API OMX_ERRORTYPE OMX_APIENTRY
+OMX_Init (void)
+{
+  if (g_atomic_int_add (&loopback_init_count, 1) == 0)
+    loopback_config_load (&loopback_config);
+
+  return OMX_ErrorNone;
+}
+
+OMX_API OMX_ERRORTYPE OMX_APIENTRY
+OMX_Deinit (void)
+{
+  g_atomic_int_add (&loopback_init_count, -1);
+
+  return OMX_ErrorNone;
+}
+
+OMX_API OMX_ERRORTYPE OMX_APIENTRY
+OMX_ComponentNameEnum (OMX_STRING name, OMX_U32 length, OMX_U32 index)
+{
+  static const gchar *names[] = {
+    LOOPBACK_DECODER_NAME,
+    LOOPBACK_ENCODER_NAME
+  };
+
+  if (index >= G_N_ELEMENTS (names))
+    return OMX_ErrorNoMore;
+
+  g_strlcpy (name, names[index], length);
+
+  return OMX_ErrorNone;
+}
+
+OMX_API OMX_ERRORTYPE OMX_APIENTRY
+OMX_GetRolesOfComponent (OMX_STRING name, OMX_U32 * n_roles, OMX_U8 ** roles)
+{
+  const LoopbackRole *r;
+  OMX_U32 i, n;
+
+  if (!name || !n_roles)
+    return OMX_ErrorBadParameter;
+
+  if (g_str_equal (name, LOOPBACK_DECODER_NAME))
+    r = decoder_roles;
+  else if (g_str_equal (name, LOOPBACK_ENCODER_NAME))
+    r = encoder_roles;
+  else
+    return OMX_ErrorComponentNotFound;
+
+  for (n = 0; r[n].role; n++);
+
+  if (roles) {
+    for (i = 0; i < MIN (n, *n_roles); i++)
+      g_strlcpy ((gchar *) roles[i], r[i].role, OMX_MAX_STRINGNAME_SIZE);
+  }
+  *n_roles = n;
+
+  return OMX_ErrorNone;
+}
+
+OMX_API OMX_ERRORTYPE OMX_APIENTRY
+OMX_GetHandle (OMX_HANDLETYPE * handle, OMX_STRING name, OMX_PTR app_data,
+    OMX_CALLBACKTYPE * callbacks)
+{
+  LoopbackComponent *comp;
+  OMX_COMPONENTTYPE *component;
+  gboolean decoder;
+
+  if (!handle || !name || !callbacks)
+    return OMX_ErrorBadParameter;
+
+  if (g_atomic_int_get (&loopback_init_count) == 0)
+    return OMX_ErrorNotReady;
+
+  if (g_str_equal (name, LOOPBACK_DECODER_NAME))
+    decoder = TRUE;
+  else if (g_str_equal (name, LOOPBACK_ENCODER_NAME))
+    decoder = FALSE;
+  else
+    return OMX_ErrorComponentNotFound;
+
+  comp = g_slice_new0 (LoopbackComponent);
+  comp->type = decoder ? LOOPBACK_TYPE_DECODER : LOOPBACK_TYPE_ENCODER;
+  comp->name = decoder ? LOOPBACK_DECODER_NAME : LOOPBACK_ENCODER_NAME;
+  g_strlcpy (comp->role, decoder ? decoder_roles[0].role :
+      encoder_roles[0].role, sizeof (comp->role));
+  comp->config = loopback_config;
+  comp->callbacks = *callbacks;
+  comp->app_data = app_data;
+  comp->state = OMX_StateLoaded;
+
+  g_mutex_init (&comp->lock);
+  g_cond_init (&comp->cond);
+  g_queue_init (&comp->commands);
+  g_queue_init (&comp->reorder);
+
+  loopback_port_init (comp, &comp->ports[LOOPBACK_IN_PORT], LOOPBACK_IN_PORT,
+      decoder);
+  loopback_port_init (comp, &comp->ports[LOOPBACK_OUT_PORT],
+      LOOPBACK_OUT_PORT, !decoder);
+
+  LOOPBACK_INIT_STRUCT (&comp->bitrate);
+  comp->bitrate.nPortIndex = LOOPBACK_OUT_PORT;
+  comp->bitrate.eControlRate = OMX_Video_ControlRateVariable;
+  comp->bitrate.nTargetBitrate = 2000000;
+  LOOPBACK_INIT_STRUCT (&comp->quantization);
+  comp->quantization.nPortIndex = LOOPBACK_OUT_PORT;
+  comp->quantization.nQpI = 26;
+  comp->quantization.nQpP = 28;
+  comp->quantization.nQpB = 30;
+
+  component = g_slice_new0 (OMX_COMPONENTTYPE);
+  LOOPBACK_INIT_STRUCT (component);
+  component->pComponentPrivate = comp;
+  component->pApplicationPrivate = app_data;
+  component->GetComponentVersion = loopback_get_component_version;
+  component->SendCommand = loopback_send_command;
+  component->GetParameter = loopback_get_parameter;
+  component->SetParameter = loopback_set_parameter;
+  component->GetConfig = loopback_get_config;
+  component->SetConfig = loopback_set_config;
+  component->GetExtensionIndex = loopback_get_extension_index;
+  component->GetState = loopback_get_state;
+  component->ComponentTunnelRequest = loopback_component_tunnel_request;
+  component->UseBuffer = loopback_use_buffer;
+  component->AllocateBuffer = loopback_allocate_buffer;
+  component->FreeBuffer = loopback_free_buffer;
+  component->EmptyThisBuffer = loopback_empty_this_buffer;
+  component->FillThisBuffer = loopback_fill_this_buffer;
+  component->SetCallbacks = loopback_set_callbacks;
+  component->ComponentDeInit = loopback_component_deinit;
+  component->UseEGLImage = loopback_use_egl_image;
+  component->ComponentRoleEnum = loopback_component_role_enum;
+  comp->handle = component;
+
+  comp->thread = g_thread_new ("omxloopback", loopback_thread, comp);
+
+  *handle = component;
+
+  return OMX_ErrorNone;
+}
+
+OMX_API OMX_ERRORTYPE OMX_APIENTRY
+OMX_FreeHandle (OMX_HANDLETYPE handle)
+{
+  OMX_COMPONENTTYPE *component = handle;
+
+  if (!component)
+    return OMX_ErrorBadParameter;
+
+  component->ComponentDeInit (handle);
+  g_slice_free (OMX_COMPONENTTYPE, component);
+
+  return OMX_ErrorNone;
+}
@@ -0,0 +1,432 @@
+/*
+ * Copyright (C) 2013, Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+/* Test for the loopback OpenMAX IL core. Loads the core like the plugin
+ * does, decodes a stream in decode order through the decoder component
+ * and checks that every frame comes out exactly once with its timestamp
+ * and buffer mark, in presentation order if the component reorders, and
+ * that EOS is signalled after the last frame.
+ *
+ * Usage: gstomxloopback-test [core]
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <glib.h>
+#include <gmodule.h>
+#include <string.h>
+
+#include <OMX_Core.h>
+#include <OMX_Component.h>
+
+#define TEST_INIT_STRUCT(st) G_STMT_START { \
+  memset ((st), 0, sizeof (*(st))); \
+  (st)->nSize = sizeof (*(st)); \
+  (st)->nVersion.s.nVersionMajor = OMX_VERSION_MAJOR; \
+  (st)->nVersion.s.nVersionMinor = OMX_VERSION_MINOR; \
+  (st)->nVersion.s.nRevision = OMX_VERSION_REVISION; \
+  (st)->nVersion.s.nStep = OMX_VERSION_STEP; \
+} G_STMT_END
+
+#define TEST_IN_PORT 0
+#define TEST_OUT_PORT 1
+#define TEST_N_FRAMES 40
+#define TEST_FRAME_DURATION 33333
+#define TEST_TIMEOUT (5 * G_TIME_SPAN_SECOND)
+
+typedef struct
+{
+  OMX_ERRORTYPE (*init) (void);
+  OMX_ERRORTYPE (*deinit) (void);
+  OMX_ERRORTYPE (*get_handle) (OMX_HANDLETYPE * handle,
+      OMX_STRING name, OMX_PTR data, OMX_CALLBACKTYPE * callbacks);
+  OMX_ERRORTYPE (*free_handle) (OMX_HANDLETYPE handle);
+} TestCore;
+
+typedef struct
+{
+  OMX_EVENTTYPE event;
+  OMX_U32 data1;
+  OMX_U32 data2;
+} TestEvent;
+
+typedef struct
+{
+  OMX_HANDLETYPE handle;
+
+  /* TestEvent from the EventHandler callback */
+  GAsyncQueue *events;
+  /* OMX_BUFFERHEADERTYPE returned by the component, pAppPrivate is
+   * the port index + 1 */
+  GAsyncQueue *done;
+
+  GPtrArray *in_buffers;
+  GPtrArray *out_buffers;
+} TestContext;
+
+static OMX_ERRORTYPE
+test_event_handler (OMX_HANDLETYPE handle, OMX_PTR data,
+    OMX_EVENTTYPE event, OMX_U32 data1, OMX_U32 data2, OMX_PTR event_data)
+{
+  TestContext *ctx = data;
+  TestEvent *ev;
+
+  ev = g_slice_new (TestEvent);
+  ev->event = event;
+  ev->data1 = data1;
+  ev->data2 = data2;
+  g_async_queue_push (ctx->events, ev);
+
+  return OMX_ErrorNone;
+}
+
+static OMX_ERRORTYPE
+test_buffer_done (OMX_HANDLETYPE handle, OMX_PTR data,
+    OMX_BUFFERHEADERTYPE * buf)
+{
+  TestContext *ctx = data;
+
+  g_async_queue_push (ctx->done, buf);
+
+  return OMX_ErrorNone;
+}
+
+static OMX_CALLBACKTYPE test_callbacks = {
+  test_event_handler,
+  test_buffer_done,
+  test_buffer_done
+};
+
+/* Waits until the command @cmd completes, other events are ignored */
+static gboolean
+test_wait_command (TestContext * ctx, OMX_COMMANDTYPE cmd, OMX_U32 param)
+{
+  TestEvent *ev;
+  gboolean done = FALSE, error = FALSE;
+
+  while (!done && !error) {
+    ev = g_async_queue_timeout_pop (ctx->events, TEST_TIMEOUT);
+    if (!ev) {
+      g_printerr ("Timeout waiting for command %d (%u)\n", cmd,
+          (guint) param);
+      return FALSE;
+    }
+
+    if (ev->event == OMX_EventCmdComplete && ev->data1 == cmd
+        && ev->data2 == param) {
+      done = TRUE;
+    } else if (ev->event == OMX_EventError) {
+      g_printerr ("Component error 0x%08x\n", (guint) ev->data1);
+      error = TRUE;
+    }
+    g_slice_free (TestEvent, ev);
+  }
+
+  return done;
+}
+
+static gboolean
+test_allocate_buffers (TestContext * ctx, OMX_U32 port_index,
+    GPtrArray * buffers)
+{
+  OMX_PARAM_PORTDEFINITIONTYPE def;
+  OMX_BUFFERHEADERTYPE *buf;
+  OMX_ERRORTYPE err;
+  guint i;
+
+  TEST_INIT_STRUCT (&def);
+  def.nPortIndex = port_index;
+  err = OMX_GetParameter (ctx->handle, OMX_IndexParamPortDefinition, &def);
+  if (err != OMX_ErrorNone) {
+    g_printerr ("Failed to get port %u definition: 0x%08x\n",
+        (guint) port_index, err);
+    return FALSE;
+  }
+
+  for (i = 0; i < def.nBufferCountActual; i++) {
+    err = OMX_AllocateBuffer (ctx->handle, &buf, port_index,
+        GUINT_TO_POINTER (port_index + 1), def.nBufferSize);
+    if (err != OMX_ErrorNone) {
+      g_printerr ("Failed to allocate buffer on port %u: 0x%08x\n",
+          (guint) port_index, err);
+      return FALSE;
+    }
+    g_ptr_array_add (buffers, buf);
+  }
+
+  return TRUE;
+}
+
+static void
+test_free_buffers (TestContext * ctx, OMX_U32 port_index,
+    GPtrArray * buffers)
+{
+  guint i;
+
+  for (i = 0; i < buffers->len; i++)
+    OMX_FreeBuffer (ctx->handle, port_index, g_ptr_array_index (buffers, i));
+  g_ptr_array_set_size (buffers, 0);
+}
+
+/* Frame number of the @n-th input buffer in decode order, every group
+ * of three frames is sent like I/P B B */
+static guint
+test_decode_order (guint n)
+{
+  guint base = n - n % 3;
+
+  if (n % 3 == 0)
+    return (base + 2 < TEST_N_FRAMES) ? base + 2 : n;
+  return (base + 2 < TEST_N_FRAMES) ? n - 1 : n;
+}
+
+/* Checks an output buffer and returns it to the component */
+static gboolean
+test_handle_output (TestContext * ctx, OMX_BUFFERHEADERTYPE * buf,
+    guint reorder, gboolean * seen, guint * n_out, gboolean * eos)
+{
+  guint frame;
+
+  if (buf->nFlags & OMX_BUFFERFLAG_EOS) {
+    *eos = TRUE;
+    return TRUE;
+  }
+  if (buf->nFilledLen == 0) {
+    g_printerr ("Empty output buffer without EOS\n");
+    return FALSE;
+  }
+
+  frame = GPOINTER_TO_UINT (buf->pMarkData);
+  if (frame == 0 || frame > TEST_N_FRAMES || seen[frame - 1]) {
+    g_printerr ("Unexpected or duplicated buffer mark %u\n", frame);
+    return FALSE;
+  }
+  frame--;
+  seen[frame] = TRUE;
+
+  if (buf->hMarkTargetComponent != ctx->handle) {
+    g_printerr ("Frame %u has the wrong mark target\n", frame);
+    return FALSE;
+  }
+  if (buf->nTimeStamp != (OMX_TICKS) frame * TEST_FRAME_DURATION) {
+    g_printerr ("Frame %u has timestamp %" G_GINT64_FORMAT "\n", frame,
+        (gint64) buf->nTimeStamp);
+    return FALSE;
+  }
+  /* The groups only need two frames of reordering */
+  if (reorder >= 2 && frame != *n_out) {
+    g_printerr ("Frame %u output at position %u\n", frame, *n_out);
+    return FALSE;
+  }
+  (*n_out)++;
+
+  buf->nFilledLen = 0;
+  buf->nFlags = 0;
+  if (OMX_FillThisBuffer (ctx->handle, buf) != OMX_ErrorNone) {
+    g_printerr ("FillThisBuffer failed\n");
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+static gboolean
+test_decode (TestCore * core, guint reorder)
+{
+  TestContext ctx = { NULL, };
+  OMX_PARAM_COMPONENTROLETYPE role;
+  OMX_BUFFERHEADERTYPE *buf;
+  TestEvent *ev;
+  gboolean seen[TEST_N_FRAMES] = { FALSE, };
+  GQueue free_in = G_QUEUE_INIT;
+  gboolean eos = FALSE, ret = FALSE, executing = FALSE;
+  guint i, frame, n_in, n_out = 0;
+  gchar *config;
+  OMX_ERRORTYPE err;
+
+  /* The configuration is read when the core is initialized */
+  config = g_strdup_printf ("reorder=%u", reorder);
+  g_setenv ("GST_OMX_LOOPBACK", config, TRUE);
+  g_free (config);
+
+  if (core->init () != OMX_ErrorNone) {
+    g_printerr ("OMX_Init failed\n");
+    return FALSE;
+  }
+
+  ctx.events = g_async_queue_new ();
+  ctx.done = g_async_queue_new ();
+  ctx.in_buffers = g_ptr_array_new ();
+  ctx.out_buffers = g_ptr_array_new ();
+
+  err = core->get_handle (&ctx.handle,
+      (OMX_STRING) "OMX.loopback.video_decoder", &ctx, &test_callbacks);
+  if (err != OMX_ErrorNone || !ctx.handle) {
+    g_printerr ("Failed to get the decoder: 0x%08x\n", err);
+    ctx.handle = NULL;
+    goto done;
+  }
+
+  TEST_INIT_STRUCT (&role);
+  g_strlcpy ((gchar *) role.cRole, "video_decoder.avc",
+      OMX_MAX_STRINGNAME_SIZE);
+  err = OMX_SetParameter (ctx.handle, OMX_IndexParamStandardComponentRole,
+      &role);
+  if (err != OMX_ErrorNone) {
+    g_printerr ("Failed to set the role: 0x%08x\n", err);
+    goto done;
+  }
+
+  OMX_SendCommand (ctx.handle, OMX_CommandStateSet, OMX_StateIdle, NULL);
+  if (!test_allocate_buffers (&ctx, TEST_IN_PORT, ctx.in_buffers)
+      || !test_allocate_buffers (&ctx, TEST_OUT_PORT, ctx.out_buffers))
+    goto done;
+  if (!test_wait_command (&ctx, OMX_CommandStateSet, OMX_StateIdle))
+    goto done;
+
+  OMX_SendCommand (ctx.handle, OMX_CommandStateSet, OMX_StateExecuting,
+      NULL);
+  if (!test_wait_command (&ctx, OMX_CommandStateSet, OMX_StateExecuting))
+    goto done;
+  executing = TRUE;
+
+  for (i = 0; i < ctx.out_buffers->len; i++)
+    OMX_FillThisBuffer (ctx.handle, g_ptr_array_index (ctx.out_buffers, i));
+  for (i = 0; i < ctx.in_buffers->len; i++)
+    g_queue_push_tail (&free_in, g_ptr_array_index (ctx.in_buffers, i));
+
+  /* Input is sent whenever an input buffer is free, the last one is the
+   * EOS buffer */
+  n_in = 0;
+  while (!eos) {
+    if (n_in <= TEST_N_FRAMES && (buf = g_queue_pop_head (&free_in))) {
+      buf->nOffset = 0;
+      if (n_in < TEST_N_FRAMES) {
+        frame = test_decode_order (n_in);
+        buf->nFilledLen = MIN (buf->nAllocLen, 64);
+        memset (buf->pBuffer, frame, buf->nFilledLen);
+        buf->nTimeStamp = (OMX_TICKS) frame * TEST_FRAME_DURATION;
+        buf->nFlags = OMX_BUFFERFLAG_ENDOFFRAME;
+        buf->hMarkTargetComponent = ctx.handle;
+        buf->pMarkData = GUINT_TO_POINTER (frame + 1);
+      } else {
+        buf->nFilledLen = 0;
+        buf->nTimeStamp = (OMX_TICKS) TEST_N_FRAMES * TEST_FRAME_DURATION;
+        buf->nFlags = OMX_BUFFERFLAG_EOS;
+        buf->hMarkTargetComponent = NULL;
+        buf->pMarkData = NULL;
+      }
+      if (OMX_EmptyThisBuffer (ctx.handle, buf) != OMX_ErrorNone) {
+        g_printerr ("EmptyThisBuffer failed\n");
+        goto done;
+      }
+      n_in++;
+      continue;
+    }
+
+    buf = g_async_queue_timeout_pop (ctx.done, TEST_TIMEOUT);
+    if (!buf) {
+      g_printerr ("Timeout after %u input and %u output buffers\n", n_in,
+          n_out);
+      goto done;
+    }
+    if (GPOINTER_TO_UINT (buf->pAppPrivate) == TEST_IN_PORT + 1)
+      g_queue_push_tail (&free_in, buf);
+    else if (!test_handle_output (&ctx, buf, reorder, seen, &n_out, &eos))
+      goto done;
+  }
+
+  if (n_out != TEST_N_FRAMES) {
+    g_printerr ("Got %u frames, expected %u\n", n_out, TEST_N_FRAMES);
+    goto done;
+  }
+
+  ret = TRUE;
+
+done:
+  if (ctx.handle) {
+    if (executing) {
+      OMX_SendCommand (ctx.handle, OMX_CommandStateSet, OMX_StateIdle, NULL);
+      if (!test_wait_command (&ctx, OMX_CommandStateSet, OMX_StateIdle))
+        ret = FALSE;
+    }
+    OMX_SendCommand (ctx.handle, OMX_CommandStateSet, OMX_StateLoaded, NULL);
+    test_free_buffers (&ctx, TEST_IN_PORT, ctx.in_buffers);
+    test_free_buffers (&ctx, TEST_OUT_PORT, ctx.out_buffers);
+    if (!test_wait_command (&ctx, OMX_CommandStateSet, OMX_StateLoaded))
+      ret = FALSE;
+    core->free_handle (ctx.handle);
+  }
+  core->deinit ();
+
+  while ((ev = g_async_queue_try_pop (ctx.events)))
+    g_slice_free (TestEvent, ev);
+  while (g_async_queue_try_pop (ctx.done));
+  g_queue_clear (&free_in);
+  g_async_queue_unref (ctx.events);
+  g_async_queue_unref (ctx.done);
+  g_ptr_array_free (ctx.in_buffers, TRUE);
+  g_ptr_array_free (ctx.out_buffers, TRUE);
+
+  return ret;
+}
+
+int
+main (int argc, char **argv)
+{
+  const gchar *filename = LOOPBACK_CORE;
+  GModule *module;
+  TestCore core;
+  gboolean ret = TRUE;
+
+  if (argc > 1)
+    filename = argv[1];
+
+  module = g_module_open (filename, G_MODULE_BIND_LAZY);
+  if (!module) {
+    g_printerr ("Failed to load '%s': %s\n", filename, g_module_error ());
+    return 1;
+  }
+  if (!g_module_symbol (module, "OMX_Init", (gpointer *) & core.init)
+      || !g_module_symbol (module, "OMX_Deinit", (gpointer *) & core.deinit)
+      || !g_module_symbol (module, "OMX_GetHandle",
+          (gpointer *) & core.get_handle)
+      || !g_module_symbol (module, "OMX_FreeHandle",
+          (gpointer *) & core.free_handle)) {
+    g_printerr ("Failed to load the core symbols: %s\n", g_module_error ());
+    g_module_close (module);
+    return 1;
+  }
+
+  /* In decode order and with the reordering emulation */
+  if (!test_decode (&core, 0)) {
+    g_printerr ("Decoding without reordering failed\n");
+    ret = FALSE;
+  }
+  if (!test_decode (&core, 2)) {
+    g_printerr ("Decoding with reordering failed\n");
+    ret = FALSE;
+  }
+
+  g_module_close (module);
+
+  return ret ? 0 : 1;
+}
@@ -39,6 +39,8 @@ static gboolean gst_omx_mpeg4_video_dec_is_format_change (GstOMXVideoDec * dec,
     GstOMXPort * port, GstVideoState * state);
 static gboolean gst_omx_mpeg4_video_dec_set_format (GstOMXVideoDec * dec,
     GstOMXPort * port, GstVideoState * state);
+static gboolean gst_omx_mpeg4_video_dec_is_droppable (GstOMXVideoDec * dec,
+    GstVideoFrame * frame);
 
 enum
 {
@@ -84,6 +86,8 @@ gst_omx_mpeg4_video_dec_class_init (GstOMXMPEG4VideoDecClass * klass)
       GST_DEBUG_FUNCPTR (gst_omx_mpeg4_video_dec_is_format_change);
   videodec_class->set_format =
       GST_DEBUG_FUNCPTR (gst_omx_mpeg4_video_dec_set_format);
+  videodec_class->is_droppable =
+      GST_DEBUG_FUNCPTR (gst_omx_mpeg4_video_dec_is_droppable);
 
   videodec_class->default_sink_template_caps = "video/mpeg, "
       "mpegversion=(int) 4, "
@@ -124,3 +128,30 @@ gst_omx_mpeg4_video_dec_set_format (GstOMXVideoDec * dec, GstOMXPort * port,
 
   return ret;
 }
+
+#define VOP_START_CODE 0xb6
+#define VOP_CODING_TYPE_B 2
+
+/* B-VOPs are never referenced by other VOPs. Packed bitstreams
+ * can contain a B-VOP together with the next P-VOP */
+static gboolean
+gst_omx_mpeg4_video_dec_is_droppable (GstOMXVideoDec * dec,
+    GstVideoFrame * frame)
+{
+  const guint8 *data = GST_BUFFER_DATA (frame->sink_buffer);
+  guint i, size = GST_BUFFER_SIZE (frame->sink_buffer);
+  gboolean have_vop = FALSE;
+
+  for (i = 0; i + 4 < size; i++) {
+    if (data[i] != 0 || data[i + 1] != 0 || data[i + 2] != 1
+        || data[i + 3] != VOP_START_CODE)
+      continue;
+
+    if ((data[i + 4] >> 6) != VOP_CODING_TYPE_B)
+      return FALSE;
+    have_vop = TRUE;
+    i += 4;
+  }
+
+  return have_vop;
+}
@@ -0,0 +1,449 @@
+/*
+ * Copyright (C) 2013, Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <unistd.h>
+
+#include "gstomxplanecopy.h"
+
+/* The x86 variants are compiled with function specific target
+ * attributes and selected at runtime, so no special compiler flags
+ * are needed. NEON is only used if the whole build targets it */
+#if (defined (__x86_64__) || defined (__i386__)) && (defined (__clang__) || \
+    __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define HAVE_X86_SIMD 1
+#include <immintrin.h>
+#elif defined (__ARM_NEON__) || defined (__aarch64__)
+#define HAVE_NEON 1
+#include <arm_neon.h>
+#endif
+
+static void
+gst_omx_plane_copy_c (guint8 * dest, gint dest_stride, const guint8 * src,
+    gint src_stride, gint width, gint height)
+{
+  gint i;
+
+  for (i = 0; i < height; i++) {
+    memcpy (dest, src, width);
+    src += src_stride;
+    dest += dest_stride;
+  }
+}
+
+#ifdef HAVE_X86_SIMD
+__attribute__ ((target ("sse2")))
+static void
+gst_omx_plane_copy_sse2 (guint8 * dest, gint dest_stride, const guint8 * src,
+    gint src_stride, gint width, gint height)
+{
+  gboolean stream =
+      (gsize) width * height >= GST_OMX_PLANE_COPY_STREAM_THRESHOLD;
+  gint i;
+
+  for (i = 0; i < height; i++) {
+    const guint8 *s = src;
+    guint8 *d = dest;
+    gint n = width;
+
+    if (stream) {
+      /* Non-temporal stores need an aligned destination */
+      gint head = MIN ((gint) ((16 - ((guintptr) d & 15)) & 15), n);
+
+      memcpy (d, s, head);
+      s += head;
+      d += head;
+      n -= head;
+
+      for (; n >= 64; n -= 64, s += 64, d += 64) {
+        __m128i a = _mm_loadu_si128 ((const __m128i *) s);
+        __m128i b = _mm_loadu_si128 ((const __m128i *) (s + 16));
+        __m128i c = _mm_loadu_si128 ((const __m128i *) (s + 32));
+        __m128i e = _mm_loadu_si128 ((const __m128i *) (s + 48));
+
+        _mm_stream_si128 ((__m128i *) d, a);
+        _mm_stream_si128 ((__m128i *) (d + 16), b);
+        _mm_stream_si128 ((__m128i *) (d + 32), c);
+        _mm_stream_si128 ((__m128i *) (d + 48), e);
+      }
+      for (; n >= 16; n -= 16, s += 16, d += 16)
+        _mm_stream_si128 ((__m128i *) d,
+            _mm_loadu_si128 ((const __m128i *) s));
+    } else {
+      for (; n >= 64; n -= 64, s += 64, d += 64) {
+        __m128i a = _mm_loadu_si128 ((const __m128i *) s);
+        __m128i b = _mm_loadu_si128 ((const __m128i *) (s + 16));
+        __m128i c = _mm_loadu_si128 ((const __m128i *) (s + 32));
+        __m128i e = _mm_loadu_si128 ((const __m128i *) (s + 48));
+
+        _mm_storeu_si128 ((__m128i *) d, a);
+        _mm_storeu_si128 ((__m128i *) (d + 16), b);
+        _mm_storeu_si128 ((__m128i *) (d + 32), c);
+        _mm_storeu_si128 ((__m128i *) (d + 48), e);
+      }
+      for (; n >= 16; n -= 16, s += 16, d += 16)
+        _mm_storeu_si128 ((__m128i *) d,
+            _mm_loadu_si128 ((const __m128i *) s));
+    }
+    memcpy (d, s, n);
+
+    src += src_stride;
+    dest += dest_stride;
+  }
+
+  /* Make the non-temporal stores visible to other threads */
+  if (stream)
+    _mm_sfence ();
+}
+
+__attribute__ ((target ("avx2")))
+static void
+gst_omx_plane_copy_avx2 (guint8 * dest, gint dest_stride, const guint8 * src,
+    gint src_stride, gint width, gint height)
+{
+  gboolean stream =
+      (gsize) width * height >= GST_OMX_PLANE_COPY_STREAM_THRESHOLD;
+  gint i;
+
+  for (i = 0; i < height; i++) {
+    const guint8 *s = src;
+    guint8 *d = dest;
+    gint n = width;
+
+    if (stream) {
+      /* Non-temporal stores need an aligned destination */
+      gint head = MIN ((gint) ((32 - ((guintptr) d & 31)) & 31), n);
+
+      memcpy (d, s, head);
+      s += head;
+      d += head;
+      n -= head;
+
+      for (; n >= 128; n -= 128, s += 128, d += 128) {
+        __m256i a = _mm256_loadu_si256 ((const __m256i *) s);
+        __m256i b = _mm256_loadu_si256 ((const __m256i *) (s + 32));
+        __m256i c = _mm256_loadu_si256 ((const __m256i *) (s + 64));
+        __m256i e = _mm256_loadu_si256 ((const __m256i *) (s + 96));
+
+        _mm256_stream_si256 ((__m256i *) d, a);
+        _mm256_stream_si256 ((__m256i *) (d + 32), b);
+        _mm256_stream_si256 ((__m256i *) (d + 64), c);
+        _mm256_stream_si256 ((__m256i *) (d + 96), e);
+      }
+      for (; n >= 32; n -= 32, s += 32, d += 32)
+        _mm256_stream_si256 ((__m256i *) d,
+            _mm256_loadu_si256 ((const __m256i *) s));
+    } else {
+      for (; n >= 128; n -= 128, s += 128, d += 128) {
+        __m256i a = _mm256_loadu_si256 ((const __m256i *) s);
+        __m256i b = _mm256_loadu_si256 ((const __m256i *) (s + 32));
+        __m256i c = _mm256_loadu_si256 ((const __m256i *) (s + 64));
+        __m256i e = _mm256_loadu_si256 ((const __m256i *) (s + 96));
+
+        _mm256_storeu_si256 ((__m256i *) d, a);
+        _mm256_storeu_si256 ((__m256i *) (d + 32), b);
+        _mm256_storeu_si256 ((__m256i *) (d + 64), c);
+        _mm256_storeu_si256 ((__m256i *) (d + 96), e);
+      }
+      for (; n >= 32; n -= 32, s += 32, d += 32)
+        _mm256_storeu_si256 ((__m256i *) d,
+            _mm256_loadu_si256 ((const __m256i *) s));
+    }
+    memcpy (d, s, n);
+
+    src += src_stride;
+    dest += dest_stride;
+  }
+
+  if (stream)
+    _mm_sfence ();
+  _mm256_zeroupper ();
+}
+#endif
+
+#ifdef HAVE_NEON
+/* NEON has no non-temporal stores that are usable from C */
+static void
+gst_omx_plane_copy_neon (guint8 * dest, gint dest_stride, const guint8 * src,
+    gint src_stride, gint width, gint height)
+{
+  gint i;
+
+  for (i = 0; i < height; i++) {
+    const guint8 *s = src;
+    guint8 *d = dest;
+    gint n = width;
+
+    for (; n >= 64; n -= 64, s += 64, d += 64) {
+      uint8x16_t a = vld1q_u8 (s);
+      uint8x16_t b = vld1q_u8 (s + 16);
+      uint8x16_t c = vld1q_u8 (s + 32);
+      uint8x16_t e = vld1q_u8 (s + 48);
+
+      vst1q_u8 (d, a);
+      vst1q_u8 (d + 16, b);
+      vst1q_u8 (d + 32, c);
+      vst1q_u8 (d + 48, e);
+    }
+    for (; n >= 16; n -= 16, s += 16, d += 16)
+      vst1q_u8 (d, vld1q_u8 (s));
+    memcpy (d, s, n);
+
+    src += src_stride;
+    dest += dest_stride;
+  }
+}
+#endif
+
+/* Best first */
+static const GstOMXPlaneCopyImpl all_impls[] = {
+#ifdef HAVE_X86_SIMD
+  {"avx2", gst_omx_plane_copy_avx2},
+  {"sse2", gst_omx_plane_copy_sse2},
+#endif
+#ifdef HAVE_NEON
+  {"neon", gst_omx_plane_copy_neon},
+#endif
+  {"c", gst_omx_plane_copy_c}
+};
+
+static GstOMXPlaneCopyImpl impls[G_N_ELEMENTS (all_impls)];
+static guint n_impls;
+static const GstOMXPlaneCopyImpl *impl =
+    &all_impls[G_N_ELEMENTS (all_impls) - 1];
+
+static gboolean
+gst_omx_plane_copy_impl_is_supported (const GstOMXPlaneCopyImpl * i)
+{
+#ifdef HAVE_X86_SIMD
+  __builtin_cpu_init ();
+
+  if (i->copy == gst_omx_plane_copy_avx2)
+    return __builtin_cpu_supports ("avx2");
+  else if (i->copy == gst_omx_plane_copy_sse2)
+    return __builtin_cpu_supports ("sse2");
+#endif
+
+  return TRUE;
+}
+
+static gpointer
+gst_omx_plane_copy_init_once (gpointer data)
+{
+  const gchar *env;
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (all_impls); i++) {
+    if (gst_omx_plane_copy_impl_is_supported (&all_impls[i]))
+      impls[n_impls++] = all_impls[i];
+  }
+  impl = &impls[0];
+
+  /* Allows to select a specific implementation for debugging */
+  env = g_getenv ("GST_OMX_PLANE_COPY");
+  if (env) {
+    for (i = 0; i < n_impls; i++) {
+      if (g_str_equal (env, impls[i].name)) {
+        impl = &impls[i];
+        break;
+      }
+    }
+  }
+
+  return NULL;
+}
+
+typedef struct
+{
+  GMutex lock;
+  GCond cond;
+  gint pending;
+} Job;
+
+typedef struct
+{
+  Job *job;
+  guint8 *dest;
+  gint dest_stride;
+  const guint8 *src;
+  gint src_stride;
+  gint width, height;
+} Band;
+
+/* Shared by all elements of the process. The calling thread copies
+ * one band itself, so the pool has one thread less than bands are used */
+static GThreadPool *pool;
+static gint n_bands = 1;
+static gsize thread_threshold = GST_OMX_PLANE_COPY_DEFAULT_THREAD_THRESHOLD;
+G_LOCK_DEFINE_STATIC (pool);
+
+static void
+gst_omx_plane_copy_band (gpointer data, gpointer user_data)
+{
+  Band *band = data;
+  Job *job = band->job;
+
+  impl->copy (band->dest, band->dest_stride, band->src, band->src_stride,
+      band->width, band->height);
+
+  g_mutex_lock (&job->lock);
+  if (--job->pending == 0)
+    g_cond_signal (&job->cond);
+  g_mutex_unlock (&job->lock);
+}
+
+/* Sets the number of threads that copy a plane together, including the
+ * calling thread, and the plane size from which on they are used.
+ * 0 uses one thread per CPU up to 4, more don't help because memory
+ * bandwidth is the limit. 1 disables threading */
+void
+gst_omx_plane_copy_set_threads (guint n_threads, gsize threshold)
+{
+  GError *err = NULL;
+
+  if (n_threads == 0) {
+#if GLIB_CHECK_VERSION(2,36,0)
+    n_threads = MIN (g_get_num_processors (), 4);
+#else
+    n_threads = CLAMP (sysconf (_SC_NPROCESSORS_ONLN), 1, 4);
+#endif
+  }
+  n_threads = MIN (n_threads, GST_OMX_PLANE_COPY_MAX_THREADS);
+
+  G_LOCK (pool);
+  thread_threshold = threshold;
+  if (n_threads > 1 && !pool) {
+    pool = g_thread_pool_new (gst_omx_plane_copy_band, NULL, n_threads - 1,
+        TRUE, &err);
+    if (!pool) {
+      g_warning ("Failed to create plane copy threads: %s", err->message);
+      g_error_free (err);
+      n_threads = 1;
+    }
+  } else if (n_threads > 1) {
+    g_thread_pool_set_max_threads (pool, n_threads - 1, NULL);
+  }
+  g_atomic_int_set (&n_bands, n_threads);
+  G_UNLOCK (pool);
+}
+
+static void
+gst_omx_plane_copy_threaded (guint8 * dest, gint dest_stride,
+    const guint8 * src, gint src_stride, gint width, gint height, gint n)
+{
+  Band bands[GST_OMX_PLANE_COPY_MAX_THREADS];
+  Job job;
+  gint rows;
+  gint i;
+
+  rows = (height + n - 1) / n;
+  n = (height + rows - 1) / rows;
+
+  g_mutex_init (&job.lock);
+  g_cond_init (&job.cond);
+  job.pending = n - 1;
+
+  for (i = 0; i < n; i++) {
+    bands[i].job = &job;
+    bands[i].dest = dest + (gsize) i * rows * dest_stride;
+    bands[i].dest_stride = dest_stride;
+    bands[i].src = src + (gsize) i * rows * src_stride;
+    bands[i].src_stride = src_stride;
+    bands[i].width = width;
+    bands[i].height = MIN (rows, height - i * rows);
+  }
+
+  /* The first band is copied by this thread while the others are
+   * copied by the pool */
+  for (i = 1; i < n; i++) {
+    GError *err = NULL;
+
+    g_thread_pool_push (pool, &bands[i], &err);
+    if (err) {
+      g_error_free (err);
+      gst_omx_plane_copy_band (&bands[i], NULL);
+    }
+  }
+  impl->copy (bands[0].dest, dest_stride, bands[0].src, src_stride, width,
+      bands[0].height);
+
+  g_mutex_lock (&job.lock);
+  while (job.pending > 0)
+    g_cond_wait (&job.cond, &job.lock);
+  g_mutex_unlock (&job.lock);
+
+  g_mutex_clear (&job.lock);
+  g_cond_clear (&job.cond);
+}
+
+void
+gst_omx_plane_copy_init (void)
+{
+  static GOnce once = G_ONCE_INIT;
+
+  g_once (&once, gst_omx_plane_copy_init_once, NULL);
+}
+
+/* Returns the implementation used by gst_omx_plane_copy() */
+const GstOMXPlaneCopyImpl *
+gst_omx_plane_copy_get_impl (void)
+{
+  gst_omx_plane_copy_init ();
+
+  return impl;
+}
+
+/* Returns all implementations supported by the CPU, best first */
+const GstOMXPlaneCopyImpl *
+gst_omx_plane_copy_get_impls (guint * n)
+{
+  gst_omx_plane_copy_init ();
+
+  *n = n_impls;
+  return impls;
+}
+
+/* Copies a plane with different source and destination strides,
+ * e.g. between OMX buffers and GstBuffers. Only width bytes
+ * of every row are copied, the padding is left as is */
+void
+gst_omx_plane_copy (guint8 * dest, gint dest_stride, const guint8 * src,
+    gint src_stride, gint width, gint height)
+{
+  gint n;
+
+  if (G_UNLIKELY (width <= 0 || height <= 0))
+    return;
+
+  gst_omx_plane_copy_init ();
+
+  n = g_atomic_int_get (&n_bands);
+  if (n > 1 && height > 1 && (gsize) width * height >= thread_threshold) {
+    gst_omx_plane_copy_threaded (dest, dest_stride, src, src_stride, width,
+        height, n);
+  } else if (src_stride == width && dest_stride == width) {
+    memcpy (dest, src, (gsize) width * height);
+  } else {
+    impl->copy (dest, dest_stride, src, src_stride, width, height);
+  }
+}
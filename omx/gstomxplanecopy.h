@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2013, Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+#ifndef __GST_OMX_PLANE_COPY_H__
+#define __GST_OMX_PLANE_COPY_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Planes of at least this size are copied with non-temporal stores
+ * if the CPU supports it. They don't fit into the caches anyway and
+ * are not read again by us */
+#define GST_OMX_PLANE_COPY_STREAM_THRESHOLD (1024 * 1024)
+
+/* Planes of at least this size are split into bands of rows that
+ * are copied in parallel, see gst_omx_plane_copy_set_threads() */
+#define GST_OMX_PLANE_COPY_DEFAULT_THREAD_THRESHOLD (2 * 1024 * 1024)
+#define GST_OMX_PLANE_COPY_MAX_THREADS 16
+
+/* Copies height rows of width bytes from src to dest */
+typedef void (*GstOMXPlaneCopyFunc) (guint8 * dest, gint dest_stride,
+    const guint8 * src, gint src_stride, gint width, gint height);
+
+typedef struct _GstOMXPlaneCopyImpl GstOMXPlaneCopyImpl;
+
+struct _GstOMXPlaneCopyImpl {
+  const gchar *name;
+  GstOMXPlaneCopyFunc copy;
+};
+
+void                        gst_omx_plane_copy_init (void);
+void                        gst_omx_plane_copy_set_threads (guint n_threads,
+                                                            gsize threshold);
+
+const GstOMXPlaneCopyImpl * gst_omx_plane_copy_get_impl (void);
+const GstOMXPlaneCopyImpl * gst_omx_plane_copy_get_impls (guint * n_impls);
+
+void                        gst_omx_plane_copy (guint8 * dest, gint dest_stride,
+                                                const guint8 * src, gint src_stride,
+                                                gint width, gint height);
+
+G_END_DECLS
+
+#endif /* __GST_OMX_PLANE_COPY_H__ */
@@ -0,0 +1,169 @@
+/*
+ * Copyright (C) 2013, Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+/* Microbenchmark for the plane copy implementations. Copies I420 frames
+ * from a padded OMX layout to the GStreamer layout like
+ * gst_omx_video_dec_fill_buffer() does and compares the implementations
+ * supported by the CPU with the plain per-row loop.
+ *
+ * Usage: gstomxplanecopy-bench [width [height [stride-alignment [iterations
+ *            [threads]]]]]
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "gstomxplanecopy.h"
+
+#define ROUND_UP(x, n) (((x) + (n) - 1) / (n) * (n))
+
+typedef struct
+{
+  gint width, height;
+  gint src_stride, dest_stride;
+  gsize src_offset, dest_offset;
+} Plane;
+
+static void
+copy_rows (guint8 * dest, gint dest_stride, const guint8 * src,
+    gint src_stride, gint width, gint height)
+{
+  gint j;
+
+  for (j = 0; j < height; j++) {
+    memcpy (dest, src, MIN (src_stride, dest_stride));
+    src += src_stride;
+    dest += dest_stride;
+  }
+}
+
+static gdouble
+run (GstOMXPlaneCopyFunc copy, const Plane * planes, guint8 * dest,
+    const guint8 * src, gint iterations)
+{
+  gint64 start;
+  gint i, p;
+
+  start = g_get_monotonic_time ();
+  for (i = 0; i < iterations; i++) {
+    for (p = 0; p < 3; p++)
+      copy (dest + planes[p].dest_offset, planes[p].dest_stride,
+          src + planes[p].src_offset, planes[p].src_stride,
+          MIN (planes[p].src_stride, planes[p].dest_stride), planes[p].height);
+  }
+
+  return (g_get_monotonic_time () - start) / 1000.0 / iterations;
+}
+
+int
+main (int argc, char **argv)
+{
+  gint width = 3840, height = 2160, align = 256, iterations = 100, threads = 0;
+  const GstOMXPlaneCopyImpl *impls;
+  Plane planes[3];
+  gsize src_size = 0, dest_size = 0, frame_size;
+  guint8 *src, *dest, *ref;
+  gdouble base;
+  guint n, i;
+  gint p;
+
+  if (argc > 1)
+    width = atoi (argv[1]);
+  if (argc > 2)
+    height = atoi (argv[2]);
+  if (argc > 3)
+    align = atoi (argv[3]);
+  if (argc > 4)
+    iterations = atoi (argv[4]);
+  if (argc > 5)
+    threads = atoi (argv[5]);
+
+  if (width <= 0 || height <= 0 || align <= 0 || iterations <= 0
+      || threads < 0) {
+    g_printerr ("Usage: %s [width [height [stride-alignment [iterations "
+        "[threads]]]]]\n", argv[0]);
+    return 1;
+  }
+
+  for (p = 0; p < 3; p++) {
+    planes[p].width = p == 0 ? width : (width + 1) / 2;
+    planes[p].height = p == 0 ? height : (height + 1) / 2;
+    planes[p].src_stride = ROUND_UP (planes[p].width, align);
+    planes[p].dest_stride = ROUND_UP (planes[p].width, 4);
+    planes[p].src_offset = src_size;
+    planes[p].dest_offset = dest_size;
+    src_size += (gsize) planes[p].src_stride * planes[p].height;
+    dest_size += (gsize) planes[p].dest_stride * planes[p].height;
+  }
+  frame_size = dest_size;
+
+  src = g_malloc (src_size);
+  dest = g_malloc (dest_size);
+  ref = g_malloc (dest_size);
+  for (i = 0; i < src_size; i++)
+    src[i] = g_random_int ();
+
+  g_print ("%dx%d I420, source strides aligned to %d bytes, %d iterations\n",
+      width, height, align, iterations);
+
+  run (copy_rows, planes, ref, src, 1);
+  base = run (copy_rows, planes, ref, src, iterations);
+  g_print ("%-10s %8.3f ms/frame %8.1f MB/s\n", "per-row", base,
+      frame_size / base / 1000.0);
+
+  impls = gst_omx_plane_copy_get_impls (&n);
+  for (i = 0; i < n; i++) {
+    gdouble t;
+
+    memset (dest, 0, dest_size);
+    run (impls[i].copy, planes, dest, src, 1);
+    if (memcmp (dest, ref, dest_size) != 0) {
+      g_printerr ("%s: output differs\n", impls[i].name);
+      return 1;
+    }
+
+    t = run (impls[i].copy, planes, dest, src, iterations);
+    g_print ("%-10s %8.3f ms/frame %8.1f MB/s %6.2fx\n", impls[i].name, t,
+        frame_size / t / 1000.0, base / t);
+  }
+
+  /* And the threaded copy as used by the elements */
+  gst_omx_plane_copy_set_threads (threads, 0);
+  memset (dest, 0, dest_size);
+  run (gst_omx_plane_copy, planes, dest, src, 1);
+  if (memcmp (dest, ref, dest_size) != 0) {
+    g_printerr ("threaded: output differs\n");
+    return 1;
+  } else {
+    gdouble t = run (gst_omx_plane_copy, planes, dest, src, iterations);
+
+    g_print ("%-10s %8.3f ms/frame %8.1f MB/s %6.2fx\n", "threaded", t,
+        frame_size / t / 1000.0, base / t);
+  }
+
+  g_free (ref);
+  g_free (dest);
+  g_free (src);
+
+  return 0;
+}
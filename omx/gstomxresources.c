@@ -0,0 +1,566 @@
+/*
+ * Copyright (C) 2013, Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+/* Admission control of the hardware resources of the cores.
+ *
+ * Elements with the same core and component role share a pool with the
+ * max-instances and max-load (in macroblocks per second) limits of their
+ * configuration groups. Before a component allocates its buffers, the
+ * element acquires its load from the pool. If that would exceed the
+ * limits, claims with a lower priority are preempted: their elements
+ * release their components and acquire the resources again later. The
+ * element waits up to the resource-timeout of the [gst-omx] group until
+ * enough resources were released, otherwise it is rejected instead of
+ * failing later with OMX_ErrorInsufficientResources.
+ *
+ * Preempted elements only notice that at their next buffer, so they
+ * have to be streaming for the resources to be released in time.
+ *
+ * The fallbacks key of an element lists other element groups whose
+ * components are used instead, e.g. a software core, if the element's
+ * own component can't be created or has no resources left. Only the
+ * last candidate preempts other elements or waits for resources.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "gstomxresources.h"
+#include "gstomx.h"
+
+GST_DEBUG_CATEGORY_EXTERN (gstomx_debug);
+#define GST_CAT_DEFAULT gstomx_debug
+
+/* Milliseconds to wait for resources to be released */
+#define GST_OMX_RESOURCES_DEFAULT_TIMEOUT 1000
+
+/* Framerate assumed for the load if the caps have none */
+#define GST_OMX_RESOURCES_DEFAULT_FPS 30
+
+typedef struct
+{
+  gchar *key;
+  guint max_instances;
+  guint64 max_load;
+
+  GList *claims;                /* Contains acquired GstOMXResource* */
+  guint n_instances;
+  guint64 load;
+} GstOMXResourcePool;
+
+struct _GstOMXResource
+{
+  GstOMXResourcePool *pool;
+  GstObject *owner;
+
+  /* Protected by the resources lock */
+  gint priority;
+  gboolean acquired;
+  gboolean preempted;
+  guint64 load;
+};
+
+/* Protects the pools and all resources, resources_cond is
+ * broadcast whenever resources are released */
+static GMutex resources_lock;
+static GCond resources_cond;
+static GHashTable *pools;       /* Contains GstOMXResourcePool* */
+static guint resources_timeout = GST_OMX_RESOURCES_DEFAULT_TIMEOUT;
+
+void
+gst_omx_resources_configure (GKeyFile * config, const gchar * group)
+{
+  GError *err = NULL;
+  gint value;
+
+  if (!g_key_file_has_key (config, group, "resource-timeout", NULL))
+    return;
+
+  value = g_key_file_get_integer (config, group, "resource-timeout", &err);
+  if (err || value < 0) {
+    GST_ERROR ("Invalid resource-timeout configuration");
+    g_clear_error (&err);
+  } else {
+    resources_timeout = value;
+  }
+}
+
+void
+gst_omx_resource_config_load (GstOMXResourceConfig * resource_config,
+    GKeyFile * config, const gchar * element_name)
+{
+  GError *err = NULL;
+  gint value;
+  guint64 load;
+
+  resource_config->max_instances = 0;
+  resource_config->max_load = 0;
+  resource_config->priority = 0;
+
+  value =
+      g_key_file_get_integer (config, element_name, "max-instances", &err);
+  if (!err && value >= 0)
+    resource_config->max_instances = value;
+  g_clear_error (&err);
+
+  load = g_key_file_get_uint64 (config, element_name, "max-load", &err);
+  if (!err)
+    resource_config->max_load = load;
+  g_clear_error (&err);
+
+  value =
+      g_key_file_get_integer (config, element_name, "resource-priority", &err);
+  if (!err)
+    resource_config->priority = value;
+  g_clear_error (&err);
+}
+
+/* NOTE: core-name and component-name have to be checked before */
+static void
+gst_omx_candidate_load (GstOMXCandidate * cand, GKeyFile * config,
+    const gchar * element_name)
+{
+  GError *err = NULL;
+  gchar **hacks;
+
+  cand->element_name = g_strdup (element_name);
+  cand->core_name =
+      g_key_file_get_string (config, element_name, "core-name", NULL);
+  cand->component_name =
+      g_key_file_get_string (config, element_name, "component-name", NULL);
+  cand->component_role =
+      g_key_file_get_string (config, element_name, "component-role", NULL);
+
+  cand->in_port_index =
+      g_key_file_get_integer (config, element_name, "in-port-index", &err);
+  if (err) {
+    cand->in_port_index = 0;
+    g_clear_error (&err);
+  }
+  cand->out_port_index =
+      g_key_file_get_integer (config, element_name, "out-port-index", &err);
+  if (err) {
+    cand->out_port_index = 1;
+    g_clear_error (&err);
+  }
+
+  if ((hacks =
+          g_key_file_get_string_list (config, element_name, "hacks", NULL,
+              NULL))) {
+    cand->hacks = gst_omx_parse_hacks (hacks);
+    g_strfreev (hacks);
+  }
+
+  gst_omx_resource_config_load (&cand->resource_config, config,
+      element_name);
+
+  cand->low_latency_extension =
+      g_key_file_get_string (config, element_name, "low-latency-extension",
+      NULL);
+}
+
+/* Returns the candidate components of an element, at least the one
+ * of its own group. Fallbacks without a usable core are skipped */
+GstOMXCandidate *
+gst_omx_candidates_load (GKeyFile * config, const gchar * element_name,
+    guint * n_candidates)
+{
+  GstOMXCandidate *candidates;
+  gchar **fallbacks;
+  gsize i, n_fallbacks = 0;
+  guint n = 0;
+
+  fallbacks =
+      g_key_file_get_string_list (config, element_name, "fallbacks",
+      &n_fallbacks, NULL);
+
+  candidates = g_new0 (GstOMXCandidate, n_fallbacks + 1);
+  gst_omx_candidate_load (&candidates[n++], config, element_name);
+
+  for (i = 0; i < n_fallbacks; i++) {
+    gchar *core_name;
+
+    core_name =
+        g_key_file_get_string (config, fallbacks[i], "core-name", NULL);
+    if (!core_name || !g_file_test (core_name, G_FILE_TEST_IS_REGULAR)
+        || !g_key_file_has_key (config, fallbacks[i], "component-name",
+            NULL)) {
+      GST_ERROR ("Invalid fallback '%s' for element '%s'", fallbacks[i],
+          element_name);
+      g_free (core_name);
+      continue;
+    }
+    g_free (core_name);
+
+    GST_DEBUG ("Using fallback '%s' for element '%s'", fallbacks[i],
+        element_name);
+    gst_omx_candidate_load (&candidates[n++], config, fallbacks[i]);
+  }
+  g_strfreev (fallbacks);
+
+  *n_candidates = n;
+
+  return candidates;
+}
+
+/* The limits of a pool are the lowest ones configured by its elements */
+static guint64
+gst_omx_resources_min_limit (guint64 a, guint64 b)
+{
+  if (a == 0)
+    return b;
+  if (b == 0)
+    return a;
+  return MIN (a, b);
+}
+
+GstOMXResource *
+gst_omx_resource_new (GstObject * owner, const gchar * core_name,
+    const gchar * component_role, const GstOMXResourceConfig * resource_config)
+{
+  GstOMXResource *res;
+  GstOMXResourcePool *pool;
+  gchar *key;
+
+  g_return_val_if_fail (core_name != NULL, NULL);
+  g_return_val_if_fail (resource_config != NULL, NULL);
+
+  key = g_strdup_printf ("%s:%s", core_name, GST_STR_NULL (component_role));
+
+  g_mutex_lock (&resources_lock);
+  if (!pools)
+    pools = g_hash_table_new (g_str_hash, g_str_equal);
+
+  pool = g_hash_table_lookup (pools, key);
+  if (!pool) {
+    pool = g_slice_new0 (GstOMXResourcePool);
+    pool->key = key;
+    g_hash_table_insert (pools, pool->key, pool);
+  } else {
+    g_free (key);
+  }
+  pool->max_instances =
+      gst_omx_resources_min_limit (pool->max_instances,
+      resource_config->max_instances);
+  pool->max_load =
+      gst_omx_resources_min_limit (pool->max_load, resource_config->max_load);
+  g_mutex_unlock (&resources_lock);
+
+  res = g_slice_new0 (GstOMXResource);
+  res->pool = pool;
+  res->owner = owner;
+  res->priority = resource_config->priority;
+
+  return res;
+}
+
+void
+gst_omx_resource_free (GstOMXResource * res)
+{
+  g_return_if_fail (res != NULL);
+
+  gst_omx_resource_release (res);
+  g_slice_free (GstOMXResource, res);
+}
+
+/* Applies from the next preemption on
+ *
+ * NOTE: Uses the resources lock */
+void
+gst_omx_resource_set_priority (GstOMXResource * res, gint priority)
+{
+  g_return_if_fail (res != NULL);
+
+  g_mutex_lock (&resources_lock);
+  res->priority = priority;
+  g_mutex_unlock (&resources_lock);
+}
+
+/* NOTE: Call with the resources lock */
+static gboolean
+gst_omx_resource_pool_fits (GstOMXResourcePool * pool, guint n_instances,
+    guint64 load)
+{
+  return (!pool->max_instances || n_instances <= pool->max_instances)
+      && (!pool->max_load || load <= pool->max_load);
+}
+
+static gint
+gst_omx_resource_compare_priority (gconstpointer a, gconstpointer b)
+{
+  const GstOMXResource *ra = a, *rb = b;
+
+  return (ra->priority > rb->priority) - (ra->priority < rb->priority);
+}
+
+/* Preempts claims with a lower priority than res, lowest first, until
+ * the load of res fits once they're released. Nothing is preempted if
+ * that's not possible. Returns TRUE if the preempted claims make enough
+ * room.
+ *
+ * NOTE: Call with the resources lock */
+static gboolean
+gst_omx_resource_preempt (GstOMXResource * res, guint64 load)
+{
+  GstOMXResourcePool *pool = res->pool;
+  GList *candidates = NULL, *l;
+  guint n_instances = pool->n_instances + 1;
+  guint64 pool_load = pool->load + load;
+  gboolean fits;
+
+  /* Claims that are already preempted will be released anyway */
+  for (l = pool->claims; l; l = l->next) {
+    GstOMXResource *claim = l->data;
+
+    if (claim->preempted) {
+      n_instances--;
+      pool_load -= claim->load;
+    } else if (claim->priority < res->priority) {
+      candidates = g_list_prepend (candidates, claim);
+    }
+  }
+  candidates = g_list_sort (candidates, gst_omx_resource_compare_priority);
+
+  fits = gst_omx_resource_pool_fits (pool, n_instances, pool_load);
+  for (l = candidates; l && !fits; l = l->next) {
+    GstOMXResource *claim = l->data;
+
+    n_instances--;
+    pool_load -= claim->load;
+    fits = gst_omx_resource_pool_fits (pool, n_instances, pool_load);
+  }
+
+  if (fits) {
+    GList *end = l;
+
+    for (l = candidates; l != end; l = l->next) {
+      GstOMXResource *claim = l->data;
+
+      GST_INFO_OBJECT (res->owner, "Preempting %" GST_PTR_FORMAT
+          " (priority %d)", claim->owner, claim->priority);
+      claim->preempted = TRUE;
+    }
+  }
+
+  g_list_free (candidates);
+
+  return fits;
+}
+
+/* TRUE if load fits into the pool of the resource without preempting
+ * other elements, counting an acquired load of res as released
+ *
+ * NOTE: Uses the resources lock */
+gboolean
+gst_omx_resource_has_room (GstOMXResource * res, guint64 load)
+{
+  GstOMXResourcePool *pool;
+  guint n_instances;
+  guint64 pool_load;
+  gboolean fits;
+
+  g_return_val_if_fail (res != NULL, FALSE);
+
+  pool = res->pool;
+
+  g_mutex_lock (&resources_lock);
+  n_instances = pool->n_instances + 1;
+  pool_load = pool->load + load;
+  if (res->acquired) {
+    n_instances--;
+    pool_load -= res->load;
+  }
+  fits = gst_omx_resource_pool_fits (pool, n_instances, pool_load);
+  g_mutex_unlock (&resources_lock);
+
+  return fits;
+}
+
+/* Acquires load macroblocks per second from the pool of the resource.
+ * If the limits are reached, claims with a lower priority are preempted
+ * and, if wait is TRUE, the resource-timeout is waited for resources to
+ * be released. A resource that is acquired already is acquired again
+ * with the new load, or keeps its old claim if that fails.
+ *
+ * NOTE: Uses the resources lock */
+GstOMXResourceReturn
+gst_omx_resource_acquire (GstOMXResource * res, guint64 load, gboolean wait)
+{
+  GstOMXResourcePool *pool;
+  GstOMXResourceReturn ret = GST_OMX_RESOURCE_OK;
+  gboolean reacquire, was_preempted;
+  guint64 old_load;
+  gint64 deadline;
+
+  g_return_val_if_fail (res != NULL, GST_OMX_RESOURCE_BUSY);
+
+  pool = res->pool;
+
+  g_mutex_lock (&resources_lock);
+  reacquire = res->acquired;
+  was_preempted = res->preempted;
+  old_load = res->load;
+  if (reacquire) {
+    pool->claims = g_list_remove (pool->claims, res);
+    pool->n_instances--;
+    pool->load -= res->load;
+    res->acquired = FALSE;
+  }
+  res->preempted = FALSE;
+
+  if (!gst_omx_resource_pool_fits (pool, 1, load)) {
+    GST_ERROR_OBJECT (res->owner, "Load %" G_GUINT64_FORMAT " exceeds the "
+        "limit %" G_GUINT64_FORMAT " of %s", load, pool->max_load, pool->key);
+    ret = GST_OMX_RESOURCE_TOO_LARGE;
+    goto done;
+  }
+
+  deadline =
+      g_get_monotonic_time () + resources_timeout * G_TIME_SPAN_MILLISECOND;
+  while (!gst_omx_resource_pool_fits (pool, pool->n_instances + 1,
+          pool->load + load)) {
+    gboolean preempting;
+
+    preempting = gst_omx_resource_preempt (res, load);
+    GST_DEBUG_OBJECT (res->owner, "%s is busy (%u instances, load %"
+        G_GUINT64_FORMAT "), %s", pool->key, pool->n_instances, pool->load,
+        (preempting ? "preempting" : "waiting"));
+
+    if (!wait || !g_cond_wait_until (&resources_cond, &resources_lock,
+            deadline)) {
+      ret = GST_OMX_RESOURCE_BUSY;
+      break;
+    }
+  }
+
+  /* Might have been released right before the timeout */
+  if (ret == GST_OMX_RESOURCE_BUSY
+      && gst_omx_resource_pool_fits (pool, pool->n_instances + 1,
+          pool->load + load))
+    ret = GST_OMX_RESOURCE_OK;
+
+done:
+  /* The hardware of the old claim is still in use */
+  if (ret != GST_OMX_RESOURCE_OK && reacquire) {
+    load = old_load;
+    res->preempted = was_preempted;
+  }
+
+  if (ret == GST_OMX_RESOURCE_OK || reacquire) {
+    pool->claims = g_list_prepend (pool->claims, res);
+    pool->n_instances++;
+    pool->load += load;
+    res->load = load;
+    res->acquired = TRUE;
+  }
+
+  GST_DEBUG_OBJECT (res->owner, "Acquiring load %" G_GUINT64_FORMAT " of %s: "
+      "%d (%u instances, load %" G_GUINT64_FORMAT ")", load, pool->key, ret,
+      pool->n_instances, pool->load);
+  g_mutex_unlock (&resources_lock);
+
+  return ret;
+}
+
+/* NOTE: Uses the resources lock */
+void
+gst_omx_resource_release (GstOMXResource * res)
+{
+  GstOMXResourcePool *pool;
+
+  g_return_if_fail (res != NULL);
+
+  pool = res->pool;
+
+  g_mutex_lock (&resources_lock);
+  if (res->acquired) {
+    pool->claims = g_list_remove (pool->claims, res);
+    pool->n_instances--;
+    pool->load -= res->load;
+    res->acquired = FALSE;
+    res->load = 0;
+    g_cond_broadcast (&resources_cond);
+
+    GST_DEBUG_OBJECT (res->owner, "Released resources of %s (%u instances, "
+        "load %" G_GUINT64_FORMAT ")", pool->key, pool->n_instances,
+        pool->load);
+  }
+  g_mutex_unlock (&resources_lock);
+}
+
+/* NOTE: Uses the resources lock */
+gboolean
+gst_omx_resource_is_acquired (GstOMXResource * res)
+{
+  gboolean acquired;
+
+  g_return_val_if_fail (res != NULL, FALSE);
+
+  g_mutex_lock (&resources_lock);
+  acquired = res->acquired;
+  g_mutex_unlock (&resources_lock);
+
+  return acquired;
+}
+
+/* Called if the component lost its resources, e.g. with
+ * OMX_ErrorResourcesPreempted
+ *
+ * NOTE: Uses the resources lock */
+void
+gst_omx_resource_set_preempted (GstOMXResource * res)
+{
+  g_return_if_fail (res != NULL);
+
+  g_mutex_lock (&resources_lock);
+  res->preempted = TRUE;
+  g_mutex_unlock (&resources_lock);
+}
+
+/* TRUE if the owner has to release the resources until
+ * it acquires them again
+ *
+ * NOTE: Uses the resources lock */
+gboolean
+gst_omx_resource_is_preempted (GstOMXResource * res)
+{
+  gboolean preempted;
+
+  g_return_val_if_fail (res != NULL, FALSE);
+
+  g_mutex_lock (&resources_lock);
+  preempted = res->preempted;
+  g_mutex_unlock (&resources_lock);
+
+  return preempted;
+}
+
+/* Load of a video stream in macroblocks per second */
+guint64
+gst_omx_resource_video_load (gint width, gint height, gint fps_n, gint fps_d)
+{
+  guint64 mbs;
+
+  mbs = (guint64) ((MAX (width, 0) + 15) / 16) * ((MAX (height, 0) + 15) / 16);
+  if (fps_n <= 0 || fps_d <= 0)
+    return mbs * GST_OMX_RESOURCES_DEFAULT_FPS;
+
+  return gst_util_uint64_scale (mbs, fps_n, fps_d);
+}
@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2013, Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+#ifndef __GST_OMX_RESOURCES_H__
+#define __GST_OMX_RESOURCES_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+typedef struct _GstOMXResource GstOMXResource;
+typedef struct _GstOMXResourceConfig GstOMXResourceConfig;
+typedef struct _GstOMXCandidate GstOMXCandidate;
+
+/* Resource configuration of an element, the defaults are read from the
+ * keys with the same names of its configuration group */
+struct _GstOMXResourceConfig {
+  /* Limits of all elements with the same core and role,
+   * 0 for no limit */
+  guint max_instances;
+  guint64 max_load; /* Macroblocks per second */
+  /* Elements with a higher priority preempt the ones with
+   * a lower priority if the limits are reached */
+  gint priority;
+};
+
+/* A component an element can use, in the order they're tried:
+ * the one of its own configuration group, then the ones of the
+ * groups listed in its fallbacks key */
+struct _GstOMXCandidate {
+  gchar *element_name; /* Configuration group */
+  gchar *core_name;
+  gchar *component_name;
+  gchar *component_role;
+  guint32 in_port_index, out_port_index;
+  guint64 hacks;
+  GstOMXResourceConfig resource_config;
+  /* Vendor extension that minimizes the output delay, see
+   * gst_omx_port_set_extension_enabled() */
+  gchar *low_latency_extension;
+};
+
+typedef enum {
+  GST_OMX_RESOURCE_OK,
+  /* The limits are reached and no resources were released in time */
+  GST_OMX_RESOURCE_BUSY,
+  /* The load alone exceeds the limits */
+  GST_OMX_RESOURCE_TOO_LARGE
+} GstOMXResourceReturn;
+
+void                 gst_omx_resources_configure (GKeyFile * config, const gchar * group);
+
+void                 gst_omx_resource_config_load (GstOMXResourceConfig * resource_config,
+                                                   GKeyFile * config,
+                                                   const gchar * element_name);
+GstOMXCandidate *    gst_omx_candidates_load (GKeyFile * config, const gchar * element_name,
+                                              guint * n_candidates);
+
+GstOMXResource *     gst_omx_resource_new (GstObject * owner, const gchar * core_name,
+                                           const gchar * component_role,
+                                           const GstOMXResourceConfig * resource_config);
+void                 gst_omx_resource_free (GstOMXResource * res);
+void                 gst_omx_resource_set_priority (GstOMXResource * res, gint priority);
+
+gboolean             gst_omx_resource_has_room (GstOMXResource * res, guint64 load);
+GstOMXResourceReturn gst_omx_resource_acquire (GstOMXResource * res, guint64 load,
+                                               gboolean wait);
+void                 gst_omx_resource_release (GstOMXResource * res);
+gboolean             gst_omx_resource_is_acquired (GstOMXResource * res);
+
+void                 gst_omx_resource_set_preempted (GstOMXResource * res);
+gboolean             gst_omx_resource_is_preempted (GstOMXResource * res);
+
+guint64              gst_omx_resource_video_load (gint width, gint height,
+                                                  gint fps_n, gint fps_d);
+
+G_END_DECLS
+
+#endif /* __GST_OMX_RESOURCES_H__ */
@@ -0,0 +1,147 @@
+/*
+ * Copyright (C) 2013, Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#include "gstomxring.h"
+
+/* Every slot starts with its sequence number, followed by the element.
+ *
+ * A slot at position pos can be pushed to if its sequence number is pos,
+ * it contains an element that can be popped if its sequence number is
+ * pos + 1. After popping, the sequence number is set to pos + capacity,
+ * which is the position at which the slot is used next.
+ */
+#define SLOT_DATA_OFFSET 8
+
+static inline volatile gint *
+gst_omx_ring_slot (GstOMXRing * ring, guint pos)
+{
+  return (volatile gint *) (ring->slots + (pos & ring->mask) * ring->slot_size);
+}
+
+GstOMXRing *
+gst_omx_ring_new (guint min_capacity, gsize element_size)
+{
+  GstOMXRing *ring;
+  guint capacity = 1;
+  guint i;
+
+  g_return_val_if_fail (min_capacity > 0, NULL);
+  g_return_val_if_fail (element_size > 0, NULL);
+
+  while (capacity < min_capacity)
+    capacity <<= 1;
+
+  ring = g_slice_new0 (GstOMXRing);
+  ring->capacity = capacity;
+  ring->mask = capacity - 1;
+  ring->element_size = element_size;
+  ring->slot_size = (SLOT_DATA_OFFSET + element_size + 7) & ~((gsize) 7);
+  ring->slots = g_malloc0 (ring->slot_size * capacity);
+
+  for (i = 0; i < capacity; i++)
+    *gst_omx_ring_slot (ring, i) = i;
+
+  return ring;
+}
+
+void
+gst_omx_ring_free (GstOMXRing * ring)
+{
+  g_return_if_fail (ring != NULL);
+
+  g_free (ring->slots);
+  g_slice_free (GstOMXRing, ring);
+}
+
+/* Returns FALSE if the ring is full */
+gboolean
+gst_omx_ring_push (GstOMXRing * ring, gconstpointer element)
+{
+  volatile gint *slot;
+  guint pos;
+  gint diff;
+
+  pos = (guint) g_atomic_int_get (&ring->tail);
+  for (;;) {
+    slot = gst_omx_ring_slot (ring, pos);
+    diff = (gint) ((guint) g_atomic_int_get (slot) - pos);
+
+    if (diff == 0) {
+      /* Slot is free, try to claim it */
+      if (g_atomic_int_compare_and_exchange (&ring->tail, (gint) pos,
+              (gint) (pos + 1)))
+        break;
+    } else if (diff < 0) {
+      /* Slot still contains the element of the previous round */
+      return FALSE;
+    }
+
+    /* Another thread pushed in the meantime */
+    pos = (guint) g_atomic_int_get (&ring->tail);
+  }
+
+  memcpy ((guint8 *) slot + SLOT_DATA_OFFSET, element, ring->element_size);
+  g_atomic_int_set (slot, (gint) (pos + 1));
+
+  return TRUE;
+}
+
+/* Returns FALSE if the ring is empty.
+ *
+ * NOTE: Calls must be serialized by the caller */
+gboolean
+gst_omx_ring_pop (GstOMXRing * ring, gpointer element)
+{
+  volatile gint *slot;
+  guint pos;
+  gint diff;
+
+  pos = (guint) g_atomic_int_get (&ring->head);
+  slot = gst_omx_ring_slot (ring, pos);
+  diff = (gint) ((guint) g_atomic_int_get (slot) - (pos + 1));
+
+  if (diff < 0)
+    return FALSE;
+
+  memcpy (element, (guint8 *) slot + SLOT_DATA_OFFSET, ring->element_size);
+  g_atomic_int_set (&ring->head, (gint) (pos + 1));
+  g_atomic_int_set (slot, (gint) (pos + ring->capacity));
+
+  return TRUE;
+}
+
+/* Can be called from any thread, but the result is only
+ * reliable if no other thread pops from the ring */
+gboolean
+gst_omx_ring_is_empty (GstOMXRing * ring)
+{
+  volatile gint *slot;
+  guint pos;
+
+  pos = (guint) g_atomic_int_get (&ring->head);
+  slot = gst_omx_ring_slot (ring, pos);
+
+  return (gint) ((guint) g_atomic_int_get (slot) - (pos + 1)) < 0;
+}
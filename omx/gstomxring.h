@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2013, Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+#ifndef __GST_OMX_RING_H__
+#define __GST_OMX_RING_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+#define GST_OMX_CACHE_LINE_SIZE 64
+
+typedef struct _GstOMXRing GstOMXRing;
+
+/* Fixed capacity, lock-free ring of fixed size elements.
+ *
+ * Pushing never blocks and never allocates, it can be done from
+ * any number of threads at the same time, e.g. from the OpenMAX
+ * callbacks. Popping must be serialized by the caller, which is
+ * usually done by holding a lock while handling the ring contents.
+ *
+ * The producer and consumer positions are on separate cache lines
+ * so that the callback threads don't contend with the consumer.
+ */
+struct _GstOMXRing {
+  guint capacity;
+  guint mask;
+  gsize element_size;
+  gsize slot_size;
+  guint8 *slots;
+
+  guint8 _pad0[GST_OMX_CACHE_LINE_SIZE];
+  volatile gint tail; /* Next position to push to */
+  guint8 _pad1[GST_OMX_CACHE_LINE_SIZE - sizeof (gint)];
+  volatile gint head; /* Next position to pop from */
+  guint8 _pad2[GST_OMX_CACHE_LINE_SIZE - sizeof (gint)];
+};
+
+GstOMXRing *      gst_omx_ring_new (guint min_capacity, gsize element_size);
+void              gst_omx_ring_free (GstOMXRing * ring);
+
+gboolean          gst_omx_ring_push (GstOMXRing * ring, gconstpointer element);
+gboolean          gst_omx_ring_pop (GstOMXRing * ring, gpointer element);
+gboolean          gst_omx_ring_is_empty (GstOMXRing * ring);
+
+G_END_DECLS
+
+#endif /* __GST_OMX_RING_H__ */
@@ -0,0 +1,276 @@
+/*
+ * Copyright (C) 2013, Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+/* Statistics of the elements, available as GstStructure in their
+ * stats property and posted as element message every stats-interval
+ * milliseconds:
+ *
+ *   GstOMXStats,
+ *     frames-in, frames-out, drops, late-drops (guint64)
+ *     bytes-copied-in, bytes-copied-out (guint64)
+ *     component-latency, latency, seek-latency (GstValueArray of guint64)
+ *
+ *   and for the in- and out- port, if the component exists:
+ *     {in,out}-acquire-time, {in,out}-flush-time,
+ *     {in,out}-reconfigure-time (GstClockTime)
+ *     {in,out}-flushes, {in,out}-reconfigures (guint)
+ *     {in,out}-buffers-component, {in,out}-buffers-pending,
+ *     {in,out}-buffers-downstream (guint)
+ *
+ * The latency histograms have GST_OMX_STATS_N_BINS bins, bin 0 counts
+ * latencies below 1ms, bin i > 0 the ones between 2^(i-1)ms and 2^i ms
+ * and the last bin all larger ones.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#include "gstomxstats.h"
+
+GstOMXStats *
+gst_omx_stats_new (void)
+{
+  GstOMXStats *stats;
+
+  stats = g_slice_new0 (GstOMXStats);
+  stats->lock = g_mutex_new ();
+
+  return stats;
+}
+
+void
+gst_omx_stats_free (GstOMXStats * stats)
+{
+  g_return_if_fail (stats != NULL);
+
+  g_mutex_free (stats->lock);
+  g_slice_free (GstOMXStats, stats);
+}
+
+/* Keeps the interval */
+void
+gst_omx_stats_reset (GstOMXStats * stats)
+{
+  g_return_if_fail (stats != NULL);
+
+  g_mutex_lock (stats->lock);
+  memset (stats->counters, 0, sizeof (stats->counters));
+  memset (stats->histograms, 0, sizeof (stats->histograms));
+  stats->last_post = 0;
+  stats->seek_start = 0;
+  g_mutex_unlock (stats->lock);
+}
+
+void
+gst_omx_stats_add (GstOMXStats * stats, GstOMXStatsCounter counter,
+    guint64 value)
+{
+  g_mutex_lock (stats->lock);
+  stats->counters[counter] += value;
+  g_mutex_unlock (stats->lock);
+}
+
+/* latency is in microseconds */
+void
+gst_omx_stats_add_latency (GstOMXStats * stats,
+    GstOMXStatsHistogram histogram, gint64 latency)
+{
+  guint bin = 0;
+  gint64 ms;
+
+  ms = latency / 1000;
+  while (ms > 0 && bin < GST_OMX_STATS_N_BINS - 1) {
+    ms >>= 1;
+    bin++;
+  }
+
+  g_mutex_lock (stats->lock);
+  stats->histograms[histogram][bin]++;
+  g_mutex_unlock (stats->lock);
+}
+
+/* Called when a flushing seek starts, the time until the next
+ * gst_omx_stats_seek_done() is added to the seek-latency. Later
+ * seeks before that are part of the first one */
+void
+gst_omx_stats_seek_start (GstOMXStats * stats)
+{
+  g_mutex_lock (stats->lock);
+  if (!stats->seek_start)
+    stats->seek_start = g_get_monotonic_time ();
+  g_mutex_unlock (stats->lock);
+}
+
+/* Called for every output that is pushed */
+void
+gst_omx_stats_seek_done (GstOMXStats * stats)
+{
+  gint64 latency;
+
+  g_mutex_lock (stats->lock);
+  if (G_LIKELY (!stats->seek_start)) {
+    g_mutex_unlock (stats->lock);
+    return;
+  }
+  latency = g_get_monotonic_time () - stats->seek_start;
+  stats->seek_start = 0;
+  g_mutex_unlock (stats->lock);
+
+  gst_omx_stats_add_latency (stats, GST_OMX_STATS_SEEK_LATENCY, latency);
+}
+
+/* interval is in milliseconds, 0 disables the messages */
+void
+gst_omx_stats_set_interval (GstOMXStats * stats, guint interval)
+{
+  g_mutex_lock (stats->lock);
+  stats->interval = (gint64) interval * 1000;
+  g_mutex_unlock (stats->lock);
+}
+
+guint
+gst_omx_stats_get_interval (GstOMXStats * stats)
+{
+  guint interval;
+
+  g_mutex_lock (stats->lock);
+  interval = stats->interval / 1000;
+  g_mutex_unlock (stats->lock);
+
+  return interval;
+}
+
+static void
+gst_omx_stats_set_histogram (GstStructure * s, const gchar * name,
+    const guint64 * bins)
+{
+  GValue array = { 0, };
+  GValue v = { 0, };
+  gint i;
+
+  g_value_init (&array, GST_TYPE_ARRAY);
+  g_value_init (&v, G_TYPE_UINT64);
+  for (i = 0; i < GST_OMX_STATS_N_BINS; i++) {
+    g_value_set_uint64 (&v, bins[i]);
+    gst_value_array_append_value (&array, &v);
+  }
+  gst_structure_set_value (s, name, &array);
+  g_value_unset (&v);
+  g_value_unset (&array);
+}
+
+static void
+gst_omx_stats_set_port (GstStructure * s, const gchar * prefix,
+    GstOMXPort * port)
+{
+  GstOMXPortStats port_stats;
+  gchar *name;
+
+  gst_omx_port_get_stats (port, &port_stats);
+
+#define SET_FIELD(field, type, value) G_STMT_START { \
+  name = g_strconcat (prefix, field, NULL); \
+  gst_structure_set (s, name, type, value, NULL); \
+  g_free (name); \
+} G_STMT_END
+
+  SET_FIELD ("-acquire-time", G_TYPE_UINT64,
+      (guint64) port_stats.acquire_time * GST_USECOND);
+  SET_FIELD ("-flushes", G_TYPE_UINT, port_stats.flushes);
+  SET_FIELD ("-flush-time", G_TYPE_UINT64,
+      (guint64) port_stats.flush_time * GST_USECOND);
+  SET_FIELD ("-reconfigures", G_TYPE_UINT, port_stats.reconfigures);
+  SET_FIELD ("-reconfigure-time", G_TYPE_UINT64,
+      (guint64) port_stats.reconfigure_time * GST_USECOND);
+  SET_FIELD ("-buffers-component", G_TYPE_UINT, port_stats.n_component);
+  SET_FIELD ("-buffers-pending", G_TYPE_UINT, port_stats.n_pending);
+  SET_FIELD ("-buffers-downstream", G_TYPE_UINT, port_stats.n_downstream);
+
+#undef SET_FIELD
+}
+
+/* The ports can be NULL if the component doesn't exist */
+GstStructure *
+gst_omx_stats_get_structure (GstOMXStats * stats, GstOMXPort * in_port,
+    GstOMXPort * out_port)
+{
+  guint64 counters[GST_OMX_STATS_N_COUNTERS];
+  guint64 histograms[GST_OMX_STATS_N_HISTOGRAMS][GST_OMX_STATS_N_BINS];
+  GstStructure *s;
+
+  g_return_val_if_fail (stats != NULL, NULL);
+
+  g_mutex_lock (stats->lock);
+  memcpy (counters, stats->counters, sizeof (counters));
+  memcpy (histograms, stats->histograms, sizeof (histograms));
+  g_mutex_unlock (stats->lock);
+
+  s = gst_structure_new ("GstOMXStats",
+      "frames-in", G_TYPE_UINT64, counters[GST_OMX_STATS_FRAMES_IN],
+      "frames-out", G_TYPE_UINT64, counters[GST_OMX_STATS_FRAMES_OUT],
+      "drops", G_TYPE_UINT64, counters[GST_OMX_STATS_DROPS],
+      "late-drops", G_TYPE_UINT64, counters[GST_OMX_STATS_LATE_DROPS],
+      "bytes-copied-in", G_TYPE_UINT64,
+      counters[GST_OMX_STATS_BYTES_COPIED_IN],
+      "bytes-copied-out", G_TYPE_UINT64,
+      counters[GST_OMX_STATS_BYTES_COPIED_OUT], NULL);
+
+  gst_omx_stats_set_histogram (s, "component-latency",
+      histograms[GST_OMX_STATS_COMPONENT_LATENCY]);
+  gst_omx_stats_set_histogram (s, "latency",
+      histograms[GST_OMX_STATS_LATENCY]);
+  gst_omx_stats_set_histogram (s, "seek-latency",
+      histograms[GST_OMX_STATS_SEEK_LATENCY]);
+
+  if (in_port)
+    gst_omx_stats_set_port (s, "in", in_port);
+  if (out_port)
+    gst_omx_stats_set_port (s, "out", out_port);
+
+  return s;
+}
+
+/* Posts the statistics as element message if the interval
+ * passed since the last message. Called by the elements
+ * for every output buffer */
+void
+gst_omx_stats_post (GstOMXStats * stats, GstElement * element,
+    GstOMXPort * in_port, GstOMXPort * out_port)
+{
+  gint64 now;
+  gboolean post = FALSE;
+
+  g_mutex_lock (stats->lock);
+  if (stats->interval > 0) {
+    now = g_get_monotonic_time ();
+    if (now - stats->last_post >= stats->interval) {
+      stats->last_post = now;
+      post = TRUE;
+    }
+  }
+  g_mutex_unlock (stats->lock);
+
+  if (post)
+    gst_element_post_message (element,
+        gst_message_new_element (GST_OBJECT (element),
+            gst_omx_stats_get_structure (stats, in_port, out_port)));
+}
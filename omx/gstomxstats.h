@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2013, Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+#ifndef __GST_OMX_STATS_H__
+#define __GST_OMX_STATS_H__
+
+#include <gst/gst.h>
+
+#include "gstomx.h"
+
+G_BEGIN_DECLS
+
+typedef struct _GstOMXStats GstOMXStats;
+
+typedef enum {
+  GST_OMX_STATS_FRAMES_IN,
+  GST_OMX_STATS_FRAMES_OUT,
+  GST_OMX_STATS_DROPS,
+  GST_OMX_STATS_LATE_DROPS,
+  GST_OMX_STATS_BYTES_COPIED_IN,
+  GST_OMX_STATS_BYTES_COPIED_OUT,
+  GST_OMX_STATS_N_COUNTERS
+} GstOMXStatsCounter;
+
+typedef enum {
+  /* From passing the input to the component until
+   * the output is handled */
+  GST_OMX_STATS_COMPONENT_LATENCY,
+  /* From receiving the input until the output was pushed */
+  GST_OMX_STATS_LATENCY,
+  /* From the start of a flushing seek until the first
+   * output was pushed */
+  GST_OMX_STATS_SEEK_LATENCY,
+  GST_OMX_STATS_N_HISTOGRAMS
+} GstOMXStatsHistogram;
+
+/* Bin i counts latencies below 2^i milliseconds, the
+ * last bin all latencies that are larger */
+#define GST_OMX_STATS_N_BINS 12
+
+/* Statistics of an element. Counters can be updated from any thread */
+struct _GstOMXStats {
+  GMutex *lock;
+
+  guint64 counters[GST_OMX_STATS_N_COUNTERS];
+  guint64 histograms[GST_OMX_STATS_N_HISTOGRAMS][GST_OMX_STATS_N_BINS];
+
+  /* Interval of the element messages in microseconds, 0 if disabled */
+  gint64 interval;
+  gint64 last_post;
+
+  /* Start of the pending seek, 0 if none */
+  gint64 seek_start;
+};
+
+GstOMXStats *  gst_omx_stats_new (void);
+void           gst_omx_stats_free (GstOMXStats * stats);
+void           gst_omx_stats_reset (GstOMXStats * stats);
+
+void           gst_omx_stats_add (GstOMXStats * stats, GstOMXStatsCounter counter,
+                                  guint64 value);
+void           gst_omx_stats_add_latency (GstOMXStats * stats,
+                                          GstOMXStatsHistogram histogram,
+                                          gint64 latency);
+void           gst_omx_stats_seek_start (GstOMXStats * stats);
+void           gst_omx_stats_seek_done (GstOMXStats * stats);
+
+void           gst_omx_stats_set_interval (GstOMXStats * stats, guint interval);
+guint          gst_omx_stats_get_interval (GstOMXStats * stats);
+
+GstStructure * gst_omx_stats_get_structure (GstOMXStats * stats,
+                                            GstOMXPort * in_port,
+                                            GstOMXPort * out_port);
+void           gst_omx_stats_post (GstOMXStats * stats, GstElement * element,
+                                   GstOMXPort * in_port, GstOMXPort * out_port);
+
+G_END_DECLS
+
+#endif /* __GST_OMX_STATS_H__ */
@@ -0,0 +1,310 @@
+/*
+ * Copyright (C) 2013, Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+/* Per-buffer lifecycle tracing of the components.
+ *
+ * Enabled by setting the GST_OMX_TRACE environment variable or the
+ * trace-file key of the [gst-omx] group to the file the traces are
+ * written to. Otherwise components have no trace and all trace points
+ * are a single branch.
+ *
+ * Events are recorded into a lock-free ring per component, so recording
+ * never blocks the streaming threads or the OpenMAX callbacks. Events
+ * that don't fit into the ring are dropped and counted. The rings are
+ * written to the file at EOS, when the component is freed or when the
+ * dump-trace action signal of an element is emitted.
+ *
+ * The file uses the JSON array format of the Chrome trace viewer, which
+ * allows the closing bracket to be missing, so that later dumps can just
+ * be appended. It can be loaded in chrome://tracing or Perfetto. Every
+ * component is shown as a process and every thread as a thread of it.
+ * Besides the calls and callbacks, the time a buffer is owned by the
+ * component or by downstream is shown as async "component" and
+ * "downstream" spans of the buffer.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <glib/gstdio.h>
+
+#include "gstomxtrace.h"
+#include "gstomxring.h"
+
+GST_DEBUG_CATEGORY_EXTERN (gstomx_debug);
+#define GST_CAT_DEFAULT gstomx_debug
+
+#define GST_OMX_TRACE_DEFAULT_SIZE 16384
+
+typedef struct
+{
+  gint64 start;
+  gint64 duration;              /* -1 for instant events */
+  gconstpointer buffer;
+  gpointer thread;
+  gint64 arg;
+  guint32 port;
+  GstOMXTraceType type;
+} GstOMXTraceEvent;
+
+struct _GstOMXTrace
+{
+  guint id;
+  gchar *component_name;
+  gchar *owner_name;            /* Protected by the trace_file lock */
+
+  GstOMXRing *events;           /* Contains GstOMXTraceEvents */
+  gint dropped;                 /* atomic */
+};
+
+static const struct
+{
+  const gchar *name;
+  const gchar *arg_name;        /* NULL if arg is unused */
+  /* Ownership span of the buffer that is started ('b')
+   * or ended ('e') by the event, if any */
+  const gchar *span;
+  gchar span_phase;
+} event_info[] = {
+  {"acquire_buffer", "ret", NULL, 0},
+  {"release_buffer", "ret", NULL, 0},
+  {"OMX_EmptyThisBuffer", "filled", "component", 'b'},
+  {"OMX_FillThisBuffer", NULL, "component", 'b'},
+  {"push", "flow", NULL, 0},
+  {"set_state", "state", NULL, 0},
+  {"set_enabled", "enabled", NULL, 0},
+  {"set_flushing", "flush", NULL, 0},
+  {"EmptyBufferDone", NULL, "component", 'e'},
+  {"FillBufferDone", "filled", "component", 'e'},
+  {"state set", "state", NULL, 0},
+  {"port enable done", "enabled", NULL, 0},
+  {"flush done", NULL, NULL, 0},
+  {"wrap_buffer", NULL, "downstream", 'b'},
+  {"unwrap_buffer", NULL, "downstream", 'e'},
+  {"EOS", NULL, NULL, 0}
+};
+
+/* Protects the file and the popping from the rings */
+G_LOCK_DEFINE_STATIC (trace_file);
+static gchar *trace_file_name;
+static FILE *trace_file;
+static guint trace_size = GST_OMX_TRACE_DEFAULT_SIZE;
+static gint trace_next_id;      /* atomic */
+
+void
+gst_omx_trace_configure (GKeyFile * config, const gchar * group)
+{
+  GError *err = NULL;
+  const gchar *env;
+  gint size;
+
+  env = g_getenv ("GST_OMX_TRACE");
+  if (env && *env) {
+    trace_file_name = g_strdup (env);
+  } else {
+    trace_file_name = g_key_file_get_string (config, group, "trace-file", NULL);
+    if (trace_file_name && !*trace_file_name) {
+      g_free (trace_file_name);
+      trace_file_name = NULL;
+    }
+  }
+
+  if (g_key_file_has_key (config, group, "trace-size", NULL)) {
+    size = g_key_file_get_integer (config, group, "trace-size", &err);
+    if (err || size <= 0) {
+      GST_ERROR ("Invalid trace-size configuration");
+      g_clear_error (&err);
+    } else {
+      trace_size = size;
+    }
+  }
+
+  if (trace_file_name)
+    GST_INFO ("Tracing components to '%s', %u events per component",
+        trace_file_name, trace_size);
+}
+
+/* Returns NULL if tracing is disabled */
+GstOMXTrace *
+gst_omx_trace_new (const gchar * component_name)
+{
+  GstOMXTrace *trace;
+
+  if (G_LIKELY (!trace_file_name))
+    return NULL;
+
+  trace = g_slice_new0 (GstOMXTrace);
+  trace->id = g_atomic_int_add (&trace_next_id, 1) + 1;
+  trace->component_name = g_strdup (component_name);
+  trace->events = gst_omx_ring_new (trace_size, sizeof (GstOMXTraceEvent));
+
+  return trace;
+}
+
+void
+gst_omx_trace_free (GstOMXTrace * trace)
+{
+  g_return_if_fail (trace != NULL);
+
+  gst_omx_trace_dump (trace);
+
+  gst_omx_ring_free (trace->events);
+  g_free (trace->owner_name);
+  g_free (trace->component_name);
+  g_slice_free (GstOMXTrace, trace);
+}
+
+/* Components are reused by other elements, see
+ * gst_omx_component_release() */
+void
+gst_omx_trace_set_owner (GstOMXTrace * trace, GstObject * owner)
+{
+  gchar *owner_name;
+
+  g_return_if_fail (trace != NULL);
+
+  owner_name = owner ? gst_object_get_name (owner) : NULL;
+
+  /* Events of the previous owner are labelled with its name */
+  gst_omx_trace_dump (trace);
+
+  G_LOCK (trace_file);
+  g_free (trace->owner_name);
+  trace->owner_name = owner_name;
+  G_UNLOCK (trace_file);
+}
+
+/* Can be called from any thread, never blocks */
+void
+gst_omx_trace_record (GstOMXTrace * trace, GstOMXTraceType type,
+    guint32 port, gconstpointer buffer, gint64 arg, gint64 start,
+    gint64 duration)
+{
+  GstOMXTraceEvent event;
+
+  event.start = start;
+  event.duration = duration;
+  event.buffer = buffer;
+  event.thread = g_thread_self ();
+  event.arg = arg;
+  event.port = port;
+  event.type = type;
+
+  if (G_UNLIKELY (!gst_omx_ring_push (trace->events, &event)))
+    g_atomic_int_inc (&trace->dropped);
+}
+
+static void
+gst_omx_trace_write_event (GstOMXTrace * trace, GString * s,
+    const GstOMXTraceEvent * event)
+{
+  const gchar *arg_name = event_info[event->type].arg_name;
+  guint64 tid = (guint64) (guintptr) event->thread;
+
+  g_string_append_printf (s, "{\"name\":\"%s\",\"cat\":\"omx\",\"ph\":\"%s\","
+      "\"ts\":%" G_GINT64_FORMAT ",", event_info[event->type].name,
+      event->duration >= 0 ? "X" : "i", event->start);
+  if (event->duration >= 0)
+    g_string_append_printf (s, "\"dur\":%" G_GINT64_FORMAT ",",
+        event->duration);
+  else
+    g_string_append (s, "\"s\":\"t\",");
+  g_string_append_printf (s, "\"pid\":%u,\"tid\":%" G_GUINT64_FORMAT ","
+      "\"args\":{\"port\":%u", trace->id, tid, event->port);
+  if (event->buffer)
+    g_string_append_printf (s, ",\"buffer\":\"%p\"", event->buffer);
+  if (arg_name)
+    g_string_append_printf (s, ",\"%s\":%" G_GINT64_FORMAT, arg_name,
+        event->arg);
+  g_string_append (s, "}},\n");
+
+  if (event_info[event->type].span && event->buffer) {
+    /* Spans start after the call passed the buffer */
+    g_string_append_printf (s, "{\"name\":\"%s\",\"cat\":\"buffer\","
+        "\"ph\":\"%c\",\"ts\":%" G_GINT64_FORMAT ",\"pid\":%u,"
+        "\"tid\":%" G_GUINT64_FORMAT ",\"id\":\"%p\"},\n",
+        event_info[event->type].span, event_info[event->type].span_phase,
+        event->start + MAX (event->duration, 0), trace->id, tid,
+        event->buffer);
+  }
+}
+
+/* Writes all recorded events of the trace to the trace file
+ *
+ * NOTE: Uses the trace_file lock */
+void
+gst_omx_trace_dump (GstOMXTrace * trace)
+{
+  GstOMXTraceEvent event;
+  GString *s;
+  gint dropped;
+
+  g_return_if_fail (trace != NULL);
+
+  G_LOCK (trace_file);
+  if (gst_omx_ring_is_empty (trace->events)
+      && !g_atomic_int_get (&trace->dropped))
+    goto done;
+
+  if (!trace_file && trace_file_name) {
+    trace_file = g_fopen (trace_file_name, "w");
+    if (trace_file) {
+      fputs ("[\n", trace_file);
+    } else {
+      GST_ERROR ("Failed to open trace file '%s'", trace_file_name);
+      /* Don't try again for every dump */
+      g_free (trace_file_name);
+      trace_file_name = NULL;
+    }
+  }
+
+  if (!trace_file) {
+    while (gst_omx_ring_pop (trace->events, &event));
+    g_atomic_int_set (&trace->dropped, 0);
+    goto done;
+  }
+
+  s = g_string_new (NULL);
+  g_string_append_printf (s, "{\"name\":\"process_name\",\"ph\":\"M\","
+      "\"pid\":%u,\"args\":{\"name\":\"%s (%s)\"}},\n", trace->id,
+      trace->component_name, GST_STR_NULL (trace->owner_name));
+
+  while (gst_omx_ring_pop (trace->events, &event))
+    gst_omx_trace_write_event (trace, s, &event);
+
+  dropped = g_atomic_int_get (&trace->dropped);
+  if (dropped) {
+    g_atomic_int_add (&trace->dropped, -dropped);
+    GST_WARNING ("Dropped %d trace events of %s, increase trace-size",
+        dropped, trace->component_name);
+    g_string_append_printf (s, "{\"name\":\"dropped events\",\"ph\":\"i\","
+        "\"s\":\"p\",\"ts\":%" G_GINT64_FORMAT ",\"pid\":%u,\"tid\":0,"
+        "\"args\":{\"count\":%d}},\n", g_get_monotonic_time (), trace->id,
+        dropped);
+  }
+
+  fwrite (s->str, 1, s->len, trace_file);
+  fflush (trace_file);
+  g_string_free (s, TRUE);
+
+done:
+  G_UNLOCK (trace_file);
+}
@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2013, Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+#ifndef __GST_OMX_TRACE_H__
+#define __GST_OMX_TRACE_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+typedef struct _GstOMXTrace GstOMXTrace;
+
+typedef enum {
+  /* Calls, recorded with their duration */
+  GST_OMX_TRACE_ACQUIRE_BUFFER,
+  GST_OMX_TRACE_RELEASE_BUFFER,
+  GST_OMX_TRACE_EMPTY_THIS_BUFFER,
+  GST_OMX_TRACE_FILL_THIS_BUFFER,
+  GST_OMX_TRACE_PUSH,
+  GST_OMX_TRACE_SET_STATE,
+  GST_OMX_TRACE_SET_ENABLED,
+  GST_OMX_TRACE_SET_FLUSHING,
+  /* Callbacks and other instant events */
+  GST_OMX_TRACE_EMPTY_BUFFER_DONE,
+  GST_OMX_TRACE_FILL_BUFFER_DONE,
+  GST_OMX_TRACE_STATE_SET,
+  GST_OMX_TRACE_PORT_ENABLE_DONE,
+  GST_OMX_TRACE_FLUSH_DONE,
+  GST_OMX_TRACE_WRAP_BUFFER,
+  GST_OMX_TRACE_UNWRAP_BUFFER,
+  GST_OMX_TRACE_EOS
+} GstOMXTraceType;
+
+/* Start time of a traced call, 0 if the trace is disabled */
+#define GST_OMX_TRACE_START(t) \
+  (G_UNLIKELY ((t) != NULL) ? g_get_monotonic_time () : 0)
+
+/* Records a call that started at start, does nothing if the
+ * trace is disabled */
+#define GST_OMX_TRACE_CALL(t, type, port, buf, arg, start) G_STMT_START { \
+  if (G_UNLIKELY ((t) != NULL)) \
+    gst_omx_trace_record ((t), (type), (port), (buf), (arg), (start), \
+        g_get_monotonic_time () - (start)); \
+} G_STMT_END
+
+/* Records an event that happens now, does nothing if the
+ * trace is disabled */
+#define GST_OMX_TRACE_INSTANT(t, type, port, buf, arg) G_STMT_START { \
+  if (G_UNLIKELY ((t) != NULL)) \
+    gst_omx_trace_record ((t), (type), (port), (buf), (arg), \
+        g_get_monotonic_time (), -1); \
+} G_STMT_END
+
+void          gst_omx_trace_configure (GKeyFile * config, const gchar * group);
+
+GstOMXTrace * gst_omx_trace_new (const gchar * component_name);
+void          gst_omx_trace_free (GstOMXTrace * trace);
+void          gst_omx_trace_set_owner (GstOMXTrace * trace, GstObject * owner);
+
+void          gst_omx_trace_record (GstOMXTrace * trace, GstOMXTraceType type,
+                                    guint32 port, gconstpointer buffer,
+                                    gint64 arg, gint64 start, gint64 duration);
+void          gst_omx_trace_dump (GstOMXTrace * trace);
+
+G_END_DECLS
+
+#endif /* __GST_OMX_TRACE_H__ */
@@ -30,6 +30,7 @@
 #include <string.h>
 
 #include "gstomxvideodec.h"
+#include "gstomxplanecopy.h"
 
 GST_DEBUG_CATEGORY_STATIC (gst_omx_video_dec_debug_category);
 #define GST_CAT_DEFAULT gst_omx_video_dec_debug_category
@@ -38,16 +39,73 @@ typedef struct _BufferIdentification BufferIdentification;
 struct _BufferIdentification
 {
   guint64 timestamp;
+
+  /* For removing the frame from the lookup tables again */
+  GstOMXVideoDec *self;
+  GstVideoFrame *frame;
+  gpointer mark;
+
+  /* For the statistics, when the frame was received
+   * and when it was passed to the component */
+  gint64 arrival;
+  gint64 queued;
+
+  /* TRUE if passed with OMX_BUFFERFLAG_DECODEONLY, the
+   * frame is dropped even if the component outputs it */
+  gboolean decode_only;
 };
 
+/* Frames with the same timestamp are kept in the order
+ * they were passed to the component */
+static void
+frames_by_timestamp_add (GstOMXVideoDec * self, BufferIdentification * id)
+{
+  GList *frames;
+
+  frames = g_hash_table_lookup (self->frames_by_timestamp, &id->timestamp);
+  if (frames)
+    g_list_append (frames, id->frame);
+  else
+    g_hash_table_insert (self->frames_by_timestamp,
+        g_memdup (&id->timestamp, sizeof (id->timestamp)),
+        g_list_append (NULL, id->frame));
+}
+
+static void
+frames_by_timestamp_remove (GstOMXVideoDec * self, BufferIdentification * id)
+{
+  GList *head, *frames, *l;
+
+  head = g_hash_table_lookup (self->frames_by_timestamp, &id->timestamp);
+  if (!(l = g_list_find (head, id->frame)))
+    return;
+
+  frames = g_list_delete_link (head, l);
+  if (!frames)
+    g_hash_table_remove (self->frames_by_timestamp, &id->timestamp);
+  else if (frames != head)
+    g_hash_table_insert (self->frames_by_timestamp,
+        g_memdup (&id->timestamp, sizeof (id->timestamp)), frames);
+}
+
 static void
 buffer_identification_free (BufferIdentification * id)
 {
+  GstOMXVideoDec *self = id->self;
+
+  if (g_hash_table_lookup (self->frames_by_mark, id->mark) == id->frame)
+    g_hash_table_remove (self->frames_by_mark, id->mark);
+  frames_by_timestamp_remove (self, id);
+
   g_slice_free (BufferIdentification, id);
 }
 
 /* prototypes */
 static void gst_omx_video_dec_finalize (GObject * object);
+static void gst_omx_video_dec_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec);
+static void gst_omx_video_dec_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec);
 
 static GstStateChangeReturn
 gst_omx_video_dec_change_state (GstElement * element,
@@ -58,17 +116,32 @@ static gboolean gst_omx_video_dec_stop (GstBaseVideoDecoder * decoder);
 static gboolean gst_omx_video_dec_set_format (GstBaseVideoDecoder * decoder,
     GstVideoState * state);
 static gboolean gst_omx_video_dec_reset (GstBaseVideoDecoder * decoder);
+static void gst_omx_video_dec_flush_start (GstBaseVideoDecoder * decoder);
 static GstFlowReturn gst_omx_video_dec_parse_data (GstBaseVideoDecoder *
     decoder, gboolean at_eos);
 static GstFlowReturn gst_omx_video_dec_handle_frame (GstBaseVideoDecoder *
     decoder, GstVideoFrame * frame);
 static GstFlowReturn gst_omx_video_dec_finish (GstBaseVideoDecoder * decoder);
+static GstFlowReturn gst_omx_video_dec_alloc_sink_buffer (GstBaseVideoDecoder *
+    decoder, guint64 offset, guint size, GstCaps * caps, GstBuffer ** buf);
 
 static GstFlowReturn gst_omx_video_dec_drain (GstOMXVideoDec * self);
+static void gst_omx_video_dec_update_latency (GstOMXVideoDec * self);
 
 enum
 {
-  PROP_0
+  PROP_0,
+  PROP_STATS,
+  PROP_STATS_INTERVAL,
+  PROP_EXTRA_INPUT_BUFFERS,
+  PROP_EXTRA_OUTPUT_BUFFERS,
+  PROP_INPUT_BUFFER_SIZE,
+  PROP_ADAPTIVE_OUTPUT_BUFFERS,
+  PROP_ADAPTIVE_MAX_WIDTH,
+  PROP_ADAPTIVE_MAX_HEIGHT,
+  PROP_RESOURCE_PRIORITY,
+  PROP_LOW_LATENCY,
+  PROP_MAX_REVERSE_BYTES
 };
 
 /* class initialization */
@@ -193,6 +266,14 @@ gst_omx_video_dec_base_init (gpointer g_class)
     videodec_class->hacks = gst_omx_parse_hacks (hacks);
   }
 
+  gst_omx_buffer_config_load (&videodec_class->buffer_config, config,
+      element_name);
+  gst_omx_resource_config_load (&videodec_class->resource_config, config,
+      element_name);
+  videodec_class->candidates =
+      gst_omx_candidates_load (config, element_name,
+      &videodec_class->n_candidates);
+
   err = NULL;
   if (videodec_class->hacks & GST_OMX_HACK_ANDROID_BUFFERS) {
     template_caps = g_strdup (ANDROID_BUFFERS_CAPS_TEMPLATE);
@@ -230,6 +311,15 @@ out:
   gst_object_unref (templ);
 }
 
+static void
+gst_omx_video_dec_dump_trace (GstOMXVideoDec * self)
+{
+  g_mutex_lock (self->component_lock);
+  if (self->component)
+    gst_omx_component_dump_trace (self->component);
+  g_mutex_unlock (self->component_lock);
+}
+
 static void
 gst_omx_video_dec_class_init (GstOMXVideoDecClass * klass)
 {
@@ -239,6 +329,87 @@ gst_omx_video_dec_class_init (GstOMXVideoDecClass * klass)
       GST_BASE_VIDEO_DECODER_CLASS (klass);
 
   gobject_class->finalize = gst_omx_video_dec_finalize;
+  gobject_class->set_property = gst_omx_video_dec_set_property;
+  gobject_class->get_property = gst_omx_video_dec_get_property;
+
+  g_object_class_install_property (gobject_class, PROP_STATS,
+      g_param_spec_boxed ("stats", "Statistics",
+          "Statistics of the decoder, see gstomxstats.c",
+          GST_TYPE_STRUCTURE, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_STATS_INTERVAL,
+      g_param_spec_uint ("stats-interval", "Statistics interval",
+          "Interval of the statistics element messages in ms (0=disabled)",
+          0, G_MAXUINT, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_EXTRA_INPUT_BUFFERS,
+      g_param_spec_uint ("extra-input-buffers", "Extra input buffers",
+          "Input buffers allocated in addition to the minimum",
+          0, G_MAXUINT, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property (gobject_class, PROP_EXTRA_OUTPUT_BUFFERS,
+      g_param_spec_uint ("extra-output-buffers", "Extra output buffers",
+          "Output buffers allocated in addition to the minimum",
+          0, G_MAXUINT, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property (gobject_class,
+      PROP_ADAPTIVE_OUTPUT_BUFFERS, g_param_spec_boolean
+      ("adaptive-output-buffers", "Adaptive output buffers",
+          "Allocate more output buffers if the component runs out of them",
+          FALSE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property (gobject_class, PROP_INPUT_BUFFER_SIZE,
+      g_param_spec_int ("input-buffer-size", "Input buffer size",
+          "Size of the input buffers (-1=component default, "
+          "0=derived from the caps)", -1, G_MAXINT, -1,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property (gobject_class, PROP_ADAPTIVE_MAX_WIDTH,
+      g_param_spec_uint ("adaptive-max-width", "Adaptive maximum width",
+          "Maximum width of resolution changes without reallocating the "
+          "output buffers (0=disabled)", 0, G_MAXUINT, 0,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property (gobject_class, PROP_ADAPTIVE_MAX_HEIGHT,
+      g_param_spec_uint ("adaptive-max-height", "Adaptive maximum height",
+          "Maximum height of resolution changes without reallocating the "
+          "output buffers (0=disabled)", 0, G_MAXUINT, 0,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property (gobject_class, PROP_RESOURCE_PRIORITY,
+      g_param_spec_int ("resource-priority", "Resource priority",
+          "Decoders with a higher priority preempt the ones with a lower "
+          "priority if the hardware resources are exhausted",
+          G_MININT, G_MAXINT, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property (gobject_class, PROP_LOW_LATENCY,
+      g_param_spec_boolean ("low-latency", "Low latency",
+          "Output every frame as soon as it is decoded, with as few "
+          "buffers as possible", FALSE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property (gobject_class, PROP_MAX_REVERSE_BYTES,
+      g_param_spec_uint64 ("max-reverse-bytes", "Max reverse bytes",
+          "Maximum input and output data that is kept for a GOP in reverse "
+          "playback (0 = unlimited)", 0, G_MAXUINT64,
+          GST_BASE_VIDEO_DECODER_MAX_REVERSE_BYTES,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+
+  /* Writes the events traced since the last dump to the trace file,
+   * see gstomxtrace.c */
+  g_signal_new_class_handler ("dump-trace", G_TYPE_FROM_CLASS (klass),
+      G_SIGNAL_RUN_LAST | G_SIGNAL_ACTION,
+      G_CALLBACK (gst_omx_video_dec_dump_trace), NULL, NULL,
+      g_cclosure_marshal_VOID__VOID, G_TYPE_NONE, 0);
 
   element_class->change_state =
       GST_DEBUG_FUNCPTR (gst_omx_video_dec_change_state);
@@ -246,6 +417,8 @@ gst_omx_video_dec_class_init (GstOMXVideoDecClass * klass)
   base_video_decoder_class->start = GST_DEBUG_FUNCPTR (gst_omx_video_dec_start);
   base_video_decoder_class->stop = GST_DEBUG_FUNCPTR (gst_omx_video_dec_stop);
   base_video_decoder_class->reset = GST_DEBUG_FUNCPTR (gst_omx_video_dec_reset);
+  base_video_decoder_class->flush_start =
+      GST_DEBUG_FUNCPTR (gst_omx_video_dec_flush_start);
   base_video_decoder_class->set_format =
       GST_DEBUG_FUNCPTR (gst_omx_video_dec_set_format);
   base_video_decoder_class->parse_data =
@@ -254,6 +427,8 @@ gst_omx_video_dec_class_init (GstOMXVideoDecClass * klass)
       GST_DEBUG_FUNCPTR (gst_omx_video_dec_handle_frame);
   base_video_decoder_class->finish =
       GST_DEBUG_FUNCPTR (gst_omx_video_dec_finish);
+  base_video_decoder_class->alloc_sink_buffer =
+      GST_DEBUG_FUNCPTR (gst_omx_video_dec_alloc_sink_buffer);
 
   klass->default_src_template_caps = "video/x-raw-yuv, "
       "width = " GST_VIDEO_SIZE_RANGE ", "
@@ -267,34 +442,106 @@ gst_omx_video_dec_init (GstOMXVideoDec * self, GstOMXVideoDecClass * klass)
 
   self->drain_lock = g_mutex_new ();
   self->drain_cond = g_cond_new ();
+  self->component_lock = g_mutex_new ();
+
+  self->frames_by_mark = g_hash_table_new (g_direct_hash, g_direct_equal);
+  self->frames_by_timestamp =
+      g_hash_table_new_full (g_int64_hash, g_int64_equal, g_free, NULL);
+
+  self->stats = gst_omx_stats_new ();
+  self->buffer_config = klass->buffer_config;
+  self->resource_config = klass->resource_config;
 }
 
+/* Fails if the component can't be created or, unless it's the
+ * last candidate, its pool has no room for another instance */
+static gboolean
+gst_omx_video_dec_open_candidate (GstOMXVideoDec * self,
+    const GstOMXCandidate * cand, gboolean last)
+{
+  GstOMXResourceConfig resource_config;
+  GstOMXComponent *component = NULL;
+  GstOMXPort *in_port, *out_port;
+
+  /* Limits of the candidate's group, priority of the element */
+  resource_config = cand->resource_config;
+  resource_config.priority = self->resource_config.priority;
+  self->resource =
+      gst_omx_resource_new (GST_OBJECT_CAST (self), cand->core_name,
+      cand->component_role, &resource_config);
+
+  if (!last && !gst_omx_resource_has_room (self->resource, 0)) {
+    GST_INFO_OBJECT (self, "No resources left for '%s'", cand->element_name);
+    goto error;
+  }
+
+  component =
+      gst_omx_component_new (GST_OBJECT_CAST (self), cand->core_name,
+      cand->component_name, cand->component_role, cand->hacks);
+  if (!component)
+    goto error;
+
+  if (gst_omx_component_get_state (component,
+          GST_CLOCK_TIME_NONE) != OMX_StateLoaded)
+    goto error;
+
+  in_port = gst_omx_component_add_port (component, cand->in_port_index);
+  out_port = gst_omx_component_add_port (component, cand->out_port_index);
+
+  if (!in_port || !out_port)
+    goto error;
+
+  g_mutex_lock (self->component_lock);
+  self->component = component;
+  self->in_port = in_port;
+  self->out_port = out_port;
+  g_mutex_unlock (self->component_lock);
+
+  return TRUE;
+
+error:
+  {
+    if (component)
+      gst_omx_component_release (component);
+    gst_omx_resource_free (self->resource);
+    self->resource = NULL;
+    return FALSE;
+  }
+}
+
+/* Opens the first available candidate component from the
+ * current one on, see gst_omx_candidates_load() */
 static gboolean
 gst_omx_video_dec_open (GstOMXVideoDec * self)
 {
   GstOMXVideoDecClass *klass = GST_OMX_VIDEO_DEC_GET_CLASS (self);
+  guint64 hacks;
 
   GST_DEBUG_OBJECT (self, "Opening decoder");
 
-  self->component =
-      gst_omx_component_new (GST_OBJECT_CAST (self), klass->core_name,
-      klass->component_name, klass->component_role, klass->hacks);
+  gst_omx_stats_reset (self->stats);
   self->started = FALSE;
 
-  if (!self->component)
-    return FALSE;
-
-  if (gst_omx_component_get_state (self->component,
-          GST_CLOCK_TIME_NONE) != OMX_StateLoaded)
+  for (; self->candidate < klass->n_candidates; self->candidate++) {
+    if (gst_omx_video_dec_open_candidate (self,
+            &klass->candidates[self->candidate],
+            self->candidate + 1 == klass->n_candidates))
+      break;
+  }
+  if (!self->component) {
+    self->candidate = 0;
     return FALSE;
+  }
 
-  self->in_port =
-      gst_omx_component_add_port (self->component, klass->in_port_index);
-  self->out_port =
-      gst_omx_component_add_port (self->component, klass->out_port_index);
+  GST_INFO_OBJECT (self, "Using component '%s'",
+      klass->candidates[self->candidate].element_name);
 
-  if (!self->in_port || !self->out_port)
-    return FALSE;
+  hacks = self->component->hacks;
+  self->in_port->zero_copy = !(hacks & GST_OMX_HACK_NO_ZERO_COPY);
+  self->out_port->zero_copy =
+      !(hacks & (GST_OMX_HACK_ANDROID_BUFFERS | GST_OMX_HACK_NO_ZERO_COPY));
+  gst_omx_buffer_config_apply (&self->buffer_config, self->in_port,
+      self->out_port);
 
   GST_DEBUG_OBJECT (self, "Opened decoder");
 
@@ -321,6 +568,9 @@ gst_omx_video_dec_shutdown (GstOMXVideoDec * self)
       gst_omx_component_get_state (self->component, 5 * GST_SECOND);
   }
 
+  if (self->resource)
+    gst_omx_resource_release (self->resource);
+
   return TRUE;
 }
 
@@ -329,14 +579,21 @@ gst_omx_video_dec_close (GstOMXVideoDec * self)
 {
   GST_DEBUG_OBJECT (self, "Closing decoder");
 
-  if (!gst_omx_video_dec_shutdown (self))
+  g_mutex_lock (self->component_lock);
+  if (!gst_omx_video_dec_shutdown (self)) {
+    g_mutex_unlock (self->component_lock);
     return FALSE;
+  }
 
   self->in_port = NULL;
   self->out_port = NULL;
   if (self->component)
-    gst_omx_component_free (self->component);
+    gst_omx_component_release (self->component);
   self->component = NULL;
+  g_mutex_unlock (self->component_lock);
+  if (self->resource)
+    gst_omx_resource_free (self->resource);
+  self->resource = NULL;
 
   self->started = FALSE;
 
@@ -352,10 +609,115 @@ gst_omx_video_dec_finalize (GObject * object)
 
   g_mutex_free (self->drain_lock);
   g_cond_free (self->drain_cond);
+  g_mutex_free (self->component_lock);
+
+  g_hash_table_destroy (self->frames_by_mark);
+  g_hash_table_destroy (self->frames_by_timestamp);
+
+  gst_omx_stats_free (self->stats);
 
   G_OBJECT_CLASS (parent_class)->finalize (object);
 }
 
+static void
+gst_omx_video_dec_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstOMXVideoDec *self = GST_OMX_VIDEO_DEC (object);
+
+  switch (prop_id) {
+    case PROP_STATS_INTERVAL:
+      gst_omx_stats_set_interval (self->stats, g_value_get_uint (value));
+      break;
+    case PROP_EXTRA_INPUT_BUFFERS:
+      self->buffer_config.extra_input_buffers = g_value_get_uint (value);
+      break;
+    case PROP_EXTRA_OUTPUT_BUFFERS:
+      self->buffer_config.extra_output_buffers = g_value_get_uint (value);
+      break;
+    case PROP_ADAPTIVE_OUTPUT_BUFFERS:
+      self->buffer_config.adaptive_output_buffers =
+          g_value_get_boolean (value);
+      break;
+    case PROP_INPUT_BUFFER_SIZE:
+      self->buffer_config.input_buffer_size = g_value_get_int (value);
+      break;
+    case PROP_ADAPTIVE_MAX_WIDTH:
+      self->buffer_config.adaptive_max_width = g_value_get_uint (value);
+      break;
+    case PROP_ADAPTIVE_MAX_HEIGHT:
+      self->buffer_config.adaptive_max_height = g_value_get_uint (value);
+      break;
+    case PROP_RESOURCE_PRIORITY:
+      self->resource_config.priority = g_value_get_int (value);
+      if (self->resource)
+        gst_omx_resource_set_priority (self->resource,
+            self->resource_config.priority);
+      break;
+    case PROP_LOW_LATENCY:
+      self->buffer_config.low_latency = g_value_get_boolean (value);
+      break;
+    case PROP_MAX_REVERSE_BYTES:
+      GST_BASE_VIDEO_DECODER (self)->max_reverse_bytes =
+          g_value_get_uint64 (value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_omx_video_dec_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec)
+{
+  GstOMXVideoDec *self = GST_OMX_VIDEO_DEC (object);
+
+  switch (prop_id) {
+    case PROP_STATS:
+      g_mutex_lock (self->component_lock);
+      g_value_take_boxed (value, gst_omx_stats_get_structure (self->stats,
+              self->in_port, self->out_port));
+      g_mutex_unlock (self->component_lock);
+      break;
+    case PROP_STATS_INTERVAL:
+      g_value_set_uint (value, gst_omx_stats_get_interval (self->stats));
+      break;
+    case PROP_EXTRA_INPUT_BUFFERS:
+      g_value_set_uint (value, self->buffer_config.extra_input_buffers);
+      break;
+    case PROP_EXTRA_OUTPUT_BUFFERS:
+      g_value_set_uint (value, self->buffer_config.extra_output_buffers);
+      break;
+    case PROP_ADAPTIVE_OUTPUT_BUFFERS:
+      g_value_set_boolean (value,
+          self->buffer_config.adaptive_output_buffers);
+      break;
+    case PROP_INPUT_BUFFER_SIZE:
+      g_value_set_int (value, self->buffer_config.input_buffer_size);
+      break;
+    case PROP_ADAPTIVE_MAX_WIDTH:
+      g_value_set_uint (value, self->buffer_config.adaptive_max_width);
+      break;
+    case PROP_ADAPTIVE_MAX_HEIGHT:
+      g_value_set_uint (value, self->buffer_config.adaptive_max_height);
+      break;
+    case PROP_RESOURCE_PRIORITY:
+      g_value_set_int (value, self->resource_config.priority);
+      break;
+    case PROP_LOW_LATENCY:
+      g_value_set_boolean (value, self->buffer_config.low_latency);
+      break;
+    case PROP_MAX_REVERSE_BYTES:
+      g_value_set_uint64 (value,
+          GST_BASE_VIDEO_DECODER (self)->max_reverse_bytes);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
 static GstStateChangeReturn
 gst_omx_video_dec_change_state (GstElement * element, GstStateChange transition)
 {
@@ -368,6 +730,7 @@ gst_omx_video_dec_change_state (GstElement * element, GstStateChange transition)
 
   switch (transition) {
     case GST_STATE_CHANGE_NULL_TO_READY:
+      self->candidate = 0;
       if (!gst_omx_video_dec_open (self))
         ret = GST_STATE_CHANGE_FAILURE;
       break;
@@ -429,17 +792,22 @@ gst_omx_video_dec_change_state (GstElement * element, GstStateChange transition)
 #define MAX_FRAME_DIST_TICKS  (5 * OMX_TICKS_PER_SECOND)
 #define MAX_FRAME_DIST_FRAMES (100)
 
+/* Number of consecutive late frames that can't be skipped after
+ * which all frames until the next keyframe are skipped */
+#define MAX_LATE_REFERENCES (3)
+
+/* Segments with a larger absolute rate are played back by
+ * decoding only the keyframes */
+#define MIN_TRICK_MODE_RATE (2.0)
+
 static GstVideoFrame *
-_find_nearest_frame (GstOMXVideoDec * self, GstOMXBuffer * buf)
+_find_nearest_frame_slow (GstOMXVideoDec * self, GstOMXBuffer * buf)
 {
-  GList *l, *best_l = NULL;
-  GList *finish_frames = NULL;
+  GList *l;
   GstVideoFrame *best = NULL;
-  guint64 best_timestamp = 0;
   guint64 best_diff = G_MAXUINT64;
-  BufferIdentification *best_id = NULL;
 
-  for (l = GST_BASE_VIDEO_CODEC (self)->frames; l; l = l->next) {
+  for (l = GST_BASE_VIDEO_CODEC (self)->frames.head; l; l = l->next) {
     GstVideoFrame *tmp = l->data;
     BufferIdentification *id = tmp->coder_hook;
     guint64 timestamp, diff;
@@ -460,10 +828,7 @@ _find_nearest_frame (GstOMXVideoDec * self, GstOMXBuffer * buf)
 
     if (best == NULL || diff < best_diff) {
       best = tmp;
-      best_timestamp = timestamp;
       best_diff = diff;
-      best_l = l;
-      best_id = id;
 
       /* For frames without timestamp we simply take the first frame */
       if ((buf->omx_buf->nTimeStamp == 0 && timestamp == 0) || diff == 0)
@@ -471,34 +836,75 @@ _find_nearest_frame (GstOMXVideoDec * self, GstOMXBuffer * buf)
     }
   }
 
-  if (best_id) {
-    for (l = GST_BASE_VIDEO_CODEC (self)->frames; l && l != best_l; l = l->next) {
-      GstVideoFrame *tmp = l->data;
-      BufferIdentification *id = tmp->coder_hook;
-      guint64 diff_ticks, diff_frames;
+  return best;
+}
 
-      if (id->timestamp > best_timestamp)
-        break;
+static GstVideoFrame *
+_find_nearest_frame (GstOMXVideoDec * self, GstOMXBuffer * buf)
+{
+  GList *l, *frames;
+  GstVideoFrame *best = NULL;
+  BufferIdentification *best_id;
+  gint64 timestamp;
+  gboolean warned = FALSE;
+
+  /* If the component propagates the marks of the input buffers
+   * we know the frame, otherwise look for the exact timestamp
+   * and only search through all frames if that fails too */
+  if (buf->omx_buf->pMarkData)
+    best = g_hash_table_lookup (self->frames_by_mark, buf->omx_buf->pMarkData);
+
+  if (!best) {
+    timestamp = buf->omx_buf->nTimeStamp;
+    frames = g_hash_table_lookup (self->frames_by_timestamp, &timestamp);
+    if (frames)
+      best = frames->data;
+  }
 
-      if (id->timestamp == 0 || best_timestamp == 0)
-        diff_ticks = 0;
-      else
-        diff_ticks = best_timestamp - id->timestamp;
-      diff_frames = best->system_frame_number - tmp->system_frame_number;
+  if (!best)
+    best = _find_nearest_frame_slow (self, buf);
 
-      if (diff_ticks > MAX_FRAME_DIST_TICKS
-          || diff_frames > MAX_FRAME_DIST_FRAMES) {
-        finish_frames = g_list_prepend (finish_frames, tmp);
-      }
+  if (!best)
+    return NULL;
+
+  best_id = best->coder_hook;
+
+  /* Frames are passed to the component in order, so only
+   * the oldest ones need to be checked here */
+  while ((l = GST_BASE_VIDEO_CODEC (self)->frames.head) && l->data != best) {
+    GstVideoFrame *tmp = l->data;
+    BufferIdentification *id = tmp->coder_hook;
+    guint64 diff_ticks, diff_frames;
+    gboolean too_old;
+
+    if (!id || id->timestamp > best_id->timestamp)
+      break;
+
+    if (id->timestamp == 0 || best_id->timestamp == 0)
+      diff_ticks = 0;
+    else
+      diff_ticks = best_id->timestamp - id->timestamp;
+    diff_frames = best->system_frame_number - tmp->system_frame_number;
+    too_old = diff_ticks > MAX_FRAME_DIST_TICKS
+        || diff_frames > MAX_FRAME_DIST_FRAMES;
+
+    /* Components usually don't output these frames, but their output
+     * can still arrive until a frame with a later timestamp is output */
+    if (id->decode_only) {
+      if (!too_old && id->timestamp >= best_id->timestamp)
+        break;
+      gst_base_video_decoder_drop_frame (GST_BASE_VIDEO_DECODER (self), tmp);
+      continue;
     }
-  }
 
-  if (finish_frames) {
-    g_warning ("Too old frames, bug in decoder -- please file a bug");
-    for (l = finish_frames; l; l = l->next) {
-      gst_base_video_decoder_finish_frame (GST_BASE_VIDEO_DECODER (self),
-          l->data);
+    if (!too_old)
+      break;
+
+    if (!warned) {
+      g_warning ("Too old frames, bug in decoder -- please file a bug");
+      warned = TRUE;
     }
+    gst_base_video_decoder_finish_frame (GST_BASE_VIDEO_DECODER (self), tmp);
   }
 
   return best;
@@ -511,20 +917,25 @@ gst_omx_video_dec_fill_buffer (GstOMXVideoDec * self, GstOMXBuffer * inbuf,
   GstVideoState *state = &GST_BASE_VIDEO_CODEC (self)->state;
   OMX_PARAM_PORTDEFINITIONTYPE *port_def = &self->out_port->port_def;
   gboolean ret = FALSE;
+  gint left = 0, top = 0;
 
   if (inbuf->port->comp->hacks & GST_OMX_HACK_ANDROID_BUFFERS) {
     ret = TRUE;
     goto done;
   }
 
-  if (state->width != port_def->format.video.nFrameWidth ||
+  if (self->crop.nWidth) {
+    left = self->crop.nLeft;
+    top = self->crop.nTop;
+  } else if (state->width != port_def->format.video.nFrameWidth ||
       state->height != port_def->format.video.nFrameHeight) {
     GST_ERROR_OBJECT (self, "Width or height do not match");
     goto done;
   }
 
   /* Same strides and everything */
-  if (GST_BUFFER_SIZE (outbuf) == inbuf->omx_buf->nFilledLen) {
+  if (!self->crop.nWidth
+      && GST_BUFFER_SIZE (outbuf) == inbuf->omx_buf->nFilledLen) {
     memcpy (GST_BUFFER_DATA (outbuf),
         inbuf->omx_buf->pBuffer + inbuf->omx_buf->nOffset,
         inbuf->omx_buf->nFilledLen);
@@ -538,9 +949,14 @@ gst_omx_video_dec_fill_buffer (GstOMXVideoDec * self, GstOMXBuffer * inbuf,
 
   switch (state->format) {
     case GST_VIDEO_FORMAT_I420:{
-      gint i, j, height;
+      gint i, height;
       guint8 *src, *dest;
       gint src_stride, dest_stride;
+      gint slice_height = port_def->format.video.nSliceHeight;
+
+      /* XXX: Try this if no slice height was set */
+      if (slice_height == 0)
+        slice_height = port_def->format.video.nFrameHeight;
 
       for (i = 0; i < 3; i++) {
         if (i == 0) {
@@ -563,13 +979,13 @@ gst_omx_video_dec_fill_buffer (GstOMXVideoDec * self, GstOMXBuffer * inbuf,
 
         src = inbuf->omx_buf->pBuffer + inbuf->omx_buf->nOffset;
         if (i > 0)
-          src +=
-              port_def->format.video.nSliceHeight *
-              port_def->format.video.nStride;
+          src += slice_height * port_def->format.video.nStride;
         if (i == 2)
-          src +=
-              (port_def->format.video.nSliceHeight / 2) *
-              (port_def->format.video.nStride / 2);
+          src += (slice_height / 2) * (port_def->format.video.nStride / 2);
+        if (i == 0)
+          src += top * src_stride + left;
+        else
+          src += (top / 2) * src_stride + left / 2;
 
         dest =
             GST_BUFFER_DATA (outbuf) +
@@ -580,19 +996,21 @@ gst_omx_video_dec_fill_buffer (GstOMXVideoDec * self, GstOMXBuffer * inbuf,
             gst_video_format_get_component_height (state->format, i,
             state->height);
 
-        for (j = 0; j < height; j++) {
-          memcpy (dest, src, MIN (src_stride, dest_stride));
-          src += src_stride;
-          dest += dest_stride;
-        }
+        gst_omx_plane_copy (dest, dest_stride, src, src_stride,
+            MIN (src_stride, dest_stride), height);
       }
       ret = TRUE;
       break;
     }
     case GST_VIDEO_FORMAT_NV12:{
-      gint i, j, height;
+      gint i, height;
       guint8 *src, *dest;
       gint src_stride, dest_stride;
+      gint slice_height = port_def->format.video.nSliceHeight;
+
+      /* XXX: Try this if no slice height was set */
+      if (slice_height == 0)
+        slice_height = port_def->format.video.nFrameHeight;
 
       for (i = 0; i < 2; i++) {
         if (i == 0) {
@@ -615,9 +1033,11 @@ gst_omx_video_dec_fill_buffer (GstOMXVideoDec * self, GstOMXBuffer * inbuf,
 
         src = inbuf->omx_buf->pBuffer + inbuf->omx_buf->nOffset;
         if (i == 1)
-          src +=
-              port_def->format.video.nSliceHeight *
-              port_def->format.video.nStride;
+          src += slice_height * port_def->format.video.nStride;
+        if (i == 0)
+          src += top * src_stride + left;
+        else
+          src += (top / 2) * src_stride + (left & ~1);
 
         dest =
             GST_BUFFER_DATA (outbuf) +
@@ -627,11 +1047,8 @@ gst_omx_video_dec_fill_buffer (GstOMXVideoDec * self, GstOMXBuffer * inbuf,
         height =
             gst_video_format_get_component_height (state->format, i,
             state->height);
-        for (j = 0; j < height; j++) {
-          memcpy (dest, src, MIN (src_stride, dest_stride));
-          src += src_stride;
-          dest += dest_stride;
-        }
+        gst_omx_plane_copy (dest, dest_stride, src, src_stride,
+            MIN (src_stride, dest_stride), height);
       }
       ret = TRUE;
       break;
@@ -645,6 +1062,10 @@ gst_omx_video_dec_fill_buffer (GstOMXVideoDec * self, GstOMXBuffer * inbuf,
 
 done:
   if (ret) {
+    if (!(inbuf->port->comp->hacks & GST_OMX_HACK_ANDROID_BUFFERS))
+      gst_omx_stats_add (self->stats, GST_OMX_STATS_BYTES_COPIED_OUT,
+          GST_BUFFER_SIZE (outbuf));
+
     GST_BUFFER_TIMESTAMP (outbuf) =
         gst_util_uint64_scale (inbuf->omx_buf->nTimeStamp, GST_SECOND,
         OMX_TICKS_PER_SECOND);
@@ -729,6 +1150,40 @@ gst_omx_video_dec_get_native_buffer (GstOMXVideoDec * self, GstOMXBuffer * buf)
     return buffer;
 }
 
+/* Returns NULL if the output buffer can't be passed downstream as is
+ * and has to be copied, e.g. because of different strides */
+static GstBuffer *
+gst_omx_video_dec_wrap_buffer (GstOMXVideoDec * self, GstOMXBuffer * buf)
+{
+  GstVideoState *state = &GST_BASE_VIDEO_CODEC (self)->state;
+  OMX_PARAM_PORTDEFINITIONTYPE *port_def = &self->out_port->port_def;
+  GstBuffer *outbuf;
+
+  if (!self->out_port->zero_copy || state->bytes_per_picture == 0)
+    return NULL;
+
+  if (state->width != port_def->format.video.nFrameWidth ||
+      state->height != port_def->format.video.nFrameHeight ||
+      buf->omx_buf->nFilledLen != state->bytes_per_picture)
+    return NULL;
+
+  outbuf = gst_omx_port_wrap_buffer (self->out_port, buf);
+  if (!outbuf)
+    return NULL;
+
+  gst_buffer_set_caps (outbuf,
+      GST_PAD_CAPS (GST_BASE_VIDEO_CODEC_SRC_PAD (self)));
+  GST_BUFFER_TIMESTAMP (outbuf) =
+      gst_util_uint64_scale (buf->omx_buf->nTimeStamp, GST_SECOND,
+      OMX_TICKS_PER_SECOND);
+  if (buf->omx_buf->nTickCount != 0)
+    GST_BUFFER_DURATION (outbuf) =
+        gst_util_uint64_scale (buf->omx_buf->nTickCount, GST_SECOND,
+        OMX_TICKS_PER_SECOND);
+
+  return outbuf;
+}
+
 static gboolean
 gst_omx_video_dec_alloc_src_frame (GstOMXVideoDec * self, GstVideoFrame * frame,
     GstOMXBuffer * buf)
@@ -745,16 +1200,14 @@ gst_omx_video_dec_alloc_src_frame (GstOMXVideoDec * self, GstVideoFrame * frame,
 static void
 gst_omx_video_dec_loop (GstOMXVideoDec * self)
 {
-  GstOMXVideoDecClass *klass;
   GstOMXPort *port = self->out_port;
   GstOMXBuffer *buf = NULL;
   GstVideoFrame *frame;
   GstFlowReturn flow_ret = GST_FLOW_OK;
   GstOMXAcquireBufferReturn acq_return;
   GstClockTimeDiff deadline;
-  gboolean is_eos, allocated = FALSE;
-
-  klass = GST_OMX_VIDEO_DEC_GET_CLASS (self);
+  gboolean is_eos, allocated = FALSE, wrapped = FALSE;
+  gint64 start, arrival = 0;
 
   acq_return = gst_omx_port_acquire_buffer (port, &buf);
   if (acq_return == GST_OMX_ACQUIRE_BUFFER_ERROR) {
@@ -806,6 +1259,28 @@ gst_omx_video_dec_loop (GstOMXVideoDec * self)
     state->width = port_def.format.video.nFrameWidth;
     state->height = port_def.format.video.nFrameHeight;
 
+    /* With adaptive playback the frames only fill the crop rectangle
+     * of the output buffers. Android native buffers carry it */
+    self->crop.nWidth = self->crop.nHeight = 0;
+    if (port->max_width
+        && !(port->comp->hacks & GST_OMX_HACK_ANDROID_BUFFERS)) {
+      OMX_CONFIG_RECTTYPE crop;
+
+      GST_OMX_INIT_STRUCT (&crop);
+      crop.nPortIndex = port->index;
+      if (gst_omx_component_get_config (port->comp,
+              OMX_IndexConfigCommonOutputCrop, &crop) == OMX_ErrorNone
+          && crop.nWidth > 0 && crop.nHeight > 0
+          && crop.nLeft + crop.nWidth <= state->width
+          && crop.nTop + crop.nHeight <= state->height) {
+        GST_DEBUG_OBJECT (self, "Cropping %ux%u at %u,%u", crop.nWidth,
+            crop.nHeight, crop.nLeft, crop.nTop);
+        self->crop = crop;
+        state->width = crop.nWidth;
+        state->height = crop.nHeight;
+      }
+    }
+
     /* Take framerate and pixel-aspect-ratio from sinkpad caps */
 
     if (!gst_omc_video_dec_set_src_caps (self)) {
@@ -814,6 +1289,8 @@ gst_omx_video_dec_loop (GstOMXVideoDec * self)
       goto caps_failed;
     }
 
+    gst_omx_video_dec_update_latency (self);
+
     /* Now get a buffer */
     if (acq_return != GST_OMX_ACQUIRE_BUFFER_OK) {
       GST_BASE_VIDEO_CODEC_STREAM_UNLOCK (self);
@@ -843,13 +1320,32 @@ gst_omx_video_dec_loop (GstOMXVideoDec * self)
     frame = _find_nearest_frame (self, buf);
 
     is_eos = ! !(buf->omx_buf->nFlags & OMX_BUFFERFLAG_EOS);
+    start = GST_OMX_TRACE_START (self->component->trace);
+
+    if (frame && buf->omx_buf->nFilledLen > 0) {
+      BufferIdentification *id = frame->coder_hook;
+
+      gst_omx_stats_add_latency (self->stats, GST_OMX_STATS_COMPONENT_LATENCY,
+          g_get_monotonic_time () - id->queued);
+      arrival = id->arrival;
+    }
 
-    if (frame
+    if (frame && ((BufferIdentification *) frame->coder_hook)->decode_only) {
+      /* Already counted as dropped in handle_frame() */
+      GST_DEBUG_OBJECT (self, "Dropping decode-only frame");
+      arrival = 0;
+      flow_ret =
+          gst_base_video_decoder_drop_frame (GST_BASE_VIDEO_DECODER (self),
+          frame);
+      frame = NULL;
+    } else if (frame
         && (deadline = gst_base_video_decoder_get_max_decode_time
             (GST_BASE_VIDEO_DECODER (self), frame)) < 0) {
       GST_WARNING_OBJECT (self,
           "Frame is too late, dropping (deadline %" GST_TIME_FORMAT ")",
           GST_TIME_ARGS (-deadline));
+      gst_omx_stats_add (self->stats, GST_OMX_STATS_LATE_DROPS, 1);
+      arrival = 0;
       flow_ret =
           gst_base_video_decoder_drop_frame (GST_BASE_VIDEO_DECODER (self),
           frame);
@@ -864,26 +1360,31 @@ gst_omx_video_dec_loop (GstOMXVideoDec * self)
 
       GST_ERROR_OBJECT (self, "No corresponding frame found");
 
-      if (port->comp->hacks & GST_OMX_HACK_ANDROID_BUFFERS) {
-        outbuf = gst_omx_video_dec_get_native_buffer (self, buf);
+      if ((outbuf = gst_omx_video_dec_wrap_buffer (self, buf))) {
+        wrapped = TRUE;
       } else {
-        outbuf =
-            gst_base_video_decoder_alloc_src_buffer (GST_BASE_VIDEO_DECODER
-            (self));
-      }
+        if (port->comp->hacks & GST_OMX_HACK_ANDROID_BUFFERS) {
+          outbuf = gst_omx_video_dec_get_native_buffer (self, buf);
+        } else {
+          outbuf =
+              gst_base_video_decoder_alloc_src_buffer (GST_BASE_VIDEO_DECODER
+              (self));
+        }
 
-      if (!gst_omx_video_dec_fill_buffer (self, buf, outbuf)) {
-        gst_buffer_unref (outbuf);
+        if (!gst_omx_video_dec_fill_buffer (self, buf, outbuf)) {
+          gst_buffer_unref (outbuf);
 
-        if (!(port->comp->hacks & GST_OMX_HACK_ANDROID_BUFFERS)) {
-          /* unreffing a native buffer will cause it to be released. */
-          gst_omx_port_release_buffer (self->out_port, buf);
-        }
+          if (!(port->comp->hacks & GST_OMX_HACK_ANDROID_BUFFERS)) {
+            /* unreffing a native buffer will cause it to be released. */
+            gst_omx_port_release_buffer (self->out_port, buf);
+          }
 
-        goto invalid_buffer;
+          goto invalid_buffer;
+        }
       }
 
       allocated = TRUE;
+      gst_omx_stats_add (self->stats, GST_OMX_STATS_FRAMES_OUT, 1);
       flow_ret = gst_pad_push (GST_BASE_VIDEO_CODEC_SRC_PAD (self), outbuf);
     } else if (buf->omx_buf->nFilledLen > 0) {
       if (GST_BASE_VIDEO_CODEC (self)->state.bytes_per_picture == 0
@@ -894,6 +1395,17 @@ gst_omx_video_dec_loop (GstOMXVideoDec * self)
          */
         GST_WARNING_OBJECT (self,
             "Caps change pending and still have buffers for old caps -- dropping");
+        gst_omx_stats_add (self->stats, GST_OMX_STATS_DROPS, 1);
+        arrival = 0;
+      } else if ((frame->src_buffer =
+              gst_omx_video_dec_wrap_buffer (self, buf))) {
+        /* The output buffer is released once downstream is done with it */
+        wrapped = TRUE;
+        gst_omx_stats_add (self->stats, GST_OMX_STATS_FRAMES_OUT, 1);
+        flow_ret =
+            gst_base_video_decoder_finish_frame (GST_BASE_VIDEO_DECODER (self),
+            frame);
+        frame = NULL;
       } else
           if (gst_omx_video_dec_alloc_src_frame (self, frame,
               buf) == GST_FLOW_OK) {
@@ -909,6 +1421,7 @@ gst_omx_video_dec_loop (GstOMXVideoDec * self)
             frame->src_buffer = NULL;
           }
 
+          gst_omx_stats_add (self->stats, GST_OMX_STATS_DROPS, 1);
           flow_ret =
               gst_base_video_decoder_drop_frame (GST_BASE_VIDEO_DECODER (self), frame);
           frame = NULL;
@@ -919,6 +1432,7 @@ gst_omx_video_dec_loop (GstOMXVideoDec * self)
           }
           goto invalid_buffer;
         }
+        gst_omx_stats_add (self->stats, GST_OMX_STATS_FRAMES_OUT, 1);
         flow_ret =
             gst_base_video_decoder_finish_frame (GST_BASE_VIDEO_DECODER (self), frame);
         frame = NULL;
@@ -929,6 +1443,17 @@ gst_omx_video_dec_loop (GstOMXVideoDec * self)
       frame = NULL;
     }
 
+    GST_OMX_TRACE_CALL (self->component->trace, GST_OMX_TRACE_PUSH,
+        port->index, buf, flow_ret, start);
+
+    if (arrival) {
+      gst_omx_stats_add_latency (self->stats, GST_OMX_STATS_LATENCY,
+          g_get_monotonic_time () - arrival);
+      gst_omx_stats_seek_done (self->stats);
+    }
+    gst_omx_stats_post (self->stats, GST_ELEMENT_CAST (self), self->in_port,
+        self->out_port);
+
     if (is_eos || flow_ret == GST_FLOW_UNEXPECTED) {
       g_mutex_lock (self->drain_lock);
       if (self->draining) {
@@ -950,13 +1475,14 @@ gst_omx_video_dec_loop (GstOMXVideoDec * self)
 
     /* If a native buffer has been acquired from buf unreffing it will release
      * buf, if it hasn't we do that now. */
-    if (!allocated || !(port->comp->hacks & GST_OMX_HACK_ANDROID_BUFFERS)) {
+    if (!wrapped && (!allocated
+            || !(port->comp->hacks & GST_OMX_HACK_ANDROID_BUFFERS))) {
       gst_omx_port_release_buffer (port, buf);
     }
 
     self->downstream_flow_ret = flow_ret;
   } else {
-    g_assert ((klass->hacks & GST_OMX_HACK_NO_EMPTY_EOS_BUFFER));
+    g_assert ((self->component->hacks & GST_OMX_HACK_NO_EMPTY_EOS_BUFFER));
     GST_BASE_VIDEO_CODEC_STREAM_LOCK (self);
     flow_ret = GST_FLOW_UNEXPECTED;
   }
@@ -970,6 +1496,14 @@ gst_omx_video_dec_loop (GstOMXVideoDec * self)
 
 component_error:
   {
+    /* handle_frame() replaces the component and resumes later */
+    if (gst_omx_video_dec_is_lost (self)) {
+      GST_WARNING_OBJECT (self, "Component lost -- stopping task");
+      gst_pad_pause_task (GST_BASE_VIDEO_CODEC_SRC_PAD (self));
+      self->started = FALSE;
+      return;
+    }
+
     GST_ELEMENT_ERROR (self, LIBRARY, FAILED, (NULL),
         ("OpenMAX component in error state %s (0x%08x)",
             gst_omx_component_get_last_error_string (self->component),
@@ -999,6 +1533,10 @@ flow_error:
       gst_pad_push_event (GST_BASE_VIDEO_CODEC_SRC_PAD (self),
           gst_event_new_eos ());
       gst_pad_pause_task (GST_BASE_VIDEO_CODEC_SRC_PAD (self));
+
+      GST_OMX_TRACE_INSTANT (self->component->trace, GST_OMX_TRACE_EOS,
+          port->index, NULL, 0);
+      gst_omx_component_dump_trace (self->component);
     } else if (flow_ret == GST_FLOW_NOT_LINKED
         || flow_ret < GST_FLOW_UNEXPECTED) {
       GST_ELEMENT_ERROR (self, STREAM, FAILED, ("Internal data stream error."),
@@ -1061,6 +1599,8 @@ gst_omx_video_dec_start (GstBaseVideoDecoder * decoder)
 
   self->last_upstream_ts = 0;
   self->eos = FALSE;
+  self->late_references = 0;
+  self->skip_to_keyframe = FALSE;
   self->downstream_flow_ret = GST_FLOW_OK;
   ret =
       gst_pad_start_task (GST_BASE_VIDEO_CODEC_SRC_PAD (self),
@@ -1089,6 +1629,9 @@ gst_omx_video_dec_stop (GstBaseVideoDecoder * decoder)
   self->downstream_flow_ret = GST_FLOW_WRONG_STATE;
   self->started = FALSE;
   self->eos = FALSE;
+  g_mutex_lock (self->component_lock);
+  self->suspended = FALSE;
+  g_mutex_unlock (self->component_lock);
 
   g_mutex_lock (self->drain_lock);
   self->draining = FALSE;
@@ -1234,8 +1777,111 @@ gst_omx_video_dec_negotiate (GstOMXVideoDec * self)
   return (err == OMX_ErrorNone);
 }
 
+/* Smallest input buffers derived from the caps */
+#define MIN_INPUT_BUFFER_SIZE (64 * 1024)
+
+/* Estimates the size of the largest compressed frame, or returns
+ * 0 to use the component's default if the size is unknown */
+static guint32
+gst_omx_video_dec_get_input_buffer_size (GstOMXVideoDec * self,
+    GstVideoState * state)
+{
+  GstStructure *s;
+  gint bitrate;
+  guint64 size;
+
+  if (state->width <= 0 || state->height <= 0)
+    return 0;
+
+  /* Frames are compressed to at least half of the raw 4:2:0 size */
+  size = (guint64) state->width * state->height * 3 / 4;
+
+  /* Keyframes are rarely larger than 10 times the average frame */
+  s = state->caps ? gst_caps_get_structure (state->caps, 0) : NULL;
+  if (s && gst_structure_get_int (s, "bitrate", &bitrate) && bitrate > 0
+      && state->fps_n > 0 && state->fps_d > 0)
+    size = MIN (size, gst_util_uint64_scale (bitrate, 10 * state->fps_d,
+            8 * state->fps_n));
+
+  size = MAX (size, MIN_INPUT_BUFFER_SIZE);
+
+  GST_DEBUG_OBJECT (self, "Using input buffers of %" G_GUINT64_FORMAT
+      " bytes", size);
+
+  return size;
+}
+
+/* Reports the frames the component keeps before outputting one
+ * as latency: all output buffers it needs at least, or only one
+ * in low latency mode.
+ *
+ * NOTE: Call with the stream lock */
+static void
+gst_omx_video_dec_update_latency (GstOMXVideoDec * self)
+{
+  GstVideoState *state = &GST_BASE_VIDEO_CODEC (self)->state;
+  OMX_PARAM_PORTDEFINITIONTYPE port_def;
+  GstClockTime latency = 0;
+  guint frames = 1;
+
+  if (!self->buffer_config.low_latency) {
+    gst_omx_port_get_port_definition (self->out_port, &port_def);
+    frames = MAX (port_def.nBufferCountMin, 1);
+  }
+
+  if (state->fps_n > 0 && state->fps_d > 0)
+    latency = gst_util_uint64_scale (frames * GST_SECOND, state->fps_d,
+        state->fps_n);
+
+  GST_DEBUG_OBJECT (self, "Latency of %u frames: %" GST_TIME_FORMAT, frames,
+      GST_TIME_ARGS (latency));
+
+  gst_base_video_decoder_set_latency (GST_BASE_VIDEO_DECODER (self), latency,
+      latency);
+}
+
+/* Acquires the hardware resources for decoding state before the
+ * buffers are allocated, see gstomxresources.c. Before the component
+ * is configured, it's replaced by the next candidate while it has
+ * no room for state. Only the last candidate preempts other elements
+ * or, if wait is TRUE, waits for resources.
+ *
+ * NOTE: Call with the stream lock */
 static gboolean
-gst_omx_video_dec_set_format (GstBaseVideoDecoder * decoder,
+gst_omx_video_dec_acquire_resources (GstOMXVideoDec * self,
+    GstVideoState * state, gboolean wait)
+{
+  GstOMXVideoDecClass *klass = GST_OMX_VIDEO_DEC_GET_CLASS (self);
+  GstOMXResourceReturn ret;
+  guint64 load;
+
+  load =
+      gst_omx_resource_video_load (state->width, state->height, state->fps_n,
+      state->fps_d);
+
+  while (self->candidate + 1 < klass->n_candidates
+      && gst_omx_component_get_state (self->component, 0) == OMX_StateLoaded) {
+    if (gst_omx_resource_has_room (self->resource, load)
+        && gst_omx_resource_acquire (self->resource, load,
+            FALSE) == GST_OMX_RESOURCE_OK)
+      return TRUE;
+
+    GST_INFO_OBJECT (self, "Not enough resources for '%s', falling back",
+        klass->candidates[self->candidate].element_name);
+    gst_omx_video_dec_close (self);
+    self->candidate++;
+    if (!gst_omx_video_dec_open (self))
+      return FALSE;
+  }
+
+  ret = gst_omx_resource_acquire (self->resource, load, wait);
+
+  return (ret == GST_OMX_RESOURCE_OK);
+}
+
+/* NOTE: Call with the stream lock */
+static gboolean
+gst_omx_video_dec_configure (GstBaseVideoDecoder * decoder,
     GstVideoState * state)
 {
   GstOMXVideoDec *self;
@@ -1249,12 +1895,18 @@ gst_omx_video_dec_set_format (GstBaseVideoDecoder * decoder,
 
   GST_DEBUG_OBJECT (self, "Setting new caps %" GST_PTR_FORMAT, state->caps);
 
+  /* Applied once the resources are acquired again */
+  if (self->suspended) {
+    GST_DEBUG_OBJECT (self, "Suspended, not configuring the component");
+    return TRUE;
+  }
+
   gst_omx_port_get_port_definition (self->in_port, &port_def);
 
   /* Check if the caps change is a real format change or if only irrelevant
    * parts of the caps have changed or nothing at all.
    */
-  if (!(klass->hacks & GST_OMX_HACK_IMPLICIT_FORMAT_CHANGE)) {
+  if (!(self->component->hacks & GST_OMX_HACK_IMPLICIT_FORMAT_CHANGE)) {
     is_format_change |= port_def.format.video.nFrameWidth != state->width;
     is_format_change |= port_def.format.video.nFrameHeight != state->height;
     is_format_change |= (port_def.format.video.xFramerate == 0
@@ -1282,7 +1934,7 @@ gst_omx_video_dec_set_format (GstBaseVideoDecoder * decoder,
   if (needs_disable && is_format_change) {
     gst_omx_video_dec_drain (self);
 
-    if (klass->hacks & GST_OMX_HACK_NO_COMPONENT_RECONFIGURE) {
+    if (self->component->hacks & GST_OMX_HACK_NO_COMPONENT_RECONFIGURE) {
       GST_BASE_VIDEO_CODEC_STREAM_UNLOCK (self);
       gst_omx_video_dec_stop (GST_BASE_VIDEO_DECODER (self));
       gst_omx_video_dec_close (self);
@@ -1302,6 +1954,16 @@ gst_omx_video_dec_set_format (GstBaseVideoDecoder * decoder,
     }
   }
 
+  if (!gst_omx_video_dec_acquire_resources (self, state, TRUE)) {
+    GST_ELEMENT_ERROR (self, RESOURCE, BUSY, (NULL),
+        ("Not enough hardware resources to decode %dx%d", state->width,
+            state->height));
+    return FALSE;
+  }
+
+  /* Might be another component now */
+  gst_omx_port_get_port_definition (self->in_port, &port_def);
+
   port_def.format.video.nFrameWidth = state->width;
   port_def.format.video.nFrameHeight = state->height;
   if (state->fps_n == 0)
@@ -1309,6 +1971,11 @@ gst_omx_video_dec_set_format (GstBaseVideoDecoder * decoder,
   else
     port_def.format.video.xFramerate = (state->fps_n << 16) / (state->fps_d);
 
+  /* Applied when the buffers are allocated */
+  if (self->buffer_config.input_buffer_size == 0)
+    self->in_port->buffer_size =
+        gst_omx_video_dec_get_input_buffer_size (self, state);
+
   if (!gst_omx_port_update_port_definition (self->in_port, &port_def))
     return FALSE;
   if (!gst_omx_port_update_port_definition (self->out_port, NULL))
@@ -1321,6 +1988,26 @@ gst_omx_video_dec_set_format (GstBaseVideoDecoder * decoder,
     }
   }
 
+  /* Before the output buffers are allocated the first time, the
+   * output port keeps the buffers for all later resolution changes */
+  if (!needs_disable && self->buffer_config.adaptive_max_width > 0
+      && self->buffer_config.adaptive_max_height > 0) {
+    if (gst_omx_port_set_adaptive_playback (self->out_port,
+            MAX (self->buffer_config.adaptive_max_width, state->width),
+            MAX (self->buffer_config.adaptive_max_height,
+                state->height)) != OMX_ErrorNone)
+      GST_INFO_OBJECT (self, "Resolution changes reconfigure the output port");
+  }
+
+  if (!needs_disable && self->buffer_config.low_latency) {
+    const gchar *extension =
+        klass->candidates[self->candidate].low_latency_extension;
+
+    if (!extension || gst_omx_port_set_extension_enabled (self->out_port,
+            extension, TRUE) != OMX_ErrorNone)
+      GST_INFO_OBJECT (self, "Component has no low latency mode");
+  }
+
   gst_buffer_replace (&self->codec_data, state->codec_data);
 
   if (!gst_omx_video_dec_negotiate (self))
@@ -1355,6 +2042,8 @@ gst_omx_video_dec_set_format (GstBaseVideoDecoder * decoder,
       return FALSE;
   }
 
+  gst_omx_video_dec_update_latency (self);
+
   /* Unset flushing to allow ports to accept data again */
   gst_omx_port_set_flushing (self->in_port, FALSE);
   gst_omx_port_set_flushing (self->out_port, FALSE);
@@ -1374,6 +2063,28 @@ gst_omx_video_dec_set_format (GstBaseVideoDecoder * decoder,
   return TRUE;
 }
 
+/* The ports are disabled and enabled again or the component changes
+ * state while it is configured, flush_start() leaves it alone then */
+static gboolean
+gst_omx_video_dec_set_format (GstBaseVideoDecoder * decoder,
+    GstVideoState * state)
+{
+  GstOMXVideoDec *self = GST_OMX_VIDEO_DEC (decoder);
+  gboolean ret;
+
+  g_mutex_lock (self->component_lock);
+  self->configuring = TRUE;
+  g_mutex_unlock (self->component_lock);
+
+  ret = gst_omx_video_dec_configure (decoder, state);
+
+  g_mutex_lock (self->component_lock);
+  self->configuring = FALSE;
+  g_mutex_unlock (self->component_lock);
+
+  return ret;
+}
+
 static gboolean
 gst_omx_video_dec_reset (GstBaseVideoDecoder * decoder)
 {
@@ -1383,25 +2094,27 @@ gst_omx_video_dec_reset (GstBaseVideoDecoder * decoder)
 
   GST_DEBUG_OBJECT (self, "Resetting decoder");
 
-  gst_omx_video_dec_drain (self);
+  /* After a seek the ports are flushing already and there is
+   * nothing to drain, see gst_omx_video_dec_flush_start() */
+  if (!gst_omx_port_is_flushing (self->in_port))
+    gst_omx_video_dec_drain (self);
 
-  gst_omx_port_set_flushing (self->in_port, TRUE);
-  gst_omx_port_set_flushing (self->out_port, TRUE);
+  gst_omx_component_set_flushing (self->component, TRUE);
 
-  /* Wait until the srcpad loop is finished,
+  /* Wait until the srcpad loop is paused,
    * unlock GST_BASE_VIDEO_CODEC_STREAM_LOCK to prevent deadlocks
    * caused by using this lock from inside the loop function */
   GST_BASE_VIDEO_CODEC_STREAM_UNLOCK (self);
-  GST_PAD_STREAM_LOCK (GST_BASE_VIDEO_CODEC_SRC_PAD (self));
-  GST_PAD_STREAM_UNLOCK (GST_BASE_VIDEO_CODEC_SRC_PAD (self));
+  gst_pad_pause_task (GST_BASE_VIDEO_CODEC_SRC_PAD (self));
   GST_BASE_VIDEO_CODEC_STREAM_LOCK (self);
 
-  gst_omx_port_set_flushing (self->in_port, FALSE);
-  gst_omx_port_set_flushing (self->out_port, FALSE);
+  gst_omx_component_set_flushing (self->component, FALSE);
 
-  /* Start the srcpad loop again */
+  /* Resume the srcpad loop */
   self->last_upstream_ts = 0;
   self->eos = FALSE;
+  self->late_references = 0;
+  self->skip_to_keyframe = FALSE;
   self->downstream_flow_ret = GST_FLOW_OK;
   gst_pad_start_task (GST_BASE_VIDEO_CODEC_SRC_PAD (self),
       (GstTaskFunction) gst_omx_video_dec_loop, decoder);
@@ -1411,12 +2124,190 @@ gst_omx_video_dec_reset (GstBaseVideoDecoder * decoder)
   return TRUE;
 }
 
+/* Not serialized with the streaming thread, which might wait for an
+ * input buffer or for the drain. Flushing the ports unblocks it, and
+ * the component is flushed while upstream is still seeking. Nothing
+ * is flushed while the component is replaced, suspended or being
+ * configured, the streaming thread doesn't wait for it then */
+static void
+gst_omx_video_dec_flush_start (GstBaseVideoDecoder * decoder)
+{
+  GstOMXVideoDec *self;
+
+  self = GST_OMX_VIDEO_DEC (decoder);
+
+  GST_DEBUG_OBJECT (self, "Flushing decoder");
+
+  gst_omx_stats_seek_start (self->stats);
+
+  g_mutex_lock (self->component_lock);
+  if (self->component && !self->suspended && !self->configuring)
+    gst_omx_component_set_flushing (self->component, TRUE);
+  g_mutex_unlock (self->component_lock);
+
+  g_mutex_lock (self->drain_lock);
+  self->draining = FALSE;
+  g_cond_broadcast (self->drain_cond);
+  g_mutex_unlock (self->drain_lock);
+}
+
 static GstFlowReturn
 gst_omx_video_dec_parse_data (GstBaseVideoDecoder * decoder, gboolean at_eos)
 {
   return GST_FLOW_OK;
 }
 
+/* Returns TRUE if the frame can't be shown because it is outside the
+ * segment or would be too late already, and sets late accordingly */
+static gboolean
+gst_omx_video_dec_is_hidden (GstOMXVideoDec * self, GstVideoFrame * frame,
+    gboolean * late)
+{
+  GstSegment *segment = &GST_BASE_VIDEO_CODEC (self)->segment;
+  GstClockTime timestamp = frame->presentation_timestamp;
+  GstClockTime end;
+
+  *late = FALSE;
+
+  if (segment->format != GST_FORMAT_TIME
+      || !GST_CLOCK_TIME_IS_VALID (timestamp))
+    return FALSE;
+
+  end = timestamp;
+  if (GST_CLOCK_TIME_IS_VALID (frame->presentation_duration))
+    end += frame->presentation_duration;
+
+  if ((timestamp < segment->start && end <= segment->start)
+      || (GST_CLOCK_TIME_IS_VALID (segment->stop)
+          && timestamp >= segment->stop))
+    return TRUE;
+
+  /* The frame would still have to be decoded after this */
+  if (gst_base_video_decoder_get_max_decode_time (GST_BASE_VIDEO_DECODER
+          (self), frame) < 0) {
+    *late = TRUE;
+    return TRUE;
+  }
+
+  return FALSE;
+}
+
+/* Returns TRUE if only the keyframes should be decoded because the
+ * segment is played back too fast to decode all frames */
+static gboolean
+gst_omx_video_dec_is_trick_mode (GstOMXVideoDec * self)
+{
+  GstSegment *segment = &GST_BASE_VIDEO_CODEC (self)->segment;
+
+  return segment->rate > MIN_TRICK_MODE_RATE
+      || segment->rate < -MIN_TRICK_MODE_RATE;
+}
+
+static gboolean
+gst_omx_video_dec_is_preempted (GstOMXVideoDec * self)
+{
+  OMX_ERRORTYPE err;
+
+  if (self->resource && gst_omx_resource_is_preempted (self->resource))
+    return TRUE;
+
+  err = gst_omx_component_get_last_error (self->component);
+  return (err == OMX_ErrorResourcesPreempted || err == OMX_ErrorResourcesLost);
+}
+
+/* TRUE if the component has to be replaced, because its resources
+ * were preempted or because it failed and a fallback is left */
+static gboolean
+gst_omx_video_dec_is_lost (GstOMXVideoDec * self)
+{
+  GstOMXVideoDecClass *klass = GST_OMX_VIDEO_DEC_GET_CLASS (self);
+
+  if (gst_omx_video_dec_is_preempted (self))
+    return TRUE;
+
+  return self->candidate + 1 < klass->n_candidates
+      && gst_omx_component_get_last_error (self->component) != OMX_ErrorNone;
+}
+
+/* Releases the component after it was lost. Frames are dropped until
+ * a keyframe arrives and a component can be configured again, see
+ * gst_omx_video_dec_resume(). That's the first available candidate
+ * after preemption and the next one after a failure.
+ *
+ * NOTE: Call with the stream lock */
+static gboolean
+gst_omx_video_dec_suspend (GstOMXVideoDec * self, GstVideoFrame * frame)
+{
+  GList *l;
+
+  if (gst_omx_video_dec_is_preempted (self)) {
+    GST_ELEMENT_WARNING (self, RESOURCE, BUSY, (NULL),
+        ("Hardware resources preempted, dropping frames until they are "
+            "available again"));
+    self->candidate = 0;
+  } else {
+    GST_ELEMENT_WARNING (self, LIBRARY, FAILED, (NULL),
+        ("OpenMAX component in error state %s (0x%08x), falling back",
+            gst_omx_component_get_last_error_string (self->component),
+            gst_omx_component_get_last_error (self->component)));
+    self->candidate++;
+  }
+
+  GST_BASE_VIDEO_CODEC_STREAM_UNLOCK (self);
+  gst_omx_video_dec_stop (GST_BASE_VIDEO_DECODER (self));
+  gst_omx_video_dec_close (self);
+  GST_BASE_VIDEO_CODEC_STREAM_LOCK (self);
+
+  /* The frames passed to the component are lost with it */
+  l = GST_BASE_VIDEO_CODEC (self)->frames.head;
+  while (l) {
+    GstVideoFrame *tmp = l->data;
+
+    l = l->next;
+    if (tmp != frame)
+      gst_base_video_decoder_drop_frame (GST_BASE_VIDEO_DECODER (self), tmp);
+  }
+
+  g_mutex_lock (self->component_lock);
+  self->suspended = TRUE;
+  g_mutex_unlock (self->component_lock);
+
+  if (!gst_omx_video_dec_open (self)) {
+    GST_ELEMENT_ERROR (self, LIBRARY, INIT, (NULL),
+        ("Failed to open the component again"));
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+/* Configures the component again for the current format if the
+ * resources are available. Returns FALSE if it stays suspended.
+ *
+ * NOTE: Call with the stream lock */
+static gboolean
+gst_omx_video_dec_resume (GstOMXVideoDec * self, GstFlowReturn * ret)
+{
+  GstVideoState *state = &GST_BASE_VIDEO_CODEC (self)->state;
+
+  *ret = GST_FLOW_OK;
+  if (!gst_omx_video_dec_acquire_resources (self, state, FALSE))
+    return FALSE;
+
+  GST_INFO_OBJECT (self, "Resources available again, resuming");
+  g_mutex_lock (self->component_lock);
+  self->suspended = FALSE;
+  g_mutex_unlock (self->component_lock);
+
+  if (!gst_omx_video_dec_set_format (GST_BASE_VIDEO_DECODER (self), state)) {
+    GST_ELEMENT_ERROR (self, LIBRARY, SETTINGS, (NULL),
+        ("Failed to configure the component again"));
+    *ret = GST_FLOW_ERROR;
+  }
+
+  return TRUE;
+}
+
 static GstFlowReturn
 gst_omx_video_dec_handle_frame (GstBaseVideoDecoder * decoder,
     GstVideoFrame * frame)
@@ -1424,10 +2315,12 @@ gst_omx_video_dec_handle_frame (GstBaseVideoDecoder * decoder,
   GstOMXAcquireBufferReturn acq_ret = GST_OMX_ACQUIRE_BUFFER_ERROR;
   GstOMXVideoDec *self;
   GstOMXVideoDecClass *klass;
-  GstOMXBuffer *buf;
+  GstOMXBuffer *buf, *inbuf = NULL;
   GstBuffer *codec_data = NULL;
   guint offset = 0;
   GstClockTime timestamp, duration, timestamp_offset = 0;
+  gint64 arrival;
+  gboolean decode_only = FALSE, late, is_keyframe;
 
   self = GST_OMX_VIDEO_DEC (decoder);
   klass = GST_OMX_VIDEO_DEC_GET_CLASS (self);
@@ -1439,9 +2332,32 @@ gst_omx_video_dec_handle_frame (GstBaseVideoDecoder * decoder,
     return GST_FLOW_UNEXPECTED;
   }
 
+  arrival = g_get_monotonic_time ();
+  gst_omx_stats_add (self->stats, GST_OMX_STATS_FRAMES_IN, 1);
+
   timestamp = frame->presentation_timestamp;
   duration = frame->presentation_duration;
 
+  is_keyframe =
+      !GST_BUFFER_FLAG_IS_SET (frame->sink_buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+
+  if (!self->suspended && gst_omx_video_dec_is_lost (self)
+      && !gst_omx_video_dec_suspend (self, frame))
+    return GST_FLOW_ERROR;
+
+  if (self->suspended) {
+    GstFlowReturn ret = GST_FLOW_OK;
+
+    if (!is_keyframe || !gst_omx_video_dec_resume (self, &ret)) {
+      GST_LOG_OBJECT (self, "Suspended, dropping frame %" GST_TIME_FORMAT,
+          GST_TIME_ARGS (timestamp));
+      gst_omx_stats_add (self->stats, GST_OMX_STATS_DROPS, 1);
+      return gst_base_video_decoder_drop_frame (decoder, frame);
+    }
+    if (ret != GST_FLOW_OK)
+      return ret;
+  }
+
   if (self->downstream_flow_ret != GST_FLOW_OK) {
     return self->downstream_flow_ret;
   }
@@ -1457,38 +2373,107 @@ gst_omx_video_dec_handle_frame (GstBaseVideoDecoder * decoder,
     }
   }
 
+  /* In trick mode every keyframe is a GOP of its own. If the component
+   * still holds back the previous keyframe waiting for frames to
+   * reorder, it is drained and flushed before the next one. In reverse
+   * playback the base class does this for every GOP */
+  if (gst_omx_video_dec_is_trick_mode (self)) {
+    if (!is_keyframe) {
+      GST_LOG_OBJECT (self, "Trick mode, skipping delta frame %"
+          GST_TIME_FORMAT, GST_TIME_ARGS (timestamp));
+      gst_omx_stats_add (self->stats, GST_OMX_STATS_DROPS, 1);
+      return gst_base_video_decoder_drop_frame (decoder, frame);
+    }
+
+    /* The frame itself is pending already */
+    if (self->started && GST_BASE_VIDEO_CODEC (self)->frames.length > 1) {
+      GST_DEBUG_OBJECT (self, "Trick mode, flushing previous keyframe");
+      gst_omx_video_dec_reset (decoder);
+    }
+  }
+
+  /* The frames until the next keyframe can't be
+   * decoded anymore once one of them was skipped */
+  if (self->skip_to_keyframe) {
+    if (!is_keyframe) {
+      gst_omx_stats_add (self->stats, GST_OMX_STATS_LATE_DROPS, 1);
+      return gst_base_video_decoder_drop_frame (decoder, frame);
+    }
+    GST_DEBUG_OBJECT (self, "Got keyframe, decoding again");
+    self->skip_to_keyframe = FALSE;
+  }
+
+  /* Frames that won't be shown are skipped before they are passed to
+   * the component if no other frames depend on them, and otherwise only
+   * decoded without being output. If skipping these is not enough
+   * to catch up, everything is skipped until the next keyframe */
+  if (gst_omx_video_dec_is_hidden (self, frame, &late)) {
+    gst_omx_stats_add (self->stats,
+        late ? GST_OMX_STATS_LATE_DROPS : GST_OMX_STATS_DROPS, 1);
+
+    if (klass->is_droppable && klass->is_droppable (self, frame)) {
+      GST_DEBUG_OBJECT (self, "Skipping %s frame %" GST_TIME_FORMAT,
+          late ? "late" : "out of segment", GST_TIME_ARGS (timestamp));
+      return gst_base_video_decoder_drop_frame (decoder, frame);
+    }
+
+    if (late && !is_keyframe
+        && ++self->late_references >= MAX_LATE_REFERENCES) {
+      GST_WARNING_OBJECT (self, "Too late, skipping until the next keyframe");
+      self->late_references = 0;
+      self->skip_to_keyframe = TRUE;
+      return gst_base_video_decoder_drop_frame (decoder, frame);
+    }
+
+    GST_DEBUG_OBJECT (self, "Decoding %s frame %" GST_TIME_FORMAT " only",
+        late ? "late" : "out of segment", GST_TIME_ARGS (timestamp));
+    decode_only = TRUE;
+  } else {
+    self->late_references = 0;
+  }
+
+  /* Upstream might have written the frame into one of our input
+   * buffers already, see gst_omx_video_dec_alloc_sink_buffer() */
+  if (!self->codec_data && GST_BUFFER_SIZE (frame->sink_buffer) > 0)
+    inbuf = gst_omx_port_reclaim_buffer (self->in_port, frame->sink_buffer);
+
   while (offset < GST_BUFFER_SIZE (frame->sink_buffer)) {
-    /* Make sure to release the base class stream lock, otherwise
-     * _loop() can't call _finish_frame() and we might block forever
-     * because no input buffers are released */
-    GST_BASE_VIDEO_CODEC_STREAM_UNLOCK (self);
-    acq_ret = gst_omx_port_acquire_buffer (self->in_port, &buf);
+    if (inbuf) {
+      buf = inbuf;
+      acq_ret = GST_OMX_ACQUIRE_BUFFER_OK;
+    } else {
+      /* Make sure to release the base class stream lock, otherwise
+       * _loop() can't call _finish_frame() and we might block forever
+       * because no input buffers are released */
+      GST_BASE_VIDEO_CODEC_STREAM_UNLOCK (self);
+      acq_ret = gst_omx_port_acquire_buffer (self->in_port, &buf);
 
-    if (acq_ret == GST_OMX_ACQUIRE_BUFFER_ERROR) {
-      GST_BASE_VIDEO_CODEC_STREAM_LOCK (self);
-      goto component_error;
-    } else if (acq_ret == GST_OMX_ACQUIRE_BUFFER_FLUSHING) {
-      GST_BASE_VIDEO_CODEC_STREAM_LOCK (self);
-      goto flushing;
-    } else if (acq_ret == GST_OMX_ACQUIRE_BUFFER_RECONFIGURE) {
-      if (gst_omx_port_reconfigure (self->in_port) != OMX_ErrorNone) {
+      if (acq_ret == GST_OMX_ACQUIRE_BUFFER_ERROR) {
         GST_BASE_VIDEO_CODEC_STREAM_LOCK (self);
-        goto reconfigure_error;
-      }
+        goto component_error;
+      } else if (acq_ret == GST_OMX_ACQUIRE_BUFFER_FLUSHING) {
+        GST_BASE_VIDEO_CODEC_STREAM_LOCK (self);
+        goto flushing;
+      } else if (acq_ret == GST_OMX_ACQUIRE_BUFFER_RECONFIGURE) {
+        if (gst_omx_port_reconfigure (self->in_port) != OMX_ErrorNone) {
+          GST_BASE_VIDEO_CODEC_STREAM_LOCK (self);
+          goto reconfigure_error;
+        }
 
-      /* Now get a new buffer and fill it */
-      GST_BASE_VIDEO_CODEC_STREAM_LOCK (self);
-      continue;
-    } else if (acq_ret == GST_OMX_ACQUIRE_BUFFER_RECONFIGURED) {
-      /* TODO: Anything to do here? Don't think so */
+        /* Now get a new buffer and fill it */
+        GST_BASE_VIDEO_CODEC_STREAM_LOCK (self);
+        continue;
+      } else if (acq_ret == GST_OMX_ACQUIRE_BUFFER_RECONFIGURED) {
+        /* TODO: Anything to do here? Don't think so */
+        GST_BASE_VIDEO_CODEC_STREAM_LOCK (self);
+        continue;
+      }
       GST_BASE_VIDEO_CODEC_STREAM_LOCK (self);
-      continue;
     }
-    GST_BASE_VIDEO_CODEC_STREAM_LOCK (self);
 
     g_assert (acq_ret == GST_OMX_ACQUIRE_BUFFER_OK && buf != NULL);
 
-    if (buf->omx_buf->nAllocLen - buf->omx_buf->nOffset <= 0) {
+    if (!inbuf && buf->omx_buf->nAllocLen - buf->omx_buf->nOffset <= 0) {
       gst_omx_port_release_buffer (self->in_port, buf);
       goto full_buffer;
     }
@@ -1508,9 +2493,15 @@ gst_omx_video_dec_handle_frame (GstBaseVideoDecoder * decoder,
       }
 
       buf->omx_buf->nFlags |= OMX_BUFFERFLAG_CODECCONFIG;
+      /* Lets the component configure itself without waiting
+       * for the first frame */
+      if (self->buffer_config.low_latency)
+        buf->omx_buf->nFlags |= OMX_BUFFERFLAG_ENDOFFRAME;
       buf->omx_buf->nFilledLen = GST_BUFFER_SIZE (codec_data);
       memcpy (buf->omx_buf->pBuffer + buf->omx_buf->nOffset,
           GST_BUFFER_DATA (codec_data), GST_BUFFER_SIZE (codec_data));
+      gst_omx_stats_add (self->stats, GST_OMX_STATS_BYTES_COPIED_IN,
+          GST_BUFFER_SIZE (codec_data));
 
       self->started = TRUE;
       gst_omx_port_release_buffer (self->in_port, buf);
@@ -1522,13 +2513,18 @@ gst_omx_video_dec_handle_frame (GstBaseVideoDecoder * decoder,
     /* Now handle the frame */
 
     /* Copy the buffer content in chunks of size as requested
-     * by the port */
-    buf->omx_buf->nFilledLen =
-        MIN (GST_BUFFER_SIZE (frame->sink_buffer) - offset,
-        buf->omx_buf->nAllocLen - buf->omx_buf->nOffset);
-    memcpy (buf->omx_buf->pBuffer + buf->omx_buf->nOffset,
-        GST_BUFFER_DATA (frame->sink_buffer) + offset,
-        buf->omx_buf->nFilledLen);
+     * by the port, unless it's already in the buffer */
+    if (!inbuf) {
+      buf->omx_buf->nFilledLen =
+          MIN (GST_BUFFER_SIZE (frame->sink_buffer) - offset,
+          buf->omx_buf->nAllocLen - buf->omx_buf->nOffset);
+      memcpy (buf->omx_buf->pBuffer + buf->omx_buf->nOffset,
+          GST_BUFFER_DATA (frame->sink_buffer) + offset,
+          buf->omx_buf->nFilledLen);
+      gst_omx_stats_add (self->stats, GST_OMX_STATS_BYTES_COPIED_IN,
+          buf->omx_buf->nFilledLen);
+    }
+    inbuf = NULL;
 
     /* Interpolate timestamps if we're passing the buffer
      * in multiple chunks */
@@ -1554,20 +2550,32 @@ gst_omx_video_dec_handle_frame (GstBaseVideoDecoder * decoder,
     if (offset == 0) {
       BufferIdentification *id = g_slice_new0 (BufferIdentification);
 
-      if (!GST_BUFFER_FLAG_IS_SET (frame->sink_buffer,
-              GST_BUFFER_FLAG_DELTA_UNIT))
+      if (is_keyframe)
         buf->omx_buf->nFlags |= OMX_BUFFERFLAG_SYNCFRAME;
 
       id->timestamp = buf->omx_buf->nTimeStamp;
+      id->self = self;
+      id->frame = frame;
+      id->mark = GUINT_TO_POINTER (frame->system_frame_number + 1);
+      id->arrival = arrival;
+      id->queued = g_get_monotonic_time ();
+      id->decode_only = decode_only;
       frame->coder_hook = id;
       frame->coder_hook_destroy_notify =
           (GDestroyNotify) buffer_identification_free;
+
+      g_hash_table_insert (self->frames_by_mark, id->mark, frame);
+      frames_by_timestamp_add (self, id);
+
+      /* Components propagate the mark to the output buffer that is
+       * decoded from this input buffer, otherwise the frame is found
+       * by its timestamp */
+      buf->omx_buf->hMarkTargetComponent = self->component->handle;
+      buf->omx_buf->pMarkData = id->mark;
     }
 
-    /* TODO: Set flags
-     *   - OMX_BUFFERFLAG_DECODEONLY for buffers that are outside
-     *     the segment
-     */
+    if (decode_only)
+      buf->omx_buf->nFlags |= OMX_BUFFERFLAG_DECODEONLY;
 
     offset += buf->omx_buf->nFilledLen;
 
@@ -1608,6 +2616,14 @@ too_large_codec_data:
 
 component_error:
   {
+    /* Continues with the next keyframe on another component */
+    if (gst_omx_video_dec_is_lost (self)) {
+      if (!gst_omx_video_dec_suspend (self, frame))
+        return GST_FLOW_ERROR;
+      gst_omx_stats_add (self->stats, GST_OMX_STATS_DROPS, 1);
+      return gst_base_video_decoder_drop_frame (decoder, frame);
+    }
+
     GST_ELEMENT_ERROR (self, LIBRARY, FAILED, (NULL),
         ("OpenMAX component in error state %s (0x%08x)",
             gst_omx_component_get_last_error_string (self->component),
@@ -1628,16 +2644,65 @@ reconfigure_error:
   }
 }
 
+static GstFlowReturn
+gst_omx_video_dec_alloc_sink_buffer (GstBaseVideoDecoder * decoder,
+    guint64 offset, guint size, GstCaps * caps, GstBuffer ** buf)
+{
+  GstOMXVideoDec *self;
+  GstOMXBuffer *inbuf;
+  GstOMXAcquireBufferReturn acq_ret;
+
+  self = GST_OMX_VIDEO_DEC (decoder);
+
+  /* Only after the component is set up, frames that don't fit
+   * into a single buffer are copied as usual */
+  if (!self->started || !self->in_port->zero_copy || size == 0
+      || size > self->in_port->port_def.nBufferSize)
+    return GST_FLOW_OK;
+
+  /* Always keep one buffer for us, e.g. for the codec data,
+   * otherwise we could wait forever for upstream */
+  if (gst_omx_port_get_lent_count (self->in_port) + 1 >=
+      self->in_port->port_def.nBufferCountActual)
+    return GST_FLOW_OK;
+
+  acq_ret = gst_omx_port_acquire_buffer (self->in_port, &inbuf);
+  if (acq_ret == GST_OMX_ACQUIRE_BUFFER_FLUSHING)
+    return GST_FLOW_WRONG_STATE;
+  else if (acq_ret != GST_OMX_ACQUIRE_BUFFER_OK)
+    return GST_FLOW_OK;
+
+  /* The wrapped memory starts at nOffset, upstream must not
+   * write past the end of the OMX allocation */
+  if (inbuf->omx_buf->nOffset >= inbuf->omx_buf->nAllocLen
+      || size > inbuf->omx_buf->nAllocLen - inbuf->omx_buf->nOffset) {
+    gst_omx_port_release_buffer (self->in_port, inbuf);
+    return GST_FLOW_OK;
+  }
+
+  *buf = gst_omx_port_wrap_buffer (self->in_port, inbuf);
+  if (!*buf) {
+    gst_omx_port_release_buffer (self->in_port, inbuf);
+    return GST_FLOW_OK;
+  }
+
+  GST_BUFFER_SIZE (*buf) = size;
+  GST_BUFFER_OFFSET (*buf) = offset;
+  gst_buffer_set_caps (*buf, caps);
+
+  GST_LOG_OBJECT (self, "Allocated input buffer %p of size %u", inbuf, size);
+
+  return GST_FLOW_OK;
+}
+
 static GstFlowReturn
 gst_omx_video_dec_finish (GstBaseVideoDecoder * decoder)
 {
   GstOMXVideoDec *self;
-  GstOMXVideoDecClass *klass;
   GstOMXBuffer *buf;
   GstOMXAcquireBufferReturn acq_ret;
 
   self = GST_OMX_VIDEO_DEC (decoder);
-  klass = GST_OMX_VIDEO_DEC_GET_CLASS (self);
 
   GST_DEBUG_OBJECT (self, "Sending EOS to the component");
 
@@ -1648,16 +2713,16 @@ gst_omx_video_dec_finish (GstBaseVideoDecoder * decoder)
   }
   self->eos = TRUE;
 
-  if ((klass->hacks & GST_OMX_HACK_NO_EMPTY_EOS_BUFFER)) {
+  if ((self->component->hacks & GST_OMX_HACK_NO_EMPTY_EOS_BUFFER)) {
     GST_WARNING_OBJECT (self, "Component does not support empty EOS buffers");
 
     /* Insert a NULL into the queue to signal EOS */
-    g_mutex_lock (self->component->lock);
+    g_mutex_lock (self->out_port->lock);
     g_queue_push_tail (&self->out_port->pending_buffers, NULL);
-    g_mutex_lock (self->component->messages_lock);
-    g_cond_broadcast (self->component->messages_cond);
-    g_mutex_unlock (self->component->messages_lock);
-    g_mutex_unlock (self->component->lock);
+    g_mutex_lock (self->out_port->messages_lock);
+    g_cond_broadcast (self->out_port->messages_cond);
+    g_mutex_unlock (self->out_port->messages_lock);
+    g_mutex_unlock (self->out_port->lock);
 
     return GST_BASE_VIDEO_DECODER_FLOW_DROPPED;
   }
@@ -1692,14 +2757,11 @@ gst_omx_video_dec_finish (GstBaseVideoDecoder * decoder)
 static GstFlowReturn
 gst_omx_video_dec_drain (GstOMXVideoDec * self)
 {
-  GstOMXVideoDecClass *klass;
   GstOMXBuffer *buf;
   GstOMXAcquireBufferReturn acq_ret;
 
   GST_DEBUG_OBJECT (self, "Draining component");
 
-  klass = GST_OMX_VIDEO_DEC_GET_CLASS (self);
-
   if (!self->started) {
     GST_DEBUG_OBJECT (self, "Component not started yet");
     return GST_FLOW_OK;
@@ -1712,7 +2774,7 @@ gst_omx_video_dec_drain (GstOMXVideoDec * self)
     return GST_FLOW_OK;
   }
 
-  if ((klass->hacks & GST_OMX_HACK_NO_EMPTY_EOS_BUFFER)) {
+  if ((self->component->hacks & GST_OMX_HACK_NO_EMPTY_EOS_BUFFER)) {
     GST_WARNING_OBJECT (self, "Component does not support empty EOS buffers");
     return GST_FLOW_OK;
   }
@@ -1745,9 +2807,9 @@ gst_omx_video_dec_drain (GstOMXVideoDec * self)
   GST_DEBUG_OBJECT (self, "Waiting until component is drained");
 
   if (G_UNLIKELY (self->component->hacks & GST_OMX_HACK_DRAIN_MAY_NOT_RETURN)) {
-    GTimeVal tv = {.tv_sec = 0,.tv_usec = 500000 };
+    gint64 deadline = g_get_monotonic_time () + 500 * G_TIME_SPAN_MILLISECOND;
 
-    if (!g_cond_timed_wait (self->drain_cond, self->drain_lock, &tv))
+    if (!g_cond_wait_until (self->drain_cond, self->drain_lock, deadline))
       GST_WARNING_OBJECT (self, "Drain timed out");
     else
       GST_DEBUG_OBJECT (self, "Drained component");
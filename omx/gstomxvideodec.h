@@ -25,6 +25,8 @@
 #include "gstbasevideodecoder.h"
 
 #include "gstomx.h"
+#include "gstomxstats.h"
+#include "gstomxresources.h"
 
 G_BEGIN_DECLS
 
@@ -61,6 +63,12 @@ struct _GstOMXVideoDec
 
   GstClockTime last_upstream_ts;
 
+  /* Frames passed to the component by buffer mark and lists of
+   * them by timestamp, for finding the frame of an output buffer.
+   * NOTE: Protected by the stream lock */
+  GHashTable *frames_by_mark;
+  GHashTable *frames_by_timestamp;
+
   /* Draining state */
   GMutex *drain_lock;
   GCond *drain_cond;
@@ -70,7 +78,41 @@ struct _GstOMXVideoDec
   /* TRUE if upstream is EOS */
   gboolean eos;
 
+  /* Number of consecutive late frames that had to be decoded and
+   * TRUE if all frames are skipped until the next keyframe.
+   * NOTE: Protected by the stream lock */
+  guint late_references;
+  gboolean skip_to_keyframe;
+
+  /* Crop rectangle of the output frames with adaptive playback,
+   * nWidth is 0 if the whole frame is used. Only used by the
+   * output loop */
+  OMX_CONFIG_RECTTYPE crop;
+
   GstFlowReturn downstream_flow_ret;
+
+  GstOMXStats *stats;
+
+  /* Held while the component and its ports are replaced or
+   * suspended is changed, for users outside the streaming thread
+   * like flush_start(), the stats property and dump-trace */
+  GMutex *component_lock;
+  /* TRUE while set_format() configures the component.
+   * NOTE: Protected by the component lock */
+  gboolean configuring;
+
+  /* Hardware resources of the component, see gstomxresources.c.
+   * TRUE while they're preempted and the component is released.
+   * Index of the candidate component in use.
+   * NOTE: Protected by the stream lock, suspended is only changed
+   * with the component lock too */
+  GstOMXResource *resource;
+  gboolean suspended;
+  guint candidate;
+
+  /* properties */
+  GstOMXBufferConfig buffer_config;
+  GstOMXResourceConfig resource_config;
 };
 
 struct _GstOMXVideoDecClass
@@ -88,9 +130,20 @@ struct _GstOMXVideoDecClass
 
   guint64 hacks;
 
+  /* Components to use, the first is the one above */
+  GstOMXCandidate *candidates;
+  guint n_candidates;
+
+  /* Defaults of the properties */
+  GstOMXBufferConfig buffer_config;
+  GstOMXResourceConfig resource_config;
+
   gboolean (*is_format_change) (GstOMXVideoDec * self, GstOMXPort * port, GstVideoState * state);
   gboolean (*set_format)       (GstOMXVideoDec * self, GstOMXPort * port, GstVideoState * state);
   GstFlowReturn (*prepare_frame)   (GstOMXVideoDec * self, GstVideoFrame *frame);
+  /* Returns TRUE if no other frames depend on the frame, so that it
+   * does not have to be decoded if it won't be shown */
+  gboolean (*is_droppable)     (GstOMXVideoDec * self, GstVideoFrame *frame);
 };
 
 GType gst_omx_video_dec_get_type (void);
@@ -30,6 +30,7 @@
 #include <string.h>
 
 #include "gstomxvideoenc.h"
+#include "gstomxplanecopy.h"
 #include "HardwareAPI.h"
 
 GST_DEBUG_CATEGORY_STATIC (gst_omx_video_enc_debug_category);
@@ -64,11 +65,60 @@ struct _BufferIdentification
 {
   guint64 timestamp;
   GstBuffer *input;
+
+  /* For removing the frame from the lookup tables again */
+  GstOMXVideoEnc *self;
+  GstVideoFrame *frame;
+  gpointer mark;
+
+  /* For the statistics, when the frame was received
+   * and when it was passed to the component */
+  gint64 arrival;
+  gint64 queued;
 };
 
+/* Frames with the same timestamp are kept in the order
+ * they were passed to the component */
+static void
+frames_by_timestamp_add (GstOMXVideoEnc * self, BufferIdentification * id)
+{
+  GList *frames;
+
+  frames = g_hash_table_lookup (self->frames_by_timestamp, &id->timestamp);
+  if (frames)
+    g_list_append (frames, id->frame);
+  else
+    g_hash_table_insert (self->frames_by_timestamp,
+        g_memdup (&id->timestamp, sizeof (id->timestamp)),
+        g_list_append (NULL, id->frame));
+}
+
+static void
+frames_by_timestamp_remove (GstOMXVideoEnc * self, BufferIdentification * id)
+{
+  GList *head, *frames, *l;
+
+  head = g_hash_table_lookup (self->frames_by_timestamp, &id->timestamp);
+  if (!(l = g_list_find (head, id->frame)))
+    return;
+
+  frames = g_list_delete_link (head, l);
+  if (!frames)
+    g_hash_table_remove (self->frames_by_timestamp, &id->timestamp);
+  else if (frames != head)
+    g_hash_table_insert (self->frames_by_timestamp,
+        g_memdup (&id->timestamp, sizeof (id->timestamp)), frames);
+}
+
 static void
 buffer_identification_free (BufferIdentification * id)
 {
+  GstOMXVideoEnc *self = id->self;
+
+  if (g_hash_table_lookup (self->frames_by_mark, id->mark) == id->frame)
+    g_hash_table_remove (self->frames_by_mark, id->mark);
+  frames_by_timestamp_remove (self, id);
+
   gst_buffer_unref (id->input);
   g_slice_free (BufferIdentification, id);
 }
@@ -107,7 +157,14 @@ enum
   PROP_QUANT_I_FRAMES,
   PROP_QUANT_P_FRAMES,
   PROP_QUANT_B_FRAMES,
-  PROP_VIDEO_METADATA
+  PROP_VIDEO_METADATA,
+  PROP_STATS,
+  PROP_STATS_INTERVAL,
+  PROP_EXTRA_INPUT_BUFFERS,
+  PROP_EXTRA_OUTPUT_BUFFERS,
+  PROP_ADAPTIVE_OUTPUT_BUFFERS,
+  PROP_LOW_LATENCY,
+  PROP_INTRA_REFRESH_MBS
 };
 
 /* FIXME: Better defaults */
@@ -117,6 +174,7 @@ enum
 #define GST_OMX_VIDEO_ENC_QUANT_P_FRAMES_DEFAULT (0xffffffff)
 #define GST_OMX_VIDEO_ENC_QUANT_B_FRAMES_DEFAULT (0xffffffff)
 #define DEFAULT_VIDEO_METADATA                   TRUE
+#define GST_OMX_VIDEO_ENC_INTRA_REFRESH_MBS_DEFAULT (0xffffffff)
 /* class initialization */
 
 #define DEBUG_INIT(bla) \
@@ -259,6 +317,21 @@ gst_omx_video_enc_base_init (gpointer g_class)
 
     videoenc_class->hacks = gst_omx_parse_hacks (hacks);
   }
+
+  gst_omx_buffer_config_load (&videoenc_class->buffer_config, config,
+      element_name);
+  videoenc_class->candidates =
+      gst_omx_candidates_load (config, element_name,
+      &videoenc_class->n_candidates);
+}
+
+static void
+gst_omx_video_enc_dump_trace (GstOMXVideoEnc * self)
+{
+  g_mutex_lock (self->component_lock);
+  if (self->component)
+    gst_omx_component_dump_trace (self->component);
+  g_mutex_unlock (self->component_lock);
 }
 
 static void
@@ -270,6 +343,13 @@ gst_omx_video_enc_class_init (GstOMXVideoEncClass * klass)
       GST_BASE_VIDEO_ENCODER_CLASS (klass);
 
   gobject_class->finalize = gst_omx_video_enc_finalize;
+
+  /* Writes the events traced since the last dump to the trace file,
+   * see gstomxtrace.c */
+  g_signal_new_class_handler ("dump-trace", G_TYPE_FROM_CLASS (klass),
+      G_SIGNAL_RUN_LAST | G_SIGNAL_ACTION,
+      G_CALLBACK (gst_omx_video_enc_dump_trace), NULL, NULL,
+      g_cclosure_marshal_VOID__VOID, G_TYPE_NONE, 0);
   gobject_class->set_property = gst_omx_video_enc_set_property;
   gobject_class->get_property = gst_omx_video_enc_get_property;
 
@@ -293,27 +373,72 @@ gst_omx_video_enc_class_init (GstOMXVideoEncClass * klass)
           "Quantization parameter for I-frames (0xffffffff=component default)",
           0, G_MAXUINT, GST_OMX_VIDEO_ENC_QUANT_I_FRAMES_DEFAULT,
           G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
-          GST_PARAM_MUTABLE_READY));
+          GST_PARAM_MUTABLE_PLAYING));
 
   g_object_class_install_property (gobject_class, PROP_QUANT_P_FRAMES,
       g_param_spec_uint ("quant-p-frames", "P-Frame Quantization",
           "Quantization parameter for P-frames (0xffffffff=component default)",
           0, G_MAXUINT, GST_OMX_VIDEO_ENC_QUANT_P_FRAMES_DEFAULT,
           G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
-          GST_PARAM_MUTABLE_READY));
+          GST_PARAM_MUTABLE_PLAYING));
 
   g_object_class_install_property (gobject_class, PROP_QUANT_B_FRAMES,
       g_param_spec_uint ("quant-b-frames", "B-Frame Quantization",
           "Quantization parameter for B-frames (0xffffffff=component default)",
           0, G_MAXUINT, GST_OMX_VIDEO_ENC_QUANT_B_FRAMES_DEFAULT,
           G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
-          GST_PARAM_MUTABLE_READY));
+          GST_PARAM_MUTABLE_PLAYING));
 
   g_object_class_install_property (gobject_class, PROP_VIDEO_METADATA,
       g_param_spec_boolean ("video-metadata", "Video metadata",
           "Input will be video metadata",
           DEFAULT_VIDEO_METADATA, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
+  g_object_class_install_property (gobject_class, PROP_STATS,
+      g_param_spec_boxed ("stats", "Statistics",
+          "Statistics of the encoder, see gstomxstats.c",
+          GST_TYPE_STRUCTURE, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_STATS_INTERVAL,
+      g_param_spec_uint ("stats-interval", "Statistics interval",
+          "Interval of the statistics element messages in ms (0=disabled)",
+          0, G_MAXUINT, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_EXTRA_INPUT_BUFFERS,
+      g_param_spec_uint ("extra-input-buffers", "Extra input buffers",
+          "Input buffers allocated in addition to the minimum",
+          0, G_MAXUINT, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property (gobject_class, PROP_EXTRA_OUTPUT_BUFFERS,
+      g_param_spec_uint ("extra-output-buffers", "Extra output buffers",
+          "Output buffers allocated in addition to the minimum",
+          0, G_MAXUINT, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property (gobject_class,
+      PROP_ADAPTIVE_OUTPUT_BUFFERS, g_param_spec_boolean
+      ("adaptive-output-buffers", "Adaptive output buffers",
+          "Allocate more output buffers if the component runs out of them",
+          FALSE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property (gobject_class, PROP_LOW_LATENCY,
+      g_param_spec_boolean ("low-latency", "Low latency",
+          "Push every part of a frame as soon as it is encoded and refresh "
+          "the picture with intra coded macroblocks instead of keyframes",
+          FALSE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property (gobject_class, PROP_INTRA_REFRESH_MBS,
+      g_param_spec_uint ("intra-refresh-mbs", "Intra refresh macroblocks",
+          "Macroblocks intra coded per frame by cyclic intra refresh "
+          "(0=disabled, 0xffffffff=the whole picture every second in low "
+          "latency mode, component default otherwise)",
+          0, G_MAXUINT, GST_OMX_VIDEO_ENC_INTRA_REFRESH_MBS_DEFAULT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+
   element_class->change_state =
       GST_DEBUG_FUNCPTR (gst_omx_video_enc_change_state);
 
@@ -347,35 +472,162 @@ gst_omx_video_enc_init (GstOMXVideoEnc * self, GstOMXVideoEncClass * klass)
   self->quant_p_frames = GST_OMX_VIDEO_ENC_QUANT_P_FRAMES_DEFAULT;
   self->quant_b_frames = GST_OMX_VIDEO_ENC_QUANT_B_FRAMES_DEFAULT;
   self->video_metadata = DEFAULT_VIDEO_METADATA;
+  self->intra_refresh_mbs = GST_OMX_VIDEO_ENC_INTRA_REFRESH_MBS_DEFAULT;
+  self->buffer_config = klass->buffer_config;
 
   self->drain_lock = g_mutex_new ();
   self->drain_cond = g_cond_new ();
+  self->component_lock = g_mutex_new ();
+
+  self->frames_by_mark = g_hash_table_new (g_direct_hash, g_direct_equal);
+  self->frames_by_timestamp =
+      g_hash_table_new_full (g_int64_hash, g_int64_equal, g_free, NULL);
+
+  self->stats = gst_omx_stats_new ();
+}
+
+/* Fails if the component can't be created or, unless it's the
+ * last candidate, its pool has no room for another instance */
+static gboolean
+gst_omx_video_enc_open_candidate (GstOMXVideoEnc * self,
+    const GstOMXCandidate * cand, gboolean last)
+{
+  GstOMXResourceConfig resource_config;
+  GstOMXComponent *component = NULL;
+  GstOMXPort *in_port, *out_port;
+
+  /* Encoders can't release their component mid-stream,
+   * so they neither preempt nor get preempted */
+  resource_config = cand->resource_config;
+  resource_config.priority = 0;
+  self->resource =
+      gst_omx_resource_new (GST_OBJECT_CAST (self), cand->core_name,
+      cand->component_role, &resource_config);
+
+  if (!last && !gst_omx_resource_has_room (self->resource, 0)) {
+    GST_INFO_OBJECT (self, "No resources left for '%s'", cand->element_name);
+    goto error;
+  }
+
+  component =
+      gst_omx_component_new (GST_OBJECT_CAST (self), cand->core_name,
+      cand->component_name, cand->component_role, cand->hacks);
+  if (!component)
+    goto error;
+
+  if (gst_omx_component_get_state (component,
+          GST_CLOCK_TIME_NONE) != OMX_StateLoaded)
+    goto error;
+
+  in_port = gst_omx_component_add_port (component, cand->in_port_index);
+  out_port = gst_omx_component_add_port (component, cand->out_port_index);
+
+  if (!in_port || !out_port)
+    goto error;
+
+  g_mutex_lock (self->component_lock);
+  self->component = component;
+  self->in_port = in_port;
+  self->out_port = out_port;
+  g_mutex_unlock (self->component_lock);
+
+  return TRUE;
+
+error:
+  {
+    if (component)
+      gst_omx_component_release (component);
+    gst_omx_resource_free (self->resource);
+    self->resource = NULL;
+    return FALSE;
+  }
 }
 
+/* Sets the quantization parameters that aren't the component
+ * default. Most components only support this before the buffers
+ * are allocated, others also while encoding.
+ *
+ * NOTE: Call with the component lock if not on the streaming thread */
+static gboolean
+gst_omx_video_enc_set_quantization (GstOMXVideoEnc * self)
+{
+  OMX_VIDEO_PARAM_QUANTIZATIONTYPE quant_param;
+  OMX_ERRORTYPE err;
+
+  if (self->quant_i_frames == 0xffffffff &&
+      self->quant_p_frames == 0xffffffff &&
+      self->quant_b_frames == 0xffffffff)
+    return TRUE;
+
+  GST_OMX_INIT_STRUCT (&quant_param);
+  quant_param.nPortIndex = self->out_port->index;
+  self->component->reusable = FALSE;
+
+  err = gst_omx_component_get_parameter (self->component,
+      OMX_IndexParamVideoQuantization, &quant_param);
+  if (err != OMX_ErrorNone) {
+    GST_ERROR_OBJECT (self,
+        "Failed to get quantization parameters: %s (0x%08x)",
+        gst_omx_error_to_string (err), err);
+    return TRUE;
+  }
+
+  if (self->quant_i_frames != 0xffffffff)
+    quant_param.nQpI = self->quant_i_frames;
+  if (self->quant_p_frames != 0xffffffff)
+    quant_param.nQpP = self->quant_p_frames;
+  if (self->quant_b_frames != 0xffffffff)
+    quant_param.nQpB = self->quant_b_frames;
+
+  err =
+      gst_omx_component_set_parameter (self->component,
+      OMX_IndexParamVideoQuantization, &quant_param);
+  if (err == OMX_ErrorUnsupportedIndex) {
+    GST_WARNING_OBJECT (self,
+        "Setting quantization parameters not supported by the component");
+  } else if (err == OMX_ErrorUnsupportedSetting
+      || err == OMX_ErrorIncorrectStateOperation) {
+    GST_WARNING_OBJECT (self,
+        "Setting quantization parameters %u %u %u not supported by the component",
+        self->quant_i_frames, self->quant_p_frames, self->quant_b_frames);
+  } else if (err != OMX_ErrorNone) {
+    GST_ERROR_OBJECT (self,
+        "Failed to set quantization parameters: %s (0x%08x)",
+        gst_omx_error_to_string (err), err);
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+/* Opens the first available candidate component,
+ * see gst_omx_candidates_load() */
 static gboolean
 gst_omx_video_enc_open (GstOMXVideoEnc * self)
 {
   GstOMXVideoEncClass *klass = GST_OMX_VIDEO_ENC_GET_CLASS (self);
 
-  self->component =
-      gst_omx_component_new (GST_OBJECT_CAST (self), klass->core_name,
-      klass->component_name, klass->component_role, klass->hacks);
+  gst_omx_stats_reset (self->stats);
   self->started = FALSE;
 
+  for (self->candidate = 0; self->candidate < klass->n_candidates;
+      self->candidate++) {
+    if (gst_omx_video_enc_open_candidate (self,
+            &klass->candidates[self->candidate],
+            self->candidate + 1 == klass->n_candidates))
+      break;
+  }
   if (!self->component)
     return FALSE;
 
-  if (gst_omx_component_get_state (self->component,
-          GST_CLOCK_TIME_NONE) != OMX_StateLoaded)
-    return FALSE;
-
-  self->in_port =
-      gst_omx_component_add_port (self->component, klass->in_port_index);
-  self->out_port =
-      gst_omx_component_add_port (self->component, klass->out_port_index);
+  GST_INFO_OBJECT (self, "Using component '%s'",
+      klass->candidates[self->candidate].element_name);
 
-  if (!self->in_port || !self->out_port)
-    return FALSE;
+  self->out_port->zero_copy =
+      !(self->component->hacks & (GST_OMX_HACK_ANDROID_BUFFERS |
+          GST_OMX_HACK_NO_ZERO_COPY));
+  gst_omx_buffer_config_apply (&self->buffer_config, self->in_port,
+      self->out_port);
 
   if (self->video_metadata) {
     OMX_ERRORTYPE err;
@@ -383,6 +635,7 @@ gst_omx_video_enc_open (GstOMXVideoEnc * self)
     struct StoreMetaDataInBuffersParams param;
 
     GST_DEBUG_OBJECT (self, "Enabling metadata mode");
+    self->component->reusable = FALSE;
     err =
         OMX_GetExtensionIndex (self->component->handle,
         (OMX_STRING) "OMX.google.android.index.storeMetaDataInBuffers",
@@ -397,7 +650,7 @@ gst_omx_video_enc_open (GstOMXVideoEnc * self)
 
     GST_OMX_INIT_STRUCT (&param);
 
-    param.nPortIndex = klass->in_port_index;
+    param.nPortIndex = self->in_port->index;
     param.bStoreMetaData = OMX_TRUE;
 
     err = gst_omx_component_set_parameter (self->component, extension, &param);
@@ -409,7 +662,8 @@ gst_omx_video_enc_open (GstOMXVideoEnc * self)
     }
   }
 
-  /* Set properties */
+  /* Set properties. Components with non-default settings
+   * are not reused by other encoders */
   {
     OMX_ERRORTYPE err;
 
@@ -418,6 +672,7 @@ gst_omx_video_enc_open (GstOMXVideoEnc * self)
 
       GST_OMX_INIT_STRUCT (&bitrate_param);
       bitrate_param.nPortIndex = self->out_port->index;
+      self->component->reusable = FALSE;
 
       err = gst_omx_component_get_parameter (self->component,
           OMX_IndexParamVideoBitrate, &bitrate_param);
@@ -450,49 +705,8 @@ gst_omx_video_enc_open (GstOMXVideoEnc * self)
       }
     }
 
-    if (self->quant_i_frames != 0xffffffff ||
-        self->quant_p_frames != 0xffffffff ||
-        self->quant_b_frames != 0xffffffff) {
-      OMX_VIDEO_PARAM_QUANTIZATIONTYPE quant_param;
-
-      GST_OMX_INIT_STRUCT (&quant_param);
-      quant_param.nPortIndex = self->out_port->index;
-
-      err = gst_omx_component_get_parameter (self->component,
-          OMX_IndexParamVideoQuantization, &quant_param);
-
-      if (err == OMX_ErrorNone) {
-
-        if (self->quant_i_frames != 0xffffffff)
-          quant_param.nQpI = self->quant_i_frames;
-        if (self->quant_p_frames != 0xffffffff)
-          quant_param.nQpP = self->quant_p_frames;
-        if (self->quant_b_frames != 0xffffffff)
-          quant_param.nQpB = self->quant_b_frames;
-
-        err =
-            gst_omx_component_set_parameter (self->component,
-            OMX_IndexParamVideoQuantization, &quant_param);
-        if (err == OMX_ErrorUnsupportedIndex) {
-          GST_WARNING_OBJECT (self,
-              "Setting quantization parameters not supported by the component");
-        } else if (err == OMX_ErrorUnsupportedSetting) {
-          GST_WARNING_OBJECT (self,
-              "Setting quantization parameters %u %u %u not supported by the component",
-              self->quant_i_frames, self->quant_p_frames, self->quant_b_frames);
-        } else if (err != OMX_ErrorNone) {
-          GST_ERROR_OBJECT (self,
-              "Failed to set quantization parameters: %s (0x%08x)",
-              gst_omx_error_to_string (err), err);
-          return FALSE;
-        }
-      } else {
-        GST_ERROR_OBJECT (self,
-            "Failed to get quantization parameters: %s (0x%08x)",
-            gst_omx_error_to_string (err), err);
-
-      }
-    }
+    if (!gst_omx_video_enc_set_quantization (self))
+      return FALSE;
   }
 
   return TRUE;
@@ -518,6 +732,9 @@ gst_omx_video_enc_shutdown (GstOMXVideoEnc * self)
       gst_omx_component_get_state (self->component, 5 * GST_SECOND);
   }
 
+  if (self->resource)
+    gst_omx_resource_release (self->resource);
+
   return TRUE;
 }
 
@@ -526,14 +743,21 @@ gst_omx_video_enc_close (GstOMXVideoEnc * self)
 {
   GST_DEBUG_OBJECT (self, "Closing encoder");
 
-  if (!gst_omx_video_enc_shutdown (self))
+  g_mutex_lock (self->component_lock);
+  if (!gst_omx_video_enc_shutdown (self)) {
+    g_mutex_unlock (self->component_lock);
     return FALSE;
+  }
 
   self->in_port = NULL;
   self->out_port = NULL;
   if (self->component)
-    gst_omx_component_free (self->component);
+    gst_omx_component_release (self->component);
   self->component = NULL;
+  g_mutex_unlock (self->component_lock);
+  if (self->resource)
+    gst_omx_resource_free (self->resource);
+  self->resource = NULL;
 
   return TRUE;
 }
@@ -545,6 +769,12 @@ gst_omx_video_enc_finalize (GObject * object)
 
   g_mutex_free (self->drain_lock);
   g_cond_free (self->drain_cond);
+  g_mutex_free (self->component_lock);
+
+  g_hash_table_destroy (self->frames_by_mark);
+  g_hash_table_destroy (self->frames_by_timestamp);
+
+  gst_omx_stats_free (self->stats);
 
   G_OBJECT_CLASS (parent_class)->finalize (object);
 }
@@ -561,7 +791,8 @@ gst_omx_video_enc_set_property (GObject * object, guint prop_id,
       break;
     case PROP_TARGET_BITRATE:
       self->target_bitrate = g_value_get_uint (value);
-      if (self->component) {
+      g_mutex_lock (self->component_lock);
+      if (self->component && self->target_bitrate != 0xffffffff) {
         OMX_VIDEO_CONFIG_BITRATETYPE config;
         OMX_ERRORTYPE err;
 
@@ -576,19 +807,51 @@ gst_omx_video_enc_set_property (GObject * object, guint prop_id,
               "Failed to set bitrate parameter: %s (0x%08x)",
               gst_omx_error_to_string (err), err);
       }
+      g_mutex_unlock (self->component_lock);
       break;
     case PROP_QUANT_I_FRAMES:
       self->quant_i_frames = g_value_get_uint (value);
+      g_mutex_lock (self->component_lock);
+      if (self->component)
+        gst_omx_video_enc_set_quantization (self);
+      g_mutex_unlock (self->component_lock);
       break;
     case PROP_QUANT_P_FRAMES:
       self->quant_p_frames = g_value_get_uint (value);
+      g_mutex_lock (self->component_lock);
+      if (self->component)
+        gst_omx_video_enc_set_quantization (self);
+      g_mutex_unlock (self->component_lock);
       break;
     case PROP_QUANT_B_FRAMES:
       self->quant_b_frames = g_value_get_uint (value);
+      g_mutex_lock (self->component_lock);
+      if (self->component)
+        gst_omx_video_enc_set_quantization (self);
+      g_mutex_unlock (self->component_lock);
       break;
     case PROP_VIDEO_METADATA:
       self->video_metadata = g_value_get_boolean (value);
       break;
+    case PROP_STATS_INTERVAL:
+      gst_omx_stats_set_interval (self->stats, g_value_get_uint (value));
+      break;
+    case PROP_EXTRA_INPUT_BUFFERS:
+      self->buffer_config.extra_input_buffers = g_value_get_uint (value);
+      break;
+    case PROP_EXTRA_OUTPUT_BUFFERS:
+      self->buffer_config.extra_output_buffers = g_value_get_uint (value);
+      break;
+    case PROP_ADAPTIVE_OUTPUT_BUFFERS:
+      self->buffer_config.adaptive_output_buffers =
+          g_value_get_boolean (value);
+      break;
+    case PROP_LOW_LATENCY:
+      self->buffer_config.low_latency = g_value_get_boolean (value);
+      break;
+    case PROP_INTRA_REFRESH_MBS:
+      self->intra_refresh_mbs = g_value_get_uint (value);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -620,6 +883,31 @@ gst_omx_video_enc_get_property (GObject * object, guint prop_id, GValue * value,
     case PROP_VIDEO_METADATA:
       g_value_set_boolean (value, self->video_metadata);
       break;
+    case PROP_STATS:
+      g_mutex_lock (self->component_lock);
+      g_value_take_boxed (value, gst_omx_stats_get_structure (self->stats,
+              self->in_port, self->out_port));
+      g_mutex_unlock (self->component_lock);
+      break;
+    case PROP_STATS_INTERVAL:
+      g_value_set_uint (value, gst_omx_stats_get_interval (self->stats));
+      break;
+    case PROP_EXTRA_INPUT_BUFFERS:
+      g_value_set_uint (value, self->buffer_config.extra_input_buffers);
+      break;
+    case PROP_EXTRA_OUTPUT_BUFFERS:
+      g_value_set_uint (value, self->buffer_config.extra_output_buffers);
+      break;
+    case PROP_ADAPTIVE_OUTPUT_BUFFERS:
+      g_value_set_boolean (value,
+          self->buffer_config.adaptive_output_buffers);
+      break;
+    case PROP_LOW_LATENCY:
+      g_value_set_boolean (value, self->buffer_config.low_latency);
+      break;
+    case PROP_INTRA_REFRESH_MBS:
+      g_value_set_uint (value, self->intra_refresh_mbs);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -701,16 +989,13 @@ gst_omx_video_enc_change_state (GstElement * element, GstStateChange transition)
 #define MAX_FRAME_DIST_FRAMES (100)
 
 static GstVideoFrame *
-_find_nearest_frame (GstOMXVideoEnc * self, GstOMXBuffer * buf)
+_find_nearest_frame_slow (GstOMXVideoEnc * self, GstOMXBuffer * buf)
 {
-  GList *l, *best_l = NULL;
-  GList *finish_frames = NULL;
+  GList *l;
   GstVideoFrame *best = NULL;
-  guint64 best_timestamp = 0;
   guint64 best_diff = G_MAXUINT64;
-  BufferIdentification *best_id = NULL;
 
-  for (l = GST_BASE_VIDEO_CODEC (self)->frames; l; l = l->next) {
+  for (l = GST_BASE_VIDEO_CODEC (self)->frames.head; l; l = l->next) {
     GstVideoFrame *tmp = l->data;
     BufferIdentification *id = tmp->coder_hook;
     guint64 timestamp, diff;
@@ -731,10 +1016,7 @@ _find_nearest_frame (GstOMXVideoEnc * self, GstOMXBuffer * buf)
 
     if (best == NULL || diff < best_diff) {
       best = tmp;
-      best_timestamp = timestamp;
       best_diff = diff;
-      best_l = l;
-      best_id = id;
 
       /* For frames without timestamp we simply take the first frame */
       if ((buf->omx_buf->nTimeStamp == 0 && timestamp == 0) || diff == 0)
@@ -742,34 +1024,64 @@ _find_nearest_frame (GstOMXVideoEnc * self, GstOMXBuffer * buf)
     }
   }
 
-  if (best_id) {
-    for (l = GST_BASE_VIDEO_CODEC (self)->frames; l && l != best_l; l = l->next) {
-      GstVideoFrame *tmp = l->data;
-      BufferIdentification *id = tmp->coder_hook;
-      guint64 diff_ticks, diff_frames;
+  return best;
+}
 
-      if (id->timestamp > best_timestamp)
-        break;
+static GstVideoFrame *
+_find_nearest_frame (GstOMXVideoEnc * self, GstOMXBuffer * buf)
+{
+  GList *l, *frames;
+  GstVideoFrame *best = NULL;
+  BufferIdentification *best_id;
+  gint64 timestamp;
+  gboolean warned = FALSE;
+
+  /* If the component propagates the marks of the input buffers
+   * we know the frame, otherwise look for the exact timestamp
+   * and only search through all frames if that fails too */
+  if (buf->omx_buf->pMarkData)
+    best = g_hash_table_lookup (self->frames_by_mark, buf->omx_buf->pMarkData);
+
+  if (!best) {
+    timestamp = buf->omx_buf->nTimeStamp;
+    frames = g_hash_table_lookup (self->frames_by_timestamp, &timestamp);
+    if (frames)
+      best = frames->data;
+  }
 
-      if (id->timestamp == 0 || best_timestamp == 0)
-        diff_ticks = 0;
-      else
-        diff_ticks = best_timestamp - id->timestamp;
-      diff_frames = best->system_frame_number - tmp->system_frame_number;
+  if (!best)
+    best = _find_nearest_frame_slow (self, buf);
 
-      if (diff_ticks > MAX_FRAME_DIST_TICKS
-          || diff_frames > MAX_FRAME_DIST_FRAMES) {
-        finish_frames = g_list_prepend (finish_frames, tmp);
-      }
-    }
-  }
+  if (!best)
+    return NULL;
+
+  best_id = best->coder_hook;
 
-  if (finish_frames) {
-    g_warning ("Too old frames, bug in encoder -- please file a bug");
-    for (l = finish_frames; l; l = l->next) {
-      gst_base_video_encoder_finish_frame (GST_BASE_VIDEO_ENCODER (self),
-          l->data);
+  /* Frames are passed to the component in order, so only
+   * the oldest ones need to be checked here */
+  while ((l = GST_BASE_VIDEO_CODEC (self)->frames.head) && l->data != best) {
+    GstVideoFrame *tmp = l->data;
+    BufferIdentification *id = tmp->coder_hook;
+    guint64 diff_ticks, diff_frames;
+
+    if (!id || id->timestamp > best_id->timestamp)
+      break;
+
+    if (id->timestamp == 0 || best_id->timestamp == 0)
+      diff_ticks = 0;
+    else
+      diff_ticks = best_id->timestamp - id->timestamp;
+    diff_frames = best->system_frame_number - tmp->system_frame_number;
+
+    if (diff_ticks <= MAX_FRAME_DIST_TICKS
+        && diff_frames <= MAX_FRAME_DIST_FRAMES)
+      break;
+
+    if (!warned) {
+      g_warning ("Too old frames, bug in encoder -- please file a bug");
+      warned = TRUE;
     }
+    gst_base_video_encoder_finish_frame (GST_BASE_VIDEO_ENCODER (self), tmp);
   }
 
   return best;
@@ -779,7 +1091,7 @@ static GstFlowReturn
 gst_omx_video_enc_handle_output_frame (GstOMXVideoEnc * self, GstOMXPort * port,
     GstOMXBuffer * buf, GstVideoFrame * frame)
 {
-  GstOMXVideoEncClass *klass = GST_OMX_VIDEO_ENC_GET_CLASS (self);
+  OMX_BUFFERHEADERTYPE *omx_buf = buf->omx_buf;
   GstFlowReturn flow_ret = GST_FLOW_OK;
 
   if ((buf->omx_buf->nFlags & OMX_BUFFERFLAG_CODECCONFIG)
@@ -794,22 +1106,23 @@ gst_omx_video_enc_handle_output_frame (GstOMXVideoEnc * self, GstOMXPort * port,
         buf->omx_buf->nFilledLen);
 
     gst_caps_set_simple (caps, "codec_data", GST_TYPE_BUFFER, codec_data, NULL);
-    if (!gst_pad_set_caps (GST_BASE_VIDEO_CODEC_SRC_PAD (self), caps)) {
-      gst_caps_unref (caps);
-      return GST_FLOW_NOT_NEGOTIATED;
-    }
+    if (!gst_pad_set_caps (GST_BASE_VIDEO_CODEC_SRC_PAD (self), caps))
+      flow_ret = GST_FLOW_NOT_NEGOTIATED;
     gst_caps_unref (caps);
-
-    flow_ret = GST_FLOW_OK;
   } else if (buf->omx_buf->nFilledLen > 0) {
     GstBuffer *outbuf;
 
-    if (buf->omx_buf->nFilledLen > 0) {
+    /* The wrapped buffer is released once downstream is done with it */
+    if ((outbuf = gst_omx_port_wrap_buffer (port, buf))) {
+      buf = NULL;
+    } else if (buf->omx_buf->nFilledLen > 0) {
       outbuf = gst_buffer_new_and_alloc (buf->omx_buf->nFilledLen);
 
       memcpy (GST_BUFFER_DATA (outbuf),
           buf->omx_buf->pBuffer + buf->omx_buf->nOffset,
           buf->omx_buf->nFilledLen);
+      gst_omx_stats_add (self->stats, GST_OMX_STATS_BYTES_COPIED_OUT,
+          buf->omx_buf->nFilledLen);
     } else {
       outbuf = gst_buffer_new ();
     }
@@ -818,15 +1131,15 @@ gst_omx_video_enc_handle_output_frame (GstOMXVideoEnc * self, GstOMXPort * port,
         GST_PAD_CAPS (GST_BASE_VIDEO_CODEC_SRC_PAD (self)));
 
     GST_BUFFER_TIMESTAMP (outbuf) =
-        gst_util_uint64_scale (buf->omx_buf->nTimeStamp, GST_SECOND,
+        gst_util_uint64_scale (omx_buf->nTimeStamp, GST_SECOND,
         OMX_TICKS_PER_SECOND);
-    if (buf->omx_buf->nTickCount != 0)
+    if (omx_buf->nTickCount != 0)
       GST_BUFFER_DURATION (outbuf) =
-          gst_util_uint64_scale (buf->omx_buf->nTickCount, GST_SECOND,
+          gst_util_uint64_scale (omx_buf->nTickCount, GST_SECOND,
           OMX_TICKS_PER_SECOND);
 
-    if ((klass->hacks & GST_OMX_HACK_SYNCFRAME_FLAG_NOT_USED)
-        || (buf->omx_buf->nFlags & OMX_BUFFERFLAG_SYNCFRAME)) {
+    if ((self->component->hacks & GST_OMX_HACK_SYNCFRAME_FLAG_NOT_USED)
+        || (omx_buf->nFlags & OMX_BUFFERFLAG_SYNCFRAME)) {
       if (frame)
         frame->is_sync_point = TRUE;
       else
@@ -838,24 +1151,64 @@ gst_omx_video_enc_handle_output_frame (GstOMXVideoEnc * self, GstOMXPort * port,
         GST_BUFFER_FLAG_SET (outbuf, GST_BUFFER_FLAG_DELTA_UNIT);
     }
 
-    if (frame) {
+    if (frame && self->buffer_config.low_latency
+        && !(omx_buf->nFlags & OMX_BUFFERFLAG_ENDOFFRAME)) {
+      /* Only a part of the frame, e.g. a slice. The frame is finished
+       * by its last part or the next output of the component, see
+       * gst_omx_video_enc_finish_partial_frames() */
+      frame->src_buffer = outbuf;
+      flow_ret =
+          gst_base_video_encoder_finish_subframe (GST_BASE_VIDEO_ENCODER
+          (self), frame);
+    } else if (frame) {
+      gst_omx_stats_add (self->stats, GST_OMX_STATS_FRAMES_OUT, 1);
       frame->src_buffer = outbuf;
       flow_ret =
           gst_base_video_encoder_finish_frame (GST_BASE_VIDEO_ENCODER (self),
           frame);
     } else {
+      gst_omx_stats_add (self->stats, GST_OMX_STATS_FRAMES_OUT, 1);
       GST_ERROR_OBJECT (self, "No corresponding frame found");
       flow_ret = gst_pad_push (GST_BASE_VIDEO_CODEC_SRC_PAD (self), outbuf);
     }
   } else if (frame != NULL) {
+    if (frame->partial)
+      gst_omx_stats_add (self->stats, GST_OMX_STATS_FRAMES_OUT, 1);
     flow_ret =
         gst_base_video_encoder_finish_frame (GST_BASE_VIDEO_ENCODER (self),
         frame);
   }
 
+  if (buf)
+    gst_omx_port_release_buffer (port, buf);
+
   return flow_ret;
 }
 
+/* Finishes the frames other than frame that were pushed in parts.
+ * Components output the parts of a frame one after another, so
+ * they're complete even if the last part had no
+ * OMX_BUFFERFLAG_ENDOFFRAME.
+ *
+ * NOTE: Call with the stream lock */
+static void
+gst_omx_video_enc_finish_partial_frames (GstOMXVideoEnc * self,
+    GstVideoFrame * frame)
+{
+  GList *l, *next;
+
+  for (l = GST_BASE_VIDEO_CODEC (self)->frames.head; l; l = next) {
+    GstVideoFrame *tmp = l->data;
+
+    next = l->next;
+    if (tmp != frame && tmp->partial) {
+      GST_LOG_OBJECT (self, "Frame %d complete", tmp->system_frame_number);
+      gst_omx_stats_add (self->stats, GST_OMX_STATS_FRAMES_OUT, 1);
+      gst_base_video_encoder_finish_frame (GST_BASE_VIDEO_ENCODER (self), tmp);
+    }
+  }
+}
+
 static void
 gst_omx_video_enc_loop (GstOMXVideoEnc * self)
 {
@@ -866,6 +1219,7 @@ gst_omx_video_enc_loop (GstOMXVideoEnc * self)
   GstFlowReturn flow_ret = GST_FLOW_OK;
   GstOMXAcquireBufferReturn acq_return;
   gboolean is_eos;
+  gint64 start, arrival = 0;
 
   klass = GST_OMX_VIDEO_ENC_GET_CLASS (self);
 
@@ -936,10 +1290,34 @@ gst_omx_video_enc_loop (GstOMXVideoEnc * self)
     frame = _find_nearest_frame (self, buf);
 
     is_eos = ! !(buf->omx_buf->nFlags & OMX_BUFFERFLAG_EOS);
+    start = GST_OMX_TRACE_START (self->component->trace);
+
+    /* The frame is finished by handle_output_frame() */
+    if (frame && buf->omx_buf->nFilledLen > 0
+        && !(buf->omx_buf->nFlags & OMX_BUFFERFLAG_CODECCONFIG)) {
+      BufferIdentification *id = frame->coder_hook;
+
+      gst_omx_stats_add_latency (self->stats, GST_OMX_STATS_COMPONENT_LATENCY,
+          g_get_monotonic_time () - id->queued);
+      arrival = id->arrival;
+    }
+
+    if (self->buffer_config.low_latency)
+      gst_omx_video_enc_finish_partial_frames (self, frame);
 
     g_assert (klass->handle_output_frame);
+    /* Releases buf */
     flow_ret = klass->handle_output_frame (self, self->out_port, buf, frame);
 
+    GST_OMX_TRACE_CALL (self->component->trace, GST_OMX_TRACE_PUSH,
+        port->index, buf, flow_ret, start);
+
+    if (arrival)
+      gst_omx_stats_add_latency (self->stats, GST_OMX_STATS_LATENCY,
+          g_get_monotonic_time () - arrival);
+    gst_omx_stats_post (self->stats, GST_ELEMENT_CAST (self), self->in_port,
+        self->out_port);
+
     if (is_eos || flow_ret == GST_FLOW_UNEXPECTED) {
       g_mutex_lock (self->drain_lock);
       if (self->draining) {
@@ -956,9 +1334,8 @@ gst_omx_video_enc_loop (GstOMXVideoEnc * self)
           gst_flow_get_name (flow_ret));
     }
 
-    gst_omx_port_release_buffer (port, buf);
-
-    if (self->eos && klass->hacks & GST_OMX_HACK_NO_EMPTY_EOS_BUFFER
+    if (self->eos
+        && self->component->hacks & GST_OMX_HACK_NO_EMPTY_EOS_BUFFER
         && flow_ret == GST_FLOW_UNEXPECTED) {
       /* We cannot stop the task now before all buffers have been procesed */
       flow_ret = GST_FLOW_OK;
@@ -968,17 +1345,17 @@ gst_omx_video_enc_loop (GstOMXVideoEnc * self)
     }
   } else {
     guint len;
-    g_assert ((klass->hacks & GST_OMX_HACK_NO_EMPTY_EOS_BUFFER));
+    g_assert ((self->component->hacks & GST_OMX_HACK_NO_EMPTY_EOS_BUFFER));
     GST_BASE_VIDEO_CODEC_STREAM_LOCK (self);
 
-    len = g_list_length (GST_BASE_VIDEO_CODEC (self)->frames);
+    len = GST_BASE_VIDEO_CODEC (self)->frames.length;
     if (len != 0) {
       GST_DEBUG_OBJECT (self, "%d frames left to process before EOS.", len);
 
       /* push buffer back */
-      g_mutex_lock (self->component->lock);
+      g_mutex_lock (self->out_port->lock);
       g_queue_push_tail (&self->out_port->pending_buffers, NULL);
-      g_mutex_unlock (self->component->lock);
+      g_mutex_unlock (self->out_port->lock);
     } else {
       flow_ret = GST_FLOW_UNEXPECTED;
     }
@@ -1020,6 +1397,10 @@ flow_error:
       gst_pad_push_event (GST_BASE_VIDEO_CODEC_SRC_PAD (self),
           gst_event_new_eos ());
       gst_pad_pause_task (GST_BASE_VIDEO_CODEC_SRC_PAD (self));
+
+      GST_OMX_TRACE_INSTANT (self->component->trace, GST_OMX_TRACE_EOS,
+          port->index, NULL, 0);
+      gst_omx_component_dump_trace (self->component);
     } else if (flow_ret == GST_FLOW_NOT_LINKED
         || flow_ret < GST_FLOW_UNEXPECTED) {
       GST_ELEMENT_ERROR (self, STREAM, FAILED, ("Internal data stream error."),
@@ -1105,6 +1486,148 @@ gst_omx_video_enc_stop (GstBaseVideoEncoder * encoder)
   return TRUE;
 }
 
+/* Returns the framerate of state in the format of the component */
+static OMX_U32
+gst_omx_video_enc_get_xframerate (GstOMXVideoEnc * self,
+    GstVideoState * state)
+{
+  if (state->fps_n == 0)
+    return 0;
+  else if (!(self->component->hacks & GST_OMX_HACK_VIDEO_FRAMERATE_INTEGER))
+    return (state->fps_n << 16) / (state->fps_d);
+  else
+    return (state->fps_n) / (state->fps_d);
+}
+
+/* TRUE if state only differs from the configured format
+ * by its framerate
+ *
+ * NOTE: Call with the stream lock */
+static gboolean
+gst_omx_video_enc_is_framerate_change (GstOMXVideoEnc * self,
+    GstVideoState * state)
+{
+  GstVideoState *current = &GST_BASE_VIDEO_CODEC (self)->state;
+
+  return (state->fps_n > 0 && state->fps_d > 0
+      && state->format == current->format
+      && state->width == current->width
+      && state->height == current->height
+      && state->par_n == current->par_n && state->par_d == current->par_d
+      && state->have_interlaced == current->have_interlaced
+      && state->interlaced == current->interlaced);
+}
+
+/* Changes the framerate while encoding and updates the caps,
+ * without reconfiguring the input port. Fails if the component
+ * doesn't support it */
+static gboolean
+gst_omx_video_enc_set_framerate (GstOMXVideoEnc * self,
+    GstVideoState * state)
+{
+  OMX_CONFIG_FRAMERATETYPE config;
+  OMX_ERRORTYPE err;
+  GstPad *srcpad = GST_BASE_VIDEO_CODEC_SRC_PAD (self);
+  GstCaps *caps;
+
+  GST_OMX_INIT_STRUCT (&config);
+  config.nPortIndex = self->out_port->index;
+  config.xEncodeFramerate = gst_omx_video_enc_get_xframerate (self, state);
+
+  err = gst_omx_component_set_config (self->component,
+      OMX_IndexConfigVideoFramerate, &config);
+  if (err != OMX_ErrorNone) {
+    GST_INFO_OBJECT (self, "Changing the framerate needs a reconfiguration: "
+        "%s (0x%08x)", gst_omx_error_to_string (err), err);
+    return FALSE;
+  }
+
+  GST_DEBUG_OBJECT (self, "Changed framerate to %d/%d", state->fps_n,
+      state->fps_d);
+
+  if (GST_PAD_CAPS (srcpad)) {
+    caps = gst_caps_copy (GST_PAD_CAPS (srcpad));
+    gst_caps_set_simple (caps, "framerate", GST_TYPE_FRACTION, state->fps_n,
+        state->fps_d, NULL);
+    gst_pad_set_caps (srcpad, caps);
+    gst_caps_unref (caps);
+  }
+
+  return TRUE;
+}
+
+/* Acquires the hardware resources for encoding state, see
+ * gstomxresources.c. Encoders only wait for resources */
+static gboolean
+gst_omx_video_enc_acquire_resources (GstOMXVideoEnc * self,
+    GstVideoState * state)
+{
+  if (gst_omx_resource_acquire (self->resource,
+          gst_omx_resource_video_load (state->width, state->height,
+              state->fps_n, state->fps_d), TRUE) != GST_OMX_RESOURCE_OK) {
+    GST_ELEMENT_ERROR (self, RESOURCE, BUSY, (NULL),
+        ("Not enough hardware resources to encode %dx%d", state->width,
+            state->height));
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+/* Enables cyclic intra refresh, which spreads the intra coded
+ * macroblocks of a keyframe over several frames. Must be called
+ * in Loaded state */
+static void
+gst_omx_video_enc_set_intra_refresh (GstOMXVideoEnc * self,
+    GstVideoState * state)
+{
+  OMX_VIDEO_PARAM_INTRAREFRESHTYPE param;
+  OMX_ERRORTYPE err;
+  guint32 mbs = self->intra_refresh_mbs;
+
+  self->intra_refresh = FALSE;
+
+  if (mbs == GST_OMX_VIDEO_ENC_INTRA_REFRESH_MBS_DEFAULT) {
+    guint64 total;
+
+    if (!self->buffer_config.low_latency || state->fps_n <= 0
+        || state->fps_d <= 0)
+      return;
+
+    /* Refresh the whole picture every second */
+    total = (guint64) ((state->width + 15) / 16) * ((state->height + 15) / 16);
+    mbs = (total * state->fps_d + state->fps_n - 1) / state->fps_n;
+  } else if (mbs == 0) {
+    return;
+  }
+
+  GST_OMX_INIT_STRUCT (&param);
+  param.nPortIndex = self->out_port->index;
+  self->component->reusable = FALSE;
+
+  err = gst_omx_component_get_parameter (self->component,
+      OMX_IndexParamVideoIntraRefresh, &param);
+  if (err != OMX_ErrorNone) {
+    GST_WARNING_OBJECT (self, "Intra refresh not supported: %s (0x%08x)",
+        gst_omx_error_to_string (err), err);
+    return;
+  }
+
+  param.eRefreshMode = OMX_VIDEO_IntraRefreshCyclic;
+  param.nCirMBs = mbs;
+
+  err = gst_omx_component_set_parameter (self->component,
+      OMX_IndexParamVideoIntraRefresh, &param);
+  if (err != OMX_ErrorNone) {
+    GST_WARNING_OBJECT (self, "Failed to refresh %u macroblocks per frame: "
+        "%s (0x%08x)", mbs, gst_omx_error_to_string (err), err);
+    return;
+  }
+
+  GST_DEBUG_OBJECT (self, "Refreshing %u macroblocks per frame", mbs);
+  self->intra_refresh = TRUE;
+}
+
 static gboolean
 gst_omx_video_enc_set_format (GstBaseVideoEncoder * encoder,
     GstVideoState * state)
@@ -1124,6 +1647,22 @@ gst_omx_video_enc_set_format (GstBaseVideoEncoder * encoder,
   needs_disable =
       gst_omx_component_get_state (self->component,
       GST_CLOCK_TIME_NONE) != OMX_StateLoaded;
+
+  /* The resources are acquired for the new framerate before the
+   * component is changed. A failed acquire keeps the old claim and
+   * the caps are rejected, so that the state stays the old one */
+  if (needs_disable && gst_omx_video_enc_is_framerate_change (self, state)) {
+    if (gst_omx_resource_acquire (self->resource,
+            gst_omx_resource_video_load (state->width, state->height,
+                state->fps_n, state->fps_d), TRUE) != GST_OMX_RESOURCE_OK) {
+      GST_WARNING_OBJECT (self, "Not enough hardware resources for %d/%d "
+          "fps, keeping the old framerate", state->fps_n, state->fps_d);
+      return FALSE;
+    }
+    if (gst_omx_video_enc_set_framerate (self, state))
+      return TRUE;
+  }
+
   /* If the component is not in Loaded state and a real format change happens
    * we have to disable the port and re-allocate all buffers. If no real
    * format change happened we can just exit here.
@@ -1137,6 +1676,9 @@ gst_omx_video_enc_set_format (GstBaseVideoEncoder * encoder,
       return FALSE;
   }
 
+  if (!gst_omx_video_enc_acquire_resources (self, state))
+    return FALSE;
+
   if (!self->video_metadata) {
     switch (state->format) {
       case GST_VIDEO_FORMAT_I420:
@@ -1155,14 +1697,8 @@ gst_omx_video_enc_set_format (GstBaseVideoEncoder * encoder,
 
   port_def.format.video.nFrameWidth = state->width;
   port_def.format.video.nFrameHeight = state->height;
-  if (state->fps_n == 0) {
-    port_def.format.video.xFramerate = 0;
-  } else {
-    if (!(klass->hacks & GST_OMX_HACK_VIDEO_FRAMERATE_INTEGER))
-      port_def.format.video.xFramerate = (state->fps_n << 16) / (state->fps_d);
-    else
-      port_def.format.video.xFramerate = (state->fps_n) / (state->fps_d);
-  }
+  port_def.format.video.xFramerate =
+      gst_omx_video_enc_get_xframerate (self, state);
 
   if (!gst_omx_port_update_port_definition (self->in_port, &port_def))
     return FALSE;
@@ -1177,6 +1713,9 @@ gst_omx_video_enc_set_format (GstBaseVideoEncoder * encoder,
     return FALSE;
   }
 
+  if (!needs_disable)
+    gst_omx_video_enc_set_intra_refresh (self, state);
+
   if (klass->set_format) {
     if (!klass->set_format (self, self->in_port, state)) {
       GST_ERROR_OBJECT (self, "Subclass failed to set the new format");
@@ -1243,21 +1782,18 @@ gst_omx_video_enc_reset (GstBaseVideoEncoder * encoder)
 
   gst_omx_video_enc_drain (self);
 
-  gst_omx_port_set_flushing (self->in_port, TRUE);
-  gst_omx_port_set_flushing (self->out_port, TRUE);
+  gst_omx_component_set_flushing (self->component, TRUE);
 
-  /* Wait until the srcpad loop is finished,
+  /* Wait until the srcpad loop is paused,
    * unlock GST_BASE_VIDEO_CODEC_STREAM_LOCK to prevent deadlocks
    * caused by using this lock from inside the loop function */
   GST_BASE_VIDEO_CODEC_STREAM_UNLOCK (self);
-  GST_PAD_STREAM_LOCK (GST_BASE_VIDEO_CODEC_SRC_PAD (self));
-  GST_PAD_STREAM_UNLOCK (GST_BASE_VIDEO_CODEC_SRC_PAD (self));
+  gst_pad_pause_task (GST_BASE_VIDEO_CODEC_SRC_PAD (self));
   GST_BASE_VIDEO_CODEC_STREAM_LOCK (self);
 
-  gst_omx_port_set_flushing (self->in_port, FALSE);
-  gst_omx_port_set_flushing (self->out_port, FALSE);
+  gst_omx_component_set_flushing (self->component, FALSE);
 
-  /* Start the srcpad loop again */
+  /* Resume the srcpad loop */
   self->last_upstream_ts = 0;
   self->eos = FALSE;
   self->downstream_flow_ret = GST_FLOW_OK;
@@ -1294,9 +1830,14 @@ gst_omx_video_enc_fill_buffer (GstOMXVideoEnc * self, GstBuffer * inbuf,
   /* Different strides */
   switch (state->format) {
     case GST_VIDEO_FORMAT_I420:{
-      gint i, j, height;
+      gint i, height;
       guint8 *src, *dest;
       gint src_stride, dest_stride;
+      gint slice_height = port_def->format.video.nSliceHeight;
+
+      /* XXX: Try this if no slice height was set */
+      if (slice_height == 0)
+        slice_height = port_def->format.video.nFrameHeight;
 
       outbuf->omx_buf->nFilledLen = 0;
 
@@ -1320,13 +1861,9 @@ gst_omx_video_enc_fill_buffer (GstOMXVideoEnc * self, GstBuffer * inbuf,
 
         dest = outbuf->omx_buf->pBuffer + outbuf->omx_buf->nOffset;
         if (i > 0)
-          dest +=
-              port_def->format.video.nSliceHeight *
-              port_def->format.video.nStride;
+          dest += slice_height * port_def->format.video.nStride;
         if (i == 2)
-          dest +=
-              (port_def->format.video.nSliceHeight / 2) *
-              (port_def->format.video.nStride / 2);
+          dest += (slice_height / 2) * (port_def->format.video.nStride / 2);
 
         src =
             GST_BUFFER_DATA (inbuf) +
@@ -1350,20 +1887,22 @@ gst_omx_video_enc_fill_buffer (GstOMXVideoEnc * self, GstBuffer * inbuf,
           break;
         }
 
-        for (j = 0; j < height; j++) {
-          memcpy (dest, src, MIN (src_stride, dest_stride));
-          outbuf->omx_buf->nFilledLen += dest_stride;
-          src += src_stride;
-          dest += dest_stride;
-        }
+        gst_omx_plane_copy (dest, dest_stride, src, src_stride,
+            MIN (src_stride, dest_stride), height);
+        outbuf->omx_buf->nFilledLen += dest_stride * height;
       }
       ret = TRUE;
       break;
     }
     case GST_VIDEO_FORMAT_NV12:{
-      gint i, j, height;
+      gint i, height;
       guint8 *src, *dest;
       gint src_stride, dest_stride;
+      gint slice_height = port_def->format.video.nSliceHeight;
+
+      /* XXX: Try this if no slice height was set */
+      if (slice_height == 0)
+        slice_height = port_def->format.video.nFrameHeight;
 
       outbuf->omx_buf->nFilledLen = 0;
 
@@ -1386,9 +1925,7 @@ gst_omx_video_enc_fill_buffer (GstOMXVideoEnc * self, GstBuffer * inbuf,
 
         dest = outbuf->omx_buf->pBuffer + outbuf->omx_buf->nOffset;
         if (i == 1)
-          dest +=
-              port_def->format.video.nSliceHeight *
-              port_def->format.video.nStride;
+          dest += slice_height * port_def->format.video.nStride;
 
         src =
             GST_BUFFER_DATA (inbuf) +
@@ -1412,12 +1949,9 @@ gst_omx_video_enc_fill_buffer (GstOMXVideoEnc * self, GstBuffer * inbuf,
           break;
         }
 
-        for (j = 0; j < height; j++) {
-          memcpy (dest, src, MIN (src_stride, dest_stride));
-          outbuf->omx_buf->nFilledLen += dest_stride;
-          src += src_stride;
-          dest += dest_stride;
-        }
+        gst_omx_plane_copy (dest, dest_stride, src, src_stride,
+            MIN (src_stride, dest_stride), height);
+        outbuf->omx_buf->nFilledLen += dest_stride * height;
       }
       ret = TRUE;
       break;
@@ -1429,6 +1963,10 @@ gst_omx_video_enc_fill_buffer (GstOMXVideoEnc * self, GstBuffer * inbuf,
   }
 
 done:
+  if (ret)
+    gst_omx_stats_add (self->stats, GST_OMX_STATS_BYTES_COPIED_IN,
+        outbuf->omx_buf->nFilledLen);
+
   return ret;
 }
 
@@ -1439,6 +1977,7 @@ gst_omx_video_enc_handle_frame (GstBaseVideoEncoder * encoder,
   GstOMXAcquireBufferReturn acq_ret = GST_OMX_ACQUIRE_BUFFER_ERROR;
   GstOMXVideoEnc *self;
   GstOMXBuffer *buf;
+  gint64 arrival;
 
   self = GST_OMX_VIDEO_ENC (encoder);
 
@@ -1449,6 +1988,9 @@ gst_omx_video_enc_handle_frame (GstBaseVideoEncoder * encoder,
     return GST_FLOW_UNEXPECTED;
   }
 
+  arrival = g_get_monotonic_time ();
+  gst_omx_stats_add (self->stats, GST_OMX_STATS_FRAMES_IN, 1);
+
   if (self->downstream_flow_ret != GST_FLOW_OK) {
     return self->downstream_flow_ret;
   }
@@ -1540,10 +2082,24 @@ gst_omx_video_enc_handle_frame (GstBaseVideoEncoder * encoder,
     id = g_slice_new0 (BufferIdentification);
     id->timestamp = buf->omx_buf->nTimeStamp;
     id->input = gst_buffer_ref (frame->sink_buffer);
+    id->self = self;
+    id->frame = frame;
+    id->mark = GUINT_TO_POINTER (frame->system_frame_number + 1);
+    id->arrival = arrival;
+    id->queued = g_get_monotonic_time ();
     frame->coder_hook = id;
     frame->coder_hook_destroy_notify =
         (GDestroyNotify) buffer_identification_free;
 
+    g_hash_table_insert (self->frames_by_mark, id->mark, frame);
+    frames_by_timestamp_add (self, id);
+
+    /* Components propagate the mark to the output buffer that is
+     * encoded from this input buffer, otherwise the frame is found
+     * by its timestamp */
+    buf->omx_buf->hMarkTargetComponent = self->component->handle;
+    buf->omx_buf->pMarkData = id->mark;
+
     self->started = TRUE;
     gst_omx_port_release_buffer (self->in_port, buf);
   }
@@ -1595,12 +2151,10 @@ static GstFlowReturn
 gst_omx_video_enc_finish (GstBaseVideoEncoder * encoder)
 {
   GstOMXVideoEnc *self;
-  GstOMXVideoEncClass *klass;
   GstOMXBuffer *buf;
   GstOMXAcquireBufferReturn acq_ret;
 
   self = GST_OMX_VIDEO_ENC (encoder);
-  klass = GST_OMX_VIDEO_ENC_GET_CLASS (self);
 
   GST_DEBUG_OBJECT (self, "Sending EOS to the component");
 
@@ -1611,16 +2165,16 @@ gst_omx_video_enc_finish (GstBaseVideoEncoder * encoder)
   }
   self->eos = TRUE;
 
-  if ((klass->hacks & GST_OMX_HACK_NO_EMPTY_EOS_BUFFER)) {
+  if ((self->component->hacks & GST_OMX_HACK_NO_EMPTY_EOS_BUFFER)) {
     GST_WARNING_OBJECT (self, "Component does not support empty EOS buffers");
 
     /* Insert a NULL into the queue to signal EOS */   
-    g_mutex_lock (self->component->lock);
+    g_mutex_lock (self->out_port->lock);
     g_queue_push_tail (&self->out_port->pending_buffers, NULL);
-    g_mutex_lock (self->component->messages_lock);
-    g_cond_broadcast (self->component->messages_cond);
-    g_mutex_unlock (self->component->messages_lock);
-    g_mutex_unlock (self->component->lock);
+    g_mutex_lock (self->out_port->messages_lock);
+    g_cond_broadcast (self->out_port->messages_cond);
+    g_mutex_unlock (self->out_port->messages_lock);
+    g_mutex_unlock (self->out_port->lock);
 
     return GST_BASE_VIDEO_ENCODER_FLOW_DROPPED;
   }
@@ -1655,14 +2209,11 @@ gst_omx_video_enc_finish (GstBaseVideoEncoder * encoder)
 static GstFlowReturn
 gst_omx_video_enc_drain (GstOMXVideoEnc * self)
 {
-  GstOMXVideoEncClass *klass;
   GstOMXBuffer *buf;
   GstOMXAcquireBufferReturn acq_ret;
 
   GST_DEBUG_OBJECT (self, "Draining component");
 
-  klass = GST_OMX_VIDEO_ENC_GET_CLASS (self);
-
   if (!self->started) {
     GST_DEBUG_OBJECT (self, "Component not started yet");
     return GST_FLOW_OK;
@@ -1675,7 +2226,7 @@ gst_omx_video_enc_drain (GstOMXVideoEnc * self)
     return GST_FLOW_OK;
   }
 
-  if ((klass->hacks & GST_OMX_HACK_NO_EMPTY_EOS_BUFFER)) {
+  if ((self->component->hacks & GST_OMX_HACK_NO_EMPTY_EOS_BUFFER)) {
     GST_WARNING_OBJECT (self, "Component does not support empty EOS buffers");
     return GST_FLOW_OK;
   }
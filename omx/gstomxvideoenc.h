@@ -25,6 +25,8 @@
 #include "gstbasevideoencoder.h"
 
 #include "gstomx.h"
+#include "gstomxstats.h"
+#include "gstomxresources.h"
 
 G_BEGIN_DECLS
 
@@ -60,6 +62,12 @@ struct _GstOMXVideoEnc
 
   GstClockTime last_upstream_ts;
 
+  /* Frames passed to the component by buffer mark and lists of
+   * them by timestamp, for finding the frame of an output buffer.
+   * NOTE: Protected by the stream lock */
+  GHashTable *frames_by_mark;
+  GHashTable *frames_by_timestamp;
+
   /* Draining state */
   GMutex *drain_lock;
   GCond *drain_cond;
@@ -76,8 +84,25 @@ struct _GstOMXVideoEnc
   guint32 quant_p_frames;
   guint32 quant_b_frames;
   gboolean video_metadata;
+  guint32 intra_refresh_mbs;
+  GstOMXBufferConfig buffer_config;
+
+  /* TRUE if the component refreshes the picture with cyclic
+   * intra refresh, see the intra-refresh-mbs property */
+  gboolean intra_refresh;
 
   GstFlowReturn downstream_flow_ret;
+
+  GstOMXStats *stats;
+
+  /* Held while the component and its ports are replaced, for the
+   * properties that use them and the dump-trace signal */
+  GMutex *component_lock;
+
+  /* Hardware resources of the component, see gstomxresources.c,
+   * and index of the candidate component in use */
+  GstOMXResource *resource;
+  guint candidate;
 };
 
 struct _GstOMXVideoEncClass
@@ -95,8 +120,17 @@ struct _GstOMXVideoEncClass
 
   guint64 hacks;
 
+  /* Components to use, the first is the one above */
+  GstOMXCandidate *candidates;
+  guint n_candidates;
+
+  /* Defaults of the properties */
+  GstOMXBufferConfig buffer_config;
+
   gboolean (*set_format)       (GstOMXVideoEnc * self, GstOMXPort * port, GstVideoState * state);
   GstCaps *(*get_caps)         (GstOMXVideoEnc * self, GstOMXPort * port, GstVideoState * state);
+  /* Takes ownership of buffer and releases it to port,
+   * or passes it downstream with gst_omx_port_wrap_buffer() */
   GstFlowReturn (*handle_output_frame) (GstOMXVideoEnc * self, GstOMXPort * port, GstOMXBuffer * buffer, GstVideoFrame * frame);
 };
 
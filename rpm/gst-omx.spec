@@ -30,4 +30,5 @@ install -D -m 644 -o root -g root omx/gstomx.conf $RPM_BUILD_ROOT/etc/xdg/gstomx
 %files
 %defattr(-,root,root,-)
 %{_libdir}/gstreamer-0.10/libgstopenmax.so
+%{_libdir}/gst-omx/libomxloopback.so
 %config %{_sysconfdir}/xdg/gstomx.conf